@@ -0,0 +1,118 @@
+//=============================================================================
+//  Cam
+//  Webcam client
+//
+//  Copyright (C) 2016 Werner Schweer
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License version 2
+//  as published by the Free Software Foundation and appearing in
+//  the file LICENCE.GPL
+//=============================================================================
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "autoexposure.h"
+#include "histogram.h"
+#include "v4l2.h"
+
+static const int settleFrames    = 3;       // exposure changes take effect late
+static const double deadBand     = 0.08;
+static const double maxClipped   = 0.01;    // ratio of clipped samples
+
+//---------------------------------------------------------
+//   start
+//    switch the camera to manual exposure; return false
+//    if it has no absolute exposure control
+//---------------------------------------------------------
+
+bool AutoExposure::start(V4l2* c)
+      {
+      stop();
+      bool found   = false;
+      bool hasMode = false;
+      for (const V4l2Control& ctrl : c->controls()) {
+            if (ctrl.id == V4L2_CID_EXPOSURE_ABSOLUTE) {
+                  minimum = ctrl.minimum;
+                  maximum = ctrl.maximum;
+                  step    = ctrl.step > 0 ? ctrl.step : 1;
+                  value   = ctrl.defaultValue;
+                  found   = true;
+                  }
+            else if (ctrl.id == V4L2_CID_EXPOSURE_AUTO)
+                  hasMode = true;
+            }
+      if (!found) {
+            fprintf(stderr, "AutoExposure: camera has no absolute exposure control\n");
+            return false;
+            }
+      if (hasMode) {
+            savedMode = c->getControl(V4L2_CID_EXPOSURE_AUTO);
+            if (c->setControl(V4L2_CID_EXPOSURE_AUTO, V4L2_EXPOSURE_MANUAL) < 0)
+                  fprintf(stderr, "AutoExposure: cannot set manual exposure: %s\n", strerror(errno));
+            }
+      int v = c->getControl(V4L2_CID_EXPOSURE_ABSOLUTE);
+      if (v >= 0)
+            value = v;
+      cam    = c;
+      settle = settleFrames;
+      return true;
+      }
+
+//---------------------------------------------------------
+//   stop
+//    give exposure control back to the camera
+//---------------------------------------------------------
+
+void AutoExposure::stop()
+      {
+      if (cam && savedMode >= 0)
+            cam->setControl(V4L2_CID_EXPOSURE_AUTO, savedMode);
+      cam       = 0;
+      savedMode = -1;
+      }
+
+//---------------------------------------------------------
+//   update
+//    one control step per histogram; the correction is
+//    limited to a factor of two and the exposure has
+//    settleFrames histograms to take effect
+//---------------------------------------------------------
+
+void AutoExposure::update(const Histogram& h)
+      {
+      if (!cam || !h.samples)
+            return;
+      if (settle > 0) {
+            --settle;
+            return;
+            }
+      double ratio = _target / qMax(h.mean(), 1.0);
+      if (h.clippedHigh() > maxClipped)
+            ratio = qMin(ratio, 1.0 - 2 * deadBand);
+      if (ratio > 1.0 - deadBand && ratio < 1.0 + deadBand)
+            return;
+      ratio = qBound(0.5, ratio, 2.0);
+
+      qint64 v = qBound(minimum, qint64(value * ratio + 0.5), maximum);
+      v = minimum + (v - minimum) / step * step;
+      if (v == value) {
+            // small values: at least one step
+            if (ratio > 1.0 && value + step <= maximum)
+                  v = value + step;
+            else if (ratio < 1.0 && value - step >= minimum)
+                  v = value - step;
+            else
+                  return;
+            }
+      if (cam->setControl(V4L2_CID_EXPOSURE_ABSOLUTE, v) < 0) {
+            fprintf(stderr, "AutoExposure: cannot set exposure %lld: %s\n", (long long)v, strerror(errno));
+            stop();
+            return;
+            }
+      value  = v;
+      settle = settleFrames;
+      }
+
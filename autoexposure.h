@@ -0,0 +1,49 @@
+//=============================================================================
+//  Cam
+//  Webcam client
+//
+//  Copyright (C) 2016 Werner Schweer
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License version 2
+//  as published by the Free Software Foundation and appearing in
+//  the file LICENCE.GPL
+//=============================================================================
+
+#ifndef __AUTOEXPOSURE_H__
+#define __AUTOEXPOSURE_H__
+
+#include <QtGlobal>
+
+class V4l2;
+struct Histogram;
+
+//---------------------------------------------------------
+//   AutoExposure
+//    drives V4L2_CID_EXPOSURE_ABSOLUTE towards a target
+//    mean luma; clipped highlights pull the exposure
+//    down. Runs in the capture thread.
+//---------------------------------------------------------
+
+class AutoExposure {
+      V4l2* cam        { 0 };
+      qint64 minimum   { 0 };
+      qint64 maximum   { 0 };
+      qint64 step      { 1 };
+      qint64 value     { 0 };
+      qint64 savedMode { -1 };      // V4L2_CID_EXPOSURE_AUTO before start()
+      int settle       { 0 };       // histograms to skip after a change
+      int _target      { 110 };
+
+   public:
+      bool start(V4l2*);
+      void stop();
+      bool active() const           { return cam != 0; }
+      void update(const Histogram&);
+      qint64 exposure() const       { return value; }
+      void setTarget(int val)       { _target = qBound(16, val, 240); }
+      int target() const            { return _target; }
+      };
+
+#endif
+
@@ -0,0 +1,408 @@
+//=============================================================================
+//  Cam
+//  Webcam client
+//
+//  Copyright (C) 2016 Werner Schweer
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License version 2
+//  as published by the Free Software Foundation and appearing in
+//  the file LICENCE.GPL
+//=============================================================================
+
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define AVERAGE_AVX2
+#endif
+
+#include "average.h"
+
+//    Exponential:  acc = acc - acc >> k + src << (8 - k)
+//                  dst = (acc + 128) >> 8
+//       acc is the average in 8.8 fixed point and never
+//       exceeds 0xff00
+//
+//    Mean:         sum = sum - old + src
+//                  dst = ((sum + n / 2) * recip) >> 16
+//       with recip = 65536 / n + 1 the division is exact
+//       for sums up to n * 255 if n <= 16
+
+static const int maxMeanFrames  = 16;
+static const int maxShift       = 7;
+
+typedef void (*EmaKernel)(quint16* acc, const uchar* src, uchar* dst, int n, int k);
+typedef void (*MeanKernel)(quint16* sum, uchar* old, const uchar* src, uchar* dst, int n, int recip, int half);
+
+//---------------------------------------------------------
+//   emaScalar
+//---------------------------------------------------------
+
+static void emaScalar(quint16* acc, const uchar* src, uchar* dst, int n, int k)
+      {
+      for (int i = 0; i < n; ++i) {
+            unsigned a = acc[i];
+            a = a - (a >> k) + (src[i] << (8 - k));
+            acc[i] = a;
+            dst[i] = (a + 128) >> 8;
+            }
+      }
+
+//---------------------------------------------------------
+//   meanScalar
+//    old is the ring slot of the frame which drops out; it
+//    is replaced by src
+//---------------------------------------------------------
+
+static void meanScalar(quint16* sum, uchar* old, const uchar* src, uchar* dst, int n, int recip, int half)
+      {
+      for (int i = 0; i < n; ++i) {
+            unsigned s = sum[i] - old[i] + src[i];
+            old[i] = src[i];
+            sum[i] = s;
+            dst[i] = ((s + half) * recip) >> 16;
+            }
+      }
+
+#ifdef __SSE2__
+//---------------------------------------------------------
+//   emaSse2
+//---------------------------------------------------------
+
+static void emaSse2(quint16* acc, const uchar* src, uchar* dst, int n, int k)
+      {
+      const __m128i zero  = _mm_setzero_si128();
+      const __m128i round = _mm_set1_epi16(128);
+      const __m128i sk    = _mm_cvtsi32_si128(k);
+      const __m128i sl    = _mm_cvtsi32_si128(8 - k);
+      int i = 0;
+      for (; i + 16 <= n; i += 16) {
+            __m128i s  = _mm_loadu_si128((const __m128i*)(src + i));
+            __m128i a0 = _mm_loadu_si128((const __m128i*)(acc + i));
+            __m128i a1 = _mm_loadu_si128((const __m128i*)(acc + i + 8));
+            a0 = _mm_add_epi16(_mm_sub_epi16(a0, _mm_srl_epi16(a0, sk)), _mm_sll_epi16(_mm_unpacklo_epi8(s, zero), sl));
+            a1 = _mm_add_epi16(_mm_sub_epi16(a1, _mm_srl_epi16(a1, sk)), _mm_sll_epi16(_mm_unpackhi_epi8(s, zero), sl));
+            _mm_storeu_si128((__m128i*)(acc + i), a0);
+            _mm_storeu_si128((__m128i*)(acc + i + 8), a1);
+            __m128i d0 = _mm_srli_epi16(_mm_add_epi16(a0, round), 8);
+            __m128i d1 = _mm_srli_epi16(_mm_add_epi16(a1, round), 8);
+            _mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(d0, d1));
+            }
+      emaScalar(acc + i, src + i, dst + i, n - i, k);
+      }
+
+//---------------------------------------------------------
+//   meanSse2
+//---------------------------------------------------------
+
+static void meanSse2(quint16* sum, uchar* old, const uchar* src, uchar* dst, int n, int recip, int half)
+      {
+      const __m128i zero = _mm_setzero_si128();
+      const __m128i r    = _mm_set1_epi16(short(recip));
+      const __m128i h    = _mm_set1_epi16(short(half));
+      int i = 0;
+      for (; i + 16 <= n; i += 16) {
+            __m128i s  = _mm_loadu_si128((const __m128i*)(src + i));
+            __m128i o  = _mm_loadu_si128((const __m128i*)(old + i));
+            _mm_storeu_si128((__m128i*)(old + i), s);
+            __m128i s0 = _mm_loadu_si128((const __m128i*)(sum + i));
+            __m128i s1 = _mm_loadu_si128((const __m128i*)(sum + i + 8));
+            s0 = _mm_sub_epi16(_mm_add_epi16(s0, _mm_unpacklo_epi8(s, zero)), _mm_unpacklo_epi8(o, zero));
+            s1 = _mm_sub_epi16(_mm_add_epi16(s1, _mm_unpackhi_epi8(s, zero)), _mm_unpackhi_epi8(o, zero));
+            _mm_storeu_si128((__m128i*)(sum + i), s0);
+            _mm_storeu_si128((__m128i*)(sum + i + 8), s1);
+            __m128i d0 = _mm_mulhi_epu16(_mm_add_epi16(s0, h), r);
+            __m128i d1 = _mm_mulhi_epu16(_mm_add_epi16(s1, h), r);
+            _mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(d0, d1));
+            }
+      meanScalar(sum + i, old + i, src + i, dst + i, n - i, recip, half);
+      }
+#endif
+
+#ifdef AVERAGE_AVX2
+//---------------------------------------------------------
+//   emaAvx2
+//    32 bytes per iteration; packus works per 128 bit
+//    lane, the permute restores the byte order
+//---------------------------------------------------------
+
+__attribute__((target("avx2")))
+static void emaAvx2(quint16* acc, const uchar* src, uchar* dst, int n, int k)
+      {
+      const __m256i round = _mm256_set1_epi16(128);
+      const __m128i sk    = _mm_cvtsi32_si128(k);
+      const __m128i sl    = _mm_cvtsi32_si128(8 - k);
+      int i = 0;
+      for (; i + 32 <= n; i += 32) {
+            __m256i s0 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(src + i)));
+            __m256i s1 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(src + i + 16)));
+            __m256i a0 = _mm256_loadu_si256((const __m256i*)(acc + i));
+            __m256i a1 = _mm256_loadu_si256((const __m256i*)(acc + i + 16));
+            a0 = _mm256_add_epi16(_mm256_sub_epi16(a0, _mm256_srl_epi16(a0, sk)), _mm256_sll_epi16(s0, sl));
+            a1 = _mm256_add_epi16(_mm256_sub_epi16(a1, _mm256_srl_epi16(a1, sk)), _mm256_sll_epi16(s1, sl));
+            _mm256_storeu_si256((__m256i*)(acc + i), a0);
+            _mm256_storeu_si256((__m256i*)(acc + i + 16), a1);
+            __m256i d0 = _mm256_srli_epi16(_mm256_add_epi16(a0, round), 8);
+            __m256i d1 = _mm256_srli_epi16(_mm256_add_epi16(a1, round), 8);
+            __m256i d  = _mm256_permute4x64_epi64(_mm256_packus_epi16(d0, d1), 0xd8);
+            _mm256_storeu_si256((__m256i*)(dst + i), d);
+            }
+      emaScalar(acc + i, src + i, dst + i, n - i, k);
+      }
+
+//---------------------------------------------------------
+//   meanAvx2
+//---------------------------------------------------------
+
+__attribute__((target("avx2")))
+static void meanAvx2(quint16* sum, uchar* old, const uchar* src, uchar* dst, int n, int recip, int half)
+      {
+      const __m256i r = _mm256_set1_epi16(short(recip));
+      const __m256i h = _mm256_set1_epi16(short(half));
+      int i = 0;
+      for (; i + 32 <= n; i += 32) {
+            __m256i s = _mm256_loadu_si256((const __m256i*)(src + i));
+            __m256i o = _mm256_loadu_si256((const __m256i*)(old + i));
+            _mm256_storeu_si256((__m256i*)(old + i), s);
+            __m256i s0 = _mm256_loadu_si256((const __m256i*)(sum + i));
+            __m256i s1 = _mm256_loadu_si256((const __m256i*)(sum + i + 16));
+            s0 = _mm256_add_epi16(s0, _mm256_cvtepu8_epi16(_mm256_castsi256_si128(s)));
+            s1 = _mm256_add_epi16(s1, _mm256_cvtepu8_epi16(_mm256_extracti128_si256(s, 1)));
+            s0 = _mm256_sub_epi16(s0, _mm256_cvtepu8_epi16(_mm256_castsi256_si128(o)));
+            s1 = _mm256_sub_epi16(s1, _mm256_cvtepu8_epi16(_mm256_extracti128_si256(o, 1)));
+            _mm256_storeu_si256((__m256i*)(sum + i), s0);
+            _mm256_storeu_si256((__m256i*)(sum + i + 16), s1);
+            __m256i d0 = _mm256_mulhi_epu16(_mm256_add_epi16(s0, h), r);
+            __m256i d1 = _mm256_mulhi_epu16(_mm256_add_epi16(s1, h), r);
+            __m256i d  = _mm256_permute4x64_epi64(_mm256_packus_epi16(d0, d1), 0xd8);
+            _mm256_storeu_si256((__m256i*)(dst + i), d);
+            }
+      meanScalar(sum + i, old + i, src + i, dst + i, n - i, recip, half);
+      }
+#endif
+
+//---------------------------------------------------------
+//   Kernels
+//---------------------------------------------------------
+
+struct Kernels {
+      const char* name;
+      EmaKernel ema;
+      MeanKernel mean;
+      };
+
+static const Kernels scalarKernels { "scalar", emaScalar, meanScalar };
+#ifdef __SSE2__
+static const Kernels sse2Kernels   { "sse2",   emaSse2,   meanSse2   };
+#endif
+#ifdef AVERAGE_AVX2
+static const Kernels avx2Kernels   { "avx2",   emaAvx2,   meanAvx2   };
+#endif
+
+//---------------------------------------------------------
+//   bestKernels
+//---------------------------------------------------------
+
+static const Kernels* bestKernels()
+      {
+#ifdef AVERAGE_AVX2
+      if (__builtin_cpu_supports("avx2"))
+            return &avx2Kernels;
+#endif
+#ifdef __SSE2__
+      return &sse2Kernels;
+#else
+      return &scalarKernels;
+#endif
+      }
+
+static const Kernels* kernels = bestKernels();
+
+//---------------------------------------------------------
+//   averageKernel
+//---------------------------------------------------------
+
+const char* averageKernel()
+      {
+      return kernels->name;
+      }
+
+//---------------------------------------------------------
+//   setAverageKernel
+//    select "scalar", "sse2", "avx2" or "auto"; return
+//    false if the cpu or build does not support it
+//---------------------------------------------------------
+
+bool setAverageKernel(const char* name)
+      {
+      if (strcmp(name, "auto") == 0)
+            kernels = bestKernels();
+      else if (strcmp(name, "scalar") == 0)
+            kernels = &scalarKernels;
+#ifdef __SSE2__
+      else if (strcmp(name, "sse2") == 0)
+            kernels = &sse2Kernels;
+#endif
+#ifdef AVERAGE_AVX2
+      else if (strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2"))
+            kernels = &avx2Kernels;
+#endif
+      else
+            return false;
+      return true;
+      }
+
+//---------------------------------------------------------
+//   setMode
+//    n is the number of frames (Mean, 2 - 16) or the
+//    shift k (Exponential, 1 - 7, weight of a new frame
+//    is 1 / 2^k)
+//---------------------------------------------------------
+
+void FrameAverager::setMode(Mode m, int n)
+      {
+      if (m == Mode::Mean)
+            n = qBound(2, n, maxMeanFrames);
+      else if (m == Mode::Exponential)
+            n = qBound(1, n, maxShift);
+      if (m == _mode && n == _n)
+            return;
+      _mode = m;
+      _n    = n;
+      size  = 0;
+      acc.clear();
+      ring.clear();
+      out.clear();
+      acc.shrink_to_fit();
+      ring.shrink_to_fit();
+      out.shrink_to_fit();
+      }
+
+//---------------------------------------------------------
+//   reset
+//    start again with the next frame
+//---------------------------------------------------------
+
+void FrameAverager::reset()
+      {
+      size = 0;
+      }
+
+//---------------------------------------------------------
+//   resize
+//    a change of the frame size restarts the average
+//---------------------------------------------------------
+
+void FrameAverager::resize(int n)
+      {
+      if (n == size)
+            return;
+      size  = n;
+      count = 0;
+      pos   = 0;
+      out.resize(n);
+      acc.assign(n, 0);
+      if (_mode == Mode::Mean)
+            ring.assign(size_t(n) * _n, 0);
+      }
+
+//---------------------------------------------------------
+//   addSpan
+//    add n bytes at offset of the frame to out
+//---------------------------------------------------------
+
+void FrameAverager::addSpan(const uchar* src, int offset, int n)
+      {
+      uchar* dst = out.data() + offset;
+      if (_mode == Mode::Exponential) {
+            if (count == 0) {
+                  for (int i = 0; i < n; ++i)
+                        acc[offset + i] = src[i] << 8;
+                  }
+            kernels->ema(acc.data() + offset, src, dst, n, _n);
+            }
+      else {
+            // until the ring is full the slots hold zeros and
+            // the sum is divided by the frames seen so far
+
+            int frames = count < _n ? count + 1 : _n;
+            kernels->mean(acc.data() + offset, ring.data() + size_t(pos) * size + offset, src, dst, n,
+               65536 / frames + 1, frames / 2);
+            if (frames == 1)
+                  memcpy(dst, src, n);              // 65537 does not fit
+            }
+      }
+
+//---------------------------------------------------------
+//   advance
+//    the frame is complete
+//---------------------------------------------------------
+
+void FrameAverager::advance()
+      {
+      if (_mode == Mode::Mean)
+            pos = (pos + 1) % _n;
+      if (count < _n)
+            ++count;
+      }
+
+//---------------------------------------------------------
+//   add
+//    add a frame of size bytes and return the average;
+//    the result is valid until the next call. A change of
+//    size restarts the average.
+//---------------------------------------------------------
+
+const uchar* FrameAverager::add(const uchar* src, int n)
+      {
+      if (_mode == Mode::Off)
+            return src;
+      resize(n);
+      addSpan(src, 0, n);
+      advance();
+      return out.data();
+      }
+
+//---------------------------------------------------------
+//   addPlanes
+//    add a planar frame row by row; dst returns the
+//    average as planes with 32 byte aligned rows, valid
+//    until the next call. With Mode::Off dst is src.
+//    src and dst may be the same arrays.
+//---------------------------------------------------------
+
+void FrameAverager::addPlanes(const uchar* const src[3], const int srcStride[3], const int width[3],
+   const int height[3], int planes, const uchar* dst[3], int dstStride[3])
+      {
+      if (_mode == Mode::Off) {
+            for (int i = 0; i < planes; ++i) {
+                  dst[i]       = src[i];
+                  dstStride[i] = srcStride[i];
+                  }
+            return;
+            }
+      int stride[3];
+      int n = 0;
+      for (int i = 0; i < planes; ++i) {
+            stride[i] = (width[i] + 31) & ~31;
+            n        += stride[i] * height[i];
+            }
+      resize(n);
+      int offset[3];
+      int o = 0;
+      for (int i = 0; i < planes; ++i) {
+            offset[i] = o;
+            for (int y = 0; y < height[i]; ++y)
+                  addSpan(src[i] + y * srcStride[i], o + y * stride[i], width[i]);
+            o += stride[i] * height[i];
+            }
+      advance();
+      for (int i = 0; i < planes; ++i) {
+            dst[i]       = out.data() + offset[i];
+            dstStride[i] = stride[i];
+            }
+      }
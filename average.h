@@ -0,0 +1,66 @@
+//=============================================================================
+//  Cam
+//  Webcam client
+//
+//  Copyright (C) 2016 Werner Schweer
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License version 2
+//  as published by the Free Software Foundation and appearing in
+//  the file LICENCE.GPL
+//=============================================================================
+
+#ifndef __AVERAGE_H__
+#define __AVERAGE_H__
+
+#include <vector>
+
+#include <QtGlobal>
+
+//---------------------------------------------------------
+//   FrameAverager
+//    temporal noise reduction on raw frame bytes; works
+//    on packed YUYV, NV12 planes or the yuv planes of a
+//    jpeg decoder alike since averaging is done per byte
+//
+//    Mean        - mean of the last n frames (n = 2..16)
+//    Exponential - acc += (x - acc) / 2^k   (k = 1..7)
+//
+//    the accumulator has 16 bit per byte; kernels are
+//    AVX2 or SSE2, selected at runtime
+//---------------------------------------------------------
+
+class FrameAverager {
+   public:
+      enum class Mode { Off, Mean, Exponential };
+
+   private:
+      Mode _mode { Mode::Off };
+      int _n     { 0 };                 // frames (Mean) or shift (Exponential)
+      int size   { 0 };
+      int count  { 0 };                 // frames accumulated
+      int pos    { 0 };                 // ring position
+      std::vector<quint16> acc;
+      std::vector<uchar> ring;          // last n frames (Mean)
+      std::vector<uchar> out;
+
+      void resize(int n);
+      void addSpan(const uchar* src, int offset, int n);
+      void advance();
+
+   public:
+      void setMode(Mode m, int n);
+      Mode mode() const     { return _mode; }
+      int n() const         { return _n; }
+      void reset();
+      const uchar* add(const uchar* src, int size);
+      void addPlanes(const uchar* const src[3], const int srcStride[3], const int width[3],
+         const int height[3], int planes, const uchar* dst[3], int dstStride[3]);
+      qint64 memory() const { return qint64(acc.size()) * sizeof(quint16) + ring.size() + out.size(); }
+      };
+
+extern const char* averageKernel();
+extern bool setAverageKernel(const char* name);
+
+#endif
+
@@ -0,0 +1,1079 @@
+//=============================================================================
+//  Cam
+//  Webcam client
+//
+//  Copyright (C) 2016 Werner Schweer
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License version 2
+//  as published by the Free Software Foundation and appearing in
+//  the file LICENCE.GPL
+//=============================================================================
+
+//---------------------------------------------------------
+//   cam-bench
+//    single core throughput of the frame processing
+//    stages, without a camera
+//
+//    cam-bench average|histogram|reader|decode|backends|mosaic|correction|validate|http|jitter [seconds]
+//---------------------------------------------------------
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <QBuffer>
+#include <QCoreApplication>
+#include <QImage>
+#include <QImageReader>
+#include <QtPlugin>
+
+extern "C" {
+      #include <libavcodec/avcodec.h>
+      #include <libavutil/opt.h>
+      }
+
+#include "average.h"
+#include "correction.h"
+#include "decoder.h"
+#include "histogram.h"
+#include "jpeg.h"
+#include "latency.h"
+#include "mosaic.h"
+#include "realtime.h"
+#include "streamserver.h"
+#include "yuv.h"
+
+Q_IMPORT_PLUGIN(MjpegImageIOPlugin)
+
+//---------------------------------------------------------
+//   noise
+//    frames with a gradient and random noise
+//---------------------------------------------------------
+
+static void noise(std::vector<uchar>* frame, unsigned seed)
+      {
+      for (size_t i = 0; i < frame->size(); ++i) {
+            seed = seed * 1103515245 + 12345;
+            (*frame)[i] = ((i >> 4) & 0x7f) + ((seed >> 16) & 0x3f);
+            }
+      }
+
+//---------------------------------------------------------
+//   benchAverage
+//    1080p YUYV (raw path) and RGB32 (mjpeg path); 30 fps
+//    is the requirement
+//---------------------------------------------------------
+
+static bool benchAverage(double seconds)
+      {
+      struct Format {
+            const char* name;
+            int size;
+            };
+      static const Format formats[] = {
+            { "yuyv  1920x1080", 1920 * 1080 * 2 },
+            { "rgb32 1920x1080", 1920 * 1080 * 4 },
+            };
+      static const char* kernelNames[] = { "scalar", "sse2", "avx2" };
+      struct Mode {
+            const char* name;
+            FrameAverager::Mode mode;
+            int n;
+            };
+      static const Mode modes[] = {
+            { "mean 8", FrameAverager::Mode::Mean,        8 },
+            { "ema 3",  FrameAverager::Mode::Exponential, 3 },
+            };
+
+      bool ok = true;
+      for (const Format& f : formats) {
+            std::vector<std::vector<uchar>> frames(8, std::vector<uchar>(f.size));
+            for (size_t i = 0; i < frames.size(); ++i)
+                  noise(&frames[i], i + 1);
+            for (const char* k : kernelNames) {
+                  if (!setAverageKernel(k))
+                        continue;
+                  for (const Mode& m : modes) {
+                        FrameAverager a;
+                        a.setMode(m.mode, m.n);
+                        unsigned sum = 0;
+                        int n = 0;
+                        auto start = std::chrono::steady_clock::now();
+                        double dt;
+                        do {
+                              sum += a.add(frames[n % frames.size()].data(), f.size)[n];
+                              ++n;
+                              dt = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                              } while (dt < seconds);
+                        double fps = n / dt;
+                        bool pass  = fps >= 30.0;
+                        printf("average %s %-6s %-6s %7.1f fps %6.2f ms/frame %s (%u)\n",
+                           f.name, k, m.name, fps, 1000.0 / fps, pass ? "ok" : "TOO SLOW", sum & 0xff);
+                        // only the kernel cam uses has to keep up
+                        if (strcmp(k, "scalar") != 0)
+                              ok = ok && pass;
+                        }
+                  }
+            }
+      setAverageKernel("auto");
+      printf("average: cam uses %s kernels\n", averageKernel());
+      return ok;
+      }
+
+//---------------------------------------------------------
+//   benchHistogram
+//    metering of a 1080p frame has to stay below 1 ms
+//---------------------------------------------------------
+
+static bool benchHistogram(double seconds)
+      {
+      const int w = 1920;
+      const int h = 1080;
+      std::vector<uchar> yuyv(w * h * 2), nv12(w * h * 3 / 2), rgb32(w * h * 4);
+      noise(&yuyv, 1);
+      noise(&nv12, 2);
+      noise(&rgb32, 3);
+
+      bool ok = true;
+      for (int format = 0; format < 3; ++format) {
+            static const char* names[] = { "yuyv ", "nv12 ", "rgb32" };
+            Histogram hist;
+            int n = 0;
+            auto start = std::chrono::steady_clock::now();
+            double dt;
+            do {
+                  hist.clear();
+                  if (format == 0)
+                        histogramYuyv(&hist, yuyv.data(), w * 2, w, h);
+                  else if (format == 1)
+                        histogramNv12(&hist, nv12.data(), w, nv12.data() + w * h, w, w, h);
+                  else
+                        histogramRgb32(&hist, rgb32.data(), w * 4, w, h);
+                  ++n;
+                  dt = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                  } while (dt < seconds);
+            double ms = dt * 1000.0 / n;
+            bool pass = ms < 1.0;
+            printf("histogram %s 1920x1080 %6.3f ms/frame %u samples, mean %.0f %s\n",
+               names[format], ms, hist.samples, hist.mean(), pass ? "ok" : "TOO SLOW");
+            ok = ok && pass;
+            }
+      return ok;
+      }
+
+//---------------------------------------------------------
+//   testJpeg
+//    noise frame encoded by Qt
+//---------------------------------------------------------
+
+static QByteArray testJpeg(int w, int h, unsigned seed)
+      {
+      std::vector<uchar> rgb(w * h * 4);
+      noise(&rgb, seed);
+      QImage image(rgb.data(), w, h, w * 4, QImage::Format_RGB32);
+      QByteArray ba;
+      QBuffer b(&ba);
+      b.open(QIODevice::WriteOnly);
+      if (!image.save(&b, "jpeg", 90)) {
+            fprintf(stderr, "cam-bench: cannot encode jpeg\n");
+            return QByteArray();
+            }
+      return ba;
+      }
+
+//---------------------------------------------------------
+//   readMjpeg
+//    one image through a new QImageReader, as a batch job
+//    would do it
+//---------------------------------------------------------
+
+static QImage readMjpeg(const QByteArray& jpeg)
+      {
+      QBuffer b;
+      b.setData(jpeg);
+      b.open(QIODevice::ReadOnly);
+      QImageReader reader(&b, "mjpeg");
+      return reader.read();
+      }
+
+//---------------------------------------------------------
+//   perImage
+//    ms per call of f, cycling through n images
+//---------------------------------------------------------
+
+template <class F>
+static double perImage(double seconds, int n, F f)
+      {
+      int i = 0;
+      auto start = std::chrono::steady_clock::now();
+      double dt;
+      do {
+            f(i++ % n);
+            dt = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            } while (dt < seconds);
+      return dt * 1000.0 / i;
+      }
+
+//---------------------------------------------------------
+//   benchReader
+//    cost of the image plugin per image compared to the
+//    pure decode time, then all cores read images through
+//    their own readers and through one shared reader and
+//    compare them against a single threaded reference
+//---------------------------------------------------------
+
+static bool benchReader(double seconds)
+      {
+      const int w = 1920;
+      const int h = 1080;
+      std::vector<QByteArray> jpegs;
+      QByteArray recording;
+      for (int i = 0; i < 8; ++i) {
+            QByteArray ba = testJpeg(w, h, i + 1);
+            if (ba.isEmpty())
+                  return false;
+            jpegs.push_back(ba);
+            recording += ba;
+            }
+      int n = jpegs.size();
+      std::vector<QImage> reference;
+      for (const QByteArray& ba : jpegs)
+            reference.push_back(readMjpeg(ba));
+
+      MjpegDecoder* decoder = MjpegDecoder::create();
+      QImage image;
+      double decode = perImage(seconds, n, [&](int i) {
+            decoder->decode((const uchar*)jpegs[i].constData(), jpegs[i].size(), &image);
+            });
+      double setup = perImage(seconds, n, [&](int i) {
+            MjpegDecoder* d = MjpegDecoder::create();
+            d->decode((const uchar*)jpegs[i].constData(), jpegs[i].size(), &image);
+            delete d;
+            });
+      double reader = perImage(seconds, n, [&](int i) { image = readMjpeg(jpegs[i]); });
+      printf("reader %s 1920x1080: decode %6.2f ms, new decoder %6.2f ms, QImageReader %6.2f ms per image\n",
+         decoder->name(), decode, setup, reader);
+      delete decoder;
+      double overhead = (reader - decode) / decode;
+      bool ok = overhead < 0.1;
+      printf("reader: overhead %.1f%% %s\n", overhead * 100.0, ok ? "ok" : "TOO SLOW");
+
+      int threads = qMax(2u, std::thread::hardware_concurrency());
+      std::atomic<unsigned> images { 0 };
+      std::atomic<unsigned> errors { 0 };
+      QBuffer shared;
+      shared.setData(recording);
+      shared.open(QIODevice::ReadOnly);
+      QImageReader sharedReader(&shared, "mjpeg");
+      std::mutex sharedMutex;
+      auto start = std::chrono::steady_clock::now();
+      std::vector<std::thread> tl;
+      for (int t = 0; t < threads; ++t) {
+            tl.push_back(std::thread([&, t] {
+                  unsigned seed = t + 1;
+                  while (std::chrono::steady_clock::now() - start < std::chrono::duration<double>(seconds)) {
+                        seed  = seed * 1103515245 + 12345;
+                        int i = (seed >> 16) % n;
+                        QImage im;
+                        if (seed & 0x10000) {
+                              std::lock_guard<std::mutex> lock(sharedMutex);
+                              if (sharedReader.jumpToImage(i))
+                                    im = sharedReader.read();
+                              }
+                        else
+                              im = readMjpeg(jpegs[i]);
+                        if (im != reference[i])
+                              ++errors;
+                        ++images;
+                        }
+                  }));
+            }
+      for (std::thread& t : tl)
+            t.join();
+      double dt = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      printf("reader: %d threads %u images %.1f images/s, %u errors %s\n",
+         threads, unsigned(images), images / dt, unsigned(errors), errors ? "FAILED" : "ok");
+      return ok && errors == 0;
+      }
+
+//---------------------------------------------------------
+//   benchDecode
+//    latency of one 4K frame with 1, 2, 4 ... threads; the
+//    parallel result has to stay close to the serial one
+//---------------------------------------------------------
+
+static bool benchDecode(double seconds)
+      {
+      const int w = 3840;
+      const int h = 2160;
+      QByteArray jpeg = testJpeg(w, h, 1);
+      if (jpeg.isEmpty())
+            return false;
+      const uchar* data = (const uchar*)jpeg.constData();
+      int cores = std::max(1u, std::thread::hardware_concurrency());
+      bool ok   = true;
+      for (const QByteArray& backend : MjpegDecoder::backends()) {
+            QImage reference;
+            double serial = 0.0;
+            for (int threads = 1; threads <= cores; threads *= 2) {
+                  MjpegDecoder* decoder = MjpegDecoder::create(backend, threads);
+                  QImage image;
+                  double ms = perImage(seconds, 1, [&](int) { decoder->decode(data, jpeg.size(), &image); });
+                  delete decoder;
+
+                  // band seams and chroma upsampling differ
+                  // slightly from the serial decoder
+
+                  double diff = 0.0;
+                  if (threads == 1) {
+                        reference = image;
+                        serial    = ms;
+                        }
+                  else {
+                        quint64 sum = 0;
+                        for (int y = 0; y < h; ++y) {
+                              const uchar* a = reference.constScanLine(y);
+                              const uchar* b = image.constScanLine(y);
+                              for (int x = 0; x < w * 4; ++x)
+                                    sum += std::abs(a[x] - b[x]);
+                              }
+                        diff = double(sum) / (w * h * 4);
+                        }
+                  bool pass = diff < 2.0;
+                  printf("decode %-9s 3840x2160 %2d threads %6.2f ms/frame speedup %4.2f mean diff %.2f %s\n",
+                     backend.constData(), threads, ms, serial / ms, diff, pass ? "ok" : "FAILED");
+                  ok = ok && pass;
+                  }
+            }
+      return ok;
+      }
+
+//---------------------------------------------------------
+//   uvcJpeg
+//    4:2:2 frame as UVC cameras send it: encoded with the
+//    Annex K huffman tables, which are then removed. Luma
+//    is noise, chroma a smooth gradient, so the chroma
+//    upsampling of the backends hardly differs.
+//---------------------------------------------------------
+
+static QByteArray uvcJpeg(int w, int h, unsigned seed)
+      {
+      avcodec_register_all();
+      AVCodec* codec = avcodec_find_encoder(AV_CODEC_ID_MJPEG);
+      if (!codec) {
+            fprintf(stderr, "cam-bench: mjpeg encoder not found\n");
+            return QByteArray();
+            }
+      AVCodecContext* c = avcodec_alloc_context3(codec);
+      c->width     = w;
+      c->height    = h;
+      c->pix_fmt   = AV_PIX_FMT_YUVJ422P;
+      c->time_base = AVRational { 1, 30 };
+      c->flags    |= AV_CODEC_FLAG_QSCALE;
+      av_opt_set(c->priv_data, "huffman", "default", 0);    // not in older versions, which always use them
+      QByteArray jpeg;
+      AVFrame* frame = av_frame_alloc();
+      frame->format  = c->pix_fmt;
+      frame->width   = w;
+      frame->height  = h;
+      frame->quality = FF_QP2LAMBDA * 3;
+      if (avcodec_open2(c, codec, 0) < 0 || av_frame_get_buffer(frame, 32) < 0)
+            fprintf(stderr, "cam-bench: cannot open mjpeg encoder\n");
+      else {
+            std::vector<uchar> luma(w);
+            for (int y = 0; y < h; ++y) {
+                  noise(&luma, seed + y);
+                  memcpy(frame->data[0] + y * frame->linesize[0], luma.data(), w);
+                  uchar* u = frame->data[1] + y * frame->linesize[1];
+                  uchar* v = frame->data[2] + y * frame->linesize[2];
+                  for (int x = 0; x < w / 2; ++x) {
+                        u[x] = 64 + (x * 128) / (w / 2);
+                        v[x] = 64 + (y * 128) / h;
+                        }
+                  }
+            AVPacket p;
+            av_init_packet(&p);
+            p.data = 0;
+            p.size = 0;
+            if (avcodec_send_frame(c, frame) < 0 || avcodec_receive_packet(c, &p) < 0)
+                  fprintf(stderr, "cam-bench: cannot encode jpeg\n");
+            else {
+                  jpeg = QByteArray((const char*)p.data, p.size);
+                  av_packet_unref(&p);
+                  }
+            }
+      av_frame_free(&frame);
+      avcodec_free_context(&c);
+      if (jpeg.isEmpty())
+            return jpeg;
+
+      // drop the DHT segments before the scan
+
+      QByteArray stripped = jpeg.left(2);
+      int i = 2;
+      while (i + 4 <= jpeg.size()) {
+            const uchar* d = (const uchar*)jpeg.constData() + i;
+            if (d[1] == 0xda) {
+                  stripped += jpeg.mid(i);
+                  break;
+                  }
+            int len = 2 + ((d[2] << 8) | d[3]);
+            if (d[1] != 0xc4)
+                  stripped += jpeg.mid(i, len);
+            i += len;
+            }
+      if (jpegHasHuffmanTables((const uchar*)stripped.constData(), stripped.size())) {
+            fprintf(stderr, "cam-bench: cannot remove huffman tables\n");
+            return QByteArray();
+            }
+      return stripped;
+      }
+
+//---------------------------------------------------------
+//   benchBackends
+//    the decoder backends on single threaded UVC frames
+//    at the usual camera resolutions; all backends have to
+//    decode to nearly the same image as the first one
+//---------------------------------------------------------
+
+static bool benchBackends(double seconds)
+      {
+      static const struct { int w, h; } sizes[] = {
+            { 640, 480 }, { 1280, 720 }, { 1920, 1080 }
+            };
+      const int n = 4;
+      std::vector<QByteArray> backends = MjpegDecoder::backends();
+      if (backends.size() < 2)
+            printf("backends: only %s is built, nothing to compare\n", backends[0].constData());
+      bool ok = true;
+      for (const auto& s : sizes) {
+            std::vector<QByteArray> jpegs;
+            for (int i = 0; i < n; ++i) {
+                  jpegs.push_back(uvcJpeg(s.w, s.h, i + 1));
+                  if (jpegs.back().isEmpty())
+                        return false;
+                  }
+            QImage reference;
+            for (const QByteArray& backend : backends) {
+                  MjpegDecoder* decoder = MjpegDecoder::create(backend, 1);
+                  QImage image;
+                  bool decoded = decoder->decode((const uchar*)jpegs[0].constData(), jpegs[0].size(), &image)
+                     && image.width() == s.w && image.height() == s.h;
+                  QImage first = image.copy();
+                  double ms = decoded ? perImage(seconds, n, [&](int i) {
+                        decoder->decode((const uchar*)jpegs[i].constData(), jpegs[i].size(), &image);
+                        }) : 0.0;
+                  delete decoder;
+
+                  double diff  = 0.0;
+                  int maxDiff  = 0;
+                  if (reference.isNull())
+                        reference = first;
+                  else if (decoded) {
+                        quint64 sum = 0;
+                        for (int y = 0; y < s.h; ++y) {
+                              const uchar* a = reference.constScanLine(y);
+                              const uchar* b = first.constScanLine(y);
+                              for (int x = 0; x < s.w * 4; ++x) {
+                                    int d   = std::abs(a[x] - b[x]);
+                                    sum    += d;
+                                    maxDiff = std::max(maxDiff, d);
+                                    }
+                              }
+                        diff = double(sum) / (s.w * s.h * 4);
+                        }
+                  bool pass = decoded && diff < 1.0;
+                  printf("backends %-9s %4dx%-4d 4:2:2 no DHT %6.2f ms/frame %7.1f fps, mean diff %.2f max %3d %s\n",
+                     backend.constData(), s.w, s.h, ms, decoded ? 1000.0 / ms : 0.0, diff, maxDiff,
+                     pass ? "ok" : "FAILED");
+                  ok = ok && pass;
+                  }
+            }
+      return ok;
+      }
+
+//---------------------------------------------------------
+//   benchMosaic
+//    1080p frames cut from a larger synthetic sample moved
+//    along a path; registration has to keep up with 10 fps
+//    and find the position of every frame within one pixel
+//---------------------------------------------------------
+
+static bool benchMosaic(double seconds)
+      {
+      const int w  = 1920;
+      const int h  = 1080;
+      const int sw = 4 * w;
+      const int sh = 2 * h;
+
+      // sample: smooth structure of several octaves
+
+      std::vector<uchar> sample(sw * sh);
+      std::vector<int> sum(sw * sh);
+      unsigned seed = 1;
+      for (int cell = 256; cell >= 16; cell /= 2) {
+            int gw = sw / cell + 2;
+            int gh = sh / cell + 2;
+            std::vector<int> g(gw * gh);
+            for (int& v : g) {
+                  seed = seed * 1103515245 + 12345;
+                  v = (seed >> 16) & 0xff;
+                  }
+            for (int y = 0; y < sh; ++y) {
+                  int gy = y / cell, fy = y % cell;
+                  for (int x = 0; x < sw; ++x) {
+                        int gx = x / cell, fx = x % cell;
+                        int a  = g[gy * gw + gx] * (cell - fx) + g[gy * gw + gx + 1] * fx;
+                        int b  = g[(gy + 1) * gw + gx] * (cell - fx) + g[(gy + 1) * gw + gx + 1] * fx;
+                        sum[y * sw + x] += (a * (cell - fy) + b * fy) / (cell * cell) * cell / 256;
+                        }
+                  }
+            }
+      int max = *std::max_element(sum.begin(), sum.end());
+      for (int i = 0; i < sw * sh; ++i)
+            sample[i] = sum[i] * 240 / std::max(max, 1);
+
+      // frames with sensor noise along a path with changing
+      // speed and direction
+
+      const int nframes = 64;
+      std::vector<QPoint> path;
+      std::vector<QImage> frames;
+      double x = 0.0, y = 0.0;
+      for (int i = 0; i < nframes; ++i) {
+            double t = double(i) / nframes;
+            QPoint p(lrint(x), lrint(y));
+            path.push_back(p);
+            QImage image(w, h, QImage::Format_RGB32);
+            for (int row = 0; row < h; ++row) {
+                  const uchar* s = sample.data() + (p.y() + row) * sw + p.x();
+                  quint32* d     = (quint32*)image.scanLine(row);
+                  for (int col = 0; col < w; ++col) {
+                        seed  = seed * 1103515245 + 12345;
+                        int v = s[col] + ((seed >> 16) & 0xf);
+                        d[col] = 0xff000000 | v << 16 | v << 8 | v;
+                        }
+                  }
+            frames.push_back(image);
+            x += 60.0 + 40.0 * sin(t * 6.0);
+            y += 25.0 * cos(t * 9.0) + 8.0;
+            }
+
+      bool ok    = true;
+      int n      = 0;
+      double err = 0.0;
+      auto start = std::chrono::steady_clock::now();
+      double dt;
+      do {
+            Mosaic mosaic;
+            for (int i = 0; i < nframes; ++i) {
+                  if (!mosaic.add(frames[i])) {
+                        ok = false;
+                        continue;
+                        }
+                  QPoint d = mosaic.frameRect().topLeft() - path[i];
+                  err      = std::max(err, double(std::max(std::abs(d.x()), std::abs(d.y()))));
+                  }
+            n += nframes - 1;             // the first frame is pasted unregistered
+            dt = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            } while (dt < seconds);
+      double fps = n / dt;
+      bool pass  = ok && fps >= 10.0 && err <= 1.0;
+      printf("mosaic 1920x1080 %.1f fps %.2f ms/frame, max position error %.1f px %s\n",
+         fps, 1000.0 / fps, err, pass ? "ok" : (ok ? "FAILED" : "LOST"));
+      return pass;
+      }
+
+//---------------------------------------------------------
+//   benchCorrection
+//    1080p raw conversion with flat field and distortion
+//    correction against the plain conversion, and the
+//    correction of decoded RGB32 images; 30 fps is the
+//    requirement
+//---------------------------------------------------------
+
+static bool benchCorrection(double seconds)
+      {
+      const int w = 1920;
+      const int h = 1080;
+      std::vector<uchar> yuyv(w * h * 2), nv12(w * h * 3 / 2);
+      noise(&yuyv, 1);
+      noise(&nv12, 2);
+
+      // vignetting falling to 60% in the corners
+
+      Calibration c;
+      c.width  = w;
+      c.height = h;
+      c.dark.assign(w * h, 4);
+      c.flat.resize(w * h);
+      for (int y = 0; y < h; ++y) {
+            for (int x = 0; x < w; ++x) {
+                  double dx = (x - w * 0.5) / (w * 0.5);
+                  double dy = (y - h * 0.5) / (w * 0.5);
+                  c.flat[y * w + x] = lrint((1.0 - 0.2 * (dx * dx + dy * dy)) * 200.0 * 256.0);
+                  }
+            }
+      CorrectionSetting flat, lens;
+      flat.flatField = true;
+      lens.flatField = true;
+      lens.k1        = -0.08;
+      lens.k2        = 0.01;
+      struct Mode {
+            const char* name;
+            const CorrectionSetting* setting;
+            };
+      static const Mode modes[] = {
+            { "none      ", 0 },
+            { "flat      ", &flat },
+            { "flat+lens ", &lens },
+            };
+
+      bool ok = true;
+      QImage image(w, h, QImage::Format_RGB32);
+      QImage corrected(w, h, QImage::Format_RGB32);
+      for (const Mode& m : modes) {
+            auto start = std::chrono::steady_clock::now();
+            std::unique_ptr<LensCorrection> lc;
+            if (m.setting)
+                  lc.reset(new LensCorrection(w, h, c, *m.setting));
+            double table = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() * 1000.0;
+            const LensCorrection* l = lc.get();
+            double ms[3];
+            ms[0] = perImage(seconds / 3, 1, [&](int) {
+                  yuyvToImage(yuyv.data(), w * 2, &image, l);
+                  });
+            ms[1] = perImage(seconds / 3, 1, [&](int) {
+                  nv12ToImage(nv12.data(), w, nv12.data() + w * h, w, &image, l);
+                  });
+            ms[2] = l ? perImage(seconds / 3, 1, [&](int) {
+                  if (l->remap())
+                        l->apply(image, &corrected);
+                  else
+                        l->apply(image, &image);
+                  }) : 0.0;
+            static const char* names[] = { "yuyv ", "nv12 ", "rgb32" };
+            for (int i = 0; i < (l ? 3 : 2); ++i) {
+                  bool pass = ms[i] <= 1000.0 / 30.0;
+                  printf("correction %s 1920x1080 %s %6.2f ms/frame %s\n", names[i], m.name, ms[i],
+                     pass ? "ok" : "TOO SLOW");
+                  ok = ok && pass;
+                  }
+            if (l)
+                  printf("correction tables %s %.1f ms, %.1f MB\n", m.name, table, l->memory() / 1048576.0);
+            }
+      return ok;
+      }
+
+//---------------------------------------------------------
+//   benchValidate
+//    mjpeg pre-validation against the decode it saves;
+//    truncated and corrupted frames have to be rejected,
+//    padded ones accepted
+//---------------------------------------------------------
+
+static bool benchValidate(double seconds)
+      {
+      const int w = 1920;
+      const int h = 1080;
+      QByteArray jpeg = testJpeg(w, h, 1);
+      if (jpeg.isEmpty())
+            return false;
+      const uchar* data = (const uchar*)jpeg.constData();
+      int size = jpeg.size();
+      JpegInfo info;
+      double validate = perImage(seconds / 2, 1, [&](int) { jpegValidate(data, size, &info); });
+      MjpegDecoder* decoder = MjpegDecoder::create();
+      QImage image;
+      double decode = perImage(seconds / 2, 1, [&](int) { decoder->decode(data, size, &image); });
+      delete decoder;
+      bool fast = validate < decode * 0.05;
+      printf("validate 1920x1080 %s: %.3f ms, decode %.2f ms, %.1f%% %s\n", jpegSubsampling(info),
+         validate, decode, validate * 100.0 / decode, fast ? "ok" : "TOO SLOW");
+
+      QByteArray padded = jpeg + QByteArray(4096, 0);
+      QByteArray soi    = jpeg;
+      soi[size / 2]     = char(0xff);
+      soi[size / 2 + 1] = char(0xd8);
+      struct Case {
+            const char* name;
+            QByteArray data;
+            bool valid;
+            };
+      const Case cases[] = {
+            { "complete ", jpeg, true },
+            { "padded   ", padded, true },
+            { "truncated", jpeg.left(size * 9 / 10), false },
+            { "no EOI   ", jpeg.left(size - 2), false },
+            { "header   ", jpeg.left(600), false },
+            { "SOI      ", soi, false },
+            };
+      bool ok = fast;
+      for (const Case& c : cases) {
+            JpegError e = jpegValidate((const uchar*)c.data.constData(), c.data.size(), &info);
+            bool pass = (e == JpegError::None) == c.valid && (!c.valid || info.end == size);
+            printf("validate %s %-10s %s\n", c.name, jpegErrorName(e), pass ? "ok" : "FAILED");
+            ok = ok && pass;
+            }
+      return ok;
+      }
+
+//---------------------------------------------------------
+//   HttpClient
+//    loopback viewer of benchHttp(); counts the part
+//    boundaries of the multipart stream
+//---------------------------------------------------------
+
+struct HttpClient {
+      int fd            { -1 };
+      quint64 bytes     { 0 };
+      unsigned frames   { 0 };
+      QByteArray tail;              // end of the last read, boundary may be split
+      };
+
+static int connectLoopback(int port, bool smallBuffer)
+      {
+      int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+      if (fd < 0)
+            return -1;
+      if (smallBuffer) {
+            int size = 4096;
+            setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+            }
+      struct sockaddr_in addr;
+      memset(&addr, 0, sizeof(addr));
+      addr.sin_family      = AF_INET;
+      addr.sin_port        = htons(port);
+      addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+      static const char request[] = "GET / HTTP/1.0\r\n\r\n";
+      if (::connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0
+         || ::send(fd, request, sizeof(request) - 1, MSG_NOSIGNAL) < 0) {
+            ::close(fd);
+            return -1;
+            }
+      return fd;
+      }
+
+//---------------------------------------------------------
+//   benchHttp
+//    hundreds of loopback viewers and one which never
+//    reads; frames are posted at 30 fps from this thread
+//    like the capture thread does it. post() must never
+//    block, the stalled viewer must only drop frames
+//---------------------------------------------------------
+
+static bool benchHttp(double seconds)
+      {
+      const int clients = 300;
+      const double fps  = 30.0;
+
+      // the stalled client first fills its socket buffers
+      // (up to 4 MB) before frames are dropped for it
+
+      seconds = std::max(seconds, 5.0);
+      QByteArray jpeg   = testJpeg(320, 240, 1);
+      if (jpeg.isEmpty())
+            return false;
+
+      StreamServer server;
+      int port = 0;
+      for (int p = 18080; p < 18100 && !port; ++p) {
+            if (server.start(p))
+                  port = p;
+            }
+      if (!port)
+            return false;
+      std::vector<HttpClient> hc(clients);
+      for (HttpClient& c : hc) {
+            c.fd = connectLoopback(port, false);
+            if (c.fd < 0) {
+                  fprintf(stderr, "cam-bench: cannot connect: %s\n", strerror(errno));
+                  return false;
+                  }
+            }
+      int stalled = connectLoopback(port, true);
+      for (int i = 0; i < 100 && server.clients() < clients + 1; ++i)
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      printf("http: %d clients connected on port %d, %d byte frames at %.0f fps\n",
+         server.clients(), port, jpeg.size(), fps);
+
+      std::atomic<bool> reading { true };
+      std::thread reader([&] {
+            static const char boundary[] = "--camframe";
+            const int bl = sizeof(boundary) - 1;
+            std::vector<struct pollfd> fds(clients);
+            std::vector<char> buffer(65536);
+            while (reading) {
+                  for (int i = 0; i < clients; ++i)
+                        fds[i] = { hc[i].fd, POLLIN, 0 };
+                  if (poll(fds.data(), clients, 100) <= 0)
+                        continue;
+                  for (int i = 0; i < clients; ++i) {
+                        if (!(fds[i].revents & POLLIN))
+                              continue;
+                        ssize_t n = recv(hc[i].fd, buffer.data(), buffer.size(), MSG_DONTWAIT);
+                        if (n <= 0)
+                              continue;
+                        HttpClient& c = hc[i];
+                        c.bytes += n;
+                        QByteArray b = c.tail + QByteArray(buffer.data(), n);
+                        for (int k = 0; k + bl <= b.size(); ++k) {
+                              if (b[k] == '-' && memcmp(b.constData() + k, boundary, bl) == 0)
+                                    ++c.frames;
+                              }
+                        int keep = std::min(bl - 1, int(b.size()));
+                        c.tail = b.mid(b.size() - keep);
+                        }
+                  }
+            });
+
+      // post() must not wait for the server: no voluntary
+      // context switch and little cpu time in the calling
+      // thread. Wall time also counts the server thread
+      // preempting it on a loaded machine
+
+      double maxPost = 0.0;
+      double sumPost = 0.0;
+      double maxCpu  = 0.0;
+      long blocked   = 0;
+      int posted     = 0;
+      auto start     = std::chrono::steady_clock::now();
+      auto next      = start;
+      while (std::chrono::steady_clock::now() - start < std::chrono::duration<double>(seconds)) {
+            std::this_thread::sleep_until(next);
+            next += std::chrono::microseconds(int(1e6 / fps));
+            struct rusage ru0, ru1;
+            struct timespec c0, c1;
+            getrusage(RUSAGE_THREAD, &ru0);
+            clock_gettime(CLOCK_THREAD_CPUTIME_ID, &c0);
+            auto t0 = std::chrono::steady_clock::now();
+            server.post(jpeg);
+            double ms = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count() * 1000.0;
+            clock_gettime(CLOCK_THREAD_CPUTIME_ID, &c1);
+            getrusage(RUSAGE_THREAD, &ru1);
+            double cpu = (c1.tv_sec - c0.tv_sec) * 1000.0 + (c1.tv_nsec - c0.tv_nsec) / 1e6;
+            maxPost    = std::max(maxPost, ms);
+            maxCpu     = std::max(maxCpu, cpu);
+            sumPost   += ms;
+            blocked   += ru1.ru_nvcsw - ru0.ru_nvcsw;
+            ++posted;
+            }
+      double dt = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      std::this_thread::sleep_for(std::chrono::milliseconds(1200));     // server stats every 500 ms
+      reading = false;
+      reader.join();
+
+      // server side: the stalled client is the one with the
+      // fewest frames sent
+
+      std::vector<StreamClientStats> stats = server.stats();
+      const StreamClientStats* slow = 0;
+      for (const StreamClientStats& s : stats) {
+            if (!slow || s.frames < slow->frames)
+                  slow = &s;
+            }
+      unsigned minFrames = ~0u, maxFrames = 0;
+      quint64 bytes = 0;
+      unsigned frames = 0;
+      for (const HttpClient& c : hc) {
+            minFrames = std::min(minFrames, c.frames);
+            maxFrames = std::max(maxFrames, c.frames);
+            frames   += c.frames;
+            bytes    += c.bytes;
+            }
+      unsigned dropped = 0;
+      for (const StreamClientStats& s : stats) {
+            if (&s != slow)
+                  dropped += s.dropped;
+            }
+      printf("http: %d frames posted, post mean %.3f ms max %.3f ms, cpu max %.3f ms, %ld blocked\n",
+         posted, sumPost / posted, maxPost, maxCpu, blocked);
+      printf("http: per client %.1f fps mean, %.1f min, %.1f max, %.1f kB/s, %.1f dropped\n",
+         frames / dt / clients, minFrames / dt, maxFrames / dt, bytes / dt / clients / 1024.0,
+         double(dropped) / clients);
+      if (slow)
+            printf("http: stalled client %u frames sent, %u dropped\n", slow->frames, slow->dropped);
+      bool nonBlocking = blocked == 0 && maxCpu < 1.0;
+      bool served      = minFrames > 0 && int(stats.size()) == clients + 1;
+      bool dropping    = slow && slow->dropped > 0 && slow->frames < unsigned(posted);
+      printf("http: post %s, all clients served %s, stalled client drops %s\n",
+         nonBlocking ? "ok" : "BLOCKED", served ? "ok" : "FAILED", dropping ? "ok" : "FAILED");
+
+      for (const HttpClient& c : hc)
+            ::close(c.fd);
+      ::close(stalled);
+      server.stop();
+      return nonBlocking && served && dropping;
+      }
+
+//---------------------------------------------------------
+//   monotonic
+//    ns
+//---------------------------------------------------------
+
+static qint64 monotonic()
+      {
+      struct timespec ts;
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      return qint64(ts.tv_sec) * 1000000000ll + ts.tv_nsec;
+      }
+
+//---------------------------------------------------------
+//   benchJitter
+//    a thread in place of the capture thread wakes up at
+//    30 fps and copies a 1080p YUYV frame, while twice as
+//    many threads as cores copy memory. The latency
+//    histograms of --stats are recorded without and with
+//    the real time settings; the interval is taken between
+//    wakeups, there is no driver timestamp. With all
+//    settings the p99 wakeup latency has to stay below 1 ms
+//---------------------------------------------------------
+
+static bool benchJitter(double seconds)
+      {
+      const double fps    = 30.0;
+      const qint64 period = qint64(1e9 / fps);
+      seconds = std::max(seconds, 5.0);
+
+      struct Config {
+            const char* name;
+            bool fifo;
+            bool affinity;
+            bool lock;
+            };
+      const Config configs[] = {
+            { "default   ", false, false, false },
+            { "affinity  ", false, true,  false },
+            { "mlock     ", false, false, true  },
+            { "SCHED_FIFO", true,  false, false },
+            { "all       ", true,  true,  true  },
+            };
+      int cores = std::max(1u, std::thread::hardware_concurrency());
+      std::vector<uchar> frame(1920 * 1080 * 2);
+      std::vector<uchar> copy(frame.size());
+      noise(&frame, 1);
+      bool ok = true;
+      for (const Config& c : configs) {
+            std::atomic<bool> stop { false };
+            std::vector<std::thread> load;
+            for (int i = 0; i < cores * 2; ++i) {
+                  load.push_back(std::thread([&stop] {
+                        std::vector<uchar> a(8 << 20, 1);
+                        std::vector<uchar> b(a.size());
+                        while (!stop)
+                              memcpy(b.data(), a.data(), a.size());
+                        }));
+                  }
+            Latency latency;
+            bool applied = true;
+            std::thread capture([&] {
+                  if (c.fifo)
+                        applied = setThreadScheduling(pthread_self(), SCHED_FIFO, 50) && applied;
+                  if (c.affinity)
+                        applied = setThreadAffinity(pthread_self(), std::vector<int> { cores - 1 }) && applied;
+                  if (c.lock) {
+                        applied = mlock(frame.data(), frame.size()) == 0 && applied;
+                        applied = lockProcessMemory() && applied;
+                        }
+                  qint64 next = monotonic();
+                  qint64 last = 0;
+                  for (int i = 0; i < int(seconds * fps); ++i) {
+                        next += period;
+                        struct timespec ts { time_t(next / 1000000000ll), long(next % 1000000000ll) };
+                        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, 0);
+                        qint64 dequeued = monotonic();
+                        latency.wakeup.add(dequeued - next);
+                        if (last)
+                              latency.interval.add(dequeued - last);
+                        last = dequeued;
+                        memcpy(copy.data(), frame.data(), frame.size());
+                        latency.process.add(monotonic() - dequeued);
+                        }
+                  });
+            capture.join();
+            stop = true;
+            for (std::thread& t : load)
+                  t.join();
+            if (c.lock) {
+                  munlockall();
+                  munlock(frame.data(), frame.size());
+                  }
+
+            const std::pair<const char*, const LatencyHistogram*> ll[] = {
+                  { "wakeup  ", &latency.wakeup },
+                  { "interval", &latency.interval },
+                  { "process ", &latency.process },
+                  };
+            for (const auto& p : ll) {
+                  printf("jitter %s %s: mean %6.2f p50 %6.2f p99 %6.2f max %6.2f ms\n", c.name, p.first,
+                     p.second->mean(), p.second->percentile(50.0), p.second->percentile(99.0), p.second->max());
+                  }
+            if (c.fifo && c.affinity && c.lock) {
+                  double p99 = latency.wakeup.percentile(99.0);
+                  bool pass  = !applied || p99 < 1.0;
+                  printf("jitter: all settings p99 wakeup %.2f ms %s\n", p99,
+                     !applied ? "not applied" : pass ? "ok" : "TOO SLOW");
+                  ok = ok && pass;
+                  }
+            }
+      return ok;
+      }
+
+//---------------------------------------------------------
+//   main
+//---------------------------------------------------------
+
+int main(int argc, char* argv[])
+      {
+      if (argc < 2) {
+            fprintf(stderr, "usage: cam-bench average|histogram|reader|decode|backends|mosaic|correction|validate|http|jitter [seconds]\n");
+            return 2;
+            }
+      QCoreApplication app(argc, argv);           // image format plugins
+      double seconds = argc > 2 ? atof(argv[2]) : 2.0;
+      bool ok;
+      if (strcmp(argv[1], "average") == 0)
+            ok = benchAverage(seconds);
+      else if (strcmp(argv[1], "histogram") == 0)
+            ok = benchHistogram(seconds);
+      else if (strcmp(argv[1], "reader") == 0)
+            ok = benchReader(seconds);
+      else if (strcmp(argv[1], "decode") == 0)
+            ok = benchDecode(seconds);
+      else if (strcmp(argv[1], "backends") == 0)
+            ok = benchBackends(seconds);
+      else if (strcmp(argv[1], "mosaic") == 0)
+            ok = benchMosaic(seconds);
+      else if (strcmp(argv[1], "correction") == 0)
+            ok = benchCorrection(seconds);
+      else if (strcmp(argv[1], "validate") == 0)
+            ok = benchValidate(seconds);
+      else if (strcmp(argv[1], "http") == 0)
+            ok = benchHttp(seconds);
+      else if (strcmp(argv[1], "jitter") == 0)
+            ok = benchJitter(seconds);
+      else {
+            fprintf(stderr, "cam-bench: unknown benchmark <%s>\n", argv[1]);
+            return 2;
+            }
+      return ok ? 0 : 1;
+      }
+
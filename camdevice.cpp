@@ -0,0 +1,281 @@
+//=============================================================================
+//  Cam
+//  Webcam client
+//
+//  Copyright (C) 2016 Werner Schweer
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License version 2
+//  as published by the Free Software Foundation and appearing in
+//  the file LICENCE.GPL
+//=============================================================================
+
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <linux/videodev2.h>
+
+#include <algorithm>
+
+#include <QDir>
+#include <QFile>
+
+#include "camdevice.h"
+
+//---------------------------------------------------------
+//   formatCost
+//    relative cost of the decode pipeline for a camera
+//    format; raw formats are only converted
+//---------------------------------------------------------
+
+static int formatCost(unsigned fourcc)
+      {
+      switch (fourcc) {
+            case V4L2_PIX_FMT_NV12:  return 1;
+            case V4L2_PIX_FMT_YUYV:  return 2;
+            case V4L2_PIX_FMT_MJPEG: return 10;
+            }
+      return 100;
+      }
+
+//---------------------------------------------------------
+//   sizes
+//---------------------------------------------------------
+
+std::vector<QSize> CamDevice::sizes() const
+      {
+      std::vector<QSize> sl;
+      for (const CamDeviceFormat& f : formats) {
+            if (std::find(sl.begin(), sl.end(), f.size) == sl.end())
+                  sl.push_back(f.size);
+            }
+      return sl;
+      }
+
+//---------------------------------------------------------
+//   frameRates
+//---------------------------------------------------------
+
+std::vector<int> CamDevice::frameRates(const QSize& size) const
+      {
+      std::vector<int> rl;
+      for (const CamDeviceFormat& f : formats) {
+            if (f.size != size)
+                  continue;
+            for (int fps : f.frameRates) {
+                  if (std::find(rl.begin(), rl.end(), fps) == rl.end())
+                        rl.push_back(fps);
+                  }
+            }
+      return rl;
+      }
+
+//---------------------------------------------------------
+//   pixelFormats
+//    formats available for size and fps, cheapest first
+//---------------------------------------------------------
+
+std::vector<unsigned> CamDevice::pixelFormats(const QSize& size, int fps) const
+      {
+      std::vector<unsigned> pl;
+      for (const CamDeviceFormat& f : formats) {
+            if (f.size == size && std::find(f.frameRates.begin(), f.frameRates.end(), fps) != f.frameRates.end())
+                  pl.push_back(f.pixelFormat);
+            }
+      std::sort(pl.begin(), pl.end(), [](unsigned a, unsigned b) { return formatCost(a) < formatCost(b); });
+      return pl;
+      }
+
+//---------------------------------------------------------
+//   bestFormat
+//    return preferred format if available, else the
+//    cheapest format for size and fps
+//---------------------------------------------------------
+
+unsigned CamDevice::bestFormat(const QSize& size, int fps, unsigned preferred) const
+      {
+      std::vector<unsigned> pl = pixelFormats(size, fps);
+      if (pl.empty())
+            return V4L2_PIX_FMT_MJPEG;
+      if (preferred && std::find(pl.begin(), pl.end(), preferred) != pl.end())
+            return preferred;
+      return pl.front();
+      }
+
+//---------------------------------------------------------
+//   readDevices
+//    enumerate video4linux capture devices and the
+//    formats we can handle
+//---------------------------------------------------------
+
+void readDevices(std::vector<CamDevice>* devices)
+      {
+      devices->clear();
+
+      QDir d("/sys/class/video4linux/");
+      for (auto i : d.entryList(QDir::NoDotAndDotDot | QDir::AllEntries)) {
+            if (!i.startsWith("video"))
+                  continue;
+            QString name = i;
+            QDir dd(d.filePath(i));
+            QFile f(dd.filePath("name"));
+            if (f.open(QIODevice::ReadOnly)) {
+                  QByteArray ba = f.readAll();
+                  f.close();
+                  name = ba.simplified();
+                  }
+
+            CamDevice cd;
+            cd.shortName = i;
+            cd.name      = name;
+            cd.device    = "/dev/" + i;
+
+            char* videodevice = cd.device.toLocal8Bit().data();
+            int fd = ::open(videodevice, O_RDWR);
+            if (fd == -1) {
+                  fprintf(stderr, "cam: cannot open <%s>: %s\n", videodevice, strerror(errno));
+                  continue;
+                  }
+
+            struct v4l2_capability cap;
+            memset(&cap, 0, sizeof(cap));
+            int ret = ioctl(fd, VIDIOC_QUERYCAP, &cap);
+            if (ret == -1) {
+                  fprintf(stderr, "cam: <%s>: cannot read capabilities: %s\n",
+                     qPrintable(cd.device), strerror(errno));
+                  ::close(fd);
+                  continue;
+                  }
+#ifdef CAM_DEBUG
+            printf("===== Version %u.%u.%u Capabilities 0x%x\n",
+               cap.version >> 16 & 0xff, (cap.version >> 8) & 0xff, cap.version & 0xff,
+               cap.device_caps);
+#endif
+            if (!(cap.device_caps & V4L2_CAP_VIDEO_CAPTURE)) {     // check for capture device
+                  ::close(fd);
+                  continue;
+                  }
+
+            // enumerate the formats we can handle
+
+            std::vector<unsigned> pixelFormats;
+            struct v4l2_fmtdesc fmt;
+            memset(&fmt, 0, sizeof(fmt));
+            fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+
+            for (int idx = 0;; ++idx) {
+                  fmt.index = idx;
+                  int ret = ioctl(fd, VIDIOC_ENUM_FMT, &fmt);
+                  if (ret == -1) {
+                        if (errno != EINVAL) {
+                              fprintf(stderr, "cam: <%s>: cannot read format enum, idx %d: %s\n",
+                                 qPrintable(cd.device), idx, strerror(errno));
+                              }
+                        break;
+                        }
+#ifdef CAM_DEBUG
+                  printf("===== format %d <%s>\n", idx, fmt.description);
+#endif
+                  switch (fmt.pixelformat) {
+                        case V4L2_PIX_FMT_MJPEG:
+                        case V4L2_PIX_FMT_YUYV:
+                        case V4L2_PIX_FMT_NV12:
+                              pixelFormats.push_back(fmt.pixelformat);
+                              break;
+                        }
+                  }
+
+            bool ok = true;
+            for (unsigned pixelFormat : pixelFormats) {
+                  struct v4l2_frmsizeenum s;
+                  memset(&s, 0, sizeof(s));
+                  s.pixel_format = pixelFormat;
+
+                  for (int idx = 0;;++idx) {
+                        s.index = idx;
+                        int ret = ioctl(fd, VIDIOC_ENUM_FRAMESIZES, &s);
+                        if (ret == -1) {
+                              if (errno != EINVAL) {
+                                    fprintf(stderr, "cam: <%s>: cannot read framesize enum, idx %d: %s\n",
+                                       qPrintable(cd.device), idx, strerror(errno));
+                                    ok = false;
+                                    }
+                              break;
+                              }
+                        if (s.type == V4L2_FRMSIZE_TYPE_DISCRETE) {
+                              CamDeviceFormat fmt;
+                              fmt.pixelFormat = pixelFormat;
+                              fmt.size        = QSize(s.discrete.width, s.discrete.height);
+
+                              struct v4l2_frmivalenum f;
+                              memset(&f, 0, sizeof(f));
+                              f.pixel_format = pixelFormat;
+                              f.width        = s.discrete.width;
+                              f.height       = s.discrete.height;
+
+                              for (int k = 0;; ++k) {
+                                    f.index = k;
+                                    int ret = ioctl(fd, VIDIOC_ENUM_FRAMEINTERVALS, &f);
+                                    if (ret == -1) {
+                                          if (errno != EINVAL) {
+                                                fprintf(stderr, "cam: <%s>: cannot read frame intervals: %s\n",
+                                                   qPrintable(cd.device), strerror(errno));
+                                                ok = false;
+                                                }
+                                          break;
+                                          }
+                                    if (f.type == V4L2_FRMIVAL_TYPE_DISCRETE)
+                                          fmt.frameRates.push_back(f.discrete.denominator);
+                                    else if (f.type == V4L2_FRMIVAL_TYPE_STEPWISE) {
+                                          ;
+                                          }
+                                    else if (f.type == V4L2_FRMIVAL_TYPE_CONTINUOUS) {
+                                          ;
+                                          }
+                                    }
+                              cd.formats.push_back(fmt);
+                              }
+                        else if (s.type == V4L2_FRMSIZE_TYPE_CONTINUOUS)
+                              break;
+                        else if (s.type == V4L2_FRMSIZE_TYPE_STEPWISE)
+                              break;
+                        }
+                  }
+            ::close(fd);
+            // search for button device
+            QDir ddd(dd.filePath("device/input"));
+            for (auto i : ddd.entryList(QDir::NoDotAndDotDot | QDir::AllEntries)) {
+                  if (i.startsWith("input")) {
+                        QDir dddd(ddd.filePath(i));
+                        for (auto i : dddd.entryList(QDir::NoDotAndDotDot | QDir::AllEntries)) {
+                              if (i.startsWith("event")) {
+                                    cd.buttonDevice = "/dev/input/" + i;
+                                    break;
+                                    }
+                              }
+                        }
+                  break;
+                  }
+            if (ok)
+                  devices->push_back(cd);
+            }
+      }
+
+//---------------------------------------------------------
+//   findDevice
+//    find device by short name ("video0"), device path
+//    or name
+//---------------------------------------------------------
+
+CamDevice* findDevice(std::vector<CamDevice>* devices, const QString& name)
+      {
+      for (CamDevice& d : *devices) {
+            if (d.shortName == name || d.device == name || d.name == name)
+                  return &d;
+            }
+      return 0;
+      }
+
@@ -0,0 +1,63 @@
+//=============================================================================
+//  Cam
+//  Webcam client
+//
+//  Copyright (C) 2016 Werner Schweer
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License version 2
+//  as published by the Free Software Foundation and appearing in
+//  the file LICENCE.GPL
+//=============================================================================
+
+#ifndef __CAMDEVICE_H__
+#define __CAMDEVICE_H__
+
+#include <vector>
+
+#include <QString>
+#include <QSize>
+
+//---------------------------------------------------------
+//   CamDeviceFormat
+//---------------------------------------------------------
+
+struct CamDeviceFormat {
+      unsigned pixelFormat;         // V4L2 fourcc
+      QSize size;
+      std::vector<int> frameRates;
+      };
+
+//---------------------------------------------------------
+//   CamDevice
+//---------------------------------------------------------
+
+struct CamDevice {
+      QString shortName;
+      QString name;
+      QString device;
+      QString buttonDevice;
+      std::vector<CamDeviceFormat> formats;
+
+      std::vector<QSize> sizes() const;
+      std::vector<int> frameRates(const QSize&) const;
+      std::vector<unsigned> pixelFormats(const QSize&, int fps) const;
+      unsigned bestFormat(const QSize&, int fps, unsigned preferred = 0) const;
+      };
+
+//---------------------------------------------------------
+//   CamDeviceSetting
+//---------------------------------------------------------
+
+struct CamDeviceSetting {
+      CamDevice* device;
+      QSize   size;
+      int     fps;
+      unsigned pixelFormat { 0 };   // 0: choose cheapest pipeline
+      };
+
+extern void readDevices(std::vector<CamDevice>*);
+extern CamDevice* findDevice(std::vector<CamDevice>*, const QString& name);
+
+#endif
+
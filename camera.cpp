@@ -13,88 +13,152 @@
 //  the file LICENCE.GPL
 //=============================================================================
 
-#include <stdlib.h>
-#include <string.h>
-#include <stdio.h>
-#include <fcntl.h>
-#include <unistd.h>
-#include <errno.h>
-#include <sys/ioctl.h>
-#include <sys/mman.h>
-#include <linux/videodev2.h>
-#include <linux/input.h>
-#include <linux/input-event-codes.h>
-#include <poll.h>
-
-#include <QPushButton>
 #include <QPainter>
 #include <QPoint>
 #include <QWheelEvent>
-#include <QImageReader>
-#include <QBuffer>
-#include <QDir>
-#include <QFile>
-#include <QSettings>
+#include <QTimer>
+#include <QWindow>
+#include <QScreen>
+#include <QGuiApplication>
 
-#include "v4l2.h"
 #include "camera.h"
+#include "focus.h"
+#include "trace.h"
 
 //---------------------------------------------------------
-//   ~Camera
+//   Camera
 //---------------------------------------------------------
 
 Camera::Camera(QWidget* parent)
    : QWidget(parent)
       {
-      QSettings settings;
-      _picturePath   = settings.value("picPath",   _picturePath).toString();
-      _picturePrefix = settings.value("picPrefix", _picturePrefix).toString();
-
-      connect(this, SIGNAL(cameraButtonPressed()), this, SLOT(takeSnapshot()), Qt::QueuedConnection);
+      _capture = new Capture(this);
+      presentTimer = new QTimer(this);
+      presentTimer->setTimerType(Qt::PreciseTimer);
+      connect(presentTimer, SIGNAL(timeout()), SLOT(present()));
       }
 
 Camera::~Camera()
       {
-      if (isstreaming)
-            stop();
+      _capture->stop();
+      setFocusAssist(false);
+      }
+
+//---------------------------------------------------------
+//   displaySize
+//    image size in device pixels at the current zoom
+//---------------------------------------------------------
+
+QSize Camera::displaySize() const
+      {
+      qreal f = mag * devicePixelRatioF();
+      return QSize(qMax(1, qRound(image.width() * f)), qMax(1, qRound(image.height() * f)));
       }
 
 //---------------------------------------------------------
-//   takeSnapshot
+//   rescale
+//    scale the current image for display off the gui
+//    thread
 //---------------------------------------------------------
 
-void Camera::takeSnapshot()
+void Camera::rescale()
       {
-      snapshot = true;
+      if (image.isNull())
+            return;
+      scaledSize = displaySize();
+      scaler.post(image, scaledSize, devicePixelRatioF());
       }
 
 //---------------------------------------------------------
 //   paintEvent
+//    blits the prescaled image; while a new zoom factor
+//    is being scaled the previous image is stretched
 //---------------------------------------------------------
 
 void Camera::paintEvent(QPaintEvent*)
       {
+      TraceScope ts("paint");
       QPainter p(this);
-
-      p.save();
-      p.scale(mag, mag);
-      int w = width();
-      int h = height();
-
-      if (image.width()) {
-            qreal x = 0.5 * (w / mag - image.width());
-            qreal y = 0.5 * (h / mag - image.height());
-            p.drawImage(QPointF(x, y), image);
+      scaler.take(&scaled, &focusOverlay);
+
+      if (!image.isNull() && displaySize() != scaledSize)
+            rescale();              // moved to a screen with other pixel ratio
+
+      if (!scaled.isNull()) {
+            qreal dpr = devicePixelRatioF();
+            qreal iw  = image.width() * mag;
+            qreal ih  = image.height() * mag;
+            qreal x   = qRound(0.5 * (width() - iw) * dpr) / dpr;
+            qreal y   = qRound(0.5 * (height() - ih) * dpr) / dpr;
+            QRectF r(x, y, iw, ih);
+            if (scaled.size() == scaledSize)
+                  p.drawImage(QPointF(x, y), scaled);
+            else
+                  p.drawImage(r, scaled);
+            if (focus && !focusOverlay.isNull()) {
+                  if (focusOverlay.size() == scaledSize)
+                        p.drawImage(QPointF(x, y), focusOverlay);
+                  else
+                        p.drawImage(r, focusOverlay);
+                  }
             if (_crosshair) {
-                  qreal x1 = x + image.width() / 2.0;
-                  qreal y1 = y + image.height() / 2.0;
-                  p.drawLine(x1, y, x1, y + image.height());
-                  p.drawLine(x, y1, x + image.width(), y1);
+                  QPointF c = r.center();
+                  p.drawLine(QPointF(c.x(), r.top()), QPointF(c.x(), r.bottom()));
+                  p.drawLine(QPointF(r.left(), c.y()), QPointF(r.right(), c.y()));
                   }
             }
       else
             p.fillRect(0, 0, width(), height(), QColor(255, 0, 0, 255));
-      p.restore();
+      if (focus && !focusOverlay.isNull()) {
+            p.setPen(Qt::white);
+            p.drawText(QRect(8, 8, 200, 20), Qt::AlignLeft | Qt::AlignTop, QString("focus %1").arg(focusScore, 0, 'f', 1));
+            }
+      if (_previewRate == 0)
+            _capture->requestFrame();
+      }
+
+//---------------------------------------------------------
+//   present
+//    called with display refresh rate or preview rate;
+//    new frames and focus overlays go to the scaler,
+//    which repaints when they are scaled
+//---------------------------------------------------------
+
+void Camera::present()
+      {
+      TraceScope ts("present");
+      if (_previewRate > 0)
+            _capture->requestFrame();
+      QImage overlay;
+      if (focus && focus->takeResult(&overlay, &focusScore))
+            scaler.postOverlay(overlay);
+      if (_capture->takeImage(&image)) {
+            ++_presentedFrames;
+            rescale();
+            }
+      }
+
+//---------------------------------------------------------
+//   setFocusAssist
+//    highlight sharp edges and show a focus score
+//---------------------------------------------------------
+
+void Camera::setFocusAssist(bool val)
+      {
+      if (val == (focus != 0))
+            return;
+      if (val) {
+            focus = new FocusAssist;
+            _capture->addConsumer(focus);
+            }
+      else {
+            _capture->removeConsumer(focus);
+            delete focus;
+            focus = 0;
+            focusOverlay = QImage();
+            scaler.postOverlay(QImage());
+            }
+      update();
       }
 
 //---------------------------------------------------------
@@ -130,117 +194,37 @@ void Camera::wheelEvent(QWheelEvent* e)
                   mag *= .9;
                   }
             }
+      rescale();
       update();
       }
 
 //---------------------------------------------------------
-//   init
+//   presentInterval
+//    timer interval in ms
 //---------------------------------------------------------
 
-int Camera::init(const CamDeviceSetting& s)
+int Camera::presentInterval() const
       {
-      cam = new V4l2();
-      if (!cam->open(s.device->device)) {
-            fprintf(stderr, "Camera: cannot open <%s>: %s\n", qPrintable(s.device->device), strerror(errno));
-            return -1;
-            }
-      setting = s;
-
-      if (!cam->canVideoCapture()) {
-            fprintf(stderr, "Camera <%s> does not support video capture.\n", qPrintable(s.device->device));
-            return -1;
-            }
-      if (!cam->canStreaming()) {
-            fprintf(stderr, "Camera <%s> does not support streaming i/o.\n", qPrintable(s.device->device));
-            return -1;
-            }
-
-      if (!cam->setMjpegFormat(setting.size.width(), setting.size.height())) {
-            fprintf(stderr, "Camera <%s> does not support format MJPEG: %s.\n", qPrintable(s.device->device), strerror(errno));
-            return -1;
-            }
-
-      if (!cam->setFramerate(setting.fps)) {
-            fprintf(stderr, "Camera <%s>: Unable to set frame rate: %s.\n", qPrintable(s.device->device), strerror(errno));
-            return -1;
-            }
-      if (!cam->initBuffers()) {
-            fprintf(stderr, "Unable to initialize buffers: %s\n", strerror(errno));
-            return -1;
-            }
-      return 0;
-      }
-
-//---------------------------------------------------------
-//   loop
-//---------------------------------------------------------
-
-void Camera::loop()
-      {
-      isstreaming = true;
-      int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-      int ret;
-      ret = ioctl(cam->getFd(), VIDIOC_STREAMON, &type);
-      if (ret < 0) {
-            printf("Unable to start capture: %d.\n", errno);
-            return;
-            }
-      while (isstreaming) {
-            image = cam->grab();
-            if (!image.isNull()) {
-                  if (snapshot) {
-                        for (int i = 0; i < 50000; ++i) {
-                              QString picName = QString("%1/%2%3.jpeg").arg(_picturePath).arg(_picturePrefix).arg(pictureNumber);
-                              if (!QFile::exists(picName)) {
-                                    fprintf(stderr, "saving picture <%s>\n", qPrintable(picName));
-                                    image.save(picName, "jpeg" -1);
-                                    emit click(picName, 1000);
-                                    break;
-                                    }
-                              pictureNumber++;
-                              }
-                        snapshot = false;
-                        }
-                  update();
-                  }
-            else
-                  sleep(1);
-            }
-
-      type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-      ret = ioctl(cam->getFd(), VIDIOC_STREAMOFF, &type);
-      if (ret < 0)
-            printf("Unable to stop capture: %d.\n", errno);
+      if (_previewRate > 0)
+            return 1000 / _previewRate;
+      QWindow* w = window()->windowHandle();
+      QScreen* s = w ? w->screen() : QGuiApplication::primaryScreen();
+      qreal rate = s && s->refreshRate() > 1.0 ? s->refreshRate() : 60.0;
+      return qRound(1000.0 / rate);
       }
 
 //---------------------------------------------------------
-//   watchButton
+//   setPreviewRate
+//    a low preview rate saves decoding, e.g. during a
+//    timelapse
 //---------------------------------------------------------
 
-void Camera::watchButton()
+void Camera::setPreviewRate(int fps)
       {
-      if (setting.device->buttonDevice.isEmpty())
-            return;
-
-      const char* s = setting.device->buttonDevice.toLocal8Bit().data();
-      int fd = ::open(s, O_RDWR);
-      if (fd == -1) {
-            fprintf(stderr, "cannot open button input <%s>: %s\n", s, strerror(errno));
-            return;
-            }
-      while (isstreaming) {
-            struct pollfd fds = { fd, POLLIN, 0 };
-            int r = poll(&fds, 1, 100);
-            if (r > 0) {
-                  struct input_event event;
-                  int n = read(fd, &event, sizeof(event));
-                  if (n > 0 && event.type == EV_KEY && event.code == KEY_CAMERA && event.value == 1) {
-                        // camera button was pressed
-                        emit cameraButtonPressed();
-                        }
-                  }
-            }
-      ::close(fd);
+      _previewRate = fps;
+      if (presentTimer->isActive())
+            presentTimer->start(presentInterval());
+      _capture->requestFrame();
       }
 
 //---------------------------------------------------------
@@ -249,9 +233,10 @@ void Camera::watchButton()
 
 int Camera::start()
       {
-      grabLoop   = std::thread(&Camera::loop, this);
-      buttonLoop = std::thread(&Camera::watchButton, this);
-      return 0;
+      presentTimer->start(presentInterval());
+
+      _capture->requestFrame();
+      return _capture->start();
       }
 
 //---------------------------------------------------------
@@ -260,10 +245,8 @@ int Camera::start()
 
 int Camera::stop()
       {
-      isstreaming = false;
-      grabLoop.join();
-      buttonLoop.join();
-      return 0;
+      presentTimer->stop();
+      return _capture->stop();
       }
 
 //---------------------------------------------------------
@@ -272,37 +255,7 @@ int Camera::stop()
 
 void Camera::change(const CamDeviceSetting& s)
       {
-      if (isstreaming)
-            stop();
-      if (!cam->freeBuffers()) {
-            fprintf(stderr, "Unable to unmap buffer: %s\n", strerror(errno));
-            return;
-            }
-      delete cam;
-      cam = 0;
-      init(s);
-      start();
-      }
-
-//---------------------------------------------------------
-//   setPicturePath
-//---------------------------------------------------------
-
-void Camera::setPicturePath(const QString& s)
-      {
-      _picturePath = s;
-      QSettings settings;
-      settings.setValue("picPath", _picturePath);
-      }
-
-//---------------------------------------------------------
-//   setPicturePrefix
-//---------------------------------------------------------
-
-void Camera::setPicturePrefix(const QString& s)
-      {
-      _picturePrefix = s;
-      QSettings settings;
-      settings.setValue("picPrefix", _picturePrefix);
+      _capture->change(s);
+      _capture->requestFrame();
       }
 
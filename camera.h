@@ -13,96 +13,71 @@
 #ifndef __CAMERA_H__
 #define __CAMERA_H__
 
-#include <thread>
-#include <vector>
-
 #include <QWidget>
-#include <QString>
-#include <QSize>
-
-class V4l2;
-
-//---------------------------------------------------------
-//   CamDeviceFormat
-//---------------------------------------------------------
-
-struct CamDeviceFormat {
-      QSize size;
-      std::vector<int> frameRates;
-      };
-
-//---------------------------------------------------------
-//   CamDevice
-//---------------------------------------------------------
+#include <QImage>
 
-struct CamDevice {
-      QString shortName;
-      QString name;
-      QString device;
-      QString buttonDevice;
-      std::vector<CamDeviceFormat> formats;
-      };
+#include "capture.h"
+#include "scaler.h"
 
-//---------------------------------------------------------
-//   CamDeviceSetting
-//---------------------------------------------------------
-
-struct CamDeviceSetting {
-      CamDevice* device;
-      QSize   size;
-      int     fps;
-      };
+class QTimer;
+class FocusAssist;
 
 //---------------------------------------------------------
 //   Camera
+//    displays the frames of a Capture
 //---------------------------------------------------------
 
 class Camera : public QWidget {
       Q_OBJECT
 
-      V4l2* cam        { 0 };
-      bool isstreaming { false };
+      Capture* _capture;
       QImage image;
-      qreal mag        { 1.0 };
-      bool snapshot    { false };
-
+      qreal mag         { 1.0 };
+      Scaler scaler     { this };   // repaints when a scaled image is ready
+      QImage scaled;                // image at display size, device pixels
+      QSize scaledSize;             // size last posted to scaler
       bool _crosshair   { true };
+      int _previewRate  { 0 };      // fps, 0: display refresh rate
+      unsigned _presentedFrames { 0 };
 
-      QString _picturePath   { ""    };
-      QString _picturePrefix { "pic" };
-      int pictureNumber     { 1     };
+      FocusAssist* focus { 0 };     // focus peaking, 0: off
+      QImage focusOverlay;          // at display size, from scaler
+      double focusScore  { 0.0 };
 
-      CamDeviceSetting setting;
-      std::thread grabLoop;
-      std::thread buttonLoop;
+      // frames are decoded only when the display can show
+      // them; the present timer runs with the display
+      // refresh rate
+
+      QTimer* presentTimer;
 
       virtual void resizeEvent(QResizeEvent*) override;
       virtual void wheelEvent(QWheelEvent*) override;
       virtual void paintEvent(QPaintEvent*) override;
+      int presentInterval() const;
+      QSize displaySize() const;
+      void rescale();
 
-      void loop();
-      void watchButton();
+   private slots:
+      void present();
 
    public slots:
-      void takeSnapshot();
-      void setPicturePath(const QString& s);
-      void setPicturePrefix(const QString& s);
-      void setCrosshair(bool val)          { _crosshair = val; }
-
-   signals:
-      void cameraButtonPressed();
-      void click(const QString&, int);
+      void setCrosshair(bool val)          { _crosshair = val; update(); }
+      void setPreviewRate(int fps);
+      void setFocusAssist(bool);
 
    public:
       Camera(QWidget* parent = 0);
       ~Camera();
       int start();
       int stop();
-      int init(const CamDeviceSetting&);
       void change(const CamDeviceSetting&);
-      const QString& picturePath() const   { return _picturePath; }
-      const QString& picturePrefix() const { return _picturePrefix; }
+      Capture* capture() const             { return _capture; }
       bool crosshair() const               { return _crosshair; }
+      int previewRate() const              { return _previewRate; }
+      bool focusAssist() const             { return focus != 0; }
+      unsigned presentedFrames() const     { return _presentedFrames; }
+      qint64 displayMemory() const         { return qint64(scaled.bytesPerLine()) * scaled.height()
+                                                 + qint64(focusOverlay.bytesPerLine()) * focusOverlay.height(); }
       };
 
 #endif
@@ -0,0 +1,88 @@
+/*=============================================================================
+//  Cam
+//  Webcam client
+//
+//  Copyright (C) 2016 Werner Schweer
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License version 2
+//  as published by the Free Software Foundation and appearing in
+//  the file LICENCE.GPL
+//=============================================================================*/
+
+/*---------------------------------------------------------
+//   camshm-read
+//    reference reader and throughput benchmark for the
+//    shared memory frame ring
+//
+//    camshm-read [name] [seconds]
+//---------------------------------------------------------*/
+
+#include <stdlib.h>
+
+#include "camshm.h"
+
+static uint64_t now()
+      {
+      struct timespec ts;
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+      }
+
+int main(int argc, char* argv[])
+      {
+      const char* name = argc > 1 ? argv[1] : "/cam";
+      double seconds   = argc > 2 ? atof(argv[2]) : 10.0;
+
+      struct cam_shm s;
+      if (cam_shm_attach(&s, name) < 0) {
+            fprintf(stderr, "camshm-read: cannot attach <%s>: %s\n", name, strerror(errno));
+            return 1;
+            }
+      uint64_t start   = now();
+      uint64_t end     = start + (uint64_t)(seconds * 1e9);
+      uint64_t frames  = 0;
+      uint64_t bytes   = 0;
+      uint64_t torn    = 0;
+      uint64_t latency = 0;
+      uint64_t maxLatency = 0;
+      uint32_t sum     = 0;
+
+      while (now() < end) {
+            const struct cam_shm_slot* slot = cam_shm_wait(&s, 1000);
+            if (!slot) {
+                  if (cam_shm_closed(&s)) {
+                        fprintf(stderr, "camshm-read: ring closed\n");
+                        break;
+                        }
+                  continue;
+                  }
+            uint64_t seq = s.last;
+            uint64_t t   = now();
+            uint64_t l   = t > slot->timestamp ? t - slot->timestamp : 0;
+
+            /* touch every cache line of the frame in place */
+            const unsigned char* p = (const unsigned char*)cam_shm_data(&s, slot);
+            uint32_t n = slot->size;
+            for (uint32_t i = 0; i < n; i += 64)
+                  sum += p[i];
+
+            if (!cam_shm_valid(slot, seq)) {
+                  ++torn;
+                  continue;
+                  }
+            ++frames;
+            bytes   += n;
+            latency += l;
+            if (l > maxLatency)
+                  maxLatency = l;
+            }
+      double dt = (now() - start) / 1e9;
+      printf("%s: %llu frames %.1f fps %.1f MB/s, dropped %llu, overwritten %llu, latency avg %.2f ms max %.2f ms (%u)\n",
+         name, (unsigned long long)frames, frames / dt, bytes / dt / 1e6,
+         (unsigned long long)s.dropped, (unsigned long long)torn,
+         frames ? latency / frames / 1e6 : 0.0, maxLatency / 1e6, sum & 0xff);
+      cam_shm_detach(&s);
+      return 0;
+      }
+
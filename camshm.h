@@ -0,0 +1,216 @@
+/*=============================================================================
+//  Cam
+//  Webcam client
+//
+//  Copyright (C) 2016 Werner Schweer
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License version 2
+//  as published by the Free Software Foundation and appearing in
+//  the file LICENCE.GPL
+//=============================================================================*/
+
+/*---------------------------------------------------------
+//   shared memory frame ring
+//
+//    cam publishes frames into POSIX shared memory objects:
+//       /<name>      decoded frames, V4L2_PIX_FMT_XBGR32
+//                    (bytes B,G,R,X = QImage::Format_RGB32),
+//                    or in the compact image formats
+//                    V4L2_PIX_FMT_RGB24 (bytes R,G,B),
+//                    V4L2_PIX_FMT_RGB565 or V4L2_PIX_FMT_GREY
+//       /<name>-raw  frames as captured: MJPG (with huffman
+//                    tables), YUYV or NV12
+//
+//    layout: struct cam_shm_header, then header->slot_count
+//    frames of header->slot_size bytes at data_offset.
+//    Readers map the object and use the frame data in
+//    place. Every slot carries a sequence number
+//    which is 0 while cam writes the slot; a reader checks
+//    with cam_shm_valid() after use that the slot was not
+//    overwritten meanwhile. A reader has slot_count-1 frame
+//    times to process a frame.
+//
+//    this file is the reference reader; it is plain C and
+//    has no dependency on cam or Qt
+//---------------------------------------------------------*/
+
+#ifndef __CAMSHM_H__
+#define __CAMSHM_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#define CAM_SHM_MAGIC     0x4d484d43u       /* "CMHM" */
+#define CAM_SHM_VERSION   1
+#define CAM_SHM_MAX_SLOTS 16
+
+struct cam_shm_slot {
+      uint64_t sequence;      /* frame number, 0: being written */
+      uint64_t timestamp;     /* capture time, CLOCK_MONOTONIC ns */
+      uint32_t format;        /* V4L2 fourcc */
+      uint32_t width;
+      uint32_t height;
+      uint32_t stride;        /* bytes per line, 0 for MJPG */
+      uint32_t size;          /* bytes used */
+      uint32_t pad;
+      };
+
+struct cam_shm_header {
+      uint32_t magic;
+      uint32_t version;
+      uint32_t slot_count;
+      uint32_t slot_size;
+      uint64_t data_offset;
+      uint64_t sequence;      /* last published frame */
+      uint32_t futex;         /* low 32 bit of sequence, futex word */
+      uint32_t waiters;       /* readers blocked in cam_shm_wait() */
+      uint32_t readers;       /* attached readers */
+      uint32_t closed;        /* writer gone or format changed */
+      struct cam_shm_slot slot[CAM_SHM_MAX_SLOTS];
+      };
+
+/*---------------------------------------------------------
+//   cam_shm
+//    reader handle
+//---------------------------------------------------------*/
+
+struct cam_shm {
+      int fd;
+      size_t size;
+      struct cam_shm_header* header;
+      uint64_t last;          /* last frame returned */
+      uint64_t dropped;       /* frames missed since attach */
+      };
+
+/*---------------------------------------------------------
+//   cam_shm_attach
+//    return 0 on success, -1 on error (errno set)
+//---------------------------------------------------------*/
+
+static inline int cam_shm_attach(struct cam_shm* s, const char* name)
+      {
+      struct stat st;
+      memset(s, 0, sizeof(*s));
+      s->fd = shm_open(name, O_RDWR, 0);
+      if (s->fd < 0)
+            return -1;
+      if (fstat(s->fd, &st) < 0 || (size_t)st.st_size < sizeof(struct cam_shm_header)) {
+            close(s->fd);
+            errno = EINVAL;
+            return -1;
+            }
+      s->size   = st.st_size;
+      s->header = (struct cam_shm_header*)mmap(0, s->size, PROT_READ | PROT_WRITE, MAP_SHARED, s->fd, 0);
+      if (s->header == MAP_FAILED) {
+            close(s->fd);
+            return -1;
+            }
+      if (s->header->magic != CAM_SHM_MAGIC || s->header->version != CAM_SHM_VERSION) {
+            munmap(s->header, s->size);
+            close(s->fd);
+            errno = EPROTO;
+            return -1;
+            }
+      s->last = __atomic_load_n(&s->header->sequence, __ATOMIC_ACQUIRE);
+      __atomic_add_fetch(&s->header->readers, 1, __ATOMIC_RELAXED);
+      return 0;
+      }
+
+/*---------------------------------------------------------
+//   cam_shm_detach
+//---------------------------------------------------------*/
+
+static inline void cam_shm_detach(struct cam_shm* s)
+      {
+      if (!s->header)
+            return;
+      __atomic_sub_fetch(&s->header->readers, 1, __ATOMIC_RELAXED);
+      munmap(s->header, s->size);
+      close(s->fd);
+      s->header = 0;
+      }
+
+/*---------------------------------------------------------
+//   cam_shm_closed
+//    the writer has gone or changed the format; detach
+//    and attach again
+//---------------------------------------------------------*/
+
+static inline int cam_shm_closed(const struct cam_shm* s)
+      {
+      return __atomic_load_n(&s->header->closed, __ATOMIC_ACQUIRE) != 0;
+      }
+
+/*---------------------------------------------------------
+//   cam_shm_wait
+//    wait for a frame newer than the last one returned;
+//    return the slot of the newest frame or NULL on
+//    timeout (timeout_ms < 0: wait forever) or if closed
+//---------------------------------------------------------*/
+
+static inline const struct cam_shm_slot* cam_shm_wait(struct cam_shm* s, int timeout_ms)
+      {
+      struct cam_shm_header* h = s->header;
+      struct timespec ts, *tp = 0;
+      if (timeout_ms >= 0) {
+            ts.tv_sec  = timeout_ms / 1000;
+            ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+            tp = &ts;
+            }
+      for (;;) {
+            uint64_t seq = __atomic_load_n(&h->sequence, __ATOMIC_ACQUIRE);
+            if (seq > s->last) {
+                  const struct cam_shm_slot* slot = &h->slot[seq % h->slot_count];
+                  if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != seq)
+                        continue;               /* already overwritten */
+                  if (s->last)
+                        s->dropped += seq - s->last - 1;
+                  s->last = seq;
+                  return slot;
+                  }
+            if (cam_shm_closed(s))
+                  return 0;
+            __atomic_add_fetch(&h->waiters, 1, __ATOMIC_SEQ_CST);
+            long rv = syscall(SYS_futex, &h->futex, FUTEX_WAIT, (uint32_t)seq, tp, 0, 0);
+            __atomic_sub_fetch(&h->waiters, 1, __ATOMIC_SEQ_CST);
+            if (rv < 0 && errno == ETIMEDOUT)
+                  return 0;
+            }
+      }
+
+/*---------------------------------------------------------
+//   cam_shm_data
+//---------------------------------------------------------*/
+
+static inline const void* cam_shm_data(const struct cam_shm* s, const struct cam_shm_slot* slot)
+      {
+      size_t idx = slot - s->header->slot;
+      return (const char*)s->header + s->header->data_offset + idx * s->header->slot_size;
+      }
+
+/*---------------------------------------------------------
+//   cam_shm_valid
+//    nonzero if the slot still holds frame sequence; call
+//    after using the frame data
+//---------------------------------------------------------*/
+
+static inline int cam_shm_valid(const struct cam_shm_slot* slot, uint64_t sequence)
+      {
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+      return __atomic_load_n(&slot->sequence, __ATOMIC_RELAXED) == sequence;
+      }
+
+#endif
+
@@ -21,7 +21,16 @@
 
 #include <QDir>
 #include <QSettings>
+#include <QLabel>
+#include <QTimer>
+#include <QShortcut>
 #include "camview.h"
+#include "histogramview.h"
+#include "mosaicview.h"
+#include "streamserver.h"
+#include "trace.h"
+
+static const int calibrationFrames = 32;    // averaged for a dark or flat frame
 
 //---------------------------------------------------------
 //   CamView
@@ -32,7 +41,7 @@ CamView::CamView(QWidget* parent)
       {
       setupUi(this);
 
-      readDevices();
+      readDevices(&devices);
       if (devices.empty()) {
             fprintf(stderr, "CamView: no cameras found\n");
             exit(-1);
@@ -51,6 +60,35 @@ CamView::CamView(QWidget* parent)
             setting.device = &devices[0];
       setting.size = settings.value("size", devices.front().formats.front().size).toSize();
       setting.fps  = settings.value("fps", 30).toInt();
+      setting.pixelFormat = settings.value("format", 0u).toUInt();
+
+      Capture* capture = cam->capture();
+      capture->setPicturePath(settings.value("picPath", capture->picturePath()).toString());
+      capture->setPicturePrefix(settings.value("picPrefix", capture->picturePrefix()).toString());
+      capture->setLowLatency(settings.value("lowLatency", capture->lowLatency()).toBool());
+      capture->setAutoExposure(settings.value("autoExposure", false).toBool());
+      CorrectionSetting correction;
+      correction.flatField = settings.value("flatField", false).toBool();
+      // CAM_DISTORTION=k1[,k2] corrects radial lens distortion
+      QStringList distortion = QString(qgetenv("CAM_DISTORTION")).split(',');
+      correction.k1 = distortion[0].toDouble();
+      if (distortion.size() > 1)
+            correction.k2 = distortion[1].toDouble();
+      capture->setCorrection(correction);
+      capture->setCalibrationPath(settings.value("calibrationPath").toString());
+      // CAM_DECODE_THREADS=<n> decodes each frame with n threads
+      QByteArray threads = qgetenv("CAM_DECODE_THREADS");
+      if (!threads.isEmpty())
+            capture->setDecodeThreads(threads.toInt());
+      // CAM_IMAGE_FORMAT=rgb32|rgb888|rgb16|gray
+      QByteArray imageFormat = qgetenv("CAM_IMAGE_FORMAT");
+      if (!imageFormat.isEmpty()) {
+            QImage::Format f = parseImageFormat(imageFormat);
+            if (f == QImage::Format_Invalid)
+                  fprintf(stderr, "cam: bad image format <%s>\n", imageFormat.constData());
+            else
+                  capture->setImageFormat(f);
+            }
 
       for (auto& i : devices) {
             devs->addItem(i.name, QVariant::fromValue<CamDevice*>(&i));
@@ -58,18 +96,71 @@ CamView::CamView(QWidget* parent)
                   devs->setCurrentIndex(devs->count()-1);
             }
       crosshair->setChecked(cam->crosshair());
+      lowLatency->setChecked(capture->lowLatency());
+      autoExposure->setChecked(capture->autoExposureEnabled());
+      flatField->setChecked(correction.flatField);
+      cam->setPreviewRate(settings.value("previewRate", 0).toInt());
+      previewRate->setValue(cam->previewRate());
+      averageMode->setCurrentIndex(settings.value("averageMode", 0).toInt());
+      average->setValue(settings.value("average", average->value()).toInt());
+      setAverage();
+      stats    = new QLabel;
+      pipeline = new QLabel;
+      statusBar()->addPermanentWidget(stats);
+      statusBar()->addPermanentWidget(pipeline);
+
+      histogramDock = new QDockWidget(tr("Histogram"), this);
+      histogramDock->setObjectName("histogramDock");
+      histogramDock->setWidget(new HistogramView(capture));
+      addDockWidget(Qt::RightDockWidgetArea, histogramDock);
+      toolBar->addAction(histogramDock->toggleViewAction());
+      histogramDock->hide();
+
+      mosaicDock = new QDockWidget(tr("Mosaic"), this);
+      mosaicDock->setObjectName("mosaicDock");
+      mosaicDock->setWidget(new MosaicView(capture));
+      addDockWidget(Qt::RightDockWidgetArea, mosaicDock);
+      mosaicDock->hide();
 
       connect(devs,          SIGNAL(activated(int)), SLOT(changeDevice(int)));
       connect(sizes,         SIGNAL(activated(int)), SLOT(changeSize(int)));
       connect(fps,           SIGNAL(activated(int)), SLOT(changeFps(int)));
-      connect(cam,           SIGNAL(click(const QString&, int)), statusBar(), SLOT(showMessage(const QString&,int)));
-      connect(picturePath,   SIGNAL(textEdited(const QString&)), cam, SLOT(setPicturePath(const QString&)));
-      connect(picturePrefix, SIGNAL(textEdited(const QString&)), cam, SLOT(setPicturePrefix(const QString&)));
-      connect(click,         SIGNAL(clicked()),                  cam, SLOT(takeSnapshot()));
+      connect(formats,       SIGNAL(activated(int)), SLOT(changeFormat(int)));
+      connect(capture,       SIGNAL(click(const QString&, int)), statusBar(), SLOT(showMessage(const QString&,int)));
+      connect(picturePath,   SIGNAL(textEdited(const QString&)), SLOT(setPicturePath(const QString&)));
+      connect(picturePrefix, SIGNAL(textEdited(const QString&)), SLOT(setPicturePrefix(const QString&)));
+      connect(click,         SIGNAL(clicked()),                  capture, SLOT(takeSnapshot()));
       connect(crosshair,     SIGNAL(toggled(bool)),              cam, SLOT(setCrosshair(bool)));
+      connect(focusAssist,   SIGNAL(toggled(bool)),              cam, SLOT(setFocusAssist(bool)));
+      connect(lowLatency,    SIGNAL(toggled(bool)),              SLOT(setLowLatency(bool)));
+      connect(autoExposure,  SIGNAL(toggled(bool)),              SLOT(setAutoExposure(bool)));
+      connect(previewRate,   SIGNAL(valueChanged(int)),          SLOT(setPreviewRate(int)));
+      connect(timelapse,     SIGNAL(valueChanged(int)),          SLOT(setTimelapse(int)));
+      connect(motion,        SIGNAL(toggled(bool)),              SLOT(setMotion(bool)));
+      connect(mosaic,        SIGNAL(toggled(bool)),              SLOT(setMosaic(bool)));
+      connect(flatField,     SIGNAL(toggled(bool)),              SLOT(setFlatField(bool)));
+      connect(darkFrame,     SIGNAL(clicked()),                  SLOT(calibrateDark()));
+      connect(flatFrame,     SIGNAL(clicked()),                  SLOT(calibrateFlat()));
+      connect(averageMode,   SIGNAL(activated(int)),             SLOT(setAverage()));
+      connect(average,       SIGNAL(valueChanged(int)),          SLOT(setAverage()));
+      QShortcut* traceShortcut = new QShortcut(QKeySequence("Ctrl+T"), this);
+      connect(traceShortcut, SIGNAL(activated()),                SLOT(writeTrace()));
+      QTimer* statsTimer = new QTimer(this);
+      connect(statsTimer,    SIGNAL(timeout()), SLOT(updateStats()));
+      statsTimer->start(1000);
       setCam(setting);
-      picturePath->setText(cam->picturePath());
-      picturePrefix->setText(cam->picturePrefix());
+
+      // CAM_HTTP_PORT=<port> serves the camera as mjpeg stream
+      int port = qgetenv("CAM_HTTP_PORT").toInt();
+      if (port > 0)
+            capture->startServer(port);
+      // CAM_SHM=<name> publishes frames to shared memory
+      QString shm = qgetenv("CAM_SHM");
+      if (!shm.isEmpty())
+            capture->startShm(shm);
+
+      picturePath->setText(capture->picturePath());
+      picturePrefix->setText(capture->picturePrefix());
 
       cam->start();
       }
@@ -81,7 +172,7 @@ CamView::CamView(QWidget* parent)
 void CamView::setCam(const CamDeviceSetting& s)
       {
       setting = s;
-      cam->init(s);
+      cam->capture()->init(s);
       updateSetting();
       }
 
@@ -104,162 +195,34 @@ void CamView::updateSetting()
       {
       sizes->clear();
       fps->clear();
-      for (auto& i : setting.device->formats) {
-            sizes->addItem(QString("%1 x %2").arg(i.size.width()).arg(i.size.height()), i.size);
-            if (i.size == setting.size) {
-                  for (auto& ii : i.frameRates) {
-                        fps->addItem(QString("%1").arg(ii), ii);
-                        if (ii == setting.fps)
-                              fps->setCurrentIndex(fps->count()-1);
-                        }
+      formats->clear();
+      for (const QSize& size : setting.device->sizes()) {
+            sizes->addItem(QString("%1 x %2").arg(size.width()).arg(size.height()), size);
+            if (size == setting.size)
                   sizes->setCurrentIndex(sizes->count()-1);
-                  }
             }
+      for (int rate : setting.device->frameRates(setting.size)) {
+            fps->addItem(QString("%1").arg(rate), rate);
+            if (rate == setting.fps)
+                  fps->setCurrentIndex(fps->count()-1);
+            }
+      formats->addItem(tr("auto"), 0u);
+      for (unsigned pf : setting.device->pixelFormats(setting.size, setting.fps)) {
+            formats->addItem(pixelFormatName(pf), pf);
+            if (pf == setting.pixelFormat)
+                  formats->setCurrentIndex(formats->count()-1);
+            }
+      unsigned pf = cam->capture()->pixelFormat();
+      if (pf == V4L2_PIX_FMT_MJPEG)
+            pipeline->setText(tr("%1 decode (%2)").arg(pixelFormatName(pf)).arg(cam->capture()->decoderName()));
+      else
+            pipeline->setText(tr("%1 convert").arg(pixelFormatName(pf)));
+
       QSettings settings;
       settings.setValue("device", setting.device->shortName);
       settings.setValue("size", setting.size);
       settings.setValue("fps", setting.fps);
-      }
-
-//---------------------------------------------------------
-//   readDevices
-//---------------------------------------------------------
-
-void CamView::readDevices()
-      {
-      devices.clear();
-
-      QDir d("/sys/class/video4linux/");
-      for (auto i : d.entryList(QDir::NoDotAndDotDot | QDir::AllEntries)) {
-            if (!i.startsWith("video"))
-                  continue;
-            QString name = i;
-            QDir dd(d.filePath(i));
-            QFile f(dd.filePath("name"));
-            if (f.open(QIODevice::ReadOnly)) {
-                  QByteArray ba = f.readAll();
-                  f.close();
-                  name = ba.simplified();
-                  }
-
-            CamDevice cd;
-            cd.shortName = i;
-            cd.name      = name;
-            cd.device    = "/dev/" + i;
-
-            char* videodevice = cd.device.toLocal8Bit().data();
-            int fd = open(videodevice, O_RDWR);
-            if (fd == -1) {
-                  fprintf(stderr, "CamView: cannot open <%s>: %s\n", videodevice, strerror(errno));
-                  return;
-                  }
-
-            struct v4l2_capability cap;
-            memset(&cap, 0, sizeof(cap));
-            int ret = ioctl(fd, VIDIOC_QUERYCAP, &cap);
-            if (ret == -1) {
-                  fprintf(stderr, "CamView: <%s>: cannot read capabilities: %s\n",
-                     qPrintable(cd.device), strerror(errno));
-                  continue;
-                  }
-#ifdef CAM_DEBUG
-            printf("===== Version %u.%u.%u Capabilities 0x%x\n",
-               cap.version >> 16 & 0xff, (cap.version >> 8) & 0xff, cap.version & 0xff,
-               cap.device_caps);
-#endif
-            if (!(cap.device_caps & V4L2_CAP_VIDEO_CAPTURE))       // check for capture device
-                  continue;
-
-#ifdef CAM_DEBUG
-            struct v4l2_fmtdesc fmt;
-            memset(&fmt, 0, sizeof(fmt));
-            fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-
-            for (int idx = 0;; ++idx) {
-                  fmt.index = idx;
-                  int ret = ioctl(fd, VIDIOC_ENUM_FMT, &fmt);
-                  if (ret == -1) {
-                        if (errno != EINVAL) {
-                              fprintf(stderr, "CamView: <%s>: cannot read format enum, idx %d: %s\n",
-                                 qPrintable(cd.device), idx, strerror(errno));
-                              }
-                        break;
-                        }
-                  printf("===== format %d <%s>\n", idx, fmt.description);
-                  }
-#endif
-
-            struct v4l2_frmsizeenum s;
-            memset(&s, 0, sizeof(s));
-            s.pixel_format = V4L2_PIX_FMT_MJPEG;
-
-            bool ok = true;
-            for (int idx = 0;;++idx) {
-                  s.index = idx;
-                  int ret = ioctl(fd, VIDIOC_ENUM_FRAMESIZES, &s);
-                  if (ret == -1) {
-                        if (errno != EINVAL) {
-                              fprintf(stderr, "CamView: <%s>: cannot read framesize enum, idx %d: %s\n",
-                                 qPrintable(cd.device), idx, strerror(errno));
-                              ok = false;
-                              }
-                        break;
-                        }
-                  if (s.type == V4L2_FRMSIZE_TYPE_DISCRETE) {
-                        CamDeviceFormat fmt;
-                        fmt.size = QSize(s.discrete.width, s.discrete.height);
-
-                        struct v4l2_frmivalenum f;
-                        memset(&f, 0, sizeof(f));
-                        f.pixel_format = V4L2_PIX_FMT_MJPEG;
-                        f.width        = s.discrete.width;
-                        f.height       = s.discrete.height;
-
-                        for (int k = 0;; ++k) {
-                              f.index = k;
-                              int ret = ioctl(fd, VIDIOC_ENUM_FRAMEINTERVALS, &f);
-                              if (ret == -1) {
-                                    if (errno != EINVAL) {
-                                          fprintf(stderr, "CamView: <%s>: cannot read frame intervals: %s\n",
-                                             qPrintable(cd.device), strerror(errno));
-                                          ok = false;
-                                          }
-                                    break;
-                                    }
-                              if (f.type == V4L2_FRMIVAL_TYPE_DISCRETE)
-                                    fmt.frameRates.push_back(f.discrete.denominator);
-                              else if (f.type == V4L2_FRMIVAL_TYPE_STEPWISE) {
-                                    ;
-                                    }
-                              else if (f.type == V4L2_FRMIVAL_TYPE_CONTINUOUS) {
-                                    ;
-                                    }
-                              }
-                        cd.formats.push_back(fmt);
-                        }
-                  else if (s.type == V4L2_FRMSIZE_TYPE_CONTINUOUS)
-                        break;
-                  else if (s.type == V4L2_FRMSIZE_TYPE_STEPWISE)
-                        break;
-                  }
-            ::close(fd);
-            // search for button device
-            QDir ddd(dd.filePath("device/input"));
-            for (auto i : ddd.entryList(QDir::NoDotAndDotDot | QDir::AllEntries)) {
-                  if (i.startsWith("input")) {
-                        QDir dddd(ddd.filePath(i));
-                        for (auto i : dddd.entryList(QDir::NoDotAndDotDot | QDir::AllEntries)) {
-                              if (i.startsWith("event")) {
-                                    cd.buttonDevice = "/dev/input/" + i;
-                                    break;
-                                    }
-                              }
-                        }
-                  break;
-                  }
-            if (ok)
-                  devices.push_back(cd);
-            }
+      settings.setValue("format", setting.pixelFormat);
       }
 
 //---------------------------------------------------------
@@ -301,3 +264,201 @@ void CamView::changeFps(int idx)
       changeCam(setting);
       }
 
+
+//---------------------------------------------------------
+//   changeFormat
+//---------------------------------------------------------
+
+void CamView::changeFormat(int idx)
+      {
+      unsigned f = formats->itemData(idx).toUInt();
+      if (f == setting.pixelFormat)
+            return;
+      setting.pixelFormat = f;
+      changeCam(setting);
+      }
+
+
+//---------------------------------------------------------
+//   updateStats
+//---------------------------------------------------------
+
+void CamView::updateStats()
+      {
+      unsigned captured  = cam->capture()->capturedFrames();
+      unsigned presented = cam->presentedFrames();
+      QString s = tr("capture %1 fps  display %2 fps  skipped %3")
+         .arg(captured - lastCaptured).arg(presented - lastPresented).arg(cam->capture()->skippedFrames());
+      if (cam->capture()->rejectedFrames())
+            s += tr("  rejected %1").arg(cam->capture()->rejectedFrames());
+      if (cam->capture()->server())
+            s += tr("  http clients %1").arg(cam->capture()->server()->clients());
+      stats->setText(s);
+
+      QString tip;
+      qint64 total = cam->displayMemory();
+      for (const MemoryUsage& m : cam->capture()->memoryUsage()) {
+            tip += tr("%1: %2 kB\n").arg(m.stage).arg(m.bytes / 1024);
+            total += m.bytes;
+            }
+      tip += tr("display: %1 kB\ntotal: %2 kB").arg(cam->displayMemory() / 1024).arg(total / 1024);
+      stats->setToolTip(tip);
+      lastCaptured  = captured;
+      lastPresented = presented;
+      }
+
+//---------------------------------------------------------
+//   setPicturePath
+//---------------------------------------------------------
+
+void CamView::setPicturePath(const QString& s)
+      {
+      cam->capture()->setPicturePath(s);
+      QSettings settings;
+      settings.setValue("picPath", s);
+      }
+
+//---------------------------------------------------------
+//   setPicturePrefix
+//---------------------------------------------------------
+
+void CamView::setPicturePrefix(const QString& s)
+      {
+      cam->capture()->setPicturePrefix(s);
+      QSettings settings;
+      settings.setValue("picPrefix", s);
+      }
+
+//---------------------------------------------------------
+//   setLowLatency
+//---------------------------------------------------------
+
+void CamView::setLowLatency(bool val)
+      {
+      cam->capture()->setLowLatency(val);
+      QSettings settings;
+      settings.setValue("lowLatency", val);
+      }
+
+//---------------------------------------------------------
+//   setAutoExposure
+//---------------------------------------------------------
+
+void CamView::setAutoExposure(bool val)
+      {
+      cam->capture()->setAutoExposure(val);
+      QSettings settings;
+      settings.setValue("autoExposure", val);
+      }
+
+//---------------------------------------------------------
+//   setPreviewRate
+//---------------------------------------------------------
+
+void CamView::setPreviewRate(int val)
+      {
+      cam->setPreviewRate(val);
+      QSettings settings;
+      settings.setValue("previewRate", val);
+      }
+
+//---------------------------------------------------------
+//   setTimelapse
+//---------------------------------------------------------
+
+void CamView::setTimelapse(int sec)
+      {
+      if (sec > 0)
+            cam->capture()->startTimelapse(sec);
+      else
+            cam->capture()->stopTimelapse();
+      }
+
+//---------------------------------------------------------
+//   setMotion
+//---------------------------------------------------------
+
+void CamView::setMotion(bool val)
+      {
+      if (val)
+            cam->capture()->startMotion(0.5, 15, 30);
+      else
+            cam->capture()->stopMotion();
+      }
+
+//---------------------------------------------------------
+//   setMosaic
+//---------------------------------------------------------
+
+void CamView::setMosaic(bool val)
+      {
+      if (val) {
+            cam->capture()->startMosaic();
+            mosaicDock->show();
+            }
+      else
+            cam->capture()->stopMosaic();
+      }
+
+//---------------------------------------------------------
+//   setFlatField
+//---------------------------------------------------------
+
+void CamView::setFlatField(bool val)
+      {
+      CorrectionSetting c = cam->capture()->correctionSetting();
+      c.flatField = val;
+      cam->capture()->setCorrection(c);
+      QSettings settings;
+      settings.setValue("flatField", val);
+      }
+
+//---------------------------------------------------------
+//   calibrateDark
+//---------------------------------------------------------
+
+void CamView::calibrateDark()
+      {
+      cam->capture()->calibrate(Calibrator::Type::Dark, calibrationFrames);
+      statusBar()->showMessage(tr("Dark frame: averaging %1 frames").arg(calibrationFrames), 3000);
+      }
+
+//---------------------------------------------------------
+//   calibrateFlat
+//---------------------------------------------------------
+
+void CamView::calibrateFlat()
+      {
+      cam->capture()->calibrate(Calibrator::Type::Flat, calibrationFrames);
+      statusBar()->showMessage(tr("Flat frame: averaging %1 frames").arg(calibrationFrames), 3000);
+      }
+
+//---------------------------------------------------------
+//   setAverage
+//    combo index is FrameAverager::Mode
+//---------------------------------------------------------
+
+void CamView::setAverage()
+      {
+      int mode = averageMode->currentIndex();
+      cam->capture()->setAverage(FrameAverager::Mode(mode), average->value());
+      QSettings settings;
+      settings.setValue("averageMode", mode);
+      settings.setValue("average", average->value());
+      }
+
+//---------------------------------------------------------
+//   writeTrace
+//    Ctrl+T; only while CAM_TRACE is set
+//---------------------------------------------------------
+
+void CamView::writeTrace()
+      {
+      if (!Trace::enabled())
+            statusBar()->showMessage(tr("tracing is off, set CAM_TRACE=<file>"), 3000);
+      else if (Trace::write())
+            statusBar()->showMessage(tr("trace written to %1").arg(Trace::path()), 3000);
+      else
+            statusBar()->showMessage(tr("cannot write trace %1").arg(Trace::path()), 3000);
+      }
+
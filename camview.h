@@ -18,6 +18,8 @@
 #include "ui_camview.h"
 
 #include <QComboBox>
+#include <QDockWidget>
+#include <QLabel>
 #include <QSize>
 
 //---------------------------------------------------------
@@ -29,8 +31,12 @@ class CamView : public QMainWindow, public Ui::CamView {
 
       std::vector<CamDevice> devices;
       CamDeviceSetting setting;    // current setting
-
-      void readDevices();
+      QLabel* pipeline;            // shows active decode path
+      QLabel* stats;
+      QDockWidget* histogramDock;
+      QDockWidget* mosaicDock;
+      unsigned lastCaptured  { 0 };
+      unsigned lastPresented { 0 };
 
       void changeCam(const CamDeviceSetting&);
       void setCam(const CamDeviceSetting&);
@@ -40,6 +46,21 @@ class CamView : public QMainWindow, public Ui::CamView {
       void changeDevice(int);
       void changeSize(int);
       void changeFps(int);
+      void changeFormat(int);
+      void updateStats();
+      void setPicturePath(const QString&);
+      void setPicturePrefix(const QString&);
+      void setLowLatency(bool);
+      void setAutoExposure(bool);
+      void setPreviewRate(int);
+      void setTimelapse(int);
+      void setMotion(bool);
+      void setMosaic(bool);
+      void setFlatField(bool);
+      void calibrateDark();
+      void calibrateFlat();
+      void setAverage();
+      void writeTrace();
 
    public:
       CamView(QWidget* parent = 0);
@@ -0,0 +1,1014 @@
+//=============================================================================
+//  Cam
+//  Webcam client
+//
+//  This file is based on uvc_streamer from TomStöveken
+//    Copyright (C) 2007 Tom Stöveken
+//
+//  Copyright (C) 2016 Werner Schweer
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License version 2
+//  as published by the Free Software Foundation and appearing in
+//  the file LICENCE.GPL
+//=============================================================================
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <linux/videodev2.h>
+#include <linux/input.h>
+#include <linux/input-event-codes.h>
+#include <poll.h>
+#include <time.h>
+
+#include <algorithm>
+
+#include <QFile>
+
+#include "capture.h"
+#include "jpeg.h"
+#include "streamserver.h"
+#include "shmring.h"
+#include "recorder.h"
+#include "timelapse.h"
+#include "motion.h"
+#include "mosaic.h"
+#include "threadpool.h"
+#include "trace.h"
+
+static const int meterInterval = 2;     // meter every 2nd frame
+
+//---------------------------------------------------------
+//   Capture
+//---------------------------------------------------------
+
+Capture::Capture(QObject* parent)
+   : QObject(parent)
+      {
+      }
+
+Capture::~Capture()
+      {
+      stop();
+      autoExposure.stop();
+      stopRecording();
+      stopTimelapse();
+      stopMotion();
+      stopMosaic();
+      if (calibrator) {
+            removeConsumer(calibrator);
+            delete calibrator;
+            }
+      delete _server;
+      delete shm;
+      delete cam;
+      }
+
+//---------------------------------------------------------
+//   init
+//---------------------------------------------------------
+
+int Capture::init(const CamDeviceSetting& s)
+      {
+      cam = new V4l2();
+      cam->setDecodeThreads(_decodeThreads);
+      cam->setImageFormat(_imageFormat);
+      cam->setAverager(&averager);
+      if (!cam->open(s.device->device)) {
+            fprintf(stderr, "Camera: cannot open <%s>: %s\n", qPrintable(s.device->device), strerror(errno));
+            return -1;
+            }
+      setting = s;
+
+      if (!cam->canVideoCapture()) {
+            fprintf(stderr, "Camera <%s> does not support video capture.\n", qPrintable(s.device->device));
+            return -1;
+            }
+      if (!cam->canStreaming()) {
+            fprintf(stderr, "Camera <%s> does not support streaming i/o.\n", qPrintable(s.device->device));
+            return -1;
+            }
+
+      _pixelFormat = s.device->bestFormat(setting.size, setting.fps, setting.pixelFormat);
+      if (!cam->setFormat(_pixelFormat, setting.size.width(), setting.size.height())) {
+            fprintf(stderr, "Camera <%s> does not support format %s: %s.\n",
+               qPrintable(s.device->device), qPrintable(pixelFormatName(_pixelFormat)), strerror(errno));
+            return -1;
+            }
+
+      if (!cam->setFramerate(setting.fps)) {
+            fprintf(stderr, "Camera <%s>: Unable to set frame rate: %s.\n", qPrintable(s.device->device), strerror(errno));
+            return -1;
+            }
+      if (!cam->initBuffers()) {
+            fprintf(stderr, "Unable to initialize buffers: %s\n", strerror(errno));
+            return -1;
+            }
+      cam->subscribeControlEvents();
+      if (_realtime.lockMemory) {
+            // both report their own errors; one failing
+            // does not keep the other from being applied
+            cam->lockBuffers();
+            lockProcessMemory();
+            }
+      if (!_shmName.isEmpty())
+            createShm();
+      {
+      std::lock_guard<std::mutex> lock(controlMutex);
+      autoExposureChanged = _autoExposure;
+      correctionChanged   = true;
+      }
+      return 0;
+      }
+
+//---------------------------------------------------------
+//   loop
+//---------------------------------------------------------
+
+void Capture::loop()
+      {
+      int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+      int ret;
+      ret = ioctl(cam->getFd(), VIDIOC_STREAMON, &type);
+      if (ret < 0) {
+            printf("Unable to start capture: %d.\n", errno);
+            return;
+            }
+      lastSnapshot  = std::chrono::steady_clock::now();
+      lastTimestamp = 0;
+      jpegReported  = false;
+      Trace::setThreadName("capture");
+      applyRealtime();
+      auto skip = [this](const struct v4l2_buffer& b) { dispatchSkipped(b); };
+
+      while (isstreaming) {
+            struct pollfd fds = { cam->getFd(), POLLIN | POLLPRI, 0 };
+            if (poll(&fds, 1, 1000) <= 0)
+                  continue;
+            if (fds.revents & POLLPRI)
+                  cam->readEvents();
+            if (!(fds.revents & POLLIN))
+                  continue;
+            applyControls();
+            applyCorrection();
+
+            // in low latency mode only the newest of all
+            // filled buffers is decoded; the recorder still
+            // gets every frame
+
+            struct v4l2_buffer buf;
+            int skipped = 0;
+            bool ok;
+            {
+            TraceScope ts("dqbuf");
+            ok = _lowLatency ? cam->dequeueLatest(&buf, &skipped, skip) : cam->dequeue(&buf);
+            if (ok)
+                  Trace::setFrame(buf.sequence);
+            }
+            if (!ok) {
+                  sleep(1);
+                  continue;
+                  }
+            struct timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            quint64 dequeued = quint64(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+            _skippedFrames  += skipped;
+            _capturedFrames += skipped + 1;
+            TraceScope frameScope("frame");
+            FramePtr f = cam->frame(buf);
+            _lostFrames += f->lost;
+
+            // corrupt or truncated mjpeg frames are dropped
+            // before any decoder, consumer or snapshot sees
+            // them
+
+            if (rejected(buf))
+                  continue;
+
+            if (_snapshotInterval > 0.0) {
+                  auto now = std::chrono::steady_clock::now();
+                  if (std::chrono::duration<double>(now - lastSnapshot).count() >= _snapshotInterval) {
+                        lastSnapshot = now;
+                        snapshot = true;
+                        }
+                  }
+
+            // mjpeg snapshots can be written without decoding
+            // unless they have to be averaged
+
+            bool averaging = averager.mode() != FrameAverager::Mode::Off;
+            if (snapshot && _rawSnapshots && _pixelFormat == V4L2_PIX_FMT_MJPEG && !averaging) {
+                  saveSnapshot(*f);
+                  snapshot = false;
+                  }
+
+            std::lock_guard<std::mutex> lock(consumerMutex);
+            std::vector<FrameConsumer*> cl;
+            bool decode = false;
+            for (FrameConsumer* c : consumers) {
+                  if (c->wantsFrame(*f)) {
+                        cl.push_back(c);
+                        decode = decode || c->wantsImage(*f);
+                        }
+                  }
+
+            // decode once, only if the display asked for a new
+            // frame, a snapshot is pending or a consumer wants it;
+            // the averager has to see every frame
+
+            bool show = frameRequested.exchange(false);
+            bool want = show || snapshot || decode;
+
+            // metering: decoded frames are metered by the decoder,
+            // raw frames without decoding; mjpeg frames have to
+            // be decoded for it
+
+            bool meter = (_metering || autoExposure.active()) && ++unmetered >= meterInterval;
+            Histogram* hist = meter ? &histogram : 0;
+            if (hist) {
+                  hist->clear();
+                  if (!want && !averaging && !cam->meter(cam->data(buf), buf.bytesused, hist))
+                        want = true;
+                  }
+            bool failed = false;
+            if (want || averaging) {
+                  QImage img = averaging ? averageFrame(buf, want, hist) : cam->decode(buf, hist);
+                  if (!img.isNull()) {
+                        ++_decodedFrames;
+                        _imageBytes   = qint64(img.bytesPerLine()) * img.height();
+                        _decoderBytes = cam->decoderMemory();
+                        _averageBytes = averager.memory();
+                        f->setImage(img);
+                        if (snapshot) {
+                              saveSnapshot(*f);
+                              snapshot = false;
+                              }
+                        }
+                  else if (want) {
+                        if (show)
+                              frameRequested = true;
+                        failed = true;
+                        }
+                  }
+            if (hist && hist->samples)
+                  metered();
+            {
+            TraceScope ts("consumers");
+            for (FrameConsumer* c : cl)
+                  c->frame(f);
+            }
+
+            // give the buffer back; the payload is copied only
+            // if a consumer kept the frame
+
+            f->release(f.use_count() > 1);
+            if (!f->image().isNull()) {
+                  std::lock_guard<std::mutex> lock(imageMutex);
+                  image         = f->image();
+                  imageSequence = f->sequence;
+                  newFrame      = true;
+                  Trace::flowStart("display", f->sequence);
+                  }
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            {
+            std::lock_guard<std::mutex> lock(latencyMutex);
+            latency.wakeup.add(qint64(dequeued - f->timestamp));
+            if (lastTimestamp)
+                  latency.interval.add(qint64(f->timestamp - lastTimestamp));
+            latency.process.add(qint64(quint64(ts.tv_sec) * 1000000000ull + ts.tv_nsec - dequeued));
+            }
+            lastTimestamp = f->timestamp;
+            if (failed)
+                  sleep(1);
+            }
+
+      type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+      ret = ioctl(cam->getFd(), VIDIOC_STREAMOFF, &type);
+      if (ret < 0)
+            printf("Unable to stop capture: %d.\n", errno);
+      }
+
+//---------------------------------------------------------
+//   applyRealtime
+//    called by the capture thread; failures are reported
+//    and capture continues with the default scheduling
+//---------------------------------------------------------
+
+void Capture::applyRealtime()
+      {
+      const RealtimeSetting& r = _realtime;
+      if (!r.captureCpus.empty())
+            setThreadAffinity(pthread_self(), r.captureCpus);
+      if (r.policy != SCHED_OTHER && setThreadScheduling(pthread_self(), r.policy, r.priority))
+            fprintf(stderr, "cam: capture thread %s priority %d\n", schedPolicyName(r.policy), r.priority);
+      if (!r.decodeCpus.empty()) {
+            for (pthread_t t : ThreadPool::global()->handles())
+                  setThreadAffinity(t, r.decodeCpus);
+            }
+      }
+
+//---------------------------------------------------------
+//   takeLatency
+//    timing since the last call
+//---------------------------------------------------------
+
+void Capture::takeLatency(Latency* l)
+      {
+      std::lock_guard<std::mutex> lock(latencyMutex);
+      *l = latency;
+      latency.clear();
+      }
+
+//---------------------------------------------------------
+//   rejected
+//    count a buffer which failed mjpeg validation; the
+//    format of the stream is reported with the first
+//    valid frame
+//---------------------------------------------------------
+
+bool Capture::rejected(const struct v4l2_buffer& buf)
+      {
+      if (_pixelFormat != V4L2_PIX_FMT_MJPEG)
+            return false;
+      JpegError e = cam->jpegError(buf);
+      if (e != JpegError::None) {
+            ++_rejectedFrames[int(e)];
+            return true;
+            }
+      if (!jpegReported) {
+            const JpegInfo& info = cam->jpegInfo(buf);
+            fprintf(stderr, "cam: mjpeg %dx%d %s%s\n", info.width, info.height, jpegSubsampling(info),
+               info.progressive ? " progressive" : "");
+            jpegReported = true;
+            }
+      return false;
+      }
+
+//---------------------------------------------------------
+//   rejectedFrames
+//    all causes
+//---------------------------------------------------------
+
+unsigned Capture::rejectedFrames() const
+      {
+      unsigned n = 0;
+      for (const std::atomic<unsigned>& r : _rejectedFrames)
+            n += r;
+      return n;
+      }
+
+//---------------------------------------------------------
+//   dispatchSkipped
+//    pass a buffer which is dropped in low latency mode
+//    to the consumers which want all frames
+//---------------------------------------------------------
+
+void Capture::dispatchSkipped(const struct v4l2_buffer& buf)
+      {
+      if (rejected(buf))
+            return;
+      std::lock_guard<std::mutex> lock(consumerMutex);
+      FramePtr f;
+      for (FrameConsumer* c : consumers) {
+            if (!c->wantsSkipped())
+                  continue;
+            if (!f)
+                  f = cam->frame(buf, false);   // requeued by dequeueLatest()
+            if (c->wantsFrame(*f))
+                  c->frame(f);
+            }
+      if (f)
+            f->release(f.use_count() > 1);
+      }
+
+//---------------------------------------------------------
+//   averageFrame
+//    add the frame to the running average and return the
+//    averaged image if decode is set. Raw frames are
+//    averaged before conversion to RGB, mjpeg frames by
+//    the decoder in the yuv planes; they are decoded even
+//    if no image is wanted.
+//    Consumers still get the payload as captured.
+//---------------------------------------------------------
+
+QImage Capture::averageFrame(const struct v4l2_buffer& buf, bool decode, Histogram* hist)
+      {
+      TraceScope ts("average");
+      if (_pixelFormat != V4L2_PIX_FMT_MJPEG) {
+            const uchar* p = averager.add(cam->data(buf), buf.bytesused);
+            if (decode)
+                  return cam->decode(p, buf.bytesused, hist);
+            if (hist)
+                  cam->meter(p, buf.bytesused, hist);
+            return QImage();
+            }
+      return cam->decode(buf, hist);
+      }
+
+//---------------------------------------------------------
+//   metered
+//    a new histogram is ready
+//---------------------------------------------------------
+
+void Capture::metered()
+      {
+      unmetered = 0;
+      autoExposure.update(histogram);
+      _exposure = autoExposure.active() ? int(autoExposure.exposure()) : -1;
+      if (!_metering)
+            return;
+      std::lock_guard<std::mutex> lock(histogramMutex);
+      lastHistogram = histogram;
+      newHistogram  = true;
+      }
+
+//---------------------------------------------------------
+//   takeHistogram
+//    return true and the last histogram if there is a new
+//    one since the last call
+//---------------------------------------------------------
+
+bool Capture::takeHistogram(Histogram* h)
+      {
+      std::lock_guard<std::mutex> lock(histogramMutex);
+      if (!newHistogram)
+            return false;
+      *h           = lastHistogram;
+      newHistogram = false;
+      return true;
+      }
+
+//---------------------------------------------------------
+//   takeImage
+//    return true and the last decoded image if there is
+//    a new one since the last call
+//---------------------------------------------------------
+
+bool Capture::takeImage(QImage* img)
+      {
+      std::lock_guard<std::mutex> lock(imageMutex);
+      if (!newFrame)
+            return false;
+      *img     = image;
+      newFrame = false;
+      Trace::flowEnd("display", imageSequence);
+      Trace::setFrame(imageSequence);
+      return true;
+      }
+
+//---------------------------------------------------------
+//   nextPictureName
+//---------------------------------------------------------
+
+QString Capture::nextPictureName()
+      {
+      for (int i = 0; i < 50000; ++i) {
+            QString picName = QString("%1/%2%3.jpeg").arg(_picturePath).arg(_picturePrefix).arg(pictureNumber);
+            if (!QFile::exists(picName))
+                  return picName;
+            pictureNumber++;
+            }
+      return QString();
+      }
+
+//---------------------------------------------------------
+//   saveSnapshot
+//    save decoded image or, if there is none, the
+//    compressed frame with huffman tables added
+//---------------------------------------------------------
+
+void Capture::saveSnapshot(const Frame& f)
+      {
+      TraceScope ts("snapshot");
+      QString picName = nextPictureName();
+      if (picName.isEmpty())
+            return;
+      fprintf(stderr, "saving picture <%s>\n", qPrintable(picName));
+      bool ok;
+      if (f.image().isNull()) {
+            QFile file(picName);
+            ok = file.open(QIODevice::WriteOnly);
+            if (ok) {
+                  QByteArray ba = f.jpeg();
+                  ok = file.write(ba) == ba.size();
+                  }
+            }
+      else
+            ok = f.image().save(picName, "jpeg", -1);
+      if (!ok) {
+            fprintf(stderr, "cannot save picture <%s>\n", qPrintable(picName));
+            return;
+            }
+      ++_snapshots;
+      emit click(picName, 1000);
+      }
+
+//---------------------------------------------------------
+//   addConsumer
+//    consumers are called in the capture thread and must
+//    not add or remove consumers from frame()
+//---------------------------------------------------------
+
+void Capture::addConsumer(FrameConsumer* c)
+      {
+      std::lock_guard<std::mutex> lock(consumerMutex);
+      consumers.push_back(c);
+      }
+
+//---------------------------------------------------------
+//   removeConsumer
+//    after return the consumer is no longer called
+//---------------------------------------------------------
+
+void Capture::removeConsumer(FrameConsumer* c)
+      {
+      std::lock_guard<std::mutex> lock(consumerMutex);
+      consumers.erase(std::remove(consumers.begin(), consumers.end(), c), consumers.end());
+      }
+
+//---------------------------------------------------------
+//   startRecording
+//---------------------------------------------------------
+
+bool Capture::startRecording(const QString& path)
+      {
+      stopRecording();
+      Recorder* r = new Recorder;
+      if (!r->open(path)) {
+            delete r;
+            return false;
+            }
+      recorder = r;
+      addConsumer(recorder);
+      return true;
+      }
+
+//---------------------------------------------------------
+//   stopRecording
+//---------------------------------------------------------
+
+void Capture::stopRecording()
+      {
+      if (!recorder)
+            return;
+      removeConsumer(recorder);
+      delete recorder;
+      recorder = 0;
+      }
+
+//---------------------------------------------------------
+//   recordedBytes
+//---------------------------------------------------------
+
+quint64 Capture::recordedBytes() const
+      {
+      return recorder ? recorder->bytes() : 0;
+      }
+
+//---------------------------------------------------------
+//   startTimelapse
+//    save one frame every seconds into the picture path
+//    or append it to recording; seconds has to be
+//    positive, the consumer advances its next sample time
+//    by it in the capture thread
+//---------------------------------------------------------
+
+bool Capture::startTimelapse(double seconds, const QString& recording)
+      {
+      if (!(seconds > 0.0 && seconds < 1e9)) {
+            fprintf(stderr, "cam: bad timelapse interval %g seconds\n", seconds);
+            return false;
+            }
+      stopTimelapse();
+      Timelapse* t = new Timelapse(seconds, _picturePath, _picturePrefix);
+      if (!recording.isEmpty() && !t->setRecording(recording)) {
+            delete t;
+            return false;
+            }
+      timelapse = t;
+      addConsumer(timelapse);
+      return true;
+      }
+
+//---------------------------------------------------------
+//   stopTimelapse
+//---------------------------------------------------------
+
+void Capture::stopTimelapse()
+      {
+      if (!timelapse)
+            return;
+      removeConsumer(timelapse);
+      delete timelapse;
+      timelapse = 0;
+      }
+
+//---------------------------------------------------------
+//   timelapseFrames
+//---------------------------------------------------------
+
+unsigned Capture::timelapseFrames() const
+      {
+      return timelapse ? timelapse->frames() : 0;
+      }
+
+//---------------------------------------------------------
+//   startMotion
+//    save the frames around motion into the picture path;
+//    area is the changed part of the picture in percent
+//---------------------------------------------------------
+
+void Capture::startMotion(double area, int preFrames, int postFrames)
+      {
+      stopMotion();
+      motion = new MotionDetector(area, preFrames, postFrames, _picturePath, _picturePrefix);
+      addConsumer(motion);
+      }
+
+//---------------------------------------------------------
+//   stopMotion
+//    pending frames are written before return
+//---------------------------------------------------------
+
+void Capture::stopMotion()
+      {
+      if (!motion)
+            return;
+      removeConsumer(motion);
+      delete motion;
+      motion = 0;
+      }
+
+//---------------------------------------------------------
+//   startMosaic
+//    stitch the frames into a mosaic while the stage is
+//    moved; the canvas is kept until stopMosaic()
+//---------------------------------------------------------
+
+void Capture::startMosaic()
+      {
+      stopMosaic();
+      _mosaic = new Mosaic;
+      addConsumer(_mosaic);
+      }
+
+//---------------------------------------------------------
+//   stopMosaic
+//---------------------------------------------------------
+
+void Capture::stopMosaic()
+      {
+      if (!_mosaic)
+            return;
+      removeConsumer(_mosaic);
+      delete _mosaic;
+      _mosaic = 0;
+      }
+
+//---------------------------------------------------------
+//   motionEvents
+//---------------------------------------------------------
+
+unsigned Capture::motionEvents() const
+      {
+      return motion ? motion->events() : 0;
+      }
+
+//---------------------------------------------------------
+//   motionFrames
+//---------------------------------------------------------
+
+unsigned Capture::motionFrames() const
+      {
+      return motion ? motion->frames() : 0;
+      }
+
+//---------------------------------------------------------
+//   startServer
+//---------------------------------------------------------
+
+bool Capture::startServer(int port)
+      {
+      if (_server)
+            return true;
+      StreamServer* s = new StreamServer;
+      if (!s->start(port)) {
+            delete s;
+            return false;
+            }
+      _server = s;
+      addConsumer(_server);
+      return true;
+      }
+
+//---------------------------------------------------------
+//   startShm
+//    publish frames to the shared memory rings <name> and
+//    <name>-raw (see camshm.h)
+//---------------------------------------------------------
+
+void Capture::startShm(const QString& name)
+      {
+      _shmName = name;
+      if (cam)
+            createShm();
+      }
+
+//---------------------------------------------------------
+//   createShm
+//    (re)create the rings for the current format
+//---------------------------------------------------------
+
+void Capture::createShm()
+      {
+      if (shm) {
+            removeConsumer(shm);
+            delete shm;
+            }
+      shm = new ShmPublisher;
+      shm->create(_shmName, cam->width(), cam->height(), _imageFormat, cam->bufferSize());
+      addConsumer(shm);
+      }
+
+//---------------------------------------------------------
+//   setControls
+//    queue control values; all values queued between two
+//    frames are set with a single ioctl
+//---------------------------------------------------------
+
+void Capture::setControls(const std::vector<V4l2ControlValue>& vl)
+      {
+      std::lock_guard<std::mutex> lock(controlMutex);
+      for (const V4l2ControlValue& v : vl) {
+            bool found = false;
+            for (V4l2ControlValue& pv : pendingControls) {
+                  if (pv.control == v.control) {
+                        pv.value = v.value;
+                        found = true;
+                        break;
+                        }
+                  }
+            if (!found)
+                  pendingControls.push_back(v);
+            }
+      }
+
+//---------------------------------------------------------
+//   setAverage
+//    average n frames (Mean) or weight new frames with
+//    1/2^n (Exponential); takes effect with next frame
+//---------------------------------------------------------
+
+void Capture::setAverage(FrameAverager::Mode m, int n)
+      {
+      std::lock_guard<std::mutex> lock(controlMutex);
+      _averageMode   = m;
+      _averageFrames = n;
+      averageChanged = true;
+      }
+
+//---------------------------------------------------------
+//   setAutoExposure
+//    control the exposure time from the histogram; takes
+//    effect with next frame
+//---------------------------------------------------------
+
+void Capture::setAutoExposure(bool val)
+      {
+      std::lock_guard<std::mutex> lock(controlMutex);
+      _autoExposure       = val;
+      autoExposureChanged = true;
+      }
+
+//---------------------------------------------------------
+//   setCorrection
+//    flat field and distortion correction; takes effect
+//    with next frame
+//---------------------------------------------------------
+
+void Capture::setCorrection(const CorrectionSetting& c)
+      {
+      std::lock_guard<std::mutex> lock(controlMutex);
+      _correction       = c;
+      correctionChanged = true;
+      }
+
+//---------------------------------------------------------
+//   calibrate
+//    average the next frames into a dark frame (lens
+//    covered) or flat frame (evenly lit empty field); the
+//    result is saved and the correction rebuilt
+//---------------------------------------------------------
+
+void Capture::calibrate(Calibrator::Type t, int frames)
+      {
+      std::lock_guard<std::mutex> lock(controlMutex);
+      calibrationType   = t;
+      calibrationFrames = qMax(1, frames);
+      }
+
+//---------------------------------------------------------
+//   calibrationFile
+//---------------------------------------------------------
+
+QString Capture::calibrationFile() const
+      {
+      return Calibration::fileName(_calibrationPath.isEmpty() ? _picturePath : _calibrationPath,
+         cam->width(), cam->height());
+      }
+
+//---------------------------------------------------------
+//   applyCorrection
+//    capture thread; (re)builds the correction tables on a
+//    change of setting, format or calibration. Frames are
+//    not corrected while calibrating.
+//---------------------------------------------------------
+
+void Capture::applyCorrection()
+      {
+      CorrectionSetting cs;
+      bool changed;
+      int frames;
+      Calibrator::Type type;
+      {
+      std::lock_guard<std::mutex> lock(controlMutex);
+      cs                = _correction;
+      changed           = correctionChanged;
+      frames            = calibrationFrames;
+      type              = calibrationType;
+      correctionChanged = false;
+      calibrationFrames = 0;
+      }
+      if (frames && !calibrator) {
+            calibrator   = new Calibrator(type, frames);
+            _calibrating = true;
+            cam->setCorrection(LensCorrectionPtr());
+            addConsumer(calibrator);
+            }
+      if (calibrator && calibrator->done()) {
+            removeConsumer(calibrator);
+            calibrator->result(&calibration);
+            delete calibrator;
+            calibrator   = 0;
+            _calibrating = false;
+            calibration.save(calibrationFile());
+            changed = true;
+            }
+      if (!changed)
+            return;
+      if (calibration.width != cam->width() || calibration.height != cam->height()) {
+            QString path = calibrationFile();
+            if (!calibration.load(path) && cs.flatField)
+                  fprintf(stderr, "cam: no flat field calibration <%s>\n", qPrintable(path));
+            }
+      correction.reset();
+      if (cs.enabled())
+            correction = std::make_shared<LensCorrection>(cam->width(), cam->height(), calibration, cs);
+      if (!calibrator)
+            cam->setCorrection(correction);
+      _correctionBytes = correction ? correction->memory() : 0;
+      }
+
+//---------------------------------------------------------
+//   applyControls
+//---------------------------------------------------------
+
+void Capture::applyControls()
+      {
+      std::vector<V4l2ControlValue> vl;
+      {
+      std::lock_guard<std::mutex> lock(controlMutex);
+      vl.swap(pendingControls);
+      if (averageChanged) {
+            averager.setMode(_averageMode, _averageFrames);
+            averageChanged = false;
+            }
+      if (autoExposureChanged) {
+            if (_autoExposure)
+                  autoExposure.start(cam);
+            else
+                  autoExposure.stop();
+            _exposure = autoExposure.active() ? int(autoExposure.exposure()) : -1;
+            autoExposureChanged = false;
+            }
+      }
+      if (!vl.empty())
+            cam->setControls(vl);
+      }
+
+//---------------------------------------------------------
+//   watchButton
+//---------------------------------------------------------
+
+void Capture::watchButton()
+      {
+      if (setting.device->buttonDevice.isEmpty())
+            return;
+
+      QByteArray path = setting.device->buttonDevice.toLocal8Bit();
+      const char* s = path.constData();
+      int fd = ::open(s, O_RDWR);
+      if (fd == -1) {
+            fprintf(stderr, "cannot open button input <%s>: %s\n", s, strerror(errno));
+            return;
+            }
+      while (isstreaming) {
+            struct pollfd fds = { fd, POLLIN, 0 };
+            int r = poll(&fds, 1, 100);
+            if (r > 0) {
+                  struct input_event event;
+                  int n = read(fd, &event, sizeof(event));
+                  if (n > 0 && event.type == EV_KEY && event.code == KEY_CAMERA && event.value == 1) {
+                        // camera button was pressed
+                        snapshot = true;
+                        }
+                  }
+            }
+      ::close(fd);
+      }
+
+//---------------------------------------------------------
+//   start
+//---------------------------------------------------------
+
+int Capture::start()
+      {
+      isstreaming = true;
+      grabLoop   = std::thread(&Capture::loop, this);
+      buttonLoop = std::thread(&Capture::watchButton, this);
+      return 0;
+      }
+
+//---------------------------------------------------------
+//   stop
+//---------------------------------------------------------
+
+int Capture::stop()
+      {
+      if (!isstreaming)
+            return 0;
+      isstreaming = false;
+      grabLoop.join();
+      buttonLoop.join();
+      return 0;
+      }
+
+//---------------------------------------------------------
+//   change
+//---------------------------------------------------------
+
+void Capture::change(const CamDeviceSetting& s)
+      {
+      stop();
+      autoExposure.stop();
+      if (cam && !cam->freeBuffers()) {
+            fprintf(stderr, "Unable to unmap buffer: %s\n", strerror(errno));
+            return;
+            }
+      delete cam;
+      cam = 0;
+      init(s);
+      start();
+      }
+
+//---------------------------------------------------------
+//   decoderName
+//---------------------------------------------------------
+
+QString Capture::decoderName() const
+      {
+      return cam ? QString(cam->decoderName()) : QString();
+      }
+
+//---------------------------------------------------------
+//   memoryUsage
+//    per stage; the decoded frame is counted once, it is
+//    shared by the display and all consumers
+//---------------------------------------------------------
+
+std::vector<MemoryUsage> Capture::memoryUsage() const
+      {
+      std::vector<MemoryUsage> ml;
+      if (!cam)
+            return ml;
+      ml.push_back({ "capture buffers", qint64(cam->bufferSize()) * NB_BUFFER });
+      ml.push_back({ "decoder", _decoderBytes });
+      ml.push_back({ QString("frame (%1)").arg(imageFormatName(_imageFormat)), _imageBytes });
+      if (_averageMode != FrameAverager::Mode::Off)
+            ml.push_back({ "average", _averageBytes });
+      if (shm)
+            ml.push_back({ "shared memory", shm->memory() });
+      if (motion)
+            ml.push_back({ "motion", motion->memory() });
+      if (_mosaic)
+            ml.push_back({ "mosaic", _mosaic->canvas().memory() });
+      if (_correctionBytes)
+            ml.push_back({ "lens correction", _correctionBytes });
+      return ml;
+      }
+
@@ -0,0 +1,260 @@
+//=============================================================================
+//  Cam
+//  Webcam client
+//
+//  Copyright (C) 2016 Werner Schweer
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License version 2
+//  as published by the Free Software Foundation and appearing in
+//  the file LICENCE.GPL
+//=============================================================================
+
+#ifndef __CAPTURE_H__
+#define __CAPTURE_H__
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <QObject>
+#include <QString>
+#include <QImage>
+
+#include "autoexposure.h"
+#include "average.h"
+#include "camdevice.h"
+#include "correction.h"
+#include "frame.h"
+#include "histogram.h"
+#include "latency.h"
+#include "realtime.h"
+#include "v4l2.h"
+
+class StreamServer;
+class ShmPublisher;
+class Recorder;
+class Timelapse;
+class MotionDetector;
+class Mosaic;
+
+//---------------------------------------------------------
+//   MemoryUsage
+//    bytes held by one stage of the pipeline
+//---------------------------------------------------------
+
+struct MemoryUsage {
+      QString stage;
+      qint64 bytes;
+      };
+
+//---------------------------------------------------------
+//   Capture
+//    capture and decode pipeline; runs without any
+//    widget and without a Qt event loop
+//
+//    frames are only decoded if a display requested one
+//    with requestFrame(), a snapshot is pending or a
+//    registered FrameConsumer wants the image
+//
+//    takeImage() tags the calling thread with the frame
+//    sequence for the trace (see trace.h)
+//---------------------------------------------------------
+
+class Capture : public QObject {
+      Q_OBJECT
+
+      V4l2* cam        { 0 };
+      std::atomic<bool> isstreaming { false };
+      CamDeviceSetting setting;
+      unsigned _pixelFormat { 0 };  // active format
+      std::thread grabLoop;
+      std::thread buttonLoop;
+
+      std::mutex controlMutex;
+      std::vector<V4l2ControlValue> pendingControls;  // applied with next frame
+      bool averageChanged { false };
+      FrameAverager::Mode _averageMode { FrameAverager::Mode::Off };
+      int _averageFrames  { 0 };
+      bool _autoExposure  { false };
+      bool autoExposureChanged { false };
+      CorrectionSetting _correction;
+      bool correctionChanged { false };
+      int calibrationFrames { 0 };              // pending calibration request
+      Calibrator::Type calibrationType { Calibrator::Type::Dark };
+
+      std::mutex consumerMutex;                 // held while frames are dispatched
+      std::vector<FrameConsumer*> consumers;
+
+      std::atomic<bool> _lowLatency { false };  // set by the gui while capturing
+      int _decodeThreads { 1 };                 // 0: all cores
+      RealtimeSetting _realtime;
+      QImage::Format _imageFormat { QImage::Format_RGB32 };
+      FrameAverager averager;                   // capture thread only
+
+      // exposure metering
+
+      std::atomic<bool> _metering { false };
+      Histogram histogram;                      // capture thread only
+      int unmetered { 0 };                      // frames since last histogram
+      AutoExposure autoExposure;                // capture thread only
+      std::atomic<int> _exposure { -1 };
+      std::mutex histogramMutex;                // protects lastHistogram, newHistogram
+      Histogram lastHistogram;
+      bool newHistogram { false };
+
+      // flat field and distortion correction
+
+      QString _calibrationPath;                 // empty: picture path
+      Calibration calibration;                  // capture thread only
+      LensCorrectionPtr correction;             // capture thread only
+      Calibrator* calibrator { 0 };             // capture thread only
+      std::atomic<bool> _calibrating { false };
+
+      // capture thread timing
+
+      std::mutex latencyMutex;                  // protects latency
+      Latency latency;
+      quint64 lastTimestamp { 0 };              // capture thread only
+
+      // snapshots
+
+      std::atomic<bool> snapshot { false };
+      QString _picturePath   { ""    };
+      QString _picturePrefix { "pic" };
+      int pictureNumber      { 1     };
+      bool _rawSnapshots     { false };     // save mjpeg frames without decoding
+      double _snapshotInterval { 0.0 };     // seconds, 0: off
+      std::chrono::steady_clock::time_point lastSnapshot;
+
+      Recorder* recorder     { 0 };
+      Timelapse* timelapse   { 0 };
+      MotionDetector* motion { 0 };
+      Mosaic* _mosaic        { 0 };
+      StreamServer* _server  { 0 };         // http clients
+      QString _shmName;
+      ShmPublisher* shm      { 0 };
+
+      // display
+
+      std::mutex imageMutex;                    // protects image, imageSequence, newFrame
+      QImage image;
+      unsigned imageSequence { 0 };
+      bool newFrame { false };
+      std::atomic<bool> frameRequested { false };
+
+      std::atomic<unsigned> _capturedFrames { 0 };
+      std::atomic<unsigned> _decodedFrames  { 0 };
+      std::atomic<unsigned> _skippedFrames  { 0 };
+      std::atomic<unsigned> _lostFrames     { 0 };
+      std::atomic<unsigned> _snapshots      { 0 };
+      std::atomic<unsigned> _rejectedFrames[jpegErrors] {};   // corrupt mjpeg frames per JpegError
+      bool jpegReported { false };              // capture thread only
+
+      // memory, sampled by the capture thread
+
+      std::atomic<qint64> _imageBytes       { 0 };
+      std::atomic<qint64> _decoderBytes     { 0 };
+      std::atomic<qint64> _averageBytes     { 0 };
+      std::atomic<qint64> _correctionBytes  { 0 };
+
+      void loop();
+      void watchButton();
+      void applyControls();
+      void applyRealtime();
+      void applyCorrection();
+      QString calibrationFile() const;
+      bool rejected(const struct v4l2_buffer&);
+      void dispatchSkipped(const struct v4l2_buffer&);
+      QImage averageFrame(const struct v4l2_buffer&, bool decode, Histogram*);
+      void metered();
+      void saveSnapshot(const Frame&);
+      QString nextPictureName();
+      void createShm();
+
+   signals:
+      void click(const QString&, int);
+
+   public slots:
+      void takeSnapshot()                  { snapshot = true; }
+      void setPicturePath(const QString& s)   { _picturePath = s;   }
+      void setPicturePrefix(const QString& s) { _picturePrefix = s; }
+      void setLowLatency(bool val)         { _lowLatency = val; }
+      void setMetering(bool val)           { _metering = val; }
+      void setAutoExposure(bool);
+
+   public:
+      Capture(QObject* parent = 0);
+      ~Capture();
+      int init(const CamDeviceSetting&);
+      int start();
+      int stop();
+      void change(const CamDeviceSetting&);
+      void setControls(const std::vector<V4l2ControlValue>&);
+
+      void addConsumer(FrameConsumer*);
+      void removeConsumer(FrameConsumer*);
+
+      bool startRecording(const QString& path);
+      void stopRecording();
+      bool startTimelapse(double seconds, const QString& recording = QString());
+      void stopTimelapse();
+      void startMotion(double area, int preFrames, int postFrames);
+      void stopMotion();
+      bool motionDetection() const         { return motion != 0; }
+      void startMosaic();
+      void stopMosaic();
+      Mosaic* mosaic() const               { return _mosaic; }
+      bool startServer(int port);
+      StreamServer* server() const         { return _server; }
+      void startShm(const QString& name);
+      void setSnapshotInterval(double sec) { _snapshotInterval = sec; }
+      void setRawSnapshots(bool val)       { _rawSnapshots = val; }
+      void setAverage(FrameAverager::Mode, int n);
+      void setDecodeThreads(int n)         { _decodeThreads = n; }
+      void setImageFormat(QImage::Format f) { _imageFormat = f; }
+      void setRealtime(const RealtimeSetting& s) { _realtime = s; }
+      void setCorrection(const CorrectionSetting&);
+      void setCalibrationPath(const QString& s) { _calibrationPath = s; }
+      void calibrate(Calibrator::Type, int frames);
+
+      void requestFrame()                  { frameRequested = true; }
+      bool takeImage(QImage*);
+
+      const QString& picturePath() const   { return _picturePath; }
+      const QString& picturePrefix() const { return _picturePrefix; }
+      bool lowLatency() const              { return _lowLatency; }
+      int decodeThreads() const            { return _decodeThreads; }
+      QImage::Format imageFormat() const   { return _imageFormat; }
+      const RealtimeSetting& realtime() const { return _realtime; }
+      const CorrectionSetting& correctionSetting() const { return _correction; }
+      bool calibrating() const             { return _calibrating; }
+      FrameAverager::Mode averageMode() const { return _averageMode; }
+      int averageFrames() const            { return _averageFrames; }
+      bool metering() const                { return _metering; }
+      bool autoExposureEnabled() const     { return _autoExposure; }
+      int exposure() const                 { return _exposure; }
+      bool takeHistogram(Histogram*);
+      void takeLatency(Latency*);
+      unsigned pixelFormat() const         { return _pixelFormat; }
+      QString decoderName() const;
+      const CamDeviceSetting& deviceSetting() const { return setting; }
+
+      unsigned capturedFrames() const      { return _capturedFrames; }
+      unsigned decodedFrames() const       { return _decodedFrames;  }
+      unsigned skippedFrames() const       { return _skippedFrames;  }
+      unsigned lostFrames() const          { return _lostFrames;     }
+      unsigned snapshots() const           { return _snapshots;      }
+      unsigned rejectedFrames() const;
+      unsigned rejectedFrames(JpegError e) const { return _rejectedFrames[int(e)]; }
+      quint64 recordedBytes() const;
+      unsigned timelapseFrames() const;
+      unsigned motionEvents() const;
+      unsigned motionFrames() const;
+      std::vector<MemoryUsage> memoryUsage() const;
+      };
+
+#endif
+
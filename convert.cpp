@@ -0,0 +1,516 @@
+//=============================================================================
+//  Cam
+//  Webcam client
+//
+//  Copyright (C) 2016 Werner Schweer
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License version 2
+//  as published by the Free Software Foundation and appearing in
+//  the file LICENCE.GPL
+//=============================================================================
+
+//---------------------------------------------------------
+//   cam-convert
+//    converts a mjpeg recording (cam --record) or a file
+//    of raw frames into one png or tiff file per frame.
+//    Mjpeg recordings are scanned in chunks with the
+//    scanner of the image plugin, raw YUYV or NV12 files
+//    are split by frame size. Frames are read, decoded,
+//    cropped, scaled and compressed on all cores; every
+//    thread takes the next frame of a batch as soon as it
+//    is done with the last one, so slow frames do not hold
+//    up the others. Only the frame offsets of one batch
+//    and one frame per thread are in memory, whatever the
+//    size of the recording.
+//---------------------------------------------------------
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <linux/videodev2.h>
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <vector>
+
+#include <QCommandLineParser>
+#include <QCommandLineOption>
+#include <QCoreApplication>
+#include <QFileInfo>
+#include <QImage>
+#include <QImageWriter>
+#include <QStringList>
+#include <QtPlugin>
+
+#include "decoder.h"
+#include "jpeg.h"
+#include "mjpeg.h"
+#include "threadpool.h"
+#include "tiff.h"
+#include "yuv.h"
+
+Q_IMPORT_PLUGIN(MjpegImageIOPlugin)
+
+static const int batchFrames = 8;      // frames per thread and batch
+
+//---------------------------------------------------------
+//   FrameRef
+//---------------------------------------------------------
+
+struct FrameRef {
+      int number;
+      qint64 offset;
+      int size;
+      };
+
+//---------------------------------------------------------
+//   Input
+//    frames of a recording; next() returns them in file
+//    order. read() may be called from any thread.
+//---------------------------------------------------------
+
+class Input : public MjpegScanner {
+      int fd            { -1 };
+      qint64 fileSize   { 0 };
+      qint64 scanned    { 0 };
+      int frameSize     { 0 };          // raw frames, 0: mjpeg
+      int count         { 0 };          // frames found
+      std::deque<FrameRef> pending;
+      std::vector<uchar> chunk;
+
+   protected:
+      virtual void found(qint64 offset, int size) override { pending.push_back({ count++, offset, size }); }
+
+   public:
+      ~Input();
+      bool open(const QString& path, int frameSize);
+      void skip(int n);
+      bool next(FrameRef*);
+      bool read(const FrameRef&, std::vector<uchar>*) const;
+      };
+
+Input::~Input()
+      {
+      if (fd >= 0)
+            ::close(fd);
+      }
+
+//---------------------------------------------------------
+//   open
+//---------------------------------------------------------
+
+bool Input::open(const QString& path, int fs)
+      {
+      fd = ::open(qPrintable(path), O_RDONLY);
+      struct stat st;
+      if (fd < 0 || fstat(fd, &st) != 0) {
+            fprintf(stderr, "cam-convert: cannot open <%s>: %s\n", qPrintable(path), strerror(errno));
+            return false;
+            }
+      fileSize  = st.st_size;
+      frameSize = fs;
+      posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+      return true;
+      }
+
+//---------------------------------------------------------
+//   skip
+//    raw frames can be addressed directly, mjpeg frames
+//    have to be scanned
+//---------------------------------------------------------
+
+void Input::skip(int n)
+      {
+      if (frameSize)
+            count = n;
+      }
+
+//---------------------------------------------------------
+//   next
+//---------------------------------------------------------
+
+bool Input::next(FrameRef* r)
+      {
+      if (frameSize) {
+            qint64 offset = qint64(count) * frameSize;
+            if (offset + frameSize > fileSize)
+                  return false;
+            *r = { count++, offset, frameSize };
+            return true;
+            }
+      chunk.resize(MjpegImageIOHandler::chunkSize);
+      while (pending.empty() && scanned < fileSize) {
+            ssize_t n = pread(fd, chunk.data(), chunk.size(), scanned);
+            if (n <= 0)
+                  break;
+            scan(chunk.data(), n, scanned);
+            scanned += n;
+            }
+      if (pending.empty())
+            return false;
+      *r = pending.front();
+      pending.pop_front();
+      return true;
+      }
+
+//---------------------------------------------------------
+//   read
+//---------------------------------------------------------
+
+bool Input::read(const FrameRef& r, std::vector<uchar>* data) const
+      {
+      data->resize(r.size);
+      return pread(fd, data->data(), r.size, r.offset) == r.size;
+      }
+
+//---------------------------------------------------------
+//   Options
+//---------------------------------------------------------
+
+struct Options {
+      unsigned rawFormat { 0 };         // V4L2 fourcc, 0: mjpeg
+      int width          { 0 };
+      int height         { 0 };
+      QImage::Format format { QImage::Format_RGB32 };
+      QRect crop;                       // empty: whole frame
+      int downscale      { 1 };
+      QString output;
+      QString prefix;
+      QString type;                     // png or tiff
+      int quality        { -1 };
+      int first          { 0 };
+      int last           { -1 };        // -1: to the end
+      int every          { 1 };
+      };
+
+//---------------------------------------------------------
+//   Stats
+//    time is summed over all threads
+//---------------------------------------------------------
+
+struct Stats {
+      std::atomic<int> frames       { 0 };
+      std::atomic<int> failed       { 0 };
+      std::atomic<qint64> bytes     { 0 };    // input
+      std::atomic<qint64> decodeNs  { 0 };    // read, decode, crop, scale
+      std::atomic<qint64> writeNs   { 0 };    // compress and write
+      };
+
+static qint64 nsSince(std::chrono::steady_clock::time_point t)
+      {
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t).count();
+      }
+
+//---------------------------------------------------------
+//   convertFrame
+//---------------------------------------------------------
+
+static bool convertFrame(const Input& in, const Options& o, const FrameRef& r, Stats* s)
+      {
+      static thread_local std::vector<uchar> data;
+      auto start = std::chrono::steady_clock::now();
+      if (!in.read(r, &data)) {
+            fprintf(stderr, "cam-convert: cannot read frame %d\n", r.number);
+            return false;
+            }
+      QImage image;
+      if (o.rawFormat == V4L2_PIX_FMT_YUYV) {
+            image = QImage(o.width, o.height, o.format);
+            yuyvToImage(data.data(), o.width * 2, &image);
+            }
+      else if (o.rawFormat == V4L2_PIX_FMT_NV12) {
+            image = QImage(o.width, o.height, o.format);
+            nv12ToImage(data.data(), o.width, data.data() + o.width * o.height, o.width, &image);
+            }
+      else {
+            JpegInfo info;
+            JpegError e = jpegValidate(data.data(), data.size(), &info);
+            if (e != JpegError::None) {
+                  fprintf(stderr, "cam-convert: skipping frame %d: %s\n", r.number, jpegErrorName(e));
+                  return false;
+                  }
+            MjpegDecoder* d = MjpegDecoder::local();
+            d->setFormat(o.format);
+            if (!d->decode(data.data(), data.size(), &image)) {
+                  fprintf(stderr, "cam-convert: cannot decode frame %d\n", r.number);
+                  return false;
+                  }
+            }
+      if (!o.crop.isEmpty()) {
+            // copy() of the empty intersection would copy the
+            // whole frame
+
+            QRect crop = o.crop.intersected(image.rect());
+            if (crop.isEmpty()) {
+                  fprintf(stderr, "cam-convert: crop outside of frame %d (%dx%d)\n",
+                     r.number, image.width(), image.height());
+                  return false;
+                  }
+            image = image.copy(crop);
+            }
+      if (o.downscale > 1) {
+            image = image.scaled(qMax(1, image.width() / o.downscale), qMax(1, image.height() / o.downscale),
+               Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+            }
+      s->bytes    += r.size;
+      s->decodeNs += nsSince(start);
+
+      start = std::chrono::steady_clock::now();
+      QString path = QString("%1/%2%3.%4").arg(o.output).arg(o.prefix)
+         .arg(r.number, 6, 10, QChar('0')).arg(o.type == "tiff" ? "tif" : "png");
+      bool ok;
+      if (o.type == "tiff")
+            ok = writeTiff(path, image);
+      else {
+            QImageWriter w(path, "png");
+            if (o.quality >= 0)
+                  w.setQuality(o.quality);
+            ok = w.write(image);
+            if (!ok)
+                  fprintf(stderr, "cam-convert: cannot write <%s>: %s\n", qPrintable(path), qPrintable(w.errorString()));
+            }
+      s->writeNs += nsSince(start);
+      return ok;
+      }
+
+//---------------------------------------------------------
+//   checkCrop
+//    the crop has to overlap the first converted frame;
+//    its size is taken from the jpeg header
+//---------------------------------------------------------
+
+static bool checkCrop(const Input& in, const Options& o, const FrameRef& r)
+      {
+      QSize size(o.width, o.height);
+      if (!o.rawFormat) {
+            std::vector<uchar> data;
+            JpegInfo info;
+            if (!in.read(r, &data) || jpegValidate(data.data(), data.size(), &info) != JpegError::None)
+                  return true;            // reported by convertFrame()
+            size = QSize(info.width, info.height);
+            }
+      if (o.crop.intersects(QRect(QPoint(0, 0), size)))
+            return true;
+      fprintf(stderr, "cam-convert: crop %d,%d,%d,%d is outside of the %dx%d frames\n",
+         o.crop.x(), o.crop.y(), o.crop.width(), o.crop.height(), size.width(), size.height());
+      return false;
+      }
+
+//---------------------------------------------------------
+//   convert
+//    the selected frames with n threads; returns the
+//    elapsed seconds
+//---------------------------------------------------------
+
+static double convert(const QString& path, const Options& o, int threads, Stats* s)
+      {
+      int frameSize = 0;
+      if (o.rawFormat == V4L2_PIX_FMT_YUYV)
+            frameSize = o.width * o.height * 2;
+      else if (o.rawFormat == V4L2_PIX_FMT_NV12)
+            frameSize = o.width * o.height * 3 / 2;
+      Input in;
+      if (!in.open(path, frameSize))
+            return -1.0;
+      in.skip(o.first);
+
+      auto start = std::chrono::steady_clock::now();
+      ThreadPool pool(threads);
+      std::vector<FrameRef> batch;
+      bool checked = o.crop.isEmpty();
+      bool end = false;
+      while (!end) {
+            batch.clear();
+            FrameRef r;
+            while (int(batch.size()) < threads * batchFrames) {
+                  if (!in.next(&r) || (o.last >= 0 && r.number > o.last)) {
+                        end = true;
+                        break;
+                        }
+                  if (r.number >= o.first && (r.number - o.first) % o.every == 0) {
+                        if (!checked && !checkCrop(in, o, r))
+                              return -1.0;
+                        checked = true;
+                        batch.push_back(r);
+                        }
+                  }
+            pool.run(batch.size(), [&](int i) {
+                  if (convertFrame(in, o, batch[i], s))
+                        ++s->frames;
+                  else
+                        ++s->failed;
+                  });
+            }
+      return nsSince(start) * 1e-9;
+      }
+
+//---------------------------------------------------------
+//   report
+//    busy is the mean number of threads working; with
+//    perfect scaling it equals threads
+//---------------------------------------------------------
+
+static void report(const Stats& s, double seconds, int threads)
+      {
+      double busy = (s.decodeNs + s.writeNs) * 1e-9 / seconds;
+      printf("cam-convert: %d frames (%d failed) in %.2f s, %.1f fps, %.1f MB/s input\n",
+         int(s.frames), int(s.failed), seconds, s.frames / seconds, s.bytes / seconds / 1048576.0);
+      printf("cam-convert: %d threads, %.2f busy (%.0f%%), decode %.1f s, write %.1f s\n",
+         threads, busy, busy * 100.0 / threads, s.decodeNs * 1e-9, s.writeNs * 1e-9);
+      }
+
+//---------------------------------------------------------
+//   peakMemory
+//    resident set size in MB
+//---------------------------------------------------------
+
+static double peakMemory()
+      {
+      struct rusage ru;
+      getrusage(RUSAGE_SELF, &ru);
+      return ru.ru_maxrss / 1024.0;
+      }
+
+//---------------------------------------------------------
+//   parseRange
+//    "a-b", "a-" or "a"
+//---------------------------------------------------------
+
+static bool parseRange(const QString& s, int* first, int* last)
+      {
+      QStringList sl = s.split('-');
+      bool ok1 = true, ok2 = true;
+      *first = sl[0].isEmpty() ? 0 : sl[0].toInt(&ok1);
+      if (sl.size() == 1)
+            *last = *first;
+      else
+            *last = sl[1].isEmpty() ? -1 : sl[1].toInt(&ok2);
+      return ok1 && ok2 && sl.size() <= 2 && *first >= 0 && (*last < 0 || *last >= *first);
+      }
+
+//---------------------------------------------------------
+//   main
+//---------------------------------------------------------
+
+int main(int argc, char* argv[])
+      {
+      QCoreApplication app(argc, argv);
+      QCommandLineParser parser;
+      parser.setApplicationDescription("Convert a recording into one image per frame");
+      parser.addHelpOption();
+      parser.addPositionalArgument("recording", "Mjpeg recording (cam --record) or raw frames.");
+      QCommandLineOption outputOption("output", "Output directory.", "dir", ".");
+      QCommandLineOption prefixOption("prefix", "Output file name prefix.", "prefix", "frame-");
+      QCommandLineOption typeOption("type", "Output file type (png or tiff).", "type", "png");
+      QCommandLineOption qualityOption("quality", "Png quality 0 - 100, lower compresses more.", "n", "-1");
+      QCommandLineOption rawOption("raw", "Raw recording of pixel format yuyv or nv12, needs --size.", "format");
+      QCommandLineOption sizeOption("size", "Frame size WxH of raw recordings.", "size");
+      QCommandLineOption framesOption("frames", "Frame range first-last, counted from 0.", "range");
+      QCommandLineOption everyOption("every", "Convert every n'th frame of the range.", "n", "1");
+      QCommandLineOption cropOption("crop", "Crop to x,y,w,h.", "rect");
+      QCommandLineOption downscaleOption("downscale", "Scale down by n after cropping.", "n", "1");
+      QCommandLineOption grayOption("gray", "Write 8 bit gray images.");
+      QCommandLineOption threadsOption("threads", "Number of threads, 0: all cores.", "n", "0");
+      QCommandLineOption scalingOption("scaling", "Convert with 1, 2, 4 ... threads and report the scaling.");
+      parser.addOption(outputOption);
+      parser.addOption(prefixOption);
+      parser.addOption(typeOption);
+      parser.addOption(qualityOption);
+      parser.addOption(rawOption);
+      parser.addOption(sizeOption);
+      parser.addOption(framesOption);
+      parser.addOption(everyOption);
+      parser.addOption(cropOption);
+      parser.addOption(downscaleOption);
+      parser.addOption(grayOption);
+      parser.addOption(threadsOption);
+      parser.addOption(scalingOption);
+      parser.process(app);
+
+      QStringList args = parser.positionalArguments();
+      if (args.size() != 1) {
+            fprintf(stderr, "cam-convert: one recording expected\n");
+            return 2;
+            }
+      Options o;
+      o.output    = parser.value(outputOption);
+      o.prefix    = parser.value(prefixOption);
+      o.type      = parser.value(typeOption);
+      o.quality   = parser.value(qualityOption).toInt();
+      o.every     = qMax(1, parser.value(everyOption).toInt());
+      o.downscale = qMax(1, parser.value(downscaleOption).toInt());
+      o.format    = parser.isSet(grayOption) ? QImage::Format_Grayscale8 : QImage::Format_RGB32;
+      if (o.type != "png" && o.type != "tiff") {
+            fprintf(stderr, "cam-convert: bad type <%s>\n", qPrintable(o.type));
+            return 2;
+            }
+      if (!QFileInfo(o.output).isDir()) {
+            fprintf(stderr, "cam-convert: no directory <%s>\n", qPrintable(o.output));
+            return 2;
+            }
+      if (parser.isSet(rawOption)) {
+            QString raw = parser.value(rawOption).toLower();
+            QStringList sl = parser.value(sizeOption).split('x');
+            if (raw == "yuyv")
+                  o.rawFormat = V4L2_PIX_FMT_YUYV;
+            else if (raw == "nv12")
+                  o.rawFormat = V4L2_PIX_FMT_NV12;
+            if (!o.rawFormat || sl.size() != 2 || sl[0].toInt() <= 0 || sl[1].toInt() <= 0) {
+                  fprintf(stderr, "cam-convert: --raw yuyv|nv12 needs --size WxH\n");
+                  return 2;
+                  }
+            o.width  = sl[0].toInt();
+            o.height = sl[1].toInt();
+            }
+      if (parser.isSet(framesOption) && !parseRange(parser.value(framesOption), &o.first, &o.last)) {
+            fprintf(stderr, "cam-convert: bad frame range <%s>\n", qPrintable(parser.value(framesOption)));
+            return 2;
+            }
+      if (parser.isSet(cropOption)) {
+            QStringList sl = parser.value(cropOption).split(',');
+            if (sl.size() != 4 || sl[2].toInt() <= 0 || sl[3].toInt() <= 0) {
+                  fprintf(stderr, "cam-convert: bad crop <%s>\n", qPrintable(parser.value(cropOption)));
+                  return 2;
+                  }
+            o.crop = QRect(sl[0].toInt(), sl[1].toInt(), sl[2].toInt(), sl[3].toInt());
+            }
+      int threads = parser.value(threadsOption).toInt();
+      if (threads <= 0)
+            threads = ThreadPool::global()->size();
+
+      if (!parser.isSet(scalingOption)) {
+            Stats s;
+            double t = convert(args[0], o, threads, &s);
+            if (t < 0.0)
+                  return 1;
+            report(s, t, threads);
+            printf("cam-convert: peak memory %.1f MB\n", peakMemory());
+            return s.failed ? 1 : 0;
+            }
+
+      // the same frames with 1, 2, 4 ... threads
+
+      double fps1 = 0.0;
+      for (int n = 1; ; n = qMin(n * 2, threads)) {
+            Stats s;
+            double t = convert(args[0], o, n, &s);
+            if (t < 0.0)
+                  return 1;
+            report(s, t, n);
+            double fps = s.frames / t;
+            if (n == 1)
+                  fps1 = fps;
+            printf("cam-convert: %d threads %.1f fps, speedup %.2f, efficiency %.0f%%\n\n",
+               n, fps, fps / fps1, fps / fps1 * 100.0 / n);
+            if (n == threads)
+                  break;
+            }
+      printf("cam-convert: peak memory %.1f MB\n", peakMemory());
+      return 0;
+      }
@@ -0,0 +1,477 @@
+//=============================================================================
+//  Cam
+//  Webcam client
+//
+//  Copyright (C) 2016 Werner Schweer
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License version 2
+//  as published by the Free Software Foundation and appearing in
+//  the file LICENCE.GPL
+//=============================================================================
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <QFile>
+
+#include "correction.h"
+#include "threadpool.h"
+#include "trace.h"
+
+static const int maxGain = 32767;      // 7.99 in Q12
+
+//---------------------------------------------------------
+//   fileName
+//---------------------------------------------------------
+
+QString Calibration::fileName(const QString& dir, int w, int h)
+      {
+      return QString("%1/calibration-%2x%3.cal").arg(dir).arg(w).arg(h);
+      }
+
+//---------------------------------------------------------
+//   save
+//    text header line followed by the dark frame (8 bit)
+//    and the flat frame (16 bit, host byte order)
+//---------------------------------------------------------
+
+bool Calibration::save(const QString& path) const
+      {
+      QFile f(path);
+      if (!f.open(QIODevice::WriteOnly)) {
+            fprintf(stderr, "cannot write calibration <%s>\n", qPrintable(path));
+            return false;
+            }
+      QByteArray header = QString("cam-calibration %1 %2 %3 %4\n").arg(width).arg(height)
+         .arg(dark.empty() ? 0 : 1).arg(flat.empty() ? 0 : 1).toLatin1();
+      bool ok = f.write(header) == header.size();
+      if (ok && !dark.empty())
+            ok = f.write((const char*)dark.data(), dark.size()) == qint64(dark.size());
+      if (ok && !flat.empty())
+            ok = f.write((const char*)flat.data(), flat.size() * 2) == qint64(flat.size() * 2);
+      if (!ok)
+            fprintf(stderr, "cannot write calibration <%s>\n", qPrintable(path));
+      return ok;
+      }
+
+//---------------------------------------------------------
+//   load
+//    return false if there is no valid calibration file;
+//    the calibration is left empty then
+//---------------------------------------------------------
+
+bool Calibration::load(const QString& path)
+      {
+      *this = Calibration();
+      QFile f(path);
+      if (!f.open(QIODevice::ReadOnly))
+            return false;
+      int w, h, d, fl;
+      QByteArray header = f.readLine(128);
+      if (sscanf(header.constData(), "cam-calibration %d %d %d %d", &w, &h, &d, &fl) != 4
+         || w <= 0 || h <= 0 || w > 16384 || h > 16384) {
+            fprintf(stderr, "bad calibration file <%s>\n", qPrintable(path));
+            return false;
+            }
+      size_t n = size_t(w) * h;
+      std::vector<uchar> dk(d ? n : 0);
+      std::vector<quint16> ft(fl ? n : 0);
+      bool ok = dk.empty() || f.read((char*)dk.data(), n) == qint64(n);
+      ok = ok && (ft.empty() || f.read((char*)ft.data(), n * 2) == qint64(n * 2));
+      if (!ok) {
+            fprintf(stderr, "calibration file <%s> is truncated\n", qPrintable(path));
+            return false;
+            }
+      width  = w;
+      height = h;
+      dark.swap(dk);
+      flat.swap(ft);
+      return true;
+      }
+
+//---------------------------------------------------------
+//   LensCorrection
+//    gain and dark level are computed per source pixel and
+//    then moved with the remap table, so vignetting is
+//    corrected where it was recorded
+//---------------------------------------------------------
+
+LensCorrection::LensCorrection(int _w, int _h, const Calibration& c, const CorrectionSetting& s)
+   : w(_w), h(_h)
+      {
+      TraceScope ts("correction table");
+      size_t n = size_t(w) * h;
+      _gain.assign(n, 1 << gainShift);
+      _darkY.assign(n, 0);
+      _dark.assign(n, 0);
+      if (s.flatField && c.width == w && c.height == h) {
+            for (size_t i = 0; i < c.dark.size(); ++i) {
+                  _dark[i]  = c.dark[i];
+                  _darkY[i] = (c.dark[i] * 219 + 127) / 255;
+                  }
+            if (!c.flat.empty()) {
+                  // gain brings every pixel to the mean of the
+                  // dark corrected flat frame
+
+                  double sum = 0.0;
+                  for (size_t i = 0; i < n; ++i)
+                        sum += c.flat[i] - _dark[i] * 256.0;
+                  double mean = sum / n;
+                  for (size_t i = 0; i < n; ++i) {
+                        double v = c.flat[i] - _dark[i] * 256.0;
+                        double g = v > 64.0 ? mean / v * (1 << gainShift) : double(maxGain);
+                        _gain[i] = qint16(qMin(g + 0.5, double(maxGain)));
+                        }
+                  }
+            }
+      if (!s.distortion() || w < 2 || h < 2)
+            return;
+
+      std::vector<qint16> gain(n), darkY(n), dark(n);
+      _remap.resize(n);
+      double cx   = (w - 1) * 0.5;
+      double cy   = (h - 1) * 0.5;
+      double norm = 1.0 / sqrt(cx * cx + cy * cy);
+      for (int y = 0; y < h; ++y) {
+            for (int x = 0; x < w; ++x) {
+                  size_t i = size_t(y) * w + x;
+                  double dx = (x - cx) * norm;
+                  double dy = (y - cy) * norm;
+                  double r2 = dx * dx + dy * dy;
+                  double f  = 1.0 + s.k1 * r2 + s.k2 * r2 * r2;
+                  double sx = cx + (x - cx) * f;
+                  double sy = cy + (y - cy) * f;
+                  Remap& m  = _remap[i];
+                  if (sx < 0.0 || sy < 0.0 || sx > w - 1 || sy > h - 1) {
+                        m        = { 0, 0, 0, 0 };
+                        gain[i]  = 0;
+                        darkY[i] = 0;
+                        dark[i]  = 0;
+                        continue;
+                        }
+                  int ix = int(sx);
+                  int iy = int(sy);
+                  int fx = int((sx - ix) * 16.0 + 0.5);
+                  int fy = int((sy - iy) * 16.0 + 0.5);
+                  if (fx == 16) {
+                        ++ix;
+                        fx = 0;
+                        }
+                  if (fy == 16) {
+                        ++iy;
+                        fy = 0;
+                        }
+                  // the neighbor x + 1, y + 1 must stay inside
+                  if (ix >= w - 1) {
+                        ix = w - 2;
+                        fx = 16;
+                        }
+                  if (iy >= h - 1) {
+                        iy = h - 2;
+                        fy = 16;
+                        }
+                  m = { quint16(ix), quint16(iy), uchar(fx), uchar(fy) };
+                  size_t si = size_t(iy + (fy >= 8)) * w + ix + (fx >= 8);
+                  gain[i]   = _gain[si];
+                  darkY[i]  = _darkY[si];
+                  dark[i]   = _dark[si];
+                  }
+            }
+      _gain.swap(gain);
+      _darkY.swap(darkY);
+      _dark.swap(dark);
+      }
+
+//---------------------------------------------------------
+//   memory
+//---------------------------------------------------------
+
+qint64 LensCorrection::memory() const
+      {
+      return qint64(_gain.size() + _darkY.size() + _dark.size()) * sizeof(qint16)
+         + qint64(_remap.size()) * sizeof(Remap);
+      }
+
+//---------------------------------------------------------
+//   pixel formats of decoded images
+//    get() reads the channels of one pixel, put() writes
+//    them back clamped
+//---------------------------------------------------------
+
+static inline int clamp8(int v)
+      {
+      return v < 0 ? 0 : (v > 255 ? 255 : v);
+      }
+
+struct Rgb32Px {
+      static const int bpp = 4, channels = 3;
+      static inline void get(const uchar* p, int* c) {
+            c[0] = p[0];
+            c[1] = p[1];
+            c[2] = p[2];
+            }
+      static inline void put(const int* c, uchar* p) {
+            p[0] = clamp8(c[0]);
+            p[1] = clamp8(c[1]);
+            p[2] = clamp8(c[2]);
+            p[3] = 0xff;
+            }
+      };
+
+struct Rgb888Px {
+      static const int bpp = 3, channels = 3;
+      static inline void get(const uchar* p, int* c) {
+            c[0] = p[0];
+            c[1] = p[1];
+            c[2] = p[2];
+            }
+      static inline void put(const int* c, uchar* p) {
+            p[0] = clamp8(c[0]);
+            p[1] = clamp8(c[1]);
+            p[2] = clamp8(c[2]);
+            }
+      };
+
+struct Rgb16Px {
+      static const int bpp = 2, channels = 3;
+      static inline void get(const uchar* p, int* c) {
+            int v = *(const quint16*)p;
+            c[0] = ((v >> 8) & 0xf8) | (v >> 13);
+            c[1] = ((v >> 3) & 0xfc) | ((v >> 9) & 3);
+            c[2] = ((v << 3) & 0xf8) | ((v >> 2) & 7);
+            }
+      static inline void put(const int* c, uchar* p) {
+            *(quint16*)p = ((clamp8(c[0]) & 0xf8) << 8) | ((clamp8(c[1]) & 0xfc) << 3) | (clamp8(c[2]) >> 3);
+            }
+      };
+
+struct Gray8Px {
+      static const int bpp = 1, channels = 1;
+      static inline void get(const uchar* p, int* c) { c[0] = p[0]; }
+      static inline void put(const int* c, uchar* p) { p[0] = clamp8(c[0]); }
+      };
+
+//---------------------------------------------------------
+//   correctRow
+//    dark level and gain of one row in place
+//---------------------------------------------------------
+
+template <class F>
+static void correctRow(uchar* p, const qint16* gain, const qint16* dark, int w)
+      {
+      int x = 0;
+#ifdef __SSE2__
+      const __m128i zero = _mm_setzero_si128();
+      if (F::bpp == 4) {
+            // 4 pixel, gain and dark level broadcast to
+            // the channels of their pixel
+            for (; x + 4 <= w; x += 4) {
+                  uchar* d  = p + x * 4;
+                  __m128i s = _mm_loadu_si128((const __m128i*)d);
+                  __m128i g = _mm_loadl_epi64((const __m128i*)(gain + x));
+                  __m128i k = _mm_loadl_epi64((const __m128i*)(dark + x));
+                  g = _mm_unpacklo_epi16(g, g);
+                  k = _mm_unpacklo_epi16(k, k);
+                  __m128i lo = _mm_sub_epi16(_mm_unpacklo_epi8(s, zero), _mm_unpacklo_epi32(k, k));
+                  __m128i hi = _mm_sub_epi16(_mm_unpackhi_epi8(s, zero), _mm_unpackhi_epi32(k, k));
+                  lo = _mm_mulhi_epi16(_mm_slli_epi16(lo, 4), _mm_unpacklo_epi32(g, g));
+                  hi = _mm_mulhi_epi16(_mm_slli_epi16(hi, 4), _mm_unpackhi_epi32(g, g));
+                  s  = _mm_or_si128(_mm_packus_epi16(lo, hi), _mm_set1_epi32(0xff000000));
+                  _mm_storeu_si128((__m128i*)d, s);
+                  }
+            }
+      else if (F::bpp == 1) {
+            for (; x + 8 <= w; x += 8) {
+                  __m128i s = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(p + x)), zero);
+                  s = _mm_sub_epi16(s, _mm_loadu_si128((const __m128i*)(dark + x)));
+                  s = _mm_mulhi_epi16(_mm_slli_epi16(s, 4), _mm_loadu_si128((const __m128i*)(gain + x)));
+                  _mm_storel_epi64((__m128i*)(p + x), _mm_packus_epi16(s, s));
+                  }
+            }
+#endif
+      for (; x < w; ++x) {
+            uchar* d = p + x * F::bpp;
+            int c[3];
+            F::get(d, c);
+            for (int i = 0; i < F::channels; ++i)
+                  c[i] = ((c[i] - dark[x]) * gain[x]) >> LensCorrection::gainShift;
+            F::put(c, d);
+            }
+      }
+
+//---------------------------------------------------------
+//   remapRow
+//    bilinear resampling of one row followed by dark
+//    level and gain
+//---------------------------------------------------------
+
+template <class F>
+static void remapRow(const QImage& src, const LensCorrection::Remap* m, uchar* p,
+   const qint16* gain, const qint16* dark, int w)
+      {
+      const uchar* s = src.constBits();
+      int stride     = src.bytesPerLine();
+      int x = 0;
+#ifdef __SSE2__
+      if (F::bpp == 4) {
+            // one pixel, the four neighbors in 16 bit lanes;
+            // the weighted sums stay below 65536 unsigned
+            const __m128i zero = _mm_setzero_si128();
+            for (; x < w; ++x, ++m) {
+                  const uchar* a = s + m->y * stride + m->x * 4;
+                  __m128i top = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)a), zero);
+                  __m128i bot = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(a + stride)), zero);
+                  __m128i v   = _mm_add_epi16(_mm_mullo_epi16(top, _mm_set1_epi16(16 - m->fy)),
+                                              _mm_mullo_epi16(bot, _mm_set1_epi16(m->fy)));
+                  __m128i fx  = _mm_set1_epi16(m->fx);
+                  __m128i wx  = _mm_unpacklo_epi64(_mm_sub_epi16(_mm_set1_epi16(16), fx), fx);
+                  v = _mm_mullo_epi16(v, wx);
+                  v = _mm_add_epi16(v, _mm_srli_si128(v, 8));
+                  v = _mm_srli_epi16(_mm_add_epi16(v, _mm_set1_epi16(128)), 8);
+                  v = _mm_sub_epi16(v, _mm_set1_epi16(dark[x]));
+                  v = _mm_mulhi_epi16(_mm_slli_epi16(v, 4), _mm_set1_epi16(gain[x]));
+                  v = _mm_or_si128(_mm_packus_epi16(v, v), _mm_set1_epi32(0xff000000));
+                  *(quint32*)(p + x * 4) = _mm_cvtsi128_si32(v);
+                  }
+            }
+#endif
+      for (; x < w; ++x, ++m) {
+            const uchar* a = s + m->y * stride + m->x * F::bpp;
+            int c00[3], c01[3], c10[3], c11[3], c[3];
+            F::get(a, c00);
+            F::get(a + F::bpp, c01);
+            F::get(a + stride, c10);
+            F::get(a + stride + F::bpp, c11);
+            for (int i = 0; i < F::channels; ++i) {
+                  int top = c00[i] * 16 + (c01[i] - c00[i]) * m->fx;
+                  int bot = c10[i] * 16 + (c11[i] - c10[i]) * m->fx;
+                  int v   = (top * 16 + (bot - top) * m->fy + 128) >> 8;
+                  c[i]    = ((v - dark[x]) * gain[x]) >> LensCorrection::gainShift;
+                  }
+            F::put(c, p + x * F::bpp);
+            }
+      }
+
+//---------------------------------------------------------
+//   applyTo
+//    remapping in bands of rows on the thread pool
+//---------------------------------------------------------
+
+template <class F>
+static void applyTo(const LensCorrection& lc, const QImage& src, QImage* dst)
+      {
+      uchar* d       = dst->bits();
+      int stride     = dst->bytesPerLine();
+      int h          = lc.height();
+      int n          = lc.remap() ? ThreadPool::global()->size() : 1;
+      int bandHeight = (h + n - 1) / n;
+      unsigned frame = Trace::frame();
+      ThreadPool::global()->run(n, [&](int i) {
+            Trace::setFrame(frame);
+            TraceScope ts("correct");
+            for (int row = i * bandHeight; row < qMin(h, (i + 1) * bandHeight); ++row) {
+                  uchar* p = d + row * stride;
+                  if (lc.remap())
+                        remapRow<F>(src, lc.remap(row), p, lc.gain(row), lc.dark(row), lc.width());
+                  else
+                        correctRow<F>(p, lc.gain(row), lc.dark(row), lc.width());
+                  }
+            });
+      }
+
+//---------------------------------------------------------
+//   apply
+//    correct a decoded image of the table size; dst may
+//    be src without distortion correction, else it must be
+//    an allocated image of the same size and format
+//---------------------------------------------------------
+
+bool LensCorrection::apply(const QImage& src, QImage* dst) const
+      {
+      if (src.width() != w || src.height() != h || dst->size() != src.size() || dst->format() != src.format()
+         || (remap() && dst == &src))
+            return false;
+      if (!remap() && dst != &src)
+            *dst = src.copy();
+      switch (src.format()) {
+            case QImage::Format_RGB32:
+            case QImage::Format_ARGB32:
+                  applyTo<Rgb32Px>(*this, src, dst);
+                  break;
+            case QImage::Format_RGB888:
+                  applyTo<Rgb888Px>(*this, src, dst);
+                  break;
+            case QImage::Format_RGB16:
+                  applyTo<Rgb16Px>(*this, src, dst);
+                  break;
+            case QImage::Format_Grayscale8:
+                  applyTo<Gray8Px>(*this, src, dst);
+                  break;
+            default:
+                  return false;
+            }
+      return true;
+      }
+
+//---------------------------------------------------------
+//   frame
+//    sum up the luma; restarts if the frame size changes
+//---------------------------------------------------------
+
+void Calibrator::frame(const FramePtr& f)
+      {
+      const QImage& image = f->image();
+      if (image.isNull())
+            return;
+      TraceScope ts("calibrate");
+      QImage luma = image.format() == QImage::Format_Grayscale8
+         ? image : image.convertToFormat(QImage::Format_Grayscale8);
+      if (luma.width() != w || luma.height() != h) {
+            w     = luma.width();
+            h     = luma.height();
+            count = 0;
+            sum.assign(size_t(w) * h, 0);
+            }
+      for (int y = 0; y < h; ++y) {
+            const uchar* s = luma.constScanLine(y);
+            quint32* d     = sum.data() + size_t(y) * w;
+            for (int x = 0; x < w; ++x)
+                  d[x] += s[x];
+            }
+      if (++count >= frames)
+            _done = true;
+      }
+
+//---------------------------------------------------------
+//   result
+//    store the mean frame into c; a calibration of another
+//    size is replaced
+//---------------------------------------------------------
+
+void Calibrator::result(Calibration* c) const
+      {
+      if (!_done)
+            return;
+      if (c->width != w || c->height != h) {
+            *c = Calibration();
+            c->width  = w;
+            c->height = h;
+            }
+      size_t n = sum.size();
+      if (_type == Type::Dark) {
+            c->dark.resize(n);
+            for (size_t i = 0; i < n; ++i)
+                  c->dark[i] = (sum[i] + count / 2) / count;
+            }
+      else {
+            c->flat.resize(n);
+            for (size_t i = 0; i < n; ++i)
+                  c->flat[i] = qMin((quint64(sum[i]) * 256 + count / 2) / count, quint64(0xffff));
+            }
+      }
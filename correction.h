@@ -0,0 +1,135 @@
+//=============================================================================
+//  Cam
+//  Webcam client
+//
+//  Copyright (C) 2016 Werner Schweer
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License version 2
+//  as published by the Free Software Foundation and appearing in
+//  the file LICENCE.GPL
+//=============================================================================
+
+#ifndef __CORRECTION_H__
+#define __CORRECTION_H__
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include <QImage>
+#include <QString>
+
+#include "frame.h"
+
+//---------------------------------------------------------
+//   Calibration
+//    dark and flat frame of one resolution: mean luma
+//    (full range) of a number of frames taken with the
+//    lens covered and of an evenly lit empty field
+//---------------------------------------------------------
+
+struct Calibration {
+      int width  { 0 };
+      int height { 0 };
+      std::vector<uchar> dark;            // empty: no dark frame
+      std::vector<quint16> flat;          // luma * 256, empty: no flat frame
+
+      bool isEmpty() const                { return dark.empty() && flat.empty(); }
+      bool load(const QString& path);
+      bool save(const QString& path) const;
+      static QString fileName(const QString& dir, int w, int h);
+      };
+
+//---------------------------------------------------------
+//   CorrectionSetting
+//    k1, k2: radial distortion, the source of an output
+//    pixel at normalized radius r (1 at the corners) is
+//    taken at r * (1 + k1 r^2 + k2 r^4); negative k1
+//    corrects barrel distortion
+//---------------------------------------------------------
+
+struct CorrectionSetting {
+      bool flatField { false };
+      double k1      { 0.0 };
+      double k2      { 0.0 };
+
+      bool distortion() const             { return k1 != 0.0 || k2 != 0.0; }
+      bool enabled() const                { return flatField || distortion(); }
+      };
+
+//---------------------------------------------------------
+//   LensCorrection
+//    precomputed tables of one resolution, built once:
+//    per output pixel dark level and gain (Q12) and, with
+//    distortion, a fixed point remap to the source pixel
+//    with 4 bit bilinear weights. Pixels mapped outside
+//    the source get gain 0.
+//
+//    raw formats are corrected inside the yuv converters
+//    (yuv.cpp), decoded jpeg images by apply()
+//---------------------------------------------------------
+
+class LensCorrection {
+   public:
+      struct Remap {
+            quint16 x, y;                 // source pixel
+            uchar fx, fy;                 // bilinear weights of x + 1, y + 1; 0 - 16
+            };
+
+   private:
+      int w, h;
+      std::vector<qint16> _gain;          // Q12
+      std::vector<qint16> _darkY;         // limited range luma (raw formats)
+      std::vector<qint16> _dark;          // full range luma (rgb)
+      std::vector<Remap> _remap;          // empty: identity
+
+   public:
+      static const int gainShift = 12;
+
+      LensCorrection(int w, int h, const Calibration&, const CorrectionSetting&);
+      int width() const                   { return w; }
+      int height() const                  { return h; }
+      bool remap() const                  { return !_remap.empty(); }
+      const qint16* gain(int row) const   { return _gain.data() + row * w; }
+      const qint16* darkY(int row) const  { return _darkY.data() + row * w; }
+      const qint16* dark(int row) const   { return _dark.data() + row * w; }
+      const Remap* remap(int row) const   { return _remap.data() + row * w; }
+      qint64 memory() const;
+      bool apply(const QImage& src, QImage* dst) const;
+      };
+
+typedef std::shared_ptr<const LensCorrection> LensCorrectionPtr;
+
+//---------------------------------------------------------
+//   Calibrator
+//    averages the luma of the next frames into a dark or
+//    flat frame; done() after the last one
+//---------------------------------------------------------
+
+class Calibrator : public FrameConsumer {
+   public:
+      enum class Type { Dark, Flat };
+
+   private:
+      Type _type;
+      int frames;
+      int count { 0 };
+      int w     { 0 };
+      int h     { 0 };
+      std::vector<quint32> sum;
+      std::atomic<bool> _done { false };
+
+   public:
+      Calibrator(Type t, int n) : _type(t), frames(n) {}
+      Type type() const                   { return _type; }
+      bool done() const                   { return _done; }
+      void result(Calibration*) const;
+
+      virtual bool wantsFrame(const Frame& f) override { return !_done && !f.error(); }
+      virtual bool wantsImage(const Frame&) override   { return true; }
+      virtual void frame(const FramePtr&) override;
+      };
+
+#endif
+
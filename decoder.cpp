@@ -0,0 +1,529 @@
+//=============================================================================
+//  Cam
+//  Webcam client
+//
+//  Copyright (C) 2016 Werner Schweer
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License version 2
+//  as published by the Free Software Foundation and appearing in
+//  the file LICENCE.GPL
+//=============================================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <memory>
+
+extern "C" {
+      #include <libavcodec/avcodec.h>
+      #include <libavutil/pixdesc.h>
+      #include <libswscale/swscale.h>
+      }
+#ifdef HAVE_TURBOJPEG
+#include <turbojpeg.h>
+#endif
+
+#include "average.h"
+#include "decoder.h"
+#include "histogram.h"
+#include "jpeg.h"
+#include "threadpool.h"
+#include "trace.h"
+
+//---------------------------------------------------------
+//   create
+//    create decoder for backend; if no backend is given
+//    the environment variable CAM_DECODER is used,
+//    else avcodec. turbojpeg is only chosen on request
+//    until cam-bench backends shows it is faster on UVC
+//    frames
+//---------------------------------------------------------
+
+MjpegDecoder* MjpegDecoder::create(const QByteArray& b, int threads)
+      {
+      QByteArray backend = b.isEmpty() ? qgetenv("CAM_DECODER") : b;
+      if (threads <= 0)
+            threads = ThreadPool::global()->size();
+#ifdef HAVE_TURBOJPEG
+      if (backend == "turbojpeg")
+            return new TurboMjpegDecoder(threads);
+#endif
+      if (!backend.isEmpty() && backend != "avcodec")
+            fprintf(stderr, "unknown decoder backend <%s>, using avcodec\n", backend.constData());
+      return new AvMjpegDecoder(threads);
+      }
+
+//---------------------------------------------------------
+//   local
+//    decoder of the calling thread
+//---------------------------------------------------------
+
+MjpegDecoder* MjpegDecoder::local()
+      {
+      static thread_local std::unique_ptr<MjpegDecoder> decoder;
+      if (!decoder)
+            decoder.reset(create());
+      return decoder.get();
+      }
+
+//---------------------------------------------------------
+//   backends
+//---------------------------------------------------------
+
+std::vector<QByteArray> MjpegDecoder::backends()
+      {
+      std::vector<QByteArray> bl;
+      bl.push_back("avcodec");
+#ifdef HAVE_TURBOJPEG
+      bl.push_back("turbojpeg");
+#endif
+      return bl;
+      }
+
+//---------------------------------------------------------
+//   pixFormat
+//    map the deprecated full range jpeg formats
+//---------------------------------------------------------
+
+static AVPixelFormat pixFormat(int format)
+      {
+      switch (format) {
+            case AV_PIX_FMT_YUVJ420P: return AV_PIX_FMT_YUV420P;
+            case AV_PIX_FMT_YUVJ422P: return AV_PIX_FMT_YUV422P;
+            case AV_PIX_FMT_YUVJ444P: return AV_PIX_FMT_YUV444P;
+            case AV_PIX_FMT_YUVJ440P: return AV_PIX_FMT_YUV440P;
+            }
+      return AVPixelFormat(format);
+      }
+
+//---------------------------------------------------------
+//   planar
+//    8 bit planar yuv formats the histogram can use
+//    before the rgb conversion
+//---------------------------------------------------------
+
+static bool planar(int format)
+      {
+      switch (format) {
+            case AV_PIX_FMT_YUVJ420P:
+            case AV_PIX_FMT_YUVJ422P:
+            case AV_PIX_FMT_YUVJ444P:
+            case AV_PIX_FMT_YUVJ440P:
+            case AV_PIX_FMT_YUV420P:
+            case AV_PIX_FMT_YUV422P:
+            case AV_PIX_FMT_YUV444P:
+            case AV_PIX_FMT_YUV440P:
+            case AV_PIX_FMT_GRAY8:
+                  return true;
+            }
+      return false;
+      }
+
+//---------------------------------------------------------
+//   averagePlanes
+//    planes and strides of a planar format then point to
+//    the average
+//---------------------------------------------------------
+
+void MjpegDecoder::averagePlanes(const uchar* planes[3], int strides[3], int format, int w, int h)
+      {
+      TraceScope ts("average");
+      int sx = 0, sy = 0;
+      int n  = format == AV_PIX_FMT_GRAY8 ? 1 : 3;
+      if (n == 3)
+            av_pix_fmt_get_chroma_sub_sample(AVPixelFormat(format), &sx, &sy);
+      int cw = -(-w >> sx);
+      int ch = -(-h >> sy);
+      const int widths[3]  = { w, cw, cw };
+      const int heights[3] = { h, ch, ch };
+      _averager->addPlanes(planes, strides, widths, heights, n, planes, strides);
+      }
+
+//---------------------------------------------------------
+//   avFormat
+//    swscale destination format of an image format
+//---------------------------------------------------------
+
+static AVPixelFormat avFormat(QImage::Format format)
+      {
+      switch (format) {
+            case QImage::Format_RGB888:     return AV_PIX_FMT_RGB24;
+            case QImage::Format_RGB16:      return AV_PIX_FMT_RGB565;
+            case QImage::Format_Grayscale8: return AV_PIX_FMT_GRAY8;
+            default:                        return AV_PIX_FMT_RGB32;
+            }
+      }
+
+//---------------------------------------------------------
+//   BandConverter
+//---------------------------------------------------------
+
+BandConverter::~BandConverter()
+      {
+      for (Band& b : band)
+            sws_freeContext(b.ctx);
+      }
+
+//---------------------------------------------------------
+//   setup
+//    jpeg yuv is full range; the deprecated YUVJ formats
+//    are not used, the range is set explicitly
+//---------------------------------------------------------
+
+bool BandConverter::setup(Band* b, int w, int h, int format, int dstFormat)
+      {
+      if (b->ctx && b->w == w && b->h == h && b->format == format && b->dstFormat == dstFormat)
+            return true;
+      sws_freeContext(b->ctx);
+      b->ctx       = sws_getContext(w, h, AVPixelFormat(format), w, h, AVPixelFormat(dstFormat),
+                        SWS_BILINEAR, 0, 0, 0);
+      b->w         = w;
+      b->h         = h;
+      b->format    = format;
+      b->dstFormat = dstFormat;
+      if (!b->ctx)
+            return false;
+      const int* coefficients = sws_getCoefficients(SWS_CS_ITU601);
+      sws_setColorspaceDetails(b->ctx, coefficients, 1, coefficients, 1, 0, 1 << 16, 1 << 16);
+      return true;
+      }
+
+//---------------------------------------------------------
+//   convert
+//    format is an AVPixelFormat. Band boundaries are
+//    multiples of 16 rows so the chroma rows of a band
+//    start at a whole row for all jpeg subsamplings;
+//    other formats are converted in one piece.
+//---------------------------------------------------------
+
+bool BandConverter::convert(const uchar* const planes[3], const int strides[3], int format,
+   QImage* image, int n)
+      {
+      int w         = image->width();
+      int h         = image->height();
+      uchar* dst    = image->bits();
+      int dstStride = image->bytesPerLine();
+      bool yuv      = planar(format);
+      if (yuv && image->format() == QImage::Format_Grayscale8) {
+            for (int y = 0; y < h; ++y)
+                  memcpy(dst + y * dstStride, planes[0] + y * strides[0], w);
+            return true;
+            }
+      int dstFormat = avFormat(image->format());
+      if (!yuv)
+            n = 1;
+      int bandHeight = (((h + n - 1) / n) + 15) & ~15;
+      n = (h + bandHeight - 1) / bandHeight;
+      if (int(band.size()) < n)
+            band.resize(n);
+      int sy = 0;
+      if (yuv && format != AV_PIX_FMT_GRAY8) {
+            int sx;
+            av_pix_fmt_get_chroma_sub_sample(AVPixelFormat(format), &sx, &sy);
+            }
+      std::atomic<bool> ok { true };
+      unsigned frame = Trace::frame();
+      ThreadPool::global()->run(n, [&](int i) {
+            Trace::setFrame(frame);
+            TraceScope ts("convert");
+            int y0   = i * bandHeight;
+            int rows = qMin(bandHeight, h - y0);
+            if (!setup(&band[i], w, rows, format, dstFormat)) {
+                  ok = false;
+                  return;
+                  }
+            const uint8_t* src[3] = {
+                  planes[0] + y0 * strides[0],
+                  planes[1] ? planes[1] + (y0 >> sy) * strides[1] : 0,
+                  planes[2] ? planes[2] + (y0 >> sy) * strides[2] : 0
+                  };
+            uint8_t* d = dst + y0 * dstStride;
+            sws_scale(band[i].ctx, src, strides, 0, rows, &d, &dstStride);
+            });
+      return ok;
+      }
+
+//---------------------------------------------------------
+//   AvMjpegDecoder
+//    slice threads only; frame threads would delay every
+//    frame by one
+//---------------------------------------------------------
+
+AvMjpegDecoder::AvMjpegDecoder(int n)
+   : threads(n)
+      {
+      avcodec_register_all();
+      codec = avcodec_find_decoder(AV_CODEC_ID_MJPEG);
+      if (!codec) {
+            printf("codec not found\n");
+            abort();
+            }
+      c = avcodec_alloc_context3(codec);
+      if (threads > 1 && (codec->capabilities & AV_CODEC_CAP_SLICE_THREADS)) {
+            c->thread_count = threads;
+            c->thread_type  = FF_THREAD_SLICE;
+            }
+      if (avcodec_open2(c, codec, 0) < 0) {
+            printf("open codec failed\n");
+            exit(1);
+            }
+      frame = av_frame_alloc();
+      }
+
+AvMjpegDecoder::~AvMjpegDecoder()
+      {
+      if (lowres) {
+            avcodec_close(lowres);
+            av_free(lowres);
+            }
+      av_frame_free(&frame);
+      avcodec_close(c);
+      av_free(c);
+      }
+
+//---------------------------------------------------------
+//   decode
+//    frames without huffman tables are handled by the
+//    libavcodec decoder itself
+//---------------------------------------------------------
+
+bool AvMjpegDecoder::decode(const uchar* data, int size, QImage* image, Histogram* histogram)
+      {
+      AVPacket p;
+      av_init_packet(&p);
+      p.data = (uint8_t*)data;
+      p.size = size;
+
+      {
+      TraceScope ts("jpeg decode");
+      if (avcodec_send_packet(c, &p) < 0) {
+            printf("send packet failed\n");
+            return false;
+            }
+      if (avcodec_receive_frame(c, frame) < 0) {
+            printf("receive frame failed\n");
+            return false;
+            }
+      }
+      int w = frame->width;
+      int h = frame->height;
+      if (image->width() != w || image->height() != h || image->format() != _format)
+            *image = QImage(w, h, _format);
+      const uchar* planes[3] = { frame->data[0], frame->data[1], frame->data[2] };
+      int strides[3]         = { frame->linesize[0], frame->linesize[1], frame->linesize[2] };
+      if (_averager && planar(frame->format))
+            averagePlanes(planes, strides, frame->format, w, h);
+
+      // meter the decoder output planes; jpeg is full range
+
+      bool metered = false;
+      if (histogram && planar(frame->format)) {
+            int sx = 0, sy = 0;
+            bool gray = frame->format == AV_PIX_FMT_GRAY8;
+            if (!gray)
+                  av_pix_fmt_get_chroma_sub_sample(AVPixelFormat(frame->format), &sx, &sy);
+            YuvPlanes p { planes[0], gray ? 0 : planes[1], gray ? 0 : planes[2],
+               strides[0], 1, strides[1], 1, sx, sy, w, h, true };
+            histogramYuv(histogram, p);
+            metered = true;
+            }
+      bool ok = converter.convert(planes, strides, pixFormat(frame->format), image, threads);
+      av_frame_unref(frame);
+      if (!ok) {
+            printf("no conversion context\n");
+            return false;
+            }
+      if (histogram && !metered && _format == QImage::Format_RGB32)
+            histogramRgb32(histogram, image->constBits(), image->bytesPerLine(), w, h);
+      return true;
+      }
+
+//---------------------------------------------------------
+//   decodeLuma
+//    the mjpeg decoder skips the inverse DCT at lowres 3;
+//    the context is opened on first use
+//---------------------------------------------------------
+
+bool AvMjpegDecoder::decodeLuma(const uchar* data, int size, std::vector<uchar>* luma, int* w, int* h)
+      {
+      if (!lowres) {
+            lowres = avcodec_alloc_context3(codec);
+            lowres->lowres = qMin(3, int(codec->max_lowres));
+            if (avcodec_open2(lowres, codec, 0) < 0) {
+                  printf("open lowres codec failed\n");
+                  av_free(lowres);
+                  lowres = 0;
+                  return false;
+                  }
+            }
+      AVPacket p;
+      av_init_packet(&p);
+      p.data = (uint8_t*)data;
+      p.size = size;
+      if (avcodec_send_packet(lowres, &p) < 0 || avcodec_receive_frame(lowres, frame) < 0)
+            return false;
+      *w = frame->width;
+      *h = frame->height;
+      luma->resize(*w * *h);
+      for (int y = 0; y < *h; ++y)
+            memcpy(luma->data() + y * *w, frame->data[0] + y * frame->linesize[0], *w);
+      av_frame_unref(frame);
+      return true;
+      }
+
+#ifdef HAVE_TURBOJPEG
+//---------------------------------------------------------
+//   TurboMjpegDecoder
+//---------------------------------------------------------
+
+TurboMjpegDecoder::TurboMjpegDecoder(int n)
+   : threads(n)
+      {
+      handle = tjInitDecompress();
+      if (!handle) {
+            printf("turbojpeg init failed\n");
+            abort();
+            }
+      }
+
+TurboMjpegDecoder::~TurboMjpegDecoder()
+      {
+      tjDestroy(handle);
+      }
+
+//---------------------------------------------------------
+//   decode
+//    TJPF_BGRX is the memory layout of
+//    QImage::Format_RGB32 on little endian machines, TJPF_RGB
+//    of Format_RGB888; the histogram is taken from the rgb
+//    image. Other formats, the histogram of them and
+//    averaged frames go through the yuv planes.
+//---------------------------------------------------------
+
+bool TurboMjpegDecoder::decode(const uchar* data, int size, QImage* image, Histogram* histogram)
+      {
+      QByteArray jpeg;
+      if (!jpegHasHuffmanTables(data, size)) {
+            jpeg = jpegAddHuffmanTables(data, size);
+            data = (const uchar*)jpeg.constData();
+            size = jpeg.size();
+            }
+      int w, h, subsamp, colorspace;
+      if (tjDecompressHeader3(handle, data, size, &w, &h, &subsamp, &colorspace) < 0) {
+            printf("turbojpeg: %s\n", tjGetErrorStr2(handle));
+            return false;
+            }
+      if (image->width() != w || image->height() != h || image->format() != _format)
+            *image = QImage(w, h, _format);
+      int pf;
+      switch (_format) {
+            case QImage::Format_RGB888:     pf = TJPF_RGB;  break;
+            case QImage::Format_Grayscale8: pf = TJPF_GRAY; break;
+            case QImage::Format_RGB32:      pf = TJPF_BGRX; break;
+            default:                        pf = -1;        break;
+            }
+      bool planes = pf == -1 || (histogram && pf != TJPF_BGRX) || threads > 1 || _averager;
+      if (planes && subsamp != TJSAMP_411)
+            return decodePlanes(data, size, w, h, subsamp, image, histogram);
+      if (pf == -1) {
+            printf("turbojpeg: cannot decode 4:1:1 to RGB16\n");
+            return false;
+            }
+      if (tjDecompress2(handle, data, size, image->bits(), w, image->bytesPerLine(), h, pf, 0) < 0) {
+            printf("turbojpeg: %s\n", tjGetErrorStr2(handle));
+            return false;
+            }
+      if (histogram && pf == TJPF_BGRX)
+            histogramRgb32(histogram, image->constBits(), image->bytesPerLine(), w, h);
+      return true;
+      }
+
+//---------------------------------------------------------
+//   decodePlanes
+//    decode to yuv planes, average and meter them and
+//    convert the planes in bands
+//---------------------------------------------------------
+
+bool TurboMjpegDecoder::decodePlanes(const uchar* data, int size, int w, int h, int subsamp,
+   QImage* image, Histogram* histogram)
+      {
+      int format;
+      switch (subsamp) {
+            case TJSAMP_444:  format = AV_PIX_FMT_YUV444P; break;
+            case TJSAMP_422:  format = AV_PIX_FMT_YUV422P; break;
+            case TJSAMP_420:  format = AV_PIX_FMT_YUV420P; break;
+            case TJSAMP_440:  format = AV_PIX_FMT_YUV440P; break;
+            default:          format = AV_PIX_FMT_GRAY8;   break;
+            }
+      int nplanes = subsamp == TJSAMP_GRAY ? 1 : 3;
+      int strides[3] = { 0, 0, 0 };
+      int heights[3] = { 0, 0, 0 };
+      size_t total = 0;
+      for (int i = 0; i < nplanes; ++i) {
+            strides[i] = (tjPlaneWidth(i, w, subsamp) + 31) & ~31;
+            heights[i] = tjPlaneHeight(i, h, subsamp);
+            total     += size_t(strides[i]) * heights[i];
+            }
+      if (yuv.size() < total)
+            yuv.resize(total);
+      uchar* planes[3] = { yuv.data(), 0, 0 };
+      if (nplanes == 3) {
+            planes[1] = planes[0] + strides[0] * heights[0];
+            planes[2] = planes[1] + strides[1] * heights[1];
+            }
+      {
+      TraceScope ts("jpeg decode");
+      if (tjDecompressToYUVPlanes(handle, data, size, planes, w, strides, h, 0) < 0) {
+            printf("turbojpeg: %s\n", tjGetErrorStr2(handle));
+            return false;
+            }
+      }
+      const uchar* src[3] = { planes[0], planes[1], planes[2] };
+      if (_averager)
+            averagePlanes(src, strides, format, w, h);
+      if (histogram) {
+            int sx = 0, sy = 0;
+            if (nplanes == 3)
+                  av_pix_fmt_get_chroma_sub_sample(AVPixelFormat(format), &sx, &sy);
+            YuvPlanes p { src[0], src[1], src[2], strides[0], 1, strides[1], 1, sx, sy, w, h, true };
+            histogramYuv(histogram, p);
+            }
+      if (!converter.convert(src, strides, format, image, threads)) {
+            printf("no conversion context\n");
+            return false;
+            }
+      return true;
+      }
+
+//---------------------------------------------------------
+//   decodeLuma
+//    libjpeg-turbo decodes only the DC coefficients when
+//    scaling by 1/8
+//---------------------------------------------------------
+
+bool TurboMjpegDecoder::decodeLuma(const uchar* data, int size, std::vector<uchar>* luma, int* w, int* h)
+      {
+      QByteArray jpeg;
+      if (!jpegHasHuffmanTables(data, size)) {
+            jpeg = jpegAddHuffmanTables(data, size);
+            data = (const uchar*)jpeg.constData();
+            size = jpeg.size();
+            }
+      int fw, fh, subsamp, colorspace;
+      if (tjDecompressHeader3(handle, data, size, &fw, &fh, &subsamp, &colorspace) < 0)
+            return false;
+      tjscalingfactor eighth = { 1, 8 };
+      *w = TJSCALED(fw, eighth);
+      *h = TJSCALED(fh, eighth);
+      luma->resize(*w * *h);
+      if (tjDecompress2(handle, data, size, luma->data(), *w, *w, *h, TJPF_GRAY, TJFLAG_FASTDCT) < 0) {
+            printf("turbojpeg: %s\n", tjGetErrorStr2(handle));
+            return false;
+            }
+      return true;
+      }
+#endif
+
@@ -0,0 +1,149 @@
+//=============================================================================
+//  Cam
+//  Webcam client
+//
+//  Copyright (C) 2016 Werner Schweer
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License version 2
+//  as published by the Free Software Foundation and appearing in
+//  the file LICENCE.GPL
+//=============================================================================
+
+#ifndef __DECODER_H__
+#define __DECODER_H__
+
+#include <vector>
+
+#include <QByteArray>
+#include <QImage>
+
+struct AVCodec;
+struct AVCodecContext;
+struct AVFrame;
+struct SwsContext;
+struct Histogram;
+class FrameAverager;
+
+//---------------------------------------------------------
+//   MjpegDecoder
+//    jpeg decoder backend; decodes into
+//    QImage::Format_RGB32 or the format set with
+//    setFormat() (RGB888, RGB16, Grayscale8) and, if
+//    histogram is given, meters the frame on the way.
+//    decodeLuma() is the cheap path for analysis: the
+//    luma plane at 1/8 scale from the DC coefficients
+//
+//    with setAverager() the yuv planes are averaged before
+//    the rgb conversion, at half the bytes of RGB32 for
+//    4:2:2; gray and 4:2:0, 4:2:2, 4:4:0, 4:4:4 frames only
+//
+//    a decoder is used by one thread at a time; local()
+//    returns a decoder owned by the calling thread which
+//    is set up once and freed when the thread exits.
+//
+//    threads > 1 splits one frame over the global thread
+//    pool (0: all cores): slice threads in the codec where
+//    supported and the rgb conversion in bands. There is
+//    no frame threading, a frame is ready when decode()
+//    returns.
+//---------------------------------------------------------
+
+class MjpegDecoder {
+   protected:
+      QImage::Format _format { QImage::Format_RGB32 };
+      FrameAverager* _averager { 0 };
+
+      void averagePlanes(const uchar* planes[3], int strides[3], int format, int w, int h);
+
+   public:
+      virtual ~MjpegDecoder() {}
+      void setFormat(QImage::Format f)    { _format = f; }
+      QImage::Format format() const       { return _format; }
+      void setAverager(FrameAverager* a)  { _averager = a; }
+      virtual const char* name() const = 0;
+      virtual bool decode(const uchar* data, int size, QImage* image, Histogram* histogram = 0) = 0;
+      virtual bool decodeLuma(const uchar* data, int size, std::vector<uchar>* luma, int* w, int* h) = 0;
+      virtual qint64 memory() const { return 0; }     // working buffers besides the image
+
+      static MjpegDecoder* create(const QByteArray& backend = QByteArray(), int threads = 1);
+      static MjpegDecoder* local();
+      static std::vector<QByteArray> backends();
+      };
+
+//---------------------------------------------------------
+//   BandConverter
+//    jpeg decoder output (full range) to the format of
+//    image; planar yuv is converted in horizontal bands of
+//    whole MCU rows in parallel on the thread pool. Every
+//    band has its own swscale context. Grayscale8 from
+//    planar yuv is a copy of the luma plane.
+//---------------------------------------------------------
+
+class BandConverter {
+      struct Band {
+            SwsContext* ctx { 0 };
+            int w, h, format, dstFormat;
+            };
+      std::vector<Band> band;
+
+      bool setup(Band*, int w, int h, int format, int dstFormat);
+
+   public:
+      ~BandConverter();
+      bool convert(const uchar* const planes[3], const int strides[3], int format,
+         QImage* image, int bands);
+      };
+
+//---------------------------------------------------------
+//   AvMjpegDecoder
+//    libavcodec backend
+//---------------------------------------------------------
+
+class AvMjpegDecoder : public MjpegDecoder {
+      AVCodec* codec;
+      AVCodecContext* c;
+      AVCodecContext* lowres { 0 };     // 1/8 scale, for decodeLuma()
+      AVFrame* frame;
+      int threads;
+      BandConverter converter;
+
+   public:
+      AvMjpegDecoder(int threads = 1);
+      virtual ~AvMjpegDecoder();
+      virtual const char* name() const override { return "avcodec"; }
+      virtual bool decode(const uchar* data, int size, QImage* image, Histogram* histogram = 0) override;
+      virtual bool decodeLuma(const uchar* data, int size, std::vector<uchar>* luma, int* w, int* h) override;
+      };
+
+#ifdef HAVE_TURBOJPEG
+//---------------------------------------------------------
+//   TurboMjpegDecoder
+//    libjpeg-turbo backend; decodes directly into
+//    RGB32, RGB888 or Grayscale8 without swscale. With
+//    threads the entropy decode stays serial, it decodes
+//    to yuv planes which are converted in bands; RGB16,
+//    which turbojpeg cannot write, takes the same path.
+//---------------------------------------------------------
+
+class TurboMjpegDecoder : public MjpegDecoder {
+      void* handle;
+      int threads;
+      std::vector<uchar> yuv;           // decoded planes for band conversion
+      BandConverter converter;
+
+      bool decodePlanes(const uchar* data, int size, int w, int h, int subsamp,
+         QImage* image, Histogram* histogram);
+
+   public:
+      TurboMjpegDecoder(int threads = 1);
+      virtual ~TurboMjpegDecoder();
+      virtual const char* name() const override { return "turbojpeg"; }
+      virtual bool decode(const uchar* data, int size, QImage* image, Histogram* histogram = 0) override;
+      virtual bool decodeLuma(const uchar* data, int size, std::vector<uchar>* luma, int* w, int* h) override;
+      virtual qint64 memory() const override { return yuv.capacity(); }
+      };
+#endif
+
+#endif
+
@@ -0,0 +1,122 @@
+//=============================================================================
+//  Cam
+//  Webcam client
+//
+//  Copyright (C) 2016 Werner Schweer
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License version 2
+//  as published by the Free Software Foundation and appearing in
+//  the file LICENCE.GPL
+//=============================================================================
+
+
+#include <math.h>
+
+#include <algorithm>
+
+#include "fft.h"
+#include "threadpool.h"
+
+//---------------------------------------------------------
+//   init
+//---------------------------------------------------------
+
+void Fft2d::Plan::init(int size)
+      {
+      n = size;
+      int bits = 0;
+      while ((1 << bits) < n)
+            ++bits;
+      reverse.resize(n);
+      for (int i = 0; i < n; ++i) {
+            int r = 0;
+            for (int b = 0; b < bits; ++b)
+                  r |= ((i >> b) & 1) << (bits - 1 - b);
+            reverse[i] = r;
+            }
+      twiddle.resize(n / 2);
+      for (int i = 0; i < n / 2; ++i)
+            twiddle[i] = std::polar(1.0f, float(-2.0 * M_PI * i / n));
+      }
+
+//---------------------------------------------------------
+//   transform
+//    iterative radix 2; the inverse uses the conjugate
+//    twiddles
+//---------------------------------------------------------
+
+void Fft2d::Plan::transform(Complex* d, bool inverse) const
+      {
+      for (int i = 0; i < n; ++i) {
+            int r = reverse[i];
+            if (r > i)
+                  std::swap(d[i], d[r]);
+            }
+      // complex arithmetic spelled out: std::complex
+      // multiplication checks for nan and inf
+
+      float sign = inverse ? -1.0f : 1.0f;
+      for (int len = 2; len <= n; len <<= 1) {
+            int half = len >> 1;
+            int step = n / len;
+            for (int i = 0; i < n; i += len) {
+                  for (int k = 0; k < half; ++k) {
+                        float tr = twiddle[k * step].real();
+                        float ti = twiddle[k * step].imag() * sign;
+                        Complex& a = d[i + k];
+                        Complex& b = d[i + k + half];
+                        float br = b.real() * tr - b.imag() * ti;
+                        float bi = b.real() * ti + b.imag() * tr;
+                        b = Complex(a.real() - br, a.imag() - bi);
+                        a = Complex(a.real() + br, a.imag() + bi);
+                        }
+                  }
+            }
+      }
+
+//---------------------------------------------------------
+//   Fft2d
+//---------------------------------------------------------
+
+Fft2d::Fft2d(int width, int height)
+   : w(width), h(height)
+      {
+      rows.init(w);
+      columns.init(h);
+      }
+
+//---------------------------------------------------------
+//   transform
+//    rows, then columns in blocks of 8 through a buffer;
+//    every pool thread gets a contiguous range
+//---------------------------------------------------------
+
+void Fft2d::transform(Complex* data, bool inverse) const
+      {
+      ThreadPool* pool = ThreadPool::global();
+      int parts = pool->size();
+      pool->run(parts, [&](int part) {
+            for (int y = h * part / parts; y < h * (part + 1) / parts; ++y)
+                  rows.transform(data + y * w, inverse);
+            });
+      pool->run(parts, [&](int part) {
+            const int block = 8;
+            std::vector<Complex> buffer(h * block);
+            int x1 = w * (part + 1) / parts;
+            for (int x = w * part / parts; x < x1; x += block) {
+                  int n = std::min(block, x1 - x);
+                  for (int y = 0; y < h; ++y) {
+                        for (int i = 0; i < n; ++i)
+                              buffer[i * h + y] = data[y * w + x + i];
+                        }
+                  for (int i = 0; i < n; ++i)
+                        columns.transform(buffer.data() + i * h, inverse);
+                  for (int y = 0; y < h; ++y) {
+                        for (int i = 0; i < n; ++i)
+                              data[y * w + x + i] = buffer[i * h + y];
+                        }
+                  }
+            });
+      }
+
@@ -0,0 +1,52 @@
+//=============================================================================
+//  Cam
+//  Webcam client
+//
+//  Copyright (C) 2016 Werner Schweer
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License version 2
+//  as published by the Free Software Foundation and appearing in
+//  the file LICENCE.GPL
+//=============================================================================
+
+
+#ifndef __FFT_H__
+#define __FFT_H__
+
+#include <complex>
+#include <vector>
+
+typedef std::complex<float> Complex;
+
+//---------------------------------------------------------
+//   Fft2d
+//    complex 2D FFT, width and height powers of two;
+//    in place, row major. Rows and columns are transformed
+//    in parallel on the global thread pool. inverse() is
+//    not scaled.
+//---------------------------------------------------------
+
+class Fft2d {
+      struct Plan {
+            int n;
+            std::vector<Complex> twiddle;       // n / 2
+            std::vector<int> reverse;           // bit reversed index
+            void init(int n);
+            void transform(Complex* data, bool inverse) const;
+            };
+      int w, h;
+      Plan rows, columns;
+
+      void transform(Complex* data, bool inverse) const;
+
+   public:
+      Fft2d(int w, int h);
+      int width() const                   { return w; }
+      int height() const                  { return h; }
+      void forward(Complex* data) const   { transform(data, false); }
+      void inverse(Complex* data) const   { transform(data, true);  }
+      };
+
+#endif
+
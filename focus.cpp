@@ -0,0 +1,377 @@
+//=============================================================================
+//  Cam
+//  Webcam client
+//
+//  Copyright (C) 2016 Werner Schweer
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License version 2
+//  as published by the Free Software Foundation and appearing in
+//  the file LICENCE.GPL
+//=============================================================================
+
+#include <math.h>
+#include <string.h>
+
+#include <linux/videodev2.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "focus.h"
+#include "trace.h"
+
+static const int minThreshold  = 48;          // |gx| + |gy| on the grid
+static const int meanFactor    = 4;           // highlight edges above 4 x mean
+static const quint32 peakColor = 0xff30ff30;  // premultiplied ARGB
+
+//---------------------------------------------------------
+//   lumaYuyv
+//    2 x 2 box filter of the Y samples
+//---------------------------------------------------------
+
+static void lumaYuyv(const uchar* src, int stride, uchar* dst, int gw, int gh)
+      {
+      for (int y = 0; y < gh; ++y) {
+            const uchar* s0 = src + 2 * y * stride;
+            const uchar* s1 = s0 + stride;
+            uchar* d        = dst + y * gw;
+            int x = 0;
+#ifdef __SSE2__
+            const __m128i mask = _mm_set1_epi16(0xff);
+            const __m128i ones = _mm_set1_epi16(1);
+            const __m128i two  = _mm_set1_epi32(2);
+            for (; x + 8 <= gw; x += 8) {
+                  const uchar* p0 = s0 + x * 4;
+                  const uchar* p1 = s1 + x * 4;
+                  __m128i a = _mm_add_epi16(_mm_and_si128(_mm_loadu_si128((const __m128i*)p0), mask),
+                                            _mm_and_si128(_mm_loadu_si128((const __m128i*)p1), mask));
+                  __m128i b = _mm_add_epi16(_mm_and_si128(_mm_loadu_si128((const __m128i*)(p0 + 16)), mask),
+                                            _mm_and_si128(_mm_loadu_si128((const __m128i*)(p1 + 16)), mask));
+                  a = _mm_srli_epi32(_mm_add_epi32(_mm_madd_epi16(a, ones), two), 2);
+                  b = _mm_srli_epi32(_mm_add_epi32(_mm_madd_epi16(b, ones), two), 2);
+                  __m128i v = _mm_packs_epi32(a, b);
+                  _mm_storel_epi64((__m128i*)(d + x), _mm_packus_epi16(v, v));
+                  }
+#endif
+            for (const uchar* p0 = s0 + x * 4, *p1 = s1 + x * 4; x < gw; ++x, p0 += 4, p1 += 4)
+                  d[x] = (p0[0] + p0[2] + p1[0] + p1[2] + 2) >> 2;
+            }
+      }
+
+//---------------------------------------------------------
+//   lumaPlanar
+//    2 x 2 box filter of an 8 bit plane (NV12 Y)
+//---------------------------------------------------------
+
+static void lumaPlanar(const uchar* src, int stride, uchar* dst, int gw, int gh)
+      {
+      for (int y = 0; y < gh; ++y) {
+            const uchar* s0 = src + 2 * y * stride;
+            const uchar* s1 = s0 + stride;
+            uchar* d        = dst + y * gw;
+            int x = 0;
+#ifdef __SSE2__
+            const __m128i mask = _mm_set1_epi16(0xff);
+            const __m128i two  = _mm_set1_epi16(2);
+            for (; x + 8 <= gw; x += 8) {
+                  __m128i a = _mm_loadu_si128((const __m128i*)(s0 + x * 2));
+                  __m128i b = _mm_loadu_si128((const __m128i*)(s1 + x * 2));
+                  __m128i v = _mm_add_epi16(_mm_add_epi16(_mm_and_si128(a, mask), _mm_srli_epi16(a, 8)),
+                                            _mm_add_epi16(_mm_and_si128(b, mask), _mm_srli_epi16(b, 8)));
+                  v = _mm_srli_epi16(_mm_add_epi16(v, two), 2);
+                  _mm_storel_epi64((__m128i*)(d + x), _mm_packus_epi16(v, v));
+                  }
+#endif
+            for (const uchar* p0 = s0 + x * 2, *p1 = s1 + x * 2; x < gw; ++x, p0 += 2, p1 += 2)
+                  d[x] = (p0[0] + p0[1] + p1[0] + p1[1] + 2) >> 2;
+            }
+      }
+
+//---------------------------------------------------------
+//   lumaRgb32
+//    Y ~ (R + 2G + B) / 4, 2 x 2 box filter
+//---------------------------------------------------------
+
+static void lumaRgb32(const uchar* src, int stride, uchar* dst, int gw, int gh)
+      {
+      for (int y = 0; y < gh; ++y) {
+            const uchar* s0 = src + 2 * y * stride;
+            const uchar* s1 = s0 + stride;
+            uchar* d        = dst + y * gw;
+            for (int x = 0; x < gw; ++x) {
+                  const uchar* p0 = s0 + x * 8;
+                  const uchar* p1 = s1 + x * 8;
+                  int v = p0[0] + 2 * p0[1] + p0[2] + p0[4] + 2 * p0[5] + p0[6]
+                        + p1[0] + 2 * p1[1] + p1[2] + p1[4] + 2 * p1[5] + p1[6];
+                  d[x] = (v + 8) >> 4;
+                  }
+            }
+      }
+
+//---------------------------------------------------------
+//   sobelRow
+//    gradient of row c (neighbours u and d) for x = 1 ..
+//    w - 2; store |gx| + |gy|, return the sum of
+//    gx^2 + gy^2 and add |gx| + |gy| to l1
+//---------------------------------------------------------
+
+static quint64 sobelRow(const uchar* u, const uchar* c, const uchar* d, quint16* mag, int w, quint64* l1)
+      {
+      quint64 sq  = 0;
+      quint64 abs = 0;
+      int x = 1;
+#ifdef __SSE2__
+      const __m128i zero = _mm_setzero_si128();
+      const __m128i ones = _mm_set1_epi16(1);
+      __m128i sqAcc  = zero;
+      __m128i absAcc = zero;
+      for (; x + 8 <= w - 1; x += 8) {
+            __m128i ul = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(u + x - 1)), zero);
+            __m128i uc = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(u + x)),     zero);
+            __m128i ur = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(u + x + 1)), zero);
+            __m128i cl = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(c + x - 1)), zero);
+            __m128i cr = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(c + x + 1)), zero);
+            __m128i dl = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(d + x - 1)), zero);
+            __m128i dc = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(d + x)),     zero);
+            __m128i dr = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(d + x + 1)), zero);
+
+            __m128i gx = _mm_add_epi16(_mm_sub_epi16(ur, ul), _mm_sub_epi16(dr, dl));
+            gx = _mm_add_epi16(gx, _mm_slli_epi16(_mm_sub_epi16(cr, cl), 1));
+            __m128i gy = _mm_add_epi16(_mm_sub_epi16(dl, ul), _mm_sub_epi16(dr, ur));
+            gy = _mm_add_epi16(gy, _mm_slli_epi16(_mm_sub_epi16(dc, uc), 1));
+
+            __m128i m = _mm_add_epi16(_mm_max_epi16(gx, _mm_sub_epi16(zero, gx)),
+                                      _mm_max_epi16(gy, _mm_sub_epi16(zero, gy)));
+            _mm_storeu_si128((__m128i*)(mag + x), m);
+            absAcc = _mm_add_epi32(absAcc, _mm_madd_epi16(m, ones));
+            __m128i lo = _mm_unpacklo_epi16(gx, gy);
+            __m128i hi = _mm_unpackhi_epi16(gx, gy);
+            sqAcc = _mm_add_epi32(sqAcc, _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi)));
+            }
+      // below 2^32 per lane for rows of up to 8192 cells
+      quint32 v[4];
+      _mm_storeu_si128((__m128i*)v, sqAcc);
+      sq += quint64(v[0]) + v[1] + v[2] + v[3];
+      _mm_storeu_si128((__m128i*)v, absAcc);
+      abs += quint64(v[0]) + v[1] + v[2] + v[3];
+#endif
+      for (; x < w - 1; ++x) {
+            int gx = (u[x + 1] - u[x - 1]) + 2 * (c[x + 1] - c[x - 1]) + (d[x + 1] - d[x - 1]);
+            int gy = (d[x - 1] - u[x - 1]) + 2 * (d[x] - u[x]) + (d[x + 1] - u[x + 1]);
+            int m  = (gx < 0 ? -gx : gx) + (gy < 0 ? -gy : gy);
+            mag[x] = m;
+            abs   += m;
+            sq    += gx * gx + gy * gy;
+            }
+      mag[0]     = 0;
+      mag[w - 1] = 0;
+      *l1 += abs;
+      return sq;
+      }
+
+//---------------------------------------------------------
+//   peakRow
+//    write peakColor where mag > threshold, transparent
+//    elsewhere
+//---------------------------------------------------------
+
+static void peakRow(const quint16* mag, quint32* dst, int w, int threshold)
+      {
+      int x = 0;
+#ifdef __SSE2__
+      const __m128i t     = _mm_set1_epi16(threshold);
+      const __m128i color = _mm_set1_epi32(peakColor);
+      for (; x + 8 <= w; x += 8) {
+            __m128i m = _mm_cmpgt_epi16(_mm_loadu_si128((const __m128i*)(mag + x)), t);
+            _mm_storeu_si128((__m128i*)(dst + x),     _mm_and_si128(_mm_unpacklo_epi16(m, m), color));
+            _mm_storeu_si128((__m128i*)(dst + x + 4), _mm_and_si128(_mm_unpackhi_epi16(m, m), color));
+            }
+#endif
+      for (; x < w; ++x)
+            dst[x] = mag[x] > threshold ? peakColor : 0;
+      }
+
+//---------------------------------------------------------
+//   FocusAssist
+//---------------------------------------------------------
+
+FocusAssist::FocusAssist()
+      {
+      thread = std::thread(&FocusAssist::loop, this);
+      }
+
+FocusAssist::~FocusAssist()
+      {
+      {
+      std::lock_guard<std::mutex> lock(mutex);
+      running = false;
+      }
+      cv.notify_one();
+      thread.join();
+      }
+
+//---------------------------------------------------------
+//   wantsImage
+//    raw formats are analyzed without decoding
+//---------------------------------------------------------
+
+bool FocusAssist::wantsImage(const Frame& f)
+      {
+      return f.pixelFormat != V4L2_PIX_FMT_YUYV && f.pixelFormat != V4L2_PIX_FMT_NV12;
+      }
+
+//---------------------------------------------------------
+//   frame
+//    hand the frame to the worker; called in the capture
+//    thread. The payload of a raw frame is only valid
+//    until the capture thread releases it, so its luma
+//    grid is built here; decoded images are shared.
+//---------------------------------------------------------
+
+void FocusAssist::frame(const FramePtr& f)
+      {
+      next.sequence = f->sequence;
+      next.image    = QImage();
+      if ((f->pixelFormat == V4L2_PIX_FMT_YUYV || f->pixelFormat == V4L2_PIX_FMT_NV12) && f->data())
+            rawLuma(*f, &next);
+      else {
+            next.image = f->image();
+            next.gw    = 0;
+            next.gh    = 0;
+            }
+      {
+      std::lock_guard<std::mutex> lock(mutex);
+      std::swap(pending, next);
+      hasPending = true;
+      busy       = true;
+      Trace::flowStart("focus", pending.sequence);
+      }
+      cv.notify_one();
+      }
+
+//---------------------------------------------------------
+//   takeResult
+//    return true if there is a new result since the last
+//    call
+//---------------------------------------------------------
+
+bool FocusAssist::takeResult(QImage* overlay, double* score)
+      {
+      std::lock_guard<std::mutex> lock(resultMutex);
+      if (!newResult)
+            return false;
+      *overlay  = _overlay;
+      *score    = _score;
+      newResult = false;
+      return true;
+      }
+
+//---------------------------------------------------------
+//   loop
+//---------------------------------------------------------
+
+void FocusAssist::loop()
+      {
+      Trace::setThreadName("focus");
+      for (;;) {
+            {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [this] { return hasPending || !running; });
+            if (!running)
+                  return;
+            std::swap(current, pending);
+            hasPending = false;
+            }
+            Trace::setFrame(current.sequence);
+            {
+            TraceScope ts("focus");
+            Trace::flowEnd("focus", current.sequence);
+            analyze(&current);
+            }
+            current.image = QImage();
+            busy = false;
+            }
+      }
+
+//---------------------------------------------------------
+//   rawLuma
+//    half resolution luma grid of a YUYV or NV12 frame
+//---------------------------------------------------------
+
+void FocusAssist::rawLuma(const Frame& f, Job* job)
+      {
+      job->gw = f.width / 2;
+      job->gh = f.height / 2;
+      if (job->gw < 3 || job->gh < 3)
+            return;
+      job->grid.resize(job->gw * job->gh);
+      if (f.pixelFormat == V4L2_PIX_FMT_YUYV)
+            lumaYuyv(f.plane(0), f.stride(0), job->grid.data(), job->gw, job->gh);
+      else
+            lumaPlanar(f.plane(0), f.stride(0), job->grid.data(), job->gw, job->gh);
+      }
+
+//---------------------------------------------------------
+//   imageLuma
+//    half resolution luma grid of a decoded image
+//---------------------------------------------------------
+
+void FocusAssist::imageLuma(Job* job)
+      {
+      const QImage& img = job->image;
+      job->gw = img.width() / 2;
+      job->gh = img.height() / 2;
+      if (job->gw < 3 || job->gh < 3)
+            return;
+      job->grid.resize(job->gw * job->gh);
+      uchar* grid = job->grid.data();
+      if (img.format() == QImage::Format_Grayscale8)
+            lumaPlanar(img.constBits(), img.bytesPerLine(), grid, job->gw, job->gh);
+      else if (img.format() == QImage::Format_RGB32 || img.format() == QImage::Format_ARGB32)
+            lumaRgb32(img.constBits(), img.bytesPerLine(), grid, job->gw, job->gh);
+      else {
+            QImage i = img.convertToFormat(QImage::Format_RGB32);
+            lumaRgb32(i.constBits(), i.bytesPerLine(), grid, job->gw, job->gh);
+            }
+      }
+
+//---------------------------------------------------------
+//   analyze
+//    the threshold follows the image content: edges
+//    above meanFactor times the mean gradient are
+//    highlighted
+//---------------------------------------------------------
+
+void FocusAssist::analyze(Job* job)
+      {
+      if (!job->image.isNull())
+            imageLuma(job);
+      int gw = job->gw;
+      int gh = job->gh;
+      if (gw < 3 || gh < 3)
+            return;
+      const uchar* grid = job->grid.data();
+      magnitude.resize(gw * gh);
+      memset(magnitude.data(), 0, gw * sizeof(quint16));
+      memset(magnitude.data() + (gh - 1) * gw, 0, gw * sizeof(quint16));
+      quint64 sq = 0;
+      quint64 l1 = 0;
+      for (int y = 1; y < gh - 1; ++y) {
+            const uchar* c = grid + y * gw;
+            sq += sobelRow(c - gw, c, c + gw, magnitude.data() + y * gw, gw, &l1);
+            }
+      quint64 n     = quint64(gw - 2) * (gh - 2);
+      int threshold = qMax(minThreshold, int(meanFactor * l1 / n));
+
+      QImage overlay(gw, gh, QImage::Format_ARGB32_Premultiplied);
+      for (int y = 0; y < gh; ++y)
+            peakRow(magnitude.data() + y * gw, (quint32*)overlay.scanLine(y), gw, threshold);
+
+      std::lock_guard<std::mutex> lock(resultMutex);
+      _overlay  = overlay;
+      _score    = sqrt(double(sq) / n);
+      newResult = true;
+      }
+
@@ -0,0 +1,83 @@
+//=============================================================================
+//  Cam
+//  Webcam client
+//
+//  Copyright (C) 2016 Werner Schweer
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License version 2
+//  as published by the Free Software Foundation and appearing in
+//  the file LICENCE.GPL
+//=============================================================================
+
+#ifndef __FOCUS_H__
+#define __FOCUS_H__
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <QImage>
+
+#include "frame.h"
+
+//---------------------------------------------------------
+//   FocusAssist
+//    focus peaking: Sobel gradient of the luma plane on a
+//    half resolution grid, computed in a worker thread.
+//    The result is an overlay with the sharpest edges
+//    highlighted and a focus score (rms gradient, higher
+//    is sharper).
+//
+//    only frames arriving while the worker is idle are
+//    taken. Raw frames are reduced to the luma grid in the
+//    capture thread, the leased buffer never reaches the
+//    worker.
+//---------------------------------------------------------
+
+class FocusAssist : public FrameConsumer {
+      struct Job {
+            unsigned sequence { 0 };
+            QImage image;                 // decoded frame
+            std::vector<uchar> grid;      // luma, half resolution
+            int gw { 0 };
+            int gh { 0 };
+            };
+
+      std::thread thread;
+      std::mutex mutex;                   // protects pending, hasPending, running
+      std::condition_variable cv;
+      Job pending;
+      bool hasPending { false };
+      bool running { true };
+      std::atomic<bool> busy { false };
+      Job next;                           // capture thread only
+      Job current;                        // worker only
+
+      std::mutex resultMutex;             // protects _overlay, _score, newResult
+      QImage _overlay;
+      double _score   { 0.0 };
+      bool newResult  { false };
+
+      std::vector<quint16> magnitude;     // |gx| + |gy|
+
+      void loop();
+      static void rawLuma(const Frame&, Job*);
+      static void imageLuma(Job*);
+      void analyze(Job*);
+
+   public:
+      FocusAssist();
+      ~FocusAssist();
+
+      virtual bool wantsFrame(const Frame&) override { return !busy; }
+      virtual bool wantsImage(const Frame&) override;
+      virtual void frame(const FramePtr&) override;
+
+      bool takeResult(QImage* overlay, double* score);
+      };
+
+#endif
+
@@ -0,0 +1,100 @@
+//=============================================================================
+//  Cam
+//  Webcam client
+//
+//  Copyright (C) 2016 Werner Schweer
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License version 2
+//  as published by the Free Software Foundation and appearing in
+//  the file LICENCE.GPL
+//=============================================================================
+
+#include <linux/videodev2.h>
+
+#include "frame.h"
+#include "jpeg.h"
+
+//---------------------------------------------------------
+//   Frame
+//---------------------------------------------------------
+
+Frame::Frame(const uchar* data, int size, std::function<void()> l)
+   : _data(data), _size(size), lease(l)
+      {
+      }
+
+Frame::~Frame()
+      {
+      if (lease)
+            lease();
+      }
+
+//---------------------------------------------------------
+//   release
+//    give the buffer back to the driver; keep a copy of
+//    the payload if keep is set
+//---------------------------------------------------------
+
+void Frame::release(bool keep)
+      {
+      if (!lease)
+            return;
+      if (keep) {
+            _copy = QByteArray((const char*)_data, _size);
+            _data = (const uchar*)_copy.constData();
+            }
+      else {
+            _data = 0;
+            _size = 0;
+            }
+      lease();
+      lease = nullptr;
+      }
+
+//---------------------------------------------------------
+//   error
+//    the driver marked the frame as corrupted
+//---------------------------------------------------------
+
+bool Frame::error() const
+      {
+      return flags & V4L2_BUF_FLAG_ERROR;
+      }
+
+//---------------------------------------------------------
+//   plane
+//    raw formats: 0 - Y or packed YUYV, 1 - interleaved
+//    UV of NV12
+//---------------------------------------------------------
+
+const uchar* Frame::plane(int idx) const
+      {
+      if (idx == 0)
+            return _data;
+      if (idx == 1 && pixelFormat == V4L2_PIX_FMT_NV12 && _data)
+            return _data + bytesPerLine * height;
+      return 0;
+      }
+
+//---------------------------------------------------------
+//   stride
+//---------------------------------------------------------
+
+int Frame::stride(int idx) const
+      {
+      return plane(idx) ? bytesPerLine : 0;
+      }
+
+//---------------------------------------------------------
+//   jpeg
+//    mjpeg payload as complete jpeg image
+//---------------------------------------------------------
+
+QByteArray Frame::jpeg() const
+      {
+      if (pixelFormat != V4L2_PIX_FMT_MJPEG || !_data)
+            return QByteArray();
+      return jpegAddHuffmanTables(_data, _size);
+      }
+
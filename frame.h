@@ -0,0 +1,97 @@
+//=============================================================================
+//  Cam
+//  Webcam client
+//
+//  Copyright (C) 2016 Werner Schweer
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License version 2
+//  as published by the Free Software Foundation and appearing in
+//  the file LICENCE.GPL
+//=============================================================================
+
+#ifndef __FRAME_H__
+#define __FRAME_H__
+
+#include <functional>
+#include <memory>
+
+#include <QByteArray>
+#include <QImage>
+
+//---------------------------------------------------------
+//   Frame
+//    one captured frame: metadata, the compressed or raw
+//    payload and the decoded image
+//
+//    while the frame is leased the payload points into the
+//    mapped V4L2 buffer; release() returns the buffer to
+//    the driver and copies the payload only if somebody
+//    still holds a reference to the frame
+//---------------------------------------------------------
+
+class Frame {
+      const uchar* _data { 0 };
+      int _size          { 0 };
+      QByteArray _copy;                   // payload after release
+      QImage _image;
+      std::function<void()> lease;        // requeues the buffer
+
+   public:
+      unsigned sequence    { 0 };         // driver frame counter
+      quint64 timestamp    { 0 };         // CLOCK_MONOTONIC ns
+      unsigned flags       { 0 };         // V4L2_BUF_FLAG_*
+      unsigned pixelFormat { 0 };
+      int width            { 0 };
+      int height           { 0 };
+      int bytesPerLine     { 0 };
+      unsigned lost        { 0 };         // frames dropped by the driver before this one
+
+      Frame(const uchar* data, int size, std::function<void()> lease = nullptr);
+      ~Frame();
+      Frame(const Frame&) = delete;
+      Frame& operator=(const Frame&) = delete;
+
+      const uchar* data() const       { return _data; }
+      int size() const                { return _size; }
+      bool leased() const             { return bool(lease); }
+      void release(bool keep);
+
+      bool error() const;
+      const uchar* plane(int idx) const;
+      int stride(int idx) const;
+      QByteArray jpeg() const;
+
+      const QImage& image() const     { return _image; }
+      void setImage(const QImage& i)  { _image = i; }
+      };
+
+typedef std::shared_ptr<Frame> FramePtr;
+
+//---------------------------------------------------------
+//   FrameConsumer
+//    gets every frame of a Capture in the capture thread;
+//    the image is decoded once for all consumers which
+//    want it. Consumers which keep the frame beyond
+//    frame() cause one copy of the payload.
+//
+//    The capture thread releases the frame after the last
+//    consumer returned, release() requeues the buffer and
+//    swaps the payload pointer without synchronization.
+//    A consumer must not hand a leased Frame to another
+//    thread; copy what it needs in frame() and pass only
+//    owned data (the decoded QImage is implicitly shared
+//    and may be passed).
+//---------------------------------------------------------
+
+class FrameConsumer {
+   public:
+      virtual ~FrameConsumer() {}
+      virtual bool wantsFrame(const Frame&)     { return true; }
+      virtual bool wantsImage(const Frame&)     { return false; }
+      virtual bool wantsSkipped() const         { return false; }   // frames dropped in low latency mode
+      virtual void frame(const FramePtr&) = 0;
+      };
+
+#endif
+
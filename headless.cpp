@@ -0,0 +1,373 @@
+//=============================================================================
+//  Cam
+//  Webcam client
+//
+//  Copyright (C) 2016 Werner Schweer
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License version 2
+//  as published by the Free Software Foundation and appearing in
+//  the file LICENCE.GPL
+//=============================================================================
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+
+#include <chrono>
+#include <vector>
+
+#include <QCommandLineParser>
+#include <QCommandLineOption>
+#include <QStringList>
+#include <QSize>
+
+#include "headless.h"
+#include "camdevice.h"
+#include "capture.h"
+#include "mosaic.h"
+#include "streamserver.h"
+#include "tiff.h"
+#include "trace.h"
+
+//---------------------------------------------------------
+//   parseFormat
+//    map a fourcc name like "MJPG" or "YUYV" to one of the
+//    formats the device offers; return 0 for "auto"
+//---------------------------------------------------------
+
+static unsigned parseFormat(const CamDevice* d, const QString& s)
+      {
+      if (s.isEmpty() || s == "auto")
+            return 0;
+      for (const CamDeviceFormat& f : d->formats) {
+            if (pixelFormatName(f.pixelFormat).compare(s, Qt::CaseInsensitive) == 0)
+                  return f.pixelFormat;
+            }
+      fprintf(stderr, "cam: device <%s> has no format <%s>, using auto\n",
+         qPrintable(d->device), qPrintable(s));
+      return 0;
+      }
+
+//---------------------------------------------------------
+//   headless
+//    capture without any widget and without a Qt event
+//    loop; runs until SIGINT/SIGTERM or --duration expires
+//---------------------------------------------------------
+
+int headless(const QStringList& args)
+      {
+      // block the termination signals before any thread is
+      // created (capture, button, decode pool, http server,
+      // motion detector, mosaic), all of them inherit the
+      // mask and only sigtimedwait() below sees the signals.
+      // Recorder and shm publisher run on the capture thread
+
+      sigset_t sigs;
+      sigemptyset(&sigs);
+      sigaddset(&sigs, SIGINT);
+      sigaddset(&sigs, SIGTERM);
+      sigaddset(&sigs, SIGHUP);
+      sigaddset(&sigs, SIGUSR1);
+      pthread_sigmask(SIG_BLOCK, &sigs, 0);
+
+      QCommandLineParser parser;
+      parser.setApplicationDescription("Webcam capture daemon");
+      parser.addHelpOption();
+      QCommandLineOption headlessOption("headless", "Run without display.");
+      QCommandLineOption deviceOption("device", "Capture device (video0, /dev/video0 or name).", "device");
+      QCommandLineOption sizeOption("size", "Frame size WxH.", "size");
+      QCommandLineOption fpsOption("fps", "Frame rate.", "fps", "30");
+      QCommandLineOption formatOption("format", "Pixel format (MJPG, YUYV, NV12 or auto).", "format", "auto");
+      QCommandLineOption intervalOption("snapshot-interval", "Save a snapshot every n seconds.", "sec", "0");
+      QCommandLineOption outputOption("output", "Snapshot directory.", "dir", ".");
+      QCommandLineOption prefixOption("prefix", "Snapshot file name prefix.", "prefix", "pic");
+      QCommandLineOption rawOption("raw", "Save mjpeg snapshots without decoding.");
+      QCommandLineOption recordOption("record", "Append all captured frames to file.", "file");
+      QCommandLineOption timelapseOption("timelapse", "Keep one frame every n seconds without decoding the others.", "sec");
+      QCommandLineOption timelapseRecordOption("timelapse-record", "Append timelapse frames to file instead of --output.", "file");
+      QCommandLineOption motionOption("motion", "Save frames around motion covering more than percent of the picture.", "percent");
+      QCommandLineOption motionPreOption("motion-pre", "Frames saved before motion.", "n", "15");
+      QCommandLineOption motionPostOption("motion-post", "Frames saved after motion.", "n", "30");
+      QCommandLineOption mosaicOption("mosaic", "Stitch the frames of a moving stage, written on exit as tiled tiff. The mosaic is kept in memory, about 5.3 GB per gigapixel.", "file");
+      QCommandLineOption httpOption("http-port", "Serve mjpeg over http on port.", "port");
+      QCommandLineOption shmOption("shm", "Publish frames to shared memory <name> and <name>-raw.", "name");
+      QCommandLineOption lowLatencyOption("low-latency", "Decode only the newest frame.");
+      QCommandLineOption imageFormatOption("image-format", "Decoded image format (rgb32, rgb888, rgb16 or gray).", "format", "rgb32");
+      QCommandLineOption decodeThreadsOption("decode-threads", "Decode every frame with n threads, 0: all cores.", "n", "1");
+      QCommandLineOption averageOption("average", "Average the last n frames (2 - 16).", "n");
+      QCommandLineOption averageEmaOption("average-ema", "Exponential moving average, new frames weighted 1/2^k (1 - 7).", "k");
+      QCommandLineOption capturePriorityOption("capture-priority", "Run the capture thread with real time priority n.", "n");
+      QCommandLineOption capturePolicyOption("capture-policy", "Real time policy of the capture thread (fifo or rr).", "policy", "fifo");
+      QCommandLineOption captureCpusOption("capture-cpus", "Pin the capture thread to cpus (e.g. 2 or 2-3).", "cpus");
+      QCommandLineOption decodeCpusOption("decode-cpus", "Pin the decode threads to cpus (e.g. 4-7).", "cpus");
+      QCommandLineOption mlockOption("mlock", "Lock capture buffers and process memory.");
+      QCommandLineOption flatFieldOption("flat-field", "Correct dark level and vignetting with the calibration of the frame size.");
+      QCommandLineOption distortionOption("distortion", "Correct radial lens distortion, negative k1 for barrel distortion.", "k1[,k2]");
+      QCommandLineOption calibrateOption("calibrate", "Take a dark (lens covered) or flat (even empty field) calibration frame.", "dark|flat");
+      QCommandLineOption calibrateFramesOption("calibrate-frames", "Frames averaged for a calibration frame.", "n", "32");
+      QCommandLineOption calibrationDirOption("calibration-dir", "Directory of the calibration files, default --output.", "dir");
+      QCommandLineOption autoExposureOption("auto-exposure", "Control the exposure time from the frame histogram.");
+      QCommandLineOption traceOption("trace", "Record a pipeline trace, written on exit and on SIGUSR1 (Chrome JSON).", "file");
+      QCommandLineOption statsOption("stats", "Print statistics every n seconds.", "sec", "0");
+      QCommandLineOption durationOption("duration", "Stop after n seconds.", "sec", "0");
+      parser.addOption(headlessOption);
+      parser.addOption(deviceOption);
+      parser.addOption(sizeOption);
+      parser.addOption(fpsOption);
+      parser.addOption(formatOption);
+      parser.addOption(intervalOption);
+      parser.addOption(outputOption);
+      parser.addOption(prefixOption);
+      parser.addOption(rawOption);
+      parser.addOption(recordOption);
+      parser.addOption(timelapseOption);
+      parser.addOption(timelapseRecordOption);
+      parser.addOption(motionOption);
+      parser.addOption(motionPreOption);
+      parser.addOption(motionPostOption);
+      parser.addOption(mosaicOption);
+      parser.addOption(httpOption);
+      parser.addOption(shmOption);
+      parser.addOption(lowLatencyOption);
+      parser.addOption(imageFormatOption);
+      parser.addOption(decodeThreadsOption);
+      parser.addOption(averageOption);
+      parser.addOption(averageEmaOption);
+      parser.addOption(capturePriorityOption);
+      parser.addOption(capturePolicyOption);
+      parser.addOption(captureCpusOption);
+      parser.addOption(decodeCpusOption);
+      parser.addOption(mlockOption);
+      parser.addOption(flatFieldOption);
+      parser.addOption(distortionOption);
+      parser.addOption(calibrateOption);
+      parser.addOption(calibrateFramesOption);
+      parser.addOption(calibrationDirOption);
+      parser.addOption(autoExposureOption);
+      parser.addOption(traceOption);
+      parser.addOption(statsOption);
+      parser.addOption(durationOption);
+      parser.process(args);
+
+      std::vector<CamDevice> devices;
+      readDevices(&devices);
+      if (devices.empty()) {
+            fprintf(stderr, "cam: no cameras found\n");
+            return -1;
+            }
+      CamDeviceSetting setting;
+      if (parser.isSet(deviceOption)) {
+            setting.device = findDevice(&devices, parser.value(deviceOption));
+            if (!setting.device) {
+                  fprintf(stderr, "cam: camera <%s> not found\n", qPrintable(parser.value(deviceOption)));
+                  return -1;
+                  }
+            }
+      else
+            setting.device = &devices[0];
+
+      setting.size = setting.device->formats.front().size;
+      if (parser.isSet(sizeOption)) {
+            QStringList sl = parser.value(sizeOption).split('x');
+            if (sl.size() != 2 || sl[0].toInt() <= 0 || sl[1].toInt() <= 0) {
+                  fprintf(stderr, "cam: bad size <%s>\n", qPrintable(parser.value(sizeOption)));
+                  return -1;
+                  }
+            setting.size = QSize(sl[0].toInt(), sl[1].toInt());
+            }
+      setting.fps         = parser.value(fpsOption).toInt();
+      setting.pixelFormat = parseFormat(setting.device, parser.value(formatOption));
+
+      QImage::Format imageFormat = parseImageFormat(parser.value(imageFormatOption));
+      if (imageFormat == QImage::Format_Invalid) {
+            fprintf(stderr, "cam: bad image format <%s>\n", qPrintable(parser.value(imageFormatOption)));
+            return -1;
+            }
+
+      RealtimeSetting realtime;
+      if (parser.isSet(capturePriorityOption)) {
+            if (!parseSchedPolicy(parser.value(capturePolicyOption), &realtime.policy)) {
+                  fprintf(stderr, "cam: bad policy <%s>\n", qPrintable(parser.value(capturePolicyOption)));
+                  return -1;
+                  }
+            realtime.priority = parser.value(capturePriorityOption).toInt();
+            }
+      if (parser.isSet(captureCpusOption) && !parseCpuList(parser.value(captureCpusOption), &realtime.captureCpus)) {
+            fprintf(stderr, "cam: bad cpu list <%s>\n", qPrintable(parser.value(captureCpusOption)));
+            return -1;
+            }
+      if (parser.isSet(decodeCpusOption) && !parseCpuList(parser.value(decodeCpusOption), &realtime.decodeCpus)) {
+            fprintf(stderr, "cam: bad cpu list <%s>\n", qPrintable(parser.value(decodeCpusOption)));
+            return -1;
+            }
+      realtime.lockMemory = parser.isSet(mlockOption);
+
+      CorrectionSetting correction;
+      correction.flatField = parser.isSet(flatFieldOption);
+      if (parser.isSet(distortionOption)) {
+            QStringList sl = parser.value(distortionOption).split(',');
+            bool ok1 = true, ok2 = true;
+            correction.k1 = sl[0].toDouble(&ok1);
+            if (sl.size() > 1)
+                  correction.k2 = sl[1].toDouble(&ok2);
+            if (!ok1 || !ok2 || sl.size() > 2) {
+                  fprintf(stderr, "cam: bad distortion <%s>\n", qPrintable(parser.value(distortionOption)));
+                  return -1;
+                  }
+            }
+      QString calibrate = parser.value(calibrateOption);
+      if (!calibrate.isEmpty() && calibrate != "dark" && calibrate != "flat") {
+            fprintf(stderr, "cam: bad calibration <%s>\n", qPrintable(calibrate));
+            return -1;
+            }
+
+      double statsInterval = parser.value(statsOption).toDouble();
+      double duration      = parser.value(durationOption).toDouble();
+
+      if (parser.isSet(traceOption))
+            Trace::start(parser.value(traceOption));
+
+      Capture capture;
+      capture.setPicturePath(parser.value(outputOption));
+      capture.setPicturePrefix(parser.value(prefixOption));
+      capture.setSnapshotInterval(parser.value(intervalOption).toDouble());
+      capture.setRawSnapshots(parser.isSet(rawOption));
+      capture.setLowLatency(parser.isSet(lowLatencyOption));
+      capture.setDecodeThreads(parser.value(decodeThreadsOption).toInt());
+      capture.setImageFormat(imageFormat);
+      capture.setRealtime(realtime);
+      if (parser.isSet(averageOption))
+            capture.setAverage(FrameAverager::Mode::Mean, parser.value(averageOption).toInt());
+      else if (parser.isSet(averageEmaOption))
+            capture.setAverage(FrameAverager::Mode::Exponential, parser.value(averageEmaOption).toInt());
+      if (correction.enabled())
+            capture.setCorrection(correction);
+      if (parser.isSet(calibrationDirOption))
+            capture.setCalibrationPath(parser.value(calibrationDirOption));
+      if (!calibrate.isEmpty()) {
+            capture.calibrate(calibrate == "dark" ? Calibrator::Type::Dark : Calibrator::Type::Flat,
+               parser.value(calibrateFramesOption).toInt());
+            }
+      if (parser.isSet(autoExposureOption)) {
+            capture.setAutoExposure(true);
+            capture.setMetering(statsInterval > 0.0);
+            }
+      if (parser.isSet(recordOption) && !capture.startRecording(parser.value(recordOption)))
+            return -1;
+      if (parser.isSet(timelapseOption)) {
+            bool ok;
+            double seconds = parser.value(timelapseOption).toDouble(&ok);
+            if (!ok) {
+                  fprintf(stderr, "cam: bad timelapse interval <%s>\n", qPrintable(parser.value(timelapseOption)));
+                  return -1;
+                  }
+            if (!capture.startTimelapse(seconds, parser.value(timelapseRecordOption)))
+                  return -1;
+            }
+      if (parser.isSet(motionOption))
+            capture.startMotion(parser.value(motionOption).toDouble(), parser.value(motionPreOption).toInt(),
+               parser.value(motionPostOption).toInt());
+      if (parser.isSet(mosaicOption))
+            capture.startMosaic();
+      if (parser.isSet(httpOption) && !capture.startServer(parser.value(httpOption).toInt()))
+            return -1;
+      if (parser.isSet(shmOption))
+            capture.startShm(parser.value(shmOption));
+      if (capture.init(setting))
+            return -1;
+
+      fprintf(stderr, "cam: capturing <%s> %d x %d %d fps %s\n", qPrintable(setting.device->device),
+         setting.size.width(), setting.size.height(), setting.fps, qPrintable(pixelFormatName(capture.pixelFormat())));
+      capture.start();
+
+      auto startTime = std::chrono::steady_clock::now();
+      auto lastStats = startTime;
+      unsigned lastCaptured = 0;
+      bool calibrating      = false;
+      for (;;) {
+            struct timespec ts = { 0, 200000000 };    // 200 ms
+            int sig = sigtimedwait(&sigs, 0, &ts);
+            if (sig == SIGUSR1) {
+                  if (Trace::write())
+                        fprintf(stderr, "cam: trace written to <%s>\n", qPrintable(Trace::path()));
+                  continue;
+                  }
+            if (sig > 0)
+                  break;
+            if (calibrating && !capture.calibrating())
+                  fprintf(stderr, "cam: %s frame calibrated\n", qPrintable(calibrate));
+            calibrating = capture.calibrating();
+            auto now = std::chrono::steady_clock::now();
+            if (duration > 0.0 && std::chrono::duration<double>(now - startTime).count() >= duration)
+                  break;
+            double dt = std::chrono::duration<double>(now - lastStats).count();
+            if (statsInterval > 0.0 && dt >= statsInterval) {
+                  unsigned captured = capture.capturedFrames();
+                  printf("captured %u (%.1f fps) decoded %u skipped %u lost %u rejected %u snapshots %u timelapse %u recorded %llu bytes\n",
+                     captured, (captured - lastCaptured) / dt, capture.decodedFrames(), capture.skippedFrames(),
+                     capture.lostFrames(), capture.rejectedFrames(), capture.snapshots(), capture.timelapseFrames(),
+                     (unsigned long long)capture.recordedBytes());
+                  if (capture.rejectedFrames()) {
+                        printf("   rejected:");
+                        for (int i = 1; i < jpegErrors; ++i) {
+                              if (capture.rejectedFrames(JpegError(i)))
+                                    printf(" %s %u", jpegErrorName(JpegError(i)), capture.rejectedFrames(JpegError(i)));
+                              }
+                        printf("\n");
+                        }
+                  Latency l;
+                  capture.takeLatency(&l);
+                  const std::pair<const char*, const LatencyHistogram*> ll[] = {
+                        { "wakeup", &l.wakeup }, { "interval", &l.interval }, { "process", &l.process }
+                        };
+                  for (const auto& p : ll) {
+                        if (p.second->count()) {
+                              printf("   latency %s: mean %.2f p50 %.2f p99 %.2f max %.2f ms\n", p.first,
+                                 p.second->mean(), p.second->percentile(50), p.second->percentile(99), p.second->max());
+                              }
+                        }
+                  qint64 total = 0;
+                  for (const MemoryUsage& m : capture.memoryUsage()) {
+                        printf("   memory %s: %.1f kB\n", qPrintable(m.stage), m.bytes / 1024.0);
+                        total += m.bytes;
+                        }
+                  printf("   memory total: %.1f kB\n", total / 1024.0);
+                  if (capture.motionDetection())
+                        printf("   motion: %u events, %u frames\n", capture.motionEvents(), capture.motionFrames());
+                  if (capture.mosaic()) {
+                        const Mosaic* m = capture.mosaic();
+                        QRect r         = m->canvas().bounds();
+                        printf("   mosaic: %u frames, %u lost, %d x %d, peak %.2f, %.1f MB\n", m->frames(), m->lost(),
+                           r.width(), r.height(), m->peak(), m->canvas().memory() / 1048576.0);
+                        }
+                  Histogram h;
+                  if (capture.takeHistogram(&h)) {
+                        printf("   exposure %d: mean %.0f, clipped %.1f%% / %.1f%%\n", capture.exposure(),
+                           h.mean(), h.clippedLow() * 100.0, h.clippedHigh() * 100.0);
+                        }
+                  if (capture.server()) {
+                        for (const StreamClientStats& c : capture.server()->stats()) {
+                              printf("   http %s: %u frames, %u dropped, %.1f fps, %.1f kB/s\n",
+                                 qPrintable(c.address), c.frames, c.dropped,
+                                 c.seconds > 0.0 ? c.frames / c.seconds : 0.0,
+                                 c.seconds > 0.0 ? c.bytes / c.seconds / 1024.0 : 0.0);
+                              }
+                        }
+                  fflush(stdout);
+                  lastCaptured = captured;
+                  lastStats    = now;
+                  }
+            }
+      capture.stop();
+      capture.stopRecording();
+      if (capture.mosaic() && writeTiledTiff(parser.value(mosaicOption), capture.mosaic()->canvas()))
+            fprintf(stderr, "cam: mosaic written to <%s>\n", qPrintable(parser.value(mosaicOption)));
+      if (Trace::enabled() && Trace::write())
+            fprintf(stderr, "cam: trace written to <%s>\n", qPrintable(Trace::path()));
+      fprintf(stderr, "cam: captured %u frames, %u snapshots\n", capture.capturedFrames(), capture.snapshots());
+      return 0;
+      }
+
@@ -0,0 +1,21 @@
+//=============================================================================
+//  Cam
+//  Webcam client
+//
+//  Copyright (C) 2016 Werner Schweer
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License version 2
+//  as published by the Free Software Foundation and appearing in
+//  the file LICENCE.GPL
+//=============================================================================
+
+#ifndef __HEADLESS_H__
+#define __HEADLESS_H__
+
+#include <QStringList>
+
+extern int headless(const QStringList& args);
+
+#endif
+
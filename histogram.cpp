@@ -0,0 +1,257 @@
+//=============================================================================
+//  Cam
+//  Webcam client
+//
+//  Copyright (C) 2016 Werner Schweer
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License version 2
+//  as published by the Free Software Foundation and appearing in
+//  the file LICENCE.GPL
+//=============================================================================
+
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "histogram.h"
+
+//    the yuv -> rgb conversion is the one of yuv.cpp:
+//       c = ky * (Y - y0) + 32
+//       R = (c + rv * V) >> 6
+//       G = (c - gu * U - gv * V) >> 6
+//       B = (c + bu * U) >> 6
+//    luma is c >> 6
+
+static const int sampleStep = 4;      // every 4th pixel
+static const int rowStep    = 8;      // of every 8th row
+
+struct Coefficients {
+      short ky, y0, rv, gu, gv, bu;
+      };
+
+static const Coefficients limitedRange { 74, 16, 102, 25, 52, 129 };
+static const Coefficients fullRange    { 64,  0,  90, 22, 46, 113 };
+
+//---------------------------------------------------------
+//   clamp
+//---------------------------------------------------------
+
+static inline int clamp(int v)
+      {
+      return v < 0 ? 0 : (v > 255 ? 255 : v);
+      }
+
+//---------------------------------------------------------
+//   count
+//    add n <= 8 converted samples; the samples are loaded
+//    into registers first, as uchar stores may alias the
+//    histogram
+//---------------------------------------------------------
+
+static inline void count(Histogram* h, const uchar* l, const uchar* r, const uchar* g, const uchar* b, int n)
+      {
+      quint64 ll, rr, gg, bb;
+      memcpy(&ll, l, 8);
+      memcpy(&rr, r, 8);
+      memcpy(&gg, g, 8);
+      memcpy(&bb, b, 8);
+      for (int i = 0; i < n; ++i) {
+            ++h->luma[ll & 0xff];
+            ++h->red[rr & 0xff];
+            ++h->green[gg & 0xff];
+            ++h->blue[bb & 0xff];
+            ll >>= 8;
+            rr >>= 8;
+            gg >>= 8;
+            bb >>= 8;
+            }
+      h->samples += n;
+      }
+
+//---------------------------------------------------------
+//   convert
+//    8 samples, int16 y, u - 128, v - 128
+//---------------------------------------------------------
+
+static inline void convert(const short* ys, const short* us, const short* vs, const Coefficients& k,
+   uchar* l, uchar* r, uchar* g, uchar* b, int n)
+      {
+#ifdef __SSE2__
+      if (n == 8) {
+            __m128i y = _mm_loadu_si128((const __m128i*)ys);
+            __m128i u = _mm_loadu_si128((const __m128i*)us);
+            __m128i v = _mm_loadu_si128((const __m128i*)vs);
+            __m128i c = _mm_mullo_epi16(_mm_sub_epi16(y, _mm_set1_epi16(k.y0)), _mm_set1_epi16(k.ky));
+            c = _mm_add_epi16(c, _mm_set1_epi16(32));
+            __m128i rr = _mm_adds_epi16(c, _mm_mullo_epi16(v, _mm_set1_epi16(k.rv)));
+            __m128i gg = _mm_subs_epi16(c, _mm_mullo_epi16(u, _mm_set1_epi16(k.gu)));
+            gg = _mm_subs_epi16(gg, _mm_mullo_epi16(v, _mm_set1_epi16(k.gv)));
+            __m128i bb = _mm_adds_epi16(c, _mm_mullo_epi16(u, _mm_set1_epi16(k.bu)));
+            __m128i lr = _mm_packus_epi16(_mm_srai_epi16(c, 6), _mm_srai_epi16(rr, 6));
+            __m128i gb = _mm_packus_epi16(_mm_srai_epi16(gg, 6), _mm_srai_epi16(bb, 6));
+            _mm_storel_epi64((__m128i*)l, lr);
+            _mm_storel_epi64((__m128i*)r, _mm_srli_si128(lr, 8));
+            _mm_storel_epi64((__m128i*)g, gb);
+            _mm_storel_epi64((__m128i*)b, _mm_srli_si128(gb, 8));
+            return;
+            }
+#endif
+      for (int i = 0; i < n; ++i) {
+            int c = k.ky * (ys[i] - k.y0) + 32;
+            l[i] = clamp(c >> 6);
+            r[i] = clamp((c + k.rv * vs[i]) >> 6);
+            g[i] = clamp((c - k.gu * us[i] - k.gv * vs[i]) >> 6);
+            b[i] = clamp((c + k.bu * us[i]) >> 6);
+            }
+      }
+
+//---------------------------------------------------------
+//   clear
+//---------------------------------------------------------
+
+void Histogram::clear()
+      {
+      memset(this, 0, sizeof(*this));
+      }
+
+//---------------------------------------------------------
+//   mean
+//    mean luma
+//---------------------------------------------------------
+
+double Histogram::mean() const
+      {
+      if (!samples)
+            return 0.0;
+      quint64 sum = 0;
+      for (int i = 0; i < 256; ++i)
+            sum += quint64(i) * luma[i];
+      return double(sum) / samples;
+      }
+
+//---------------------------------------------------------
+//   clippedLow
+//---------------------------------------------------------
+
+double Histogram::clippedLow() const
+      {
+      return samples ? double(luma[0]) / samples : 0.0;
+      }
+
+//---------------------------------------------------------
+//   clippedHigh
+//---------------------------------------------------------
+
+double Histogram::clippedHigh() const
+      {
+      return samples ? double(qMax(red[255], qMax(green[255], blue[255]))) / samples : 0.0;
+      }
+
+//---------------------------------------------------------
+//   percentile
+//    luma value below which p (0 - 1) of the samples are
+//---------------------------------------------------------
+
+int Histogram::percentile(double p) const
+      {
+      quint64 limit = quint64(p * samples);
+      quint64 sum   = 0;
+      for (int i = 0; i < 256; ++i) {
+            sum += luma[i];
+            if (sum > limit)
+                  return i;
+            }
+      return 255;
+      }
+
+//---------------------------------------------------------
+//   histogramYuv
+//    gather 8 samples, convert with SSE2, count
+//---------------------------------------------------------
+
+void histogramYuv(Histogram* h, const YuvPlanes& p)
+      {
+      const Coefficients& k = p.fullRange ? fullRange : limitedRange;
+      short ys[8], us[8], vs[8];
+      uchar l[8], r[8], g[8], b[8];
+      const int yInc = sampleStep * p.yStep;
+      const int cInc = (sampleStep >> p.shiftX) * p.cStep;
+      if (!p.u) {
+            memset(us, 0, sizeof(us));
+            memset(vs, 0, sizeof(vs));
+            }
+      for (int row = 0; row < p.height; row += rowStep) {
+            const uchar* y = p.y + row * p.yStride;
+            const uchar* u = p.u ? p.u + (row >> p.shiftY) * p.cStride : 0;
+            const uchar* v = p.v ? p.v + (row >> p.shiftY) * p.cStride : 0;
+            int n = 0;
+            for (int x = 0; x < p.width; x += sampleStep, y += yInc) {
+                  ys[n] = *y;
+                  if (u) {
+                        us[n] = *u - 128;
+                        vs[n] = *v - 128;
+                        u += cInc;
+                        v += cInc;
+                        }
+                  if (++n == 8) {
+                        convert(ys, us, vs, k, l, r, g, b, n);
+                        count(h, l, r, g, b, n);
+                        n = 0;
+                        }
+                  }
+            if (n) {
+                  convert(ys, us, vs, k, l, r, g, b, n);
+                  count(h, l, r, g, b, n);
+                  }
+            }
+      }
+
+//---------------------------------------------------------
+//   histogramYuyv
+//---------------------------------------------------------
+
+void histogramYuyv(Histogram* h, const uchar* src, int stride, int w, int hh)
+      {
+      YuvPlanes p { src, src + 1, src + 3, stride, 2, stride, 4, 1, 0, w, hh, false };
+      histogramYuv(h, p);
+      }
+
+//---------------------------------------------------------
+//   histogramNv12
+//---------------------------------------------------------
+
+void histogramNv12(Histogram* h, const uchar* y, int yStride, const uchar* uv, int uvStride, int w, int hh)
+      {
+      YuvPlanes p { y, uv, uv + 1, yStride, 1, uvStride, 2, 1, 1, w, hh, false };
+      histogramYuv(h, p);
+      }
+
+//---------------------------------------------------------
+//   histogramRgb32
+//    decoders without planar output; luma is BT.601
+//---------------------------------------------------------
+
+void histogramRgb32(Histogram* h, const uchar* src, int stride, int w, int hh)
+      {
+      uchar l[8], r[8], g[8], b[8];
+      for (int row = 0; row < hh; row += rowStep) {
+            const uchar* s = src + row * stride;
+            int n = 0;
+            for (int x = 0; x < w; x += sampleStep, s += sampleStep * 4) {
+                  const uchar* px = s;
+                  b[n] = px[0];
+                  g[n] = px[1];
+                  r[n] = px[2];
+                  l[n] = (77 * r[n] + 150 * g[n] + 29 * b[n] + 128) >> 8;
+                  if (++n == 8) {
+                        count(h, l, r, g, b, n);
+                        n = 0;
+                        }
+                  }
+            count(h, l, r, g, b, n);
+            }
+      }
+
@@ -0,0 +1,66 @@
+//=============================================================================
+//  Cam
+//  Webcam client
+//
+//  Copyright (C) 2016 Werner Schweer
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License version 2
+//  as published by the Free Software Foundation and appearing in
+//  the file LICENCE.GPL
+//=============================================================================
+
+#ifndef __HISTOGRAM_H__
+#define __HISTOGRAM_H__
+
+#include <QtGlobal>
+
+//---------------------------------------------------------
+//   Histogram
+//    luma and RGB histograms of every 4th pixel in every
+//    8th row, in display (RGB32) values
+//---------------------------------------------------------
+
+struct Histogram {
+      quint32 luma[256];
+      quint32 red[256];
+      quint32 green[256];
+      quint32 blue[256];
+      quint32 samples;
+
+      void clear();
+      double mean() const;
+      int percentile(double p) const;
+      double clippedLow() const;    // ratio of black samples
+      double clippedHigh() const;   // ratio of samples with the most clipped channel at 255
+      };
+
+//---------------------------------------------------------
+//   YuvPlanes
+//    sample (x, y) of luma is at y + row * yStride +
+//    x * yStep, chroma at (x >> shiftX, row >> shiftY);
+//    packed formats point u and v into the luma plane
+//---------------------------------------------------------
+
+struct YuvPlanes {
+      const uchar* y;
+      const uchar* u;               // 0: gray
+      const uchar* v;
+      int yStride;
+      int yStep;
+      int cStride;
+      int cStep;
+      int shiftX;
+      int shiftY;
+      int width;
+      int height;
+      bool fullRange;               // jpeg: 0 - 255, else BT.601 16 - 235
+      };
+
+extern void histogramYuv(Histogram*, const YuvPlanes&);
+extern void histogramYuyv(Histogram*, const uchar* src, int stride, int w, int h);
+extern void histogramNv12(Histogram*, const uchar* y, int yStride, const uchar* uv, int uvStride, int w, int h);
+extern void histogramRgb32(Histogram*, const uchar* src, int stride, int w, int h);
+
+#endif
+
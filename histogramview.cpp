@@ -0,0 +1,111 @@
+//=============================================================================
+//  Cam
+//  Webcam client
+//
+//  Copyright (C) 2016 Werner Schweer
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License version 2
+//  as published by the Free Software Foundation and appearing in
+//  the file LICENCE.GPL
+//=============================================================================
+
+#include <QPainter>
+#include <QPointF>
+#include <QTimer>
+
+#include "histogramview.h"
+#include "capture.h"
+
+//---------------------------------------------------------
+//   HistogramView
+//---------------------------------------------------------
+
+HistogramView::HistogramView(Capture* c, QWidget* parent)
+   : QWidget(parent), capture(c)
+      {
+      histogram.clear();
+      setMinimumSize(128, 80);
+      timer = new QTimer(this);
+      connect(timer, SIGNAL(timeout()), SLOT(poll()));
+      }
+
+//---------------------------------------------------------
+//   showEvent
+//---------------------------------------------------------
+
+void HistogramView::showEvent(QShowEvent* e)
+      {
+      QWidget::showEvent(e);
+      capture->setMetering(true);
+      timer->start(100);
+      }
+
+//---------------------------------------------------------
+//   hideEvent
+//---------------------------------------------------------
+
+void HistogramView::hideEvent(QHideEvent* e)
+      {
+      QWidget::hideEvent(e);
+      capture->setMetering(false);
+      timer->stop();
+      }
+
+//---------------------------------------------------------
+//   poll
+//---------------------------------------------------------
+
+void HistogramView::poll()
+      {
+      if (capture->takeHistogram(&histogram))
+            update();
+      }
+
+//---------------------------------------------------------
+//   paintEvent
+//    bins are scaled to the largest bin without the
+//    clipped ends
+//---------------------------------------------------------
+
+void HistogramView::paintEvent(QPaintEvent*)
+      {
+      QPainter p(this);
+      p.fillRect(rect(), QColor(30, 30, 30));
+      if (!histogram.samples)
+            return;
+
+      quint32 max = 1;
+      for (int i = 1; i < 255; ++i) {
+            max = qMax(max, histogram.luma[i]);
+            max = qMax(max, qMax(histogram.red[i], qMax(histogram.green[i], histogram.blue[i])));
+            }
+      qreal w  = width();
+      qreal h  = height() - 16;
+      qreal sx = w / 256.0;
+      qreal sy = h / max;
+
+      for (int i = 0; i < 256; ++i) {
+            qreal v = qMin(qreal(histogram.luma[i]) * sy, h);
+            p.fillRect(QRectF(i * sx, h - v, sx + 0.5, v), QColor(160, 160, 160));
+            }
+      const quint32* channel[3] = { histogram.red, histogram.green, histogram.blue };
+      const QColor color[3]     = { QColor(255, 60, 60), QColor(60, 255, 60), QColor(80, 80, 255) };
+      QPointF line[256];
+      for (int c = 0; c < 3; ++c) {
+            for (int i = 0; i < 256; ++i)
+                  line[i] = QPointF((i + 0.5) * sx, h - qMin(qreal(channel[c][i]) * sy, h));
+            p.setPen(color[c]);
+            p.drawPolyline(line, 256);
+            }
+
+      QString s = QString("mean %1  clipped %2% / %3%")
+         .arg(histogram.mean(), 0, 'f', 0)
+         .arg(histogram.clippedLow() * 100.0, 0, 'f', 1)
+         .arg(histogram.clippedHigh() * 100.0, 0, 'f', 1);
+      if (capture->exposure() >= 0)
+            s += QString("  exposure %1").arg(capture->exposure());
+      p.setPen(Qt::white);
+      p.drawText(QRect(4, int(h), width() - 8, 16), Qt::AlignLeft, s);
+      }
+
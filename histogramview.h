@@ -0,0 +1,49 @@
+//=============================================================================
+//  Cam
+//  Webcam client
+//
+//  Copyright (C) 2016 Werner Schweer
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License version 2
+//  as published by the Free Software Foundation and appearing in
+//  the file LICENCE.GPL
+//=============================================================================
+
+#ifndef __HISTOGRAMVIEW_H__
+#define __HISTOGRAMVIEW_H__
+
+#include <QWidget>
+
+#include "histogram.h"
+
+class Capture;
+class QTimer;
+
+//---------------------------------------------------------
+//   HistogramView
+//    luma and RGB histograms with clipping and exposure
+//    readout; metering is switched on while visible
+//---------------------------------------------------------
+
+class HistogramView : public QWidget {
+      Q_OBJECT
+
+      Capture* capture;
+      Histogram histogram;
+      QTimer* timer;
+
+      virtual void paintEvent(QPaintEvent*) override;
+      virtual void showEvent(QShowEvent*) override;
+      virtual void hideEvent(QHideEvent*) override;
+
+   private slots:
+      void poll();
+
+   public:
+      HistogramView(Capture*, QWidget* parent = 0);
+      virtual QSize sizeHint() const override { return QSize(256, 160); }
+      };
+
+#endif
+
@@ -0,0 +1,419 @@
+//=============================================================================
+//  Cam
+//  Webcam client
+//
+//  Copyright (C) 2016 Werner Schweer
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License version 2
+//  as published by the Free Software Foundation and appearing in
+//  the file LICENCE.GPL
+//=============================================================================
+
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "jpeg.h"
+
+//---------------------------------------------------------
+//   default huffman tables (JPEG Annex K.3)
+//---------------------------------------------------------
+
+static const uchar dcLuminanceBits[16] = {
+      0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0 };
+static const uchar dcChrominanceBits[16] = {
+      0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0 };
+static const uchar dcValues[12] = {
+      0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+
+static const uchar acLuminanceBits[16] = {
+      0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d };
+static const uchar acLuminanceValues[162] = {
+      0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+      0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+      0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+      0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+      0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+      0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+      0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+      0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+      0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+      0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+      0xf9, 0xfa };
+
+static const uchar acChrominanceBits[16] = {
+      0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77 };
+static const uchar acChrominanceValues[162] = {
+      0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+      0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+      0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+      0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+      0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+      0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+      0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+      0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+      0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+      0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+      0xf9, 0xfa };
+
+//---------------------------------------------------------
+//   addTable
+//---------------------------------------------------------
+
+static void addTable(QByteArray* ba, int tableClass, const uchar* bits, const uchar* values, int n)
+      {
+      ba->append(char(tableClass));
+      ba->append((const char*)bits, 16);
+      ba->append((const char*)values, n);
+      }
+
+//---------------------------------------------------------
+//   makeHuffmanSegment
+//    DHT marker segment with all four default tables
+//---------------------------------------------------------
+
+static QByteArray makeHuffmanSegment()
+      {
+      QByteArray ba;
+      addTable(&ba, 0x00, dcLuminanceBits,   dcValues,            sizeof(dcValues));
+      addTable(&ba, 0x10, acLuminanceBits,   acLuminanceValues,   sizeof(acLuminanceValues));
+      addTable(&ba, 0x01, dcChrominanceBits, dcValues,            sizeof(dcValues));
+      addTable(&ba, 0x11, acChrominanceBits, acChrominanceValues, sizeof(acChrominanceValues));
+      int len = ba.size() + 2;
+      QByteArray s;
+      s.append(char(0xff));
+      s.append(char(0xc4));
+      s.append(char(len >> 8));
+      s.append(char(len & 0xff));
+      s.append(ba);
+      return s;
+      }
+
+//---------------------------------------------------------
+//   huffmanSegment
+//---------------------------------------------------------
+
+static const QByteArray& huffmanSegment()
+      {
+      static const QByteArray segment = makeHuffmanSegment();
+      return segment;
+      }
+
+//---------------------------------------------------------
+//   findScan
+//    walk the marker segments up to the start of scan;
+//    return offset of SOS marker or -1
+//---------------------------------------------------------
+
+static int findScan(const uchar* data, int size, bool* hasDht)
+      {
+      *hasDht = false;
+      if (size < 4 || data[0] != 0xff || data[1] != 0xd8)   // SOI
+            return -1;
+      int i = 2;
+      while (i + 4 <= size) {
+            if (data[i] != 0xff)
+                  return -1;
+            int marker = data[i + 1];
+            if (marker == 0xff) {         // fill byte
+                  ++i;
+                  continue;
+                  }
+            if (marker == 0xda)           // SOS
+                  return i;
+            if (marker == 0xc4)
+                  *hasDht = true;
+            i += 2 + ((data[i + 2] << 8) | data[i + 3]);
+            }
+      return -1;
+      }
+
+//---------------------------------------------------------
+//   jpegHasHuffmanTables
+//---------------------------------------------------------
+
+bool jpegHasHuffmanTables(const uchar* data, int size)
+      {
+      bool hasDht;
+      findScan(data, size, &hasDht);
+      return hasDht;
+      }
+
+//---------------------------------------------------------
+//   jpegAddHuffmanTables
+//    return a copy of the jpeg image with the default
+//    huffman tables inserted before the scan; images which
+//    already have tables are copied unchanged
+//---------------------------------------------------------
+
+QByteArray jpegAddHuffmanTables(const uchar* data, int size)
+      {
+      bool hasDht;
+      int sos = findScan(data, size, &hasDht);
+      if (sos < 0 || hasDht)
+            return QByteArray((const char*)data, size);
+      const QByteArray& dht = huffmanSegment();
+      QByteArray ba;
+      ba.reserve(size + dht.size());
+      ba.append((const char*)data, sos);
+      ba.append(dht);
+      ba.append((const char*)data + sos, size - sos);
+      return ba;
+      }
+
+//---------------------------------------------------------
+//   jpegHuffmanTablesSize
+//    bytes jpegCopyWithHuffmanTables() adds at most
+//---------------------------------------------------------
+
+int jpegHuffmanTablesSize()
+      {
+      return huffmanSegment().size();
+      }
+
+//---------------------------------------------------------
+//   jpegCopyWithHuffmanTables
+//    like jpegAddHuffmanTables() but writes into dst;
+//    return number of bytes written or -1 if capacity
+//    is too small
+//---------------------------------------------------------
+
+int jpegCopyWithHuffmanTables(const uchar* data, int size, uchar* dst, int capacity)
+      {
+      bool hasDht;
+      int sos = findScan(data, size, &hasDht);
+      if (sos < 0 || hasDht) {
+            if (size > capacity)
+                  return -1;
+            memcpy(dst, data, size);
+            return size;
+            }
+      const QByteArray& dht = huffmanSegment();
+      if (size + dht.size() > capacity)
+            return -1;
+      memcpy(dst, data, sos);
+      memcpy(dst + sos, dht.constData(), dht.size());
+      memcpy(dst + sos + dht.size(), data + sos, size - sos);
+      return size + dht.size();
+      }
+
+
+//---------------------------------------------------------
+//   findFF
+//    offset of the next 0xff byte at or after i, n if
+//    there is none; 0xff is rare in entropy coded data,
+//    16 bytes are tested at once
+//---------------------------------------------------------
+
+static int findFF(const uchar* p, int i, int n)
+      {
+#ifdef __SSE2__
+      const __m128i ff = _mm_set1_epi8(char(0xff));
+      for (; i + 16 <= n; i += 16) {
+            int m = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p + i)), ff));
+            if (m)
+                  return i + __builtin_ctz(m);
+            }
+#endif
+      for (; i < n; ++i) {
+            if (p[i] == 0xff)
+                  return i;
+            }
+      return n;
+      }
+
+//---------------------------------------------------------
+//   isSof
+//    start of frame, all coding processes
+//---------------------------------------------------------
+
+static bool isSof(int marker)
+      {
+      return marker >= 0xc0 && marker <= 0xcf && marker != 0xc4 && marker != 0xc8 && marker != 0xcc;
+      }
+
+//---------------------------------------------------------
+//   parseFrame
+//    SOF segment; blocks is set to the number of 8x8
+//    blocks of all components
+//---------------------------------------------------------
+
+static bool parseFrame(const uchar* s, int n, JpegInfo* info, qint64* blocks)
+      {
+      if (n < 6)
+            return false;
+      int precision    = s[0];
+      info->height     = (s[1] << 8) | s[2];
+      info->width      = (s[3] << 8) | s[4];
+      info->components = s[5];
+      int nc = info->components;
+      if ((precision != 8 && precision != 12) || info->width == 0 || info->height == 0
+         || (nc != 1 && nc != 3 && nc != 4) || n < 6 + 3 * nc)
+            return false;
+      int h[4], v[4];
+      int hmax = 1, vmax = 1;
+      for (int c = 0; c < nc; ++c) {
+            h[c] = s[7 + 3 * c] >> 4;
+            v[c] = s[7 + 3 * c] & 0xf;
+            if (h[c] < 1 || h[c] > 4 || v[c] < 1 || v[c] > 4)
+                  return false;
+            hmax = h[c] > hmax ? h[c] : hmax;
+            vmax = v[c] > vmax ? v[c] : vmax;
+            }
+      if (nc >= 3 && h[1] == h[2] && v[1] == v[2] && h[0] % h[1] == 0 && v[0] % v[1] == 0) {
+            info->hsub = h[0] / h[1];
+            info->vsub = v[0] / v[1];
+            }
+      else {
+            info->hsub = 1;
+            info->vsub = 1;
+            }
+      *blocks = 0;
+      for (int c = 0; c < nc; ++c) {
+            qint64 bw = (qint64(info->width) * h[c] + hmax * 8 - 1) / (hmax * 8);
+            qint64 bh = (qint64(info->height) * v[c] + vmax * 8 - 1) / (vmax * 8);
+            *blocks += bw * bh;
+            }
+      return true;
+      }
+
+//---------------------------------------------------------
+//   jpegValidate
+//    check the marker structure of a jpeg image without
+//    decoding it: SOI, one SOF before the first SOS, well
+//    formed segments, entropy coded data without stray
+//    markers and an EOI within size. Bytes after EOI are
+//    padding (info->end). A scan needs at least one bit
+//    per block, frames with less data are empty buffers
+//    with an intact header.
+//    Truncated UVC frames usually lack the EOI, corrupted
+//    ones carry markers which are invalid in a scan.
+//---------------------------------------------------------
+
+JpegError jpegValidate(const uchar* p, int size, JpegInfo* info)
+      {
+      *info = JpegInfo();
+      if (size < 4)
+            return JpegError::Short;
+      if (p[0] != 0xff || p[1] != 0xd8)
+            return JpegError::NoSoi;
+      bool frame    = false;
+      bool scan     = false;
+      qint64 blocks = 0;
+      qint64 coded  = 0;      // bytes of entropy coded data
+      int i = 2;
+      for (;;) {
+            if (i + 2 > size)
+                  return JpegError::Truncated;
+            if (p[i] != 0xff)
+                  return JpegError::Marker;
+            int marker = p[i + 1];
+            if (marker == 0xff) {         // fill byte
+                  ++i;
+                  continue;
+                  }
+            if (marker == 0xd9) {         // EOI
+                  if (!scan)
+                        return frame ? JpegError::Scan : JpegError::Frame;
+                  info->end = i + 2;
+                  break;
+                  }
+            if (marker == 0xd8 || marker == 0x00 || marker == 0x01 || (marker >= 0xd0 && marker <= 0xd7))
+                  return JpegError::Marker;
+            if (i + 4 > size)
+                  return JpegError::Truncated;
+            int len = (p[i + 2] << 8) | p[i + 3];
+            if (len < 2)
+                  return JpegError::Marker;
+            if (i + 2 + len > size)
+                  return JpegError::Truncated;
+            const uchar* s = p + i + 4;
+            int n = len - 2;
+            i += 2 + len;
+            if (isSof(marker)) {
+                  if (frame || !parseFrame(s, n, info, &blocks))
+                        return JpegError::Frame;
+                  info->progressive = marker == 0xc2 || marker == 0xc6 || marker == 0xca || marker == 0xce;
+                  frame = true;
+                  continue;
+                  }
+            if (marker != 0xda)
+                  continue;
+
+            // start of scan, followed by entropy coded data
+            // up to the next marker; 0xff00 is a stuffed
+            // 0xff, RSTn and fill bytes are part of the scan
+
+            if (!frame)
+                  return JpegError::Frame;
+            int ns = n > 0 ? s[0] : 0;
+            if (ns < 1 || ns > info->components || n < 4 + 2 * ns)
+                  return JpegError::Scan;
+            scan = true;
+            int start = i;
+            for (;;) {
+                  i = findFF(p, i, size);
+                  if (i + 1 >= size)
+                        return JpegError::Truncated;
+                  int c = p[i + 1];
+                  if (c == 0x00 || (c >= 0xd0 && c <= 0xd7))
+                        i += 2;
+                  else if (c == 0xff)
+                        ++i;
+                  else
+                        break;
+                  }
+            coded += i - start;
+            if (p[i + 1] == 0xd9) {
+                  info->end = i + 2;
+                  break;
+                  }
+            }
+      if (coded * 8 < blocks)
+            return JpegError::Empty;
+      return JpegError::None;
+      }
+
+//---------------------------------------------------------
+//   jpegErrorName
+//---------------------------------------------------------
+
+const char* jpegErrorName(JpegError e)
+      {
+      switch (e) {
+            case JpegError::None:      return "ok";
+            case JpegError::Short:     return "short";
+            case JpegError::NoSoi:     return "no SOI";
+            case JpegError::Marker:    return "bad marker";
+            case JpegError::Frame:     return "bad SOF";
+            case JpegError::Scan:      return "bad SOS";
+            case JpegError::Truncated: return "truncated";
+            case JpegError::Empty:     return "empty";
+            case JpegError::Size:      return "size";
+            }
+      return "?";
+      }
+
+//---------------------------------------------------------
+//   jpegSubsampling
+//---------------------------------------------------------
+
+const char* jpegSubsampling(const JpegInfo& info)
+      {
+      if (info.components == 1)
+            return "gray";
+      if (info.hsub == 1 && info.vsub == 1)
+            return "4:4:4";
+      if (info.hsub == 2 && info.vsub == 1)
+            return "4:2:2";
+      if (info.hsub == 2 && info.vsub == 2)
+            return "4:2:0";
+      if (info.hsub == 1 && info.vsub == 2)
+            return "4:4:0";
+      if (info.hsub == 4 && info.vsub == 1)
+            return "4:1:1";
+      return "other";
+      }
@@ -0,0 +1,62 @@
+//=============================================================================
+//  Cam
+//  Webcam client
+//
+//  Copyright (C) 2016 Werner Schweer
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License version 2
+//  as published by the Free Software Foundation and appearing in
+//  the file LICENCE.GPL
+//=============================================================================
+
+#ifndef __JPEG_H__
+#define __JPEG_H__
+
+#include <QByteArray>
+
+//---------------------------------------------------------
+//   jpeg helper
+//    UVC cameras usually omit the huffman tables (DHT)
+//    from their MJPEG frames and rely on the default
+//    tables of JPEG Annex K
+//---------------------------------------------------------
+
+extern bool jpegHasHuffmanTables(const uchar* data, int size);
+extern QByteArray jpegAddHuffmanTables(const uchar* data, int size);
+extern int jpegHuffmanTablesSize();
+extern int jpegCopyWithHuffmanTables(const uchar* data, int size, uchar* dst, int capacity);
+
+//---------------------------------------------------------
+//   JpegError
+//    why a frame failed jpegValidate(); Size is left to
+//    callers which know the frame size of the stream
+//---------------------------------------------------------
+
+enum class JpegError : int {
+      None, Short, NoSoi, Marker, Frame, Scan, Truncated, Empty, Size
+      };
+
+static const int jpegErrors = int(JpegError::Size) + 1;
+
+//---------------------------------------------------------
+//   JpegInfo
+//    frame header of a validated jpeg image
+//---------------------------------------------------------
+
+struct JpegInfo {
+      int width        { 0 };
+      int height       { 0 };
+      int components   { 0 };
+      int hsub         { 1 };     // chroma subsampling factors
+      int vsub         { 1 };
+      bool progressive { false };
+      int end          { 0 };     // bytes up to and including EOI
+      };
+
+extern JpegError jpegValidate(const uchar* data, int size, JpegInfo* info);
+extern const char* jpegErrorName(JpegError);
+extern const char* jpegSubsampling(const JpegInfo&);
+
+#endif
+
@@ -0,0 +1,96 @@
+//=============================================================================
+//  Cam
+//  Webcam client
+//
+//  Copyright (C) 2016 Werner Schweer
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License version 2
+//  as published by the Free Software Foundation and appearing in
+//  the file LICENCE.GPL
+//=============================================================================
+
+
+#include <string.h>
+
+#include "latency.h"
+
+//---------------------------------------------------------
+//   index
+//    0 - 7 us exact, then the octave and the three bits
+//    below the leading one
+//---------------------------------------------------------
+
+int LatencyHistogram::index(quint64 us)
+      {
+      if (us < 8)
+            return us;
+      int e = 63 - __builtin_clzll(us);
+      int i = (e - 2) * 8 + int((us >> (e - 3)) & 7);
+      return i < bins ? i : bins - 1;
+      }
+
+//---------------------------------------------------------
+//   lower
+//    smallest duration of bin
+//---------------------------------------------------------
+
+quint64 LatencyHistogram::lower(int i)
+      {
+      if (i < 8)
+            return i;
+      return quint64(8 + (i & 7)) << (i / 8 - 1);
+      }
+
+//---------------------------------------------------------
+//   clear
+//---------------------------------------------------------
+
+void LatencyHistogram::clear()
+      {
+      memset(bin, 0, sizeof(bin));
+      _count = 0;
+      _sum   = 0;
+      _max   = 0;
+      }
+
+//---------------------------------------------------------
+//   add
+//---------------------------------------------------------
+
+void LatencyHistogram::add(qint64 ns)
+      {
+      quint64 us = ns > 0 ? quint64(ns) / 1000 : 0;
+      ++bin[index(us)];
+      ++_count;
+      _sum += us;
+      if (us > _max)
+            _max = us;
+      }
+
+//---------------------------------------------------------
+//   mean
+//---------------------------------------------------------
+
+double LatencyHistogram::mean() const
+      {
+      return _count ? _sum / 1000.0 / _count : 0.0;
+      }
+
+//---------------------------------------------------------
+//   percentile
+//    lower bound of the bin holding percentile p (0 - 100)
+//---------------------------------------------------------
+
+double LatencyHistogram::percentile(double p) const
+      {
+      quint64 n   = quint64(_count * p / 100.0);
+      quint64 sum = 0;
+      for (int i = 0; i < bins; ++i) {
+            sum += bin[i];
+            if (sum > n)
+                  return lower(i) / 1000.0;
+            }
+      return max();
+      }
+
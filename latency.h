@@ -0,0 +1,71 @@
+//=============================================================================
+//  Cam
+//  Webcam client
+//
+//  Copyright (C) 2016 Werner Schweer
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License version 2
+//  as published by the Free Software Foundation and appearing in
+//  the file LICENCE.GPL
+//=============================================================================
+
+
+#ifndef __LATENCY_H__
+#define __LATENCY_H__
+
+#include <QtGlobal>
+
+//---------------------------------------------------------
+//   LatencyHistogram
+//    durations in microseconds, 8 bins per octave above
+//    8 us (at most 12.5% error), up to about 12 days
+//---------------------------------------------------------
+
+class LatencyHistogram {
+      static const int octaves = 40;
+      static const int bins    = (octaves + 1) * 8;
+
+      quint32 bin[bins];
+      quint32 _count;
+      quint64 _sum;                 // us
+      quint64 _max;                 // us
+
+      static int index(quint64 us);
+      static quint64 lower(int index);
+
+   public:
+      LatencyHistogram()            { clear(); }
+      void clear();
+      void add(qint64 ns);
+      quint32 count() const         { return _count; }
+      double mean() const;          // ms
+      double max() const            { return _max / 1000.0; }
+      double percentile(double p) const;    // ms
+      };
+
+//---------------------------------------------------------
+//   Latency
+//    capture thread timing per frame
+//
+//    wakeup   - driver timestamp to dequeue: how late the
+//               capture thread runs after the frame is
+//               complete; grows with preemption
+//    interval - between driver timestamps
+//    process  - dequeue to end of dispatch to consumers
+//---------------------------------------------------------
+
+struct Latency {
+      LatencyHistogram wakeup;
+      LatencyHistogram interval;
+      LatencyHistogram process;
+
+      void clear() {
+            wakeup.clear();
+            interval.clear();
+            process.clear();
+            }
+      };
+
+#endif
+
@@ -25,6 +25,8 @@
 #include <unistd.h>
 
 #include "camview.h"
+#include "headless.h"
+#include "trace.h"
 
 Q_IMPORT_PLUGIN(MjpegImageIOPlugin)
 
@@ -34,14 +36,35 @@ Q_IMPORT_PLUGIN(MjpegImageIOPlugin)
 
 int main(int argc, char* argv[])
       {
+      // the headless capture daemon needs no display server
+
+      for (int i = 1; i < argc; ++i) {
+            if (strcmp(argv[i], "--headless") == 0) {
+                  QCoreApplication a(argc, argv);
+                  return headless(a.arguments());
+                  }
+            }
+
       QApplication a(argc, argv);
       QCoreApplication::setOrganizationName("wschweer");
       QCoreApplication::setOrganizationName("wschweer.de");
       QCoreApplication::setOrganizationName("cam");
 
+      // CAM_TRACE=<file> records a pipeline trace; Ctrl+T
+      // and exit write it
+
+      QByteArray trace = qgetenv("CAM_TRACE");
+      if (!trace.isEmpty()) {
+            Trace::start(QString::fromLocal8Bit(trace));
+            Trace::setThreadName("gui");
+            }
+
       CamView* v = new CamView(0);
       v->show();
-      return a.exec();
+      int rv = a.exec();
+      if (Trace::enabled())
+            Trace::write();
+      return rv;
       }
 
 
@@ -10,98 +10,219 @@
 //  the file LICENCE.GPL
 //=============================================================================
 
+#include <limits.h>
+#include <string.h>
+
 #include <QImage>
-extern "C" {
-      #include <libavcodec/avcodec.h>
-      #include <libswscale/swscale.h>
-      }
 #include "mjpeg.h"
+#include "decoder.h"
 
 //---------------------------------------------------------
-//   MjpegImageIOHandler
+//   marker
+//    handle the marker code at device offset pos (the
+//    offset after the code)
 //---------------------------------------------------------
 
-MjpegImageIOHandler::MjpegImageIOHandler()
+void MjpegScanner::marker(uchar code, qint64 pos)
       {
-      avcodec_register_all();
-      codec = avcodec_find_decoder(AV_CODEC_ID_MJPEG);
-      if (!codec) {
-            printf("codec not found\n");
-            abort();
+      if (code == 0xd9) {                             // EOI
+            qint64 size = pos - frameStart;
+            if (size <= INT_MAX)
+                  found(frameStart, int(size));
+            state = Scan::Soi;
             }
-      c = avcodec_alloc_context3(codec);
-      if (avcodec_open2(c, codec, 0) < 0) {
-            printf("open codec failed\n");
-            exit(1);
+      else if (code == 0xd8) {                        // SOI of a new frame, previous one truncated
+            frameStart = pos - 2;
+            state      = Scan::Marker;
+            }
+      else if (code == 0x01 || (code >= 0xd0 && code <= 0xd7))
+            state = Scan::Marker;                     // no length field
+      else {
+            sos   = code == 0xda;
+            state = Scan::Length0;
             }
       }
 
-MjpegImageIOHandler::~MjpegImageIOHandler()
+//---------------------------------------------------------
+//   scan
+//    find the frame boundaries in n bytes at device offset
+//    pos; segment bodies are skipped and entropy coded data
+//    is searched for 0xff with memchr
+//---------------------------------------------------------
+
+void MjpegScanner::scan(const uchar* p, int n, qint64 pos)
       {
-      if (imgConvertCtx)
-            sws_freeContext(imgConvertCtx);
-      avcodec_close(c);
-      av_free(c);
+      int i = 0;
+      while (i < n) {
+            switch (state) {
+                  case Scan::Soi: {
+                        const uchar* f = (const uchar*)memchr(p + i, 0xff, n - i);
+                        if (!f)
+                              return;
+                        i          = f - p + 1;
+                        frameStart = pos + i - 1;
+                        state      = Scan::SoiMarker;
+                        }
+                        break;
+                  case Scan::SoiMarker: {
+                        uchar c = p[i++];
+                        if (c == 0xd8)
+                              state = Scan::Marker;
+                        else if (c == 0xff)
+                              frameStart = pos + i - 1;
+                        else
+                              state = Scan::Soi;
+                        }
+                        break;
+                  case Scan::Marker:
+                        // anything but a marker here means a broken
+                        // frame; it is dropped
+                        state = p[i++] == 0xff ? Scan::MarkerCode : Scan::Soi;
+                        break;
+                  case Scan::MarkerCode: {
+                        uchar c = p[i++];
+                        if (c != 0xff)                // fill byte
+                              marker(c, pos + i);
+                        }
+                        break;
+                  case Scan::Length0:
+                        segment = p[i++] << 8;
+                        state   = Scan::Length1;
+                        break;
+                  case Scan::Length1:
+                        segment = (segment | p[i++]) - 2;
+                        state   = Scan::Skip;
+                        if (segment < 0)
+                              state = Scan::Soi;
+                        break;
+                  case Scan::Skip: {
+                        int k = qMin(segment, n - i);
+                        i       += k;
+                        segment -= k;
+                        if (segment == 0)
+                              state = sos ? Scan::Entropy : Scan::Marker;
+                        }
+                        break;
+                  case Scan::Entropy: {
+                        const uchar* f = (const uchar*)memchr(p + i, 0xff, n - i);
+                        if (!f)
+                              return;
+                        i     = f - p + 1;
+                        state = Scan::EntropyMarker;
+                        }
+                        break;
+                  case Scan::EntropyMarker: {
+                        uchar c = p[i++];
+                        if (c == 0x00 || (c >= 0xd0 && c <= 0xd7))
+                              state = Scan::Entropy;  // stuffed byte or restart marker
+                        else if (c != 0xff)
+                              marker(c, pos + i);     // EOI or next segment
+                        }
+                        break;
+                  }
+            }
       }
 
 //---------------------------------------------------------
-//   read
+//   scan
+//    extend the index until it contains frame or the end
+//    of the device is reached; frame < 0 scans all
 //---------------------------------------------------------
 
-bool MjpegImageIOHandler::read(QImage* image)
+bool MjpegImageIOHandler::scan(int frame) const
       {
-      AVFrame* f = av_frame_alloc();
+      QIODevice* d = device();
+      if (!d || d->isSequential())
+            return false;
+      if (frame >= 0 && frame < int(index.entries.size()))
+            return true;
+      std::vector<uchar> buffer(chunkSize);
+      while (!complete && (frame < 0 || frame >= int(index.entries.size()))) {
+            if (!d->seek(scanned)) {
+                  complete = true;
+                  break;
+                  }
+            qint64 n = d->read((char*)buffer.data(), chunkSize);
+            if (n <= 0) {
+                  complete = true;
+                  break;
+                  }
+            index.scan(buffer.data(), n, scanned);
+            scanned += n;
+            }
+      return frame >= 0 && frame < int(index.entries.size());
+      }
 
-      AVPacket p;
-      av_init_packet(&p);
+//---------------------------------------------------------
+//   canRead
+//---------------------------------------------------------
 
-      QByteArray b = device()->readAll();
-      p.data      = (unsigned char*)b.data();
-      p.size      = b.size();
+bool MjpegImageIOHandler::canRead() const
+      {
+      if (device() && device()->isSequential())
+            return next == 0 && !device()->atEnd();
+      return scan(next);
+      }
 
-      int len = avcodec_send_packet(c, &p);
-      if (len < 0) {
-            printf("send packet failed\n");
-            b.clear();
-            return false;
-            }
-      if (avcodec_receive_frame(c, f) < 0) {
-            printf("receive frame failed\n");
-            b.clear();
-            return false;
+//---------------------------------------------------------
+//   read
+//    read and decode the next frame
+//---------------------------------------------------------
+
+bool MjpegImageIOHandler::read(QImage* image)
+      {
+      QByteArray b;
+      if (device()->isSequential()) {
+            if (next > 0)
+                  return false;
+            b = device()->readAll();
             }
-      if (!imgConvertCtx || (image->width() != f->width) || (image->height() != f->height)) {
-            QImage i(f->width, f->height, QImage::Format_RGB32);
-            *image = i;
-            imgConvertCtx = sws_getContext(
-               f->width, f->height,
-               // c->pix_fmt,
-               AV_PIX_FMT_YUV422P,  // hack to avoid deprecated warning
-               f->width, f->height, AV_PIX_FMT_RGB32,
-               SWS_BILINEAR,
-               0,
-               0,
-               0);
-            if (!imgConvertCtx) {
-                  printf("no conversion context\n");
+      else {
+            const Entry* e = scan(next) ? &index.entries[next] : 0;
+            if (!e || !device()->seek(e->offset))
+                  return false;
+            b = device()->read(e->size);
+            if (b.size() != e->size)
                   return false;
-                  }
             }
-      int stride    = image->bytesPerLine();
-      uint8_t* data = image->bits();
-      sws_scale(
-            imgConvertCtx,
-            f->data,
-            f->linesize,
-            0,
-            f->height,
-            &data,
-            &stride
-            );
-      av_frame_free(&f);
+      ++next;
+      return MjpegDecoder::local()->decode((const uchar*)b.constData(), b.size(), image);
+      }
+
+//---------------------------------------------------------
+//   imageCount
+//    scans the whole device
+//---------------------------------------------------------
+
+int MjpegImageIOHandler::imageCount() const
+      {
+      if (device() && device()->isSequential())
+            return 1;
+      scan(-1);
+      return index.entries.size();
+      }
+
+//---------------------------------------------------------
+//   jumpToImage
+//---------------------------------------------------------
+
+bool MjpegImageIOHandler::jumpToImage(int n)
+      {
+      if (n < 0 || !scan(n))
+            return false;
+      next = n;
       return true;
       }
 
+//---------------------------------------------------------
+//   jumpToNextImage
+//---------------------------------------------------------
+
+bool MjpegImageIOHandler::jumpToNextImage()
+      {
+      return jumpToImage(next + 1);
+      }
+
 //---------------------------------------------------------
 //   capabilities
 //---------------------------------------------------------
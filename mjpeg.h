@@ -13,27 +13,82 @@
 #ifndef __MJPEG_H__
 #define __MJPEG_H__
 
+#include <vector>
+
 #include <QImageIOHandler>
 #include <QImageIOPlugin>
 
-struct AVCodec;
-struct SwsContext;
-struct AVCodecContext;
+//---------------------------------------------------------
+//   MjpegScanner
+//    finds the frames of concatenated jpeg data. Only
+//    marker segments are parsed; the scan can stop at any
+//    byte and continue with the next chunk. found() gets
+//    offset and size of every complete frame, broken
+//    frames are skipped.
+//---------------------------------------------------------
+
+class MjpegScanner {
+      enum class Scan { Soi, SoiMarker, Marker, MarkerCode, Length0, Length1, Skip, Entropy, EntropyMarker };
+
+      Scan state        { Scan::Soi };
+      qint64 frameStart { 0 };
+      int segment       { 0 };        // bytes left of the current segment
+      bool sos          { false };    // segment is followed by entropy coded data
+
+      void marker(uchar code, qint64 pos);
+
+   protected:
+      virtual void found(qint64 offset, int size) = 0;
+
+   public:
+      virtual ~MjpegScanner() {}
+      void scan(const uchar* p, int n, qint64 pos);
+      };
 
 //---------------------------------------------------------
 //   MjpegImageIOHandler
+//    reads concatenated jpeg frames (cam --record) as an
+//    animation. The device is scanned in chunks for
+//    frame boundaries as far as needed; the index holds
+//    only offset and size of every frame, so any frame
+//    can be read without decoding the frames before it.
+//    Sequential devices return the first frame only.
+//
+//    decoding uses the decoder of the calling thread, so
+//    handlers are cheap to create and may be used from
+//    any thread
 //---------------------------------------------------------
 
 class MjpegImageIOHandler : public QImageIOHandler {
-      AVCodec* codec;
-      AVCodecContext* c;
-      SwsContext* imgConvertCtx { 0 };
+      struct Entry {
+            qint64 offset;
+            int size;
+            };
+      struct Index : public MjpegScanner {
+            std::vector<Entry> entries;
+            virtual void found(qint64 offset, int size) override { entries.push_back({ offset, size }); }
+            };
+
+      mutable Index index;
+      mutable qint64 scanned    { 0 };        // device offset of next chunk
+      mutable bool complete     { false };    // index covers the whole device
+      int next                  { 0 };        // frame returned by next read()
+
+      bool scan(int frame) const;
 
    public:
-      MjpegImageIOHandler();
-      virtual ~MjpegImageIOHandler();
-      virtual bool canRead() const { return true; }
-      virtual bool read(QImage*);
+      static const int chunkSize  = 1024 * 1024;
+      static const int frameDelay = 33;         // ms; recordings carry no timestamps
+
+      virtual bool canRead() const override;
+      virtual bool read(QImage*) override;
+      virtual int imageCount() const override;
+      virtual bool jumpToImage(int) override;
+      virtual bool jumpToNextImage() override;
+      virtual int nextImageDelay() const override  { return frameDelay; }
+      virtual int currentImageNumber() const override { return qMax(0, next - 1); }
+      virtual int loopCount() const override      { return 0; }
+      virtual bool supportsOption(ImageOption o) const override { return o == Animation; }
       };
 
 //---------------------------------------------------------
@@ -0,0 +1,602 @@
+//=============================================================================
+//  Cam
+//  Webcam client
+//
+//  Copyright (C) 2016 Werner Schweer
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License version 2
+//  as published by the Free Software Foundation and appearing in
+//  the file LICENCE.GPL
+//=============================================================================
+
+#include <math.h>
+#include <string.h>
+
+#include "mosaic.h"
+#include "threadpool.h"
+#include "trace.h"
+
+static const int maxAnalysis = 512;     // largest fft size
+
+//---------------------------------------------------------
+//   floorDiv
+//---------------------------------------------------------
+
+static inline int floorDiv(int a, int b)
+      {
+      return a >= 0 ? a / b : -((-a + b - 1) / b);
+      }
+
+//---------------------------------------------------------
+//   average4
+//    mean of four premultiplied ARGB pixels, two channels
+//    per 32 bit add
+//---------------------------------------------------------
+
+static inline quint32 average4(quint32 a, quint32 b, quint32 c, quint32 d)
+      {
+      const quint32 m = 0x00ff00ff;
+      quint32 rb = ((a & m) + (b & m) + (c & m) + (d & m) + 0x00020002) >> 2;
+      quint32 ag = (((a >> 8) & m) + ((b >> 8) & m) + ((c >> 8) & m) + ((d >> 8) & m) + 0x00020002) >> 2;
+      return (rb & m) | ((ag & m) << 8);
+      }
+
+//---------------------------------------------------------
+//   clear
+//---------------------------------------------------------
+
+void MosaicCanvas::clear()
+      {
+      std::lock_guard<std::mutex> lock(mutex);
+      tiles.clear();
+      _bounds = QRect();
+      }
+
+//---------------------------------------------------------
+//   tile
+//    find or create tile; new tiles are transparent
+//---------------------------------------------------------
+
+QImage* MosaicCanvas::tile(int level, int tx, int ty)
+      {
+      QImage& t = tiles[Key { level, tx, ty }];
+      if (t.isNull()) {
+            t = QImage(tileSize, tileSize, QImage::Format_ARGB32_Premultiplied);
+            t.fill(0);
+            }
+      return &t;
+      }
+
+//---------------------------------------------------------
+//   findTile
+//---------------------------------------------------------
+
+const QImage* MosaicCanvas::findTile(int level, int tx, int ty) const
+      {
+      auto i = tiles.find(Key { level, tx, ty });
+      return i == tiles.end() ? 0 : &i->second;
+      }
+
+//---------------------------------------------------------
+//   paste
+//    copy an RGB32 image to pos of level 0 and update the
+//    pyramid above it
+//---------------------------------------------------------
+
+void MosaicCanvas::paste(const QImage& image, const QPoint& pos)
+      {
+      int w = image.width();
+      int h = image.height();
+      if (w <= 0 || h <= 0)
+            return;
+      std::lock_guard<std::mutex> lock(mutex);
+      int x0 = pos.x();
+      int y0 = pos.y();
+      int x1 = x0 + w;
+      int y1 = y0 + h;
+      for (int ty = floorDiv(y0, tileSize); ty <= floorDiv(y1 - 1, tileSize); ++ty) {
+            for (int tx = floorDiv(x0, tileSize); tx <= floorDiv(x1 - 1, tileSize); ++tx) {
+                  QImage* t = tile(0, tx, ty);
+                  int ax = qMax(x0, tx * tileSize);
+                  int bx = qMin(x1, (tx + 1) * tileSize);
+                  int ay = qMax(y0, ty * tileSize);
+                  int by = qMin(y1, (ty + 1) * tileSize);
+                  for (int y = ay; y < by; ++y) {
+                        const quint32* s = (const quint32*)image.constScanLine(y - y0) + (ax - x0);
+                        quint32* d       = (quint32*)t->scanLine(y - ty * tileSize) + (ax - tx * tileSize);
+                        for (int x = ax; x < bx; ++x)
+                              *d++ = *s++ | 0xff000000;
+                        }
+                  }
+            }
+      _bounds |= QRect(x0, y0, w, h);
+      for (int level = 1; level < levels; ++level)
+            reduce(level, floorDiv(x0, 1 << level), floorDiv(y0, 1 << level),
+               floorDiv(x1 - 1, 1 << level) + 1, floorDiv(y1 - 1, 1 << level) + 1);
+      }
+
+//---------------------------------------------------------
+//   reduce
+//    recompute [x0, x1) x [y0, y1) of level from the 2 x 2
+//    pixels below; a destination tile covers 2 x 2 source
+//    tiles, one per quadrant
+//---------------------------------------------------------
+
+void MosaicCanvas::reduce(int level, int x0, int y0, int x1, int y1)
+      {
+      const int half = tileSize / 2;
+      for (int ty = floorDiv(y0, tileSize); ty <= floorDiv(y1 - 1, tileSize); ++ty) {
+            for (int tx = floorDiv(x0, tileSize); tx <= floorDiv(x1 - 1, tileSize); ++tx) {
+                  QImage* t = tile(level, tx, ty);
+                  int ax = qMax(x0, tx * tileSize) - tx * tileSize;
+                  int bx = qMin(x1, (tx + 1) * tileSize) - tx * tileSize;
+                  int ay = qMax(y0, ty * tileSize) - ty * tileSize;
+                  int by = qMin(y1, (ty + 1) * tileSize) - ty * tileSize;
+                  for (int qy = 0; qy < 2; ++qy) {
+                        int sy0 = qMax(ay, qy * half);
+                        int sy1 = qMin(by, (qy + 1) * half);
+                        for (int qx = 0; qx < 2; ++qx) {
+                              int sx0 = qMax(ax, qx * half);
+                              int sx1 = qMin(bx, (qx + 1) * half);
+                              if (sx0 >= sx1 || sy0 >= sy1)
+                                    continue;
+                              const QImage* s = findTile(level - 1, 2 * tx + qx, 2 * ty + qy);
+                              if (!s)
+                                    continue;
+                              for (int y = sy0; y < sy1; ++y) {
+                                    int sy = 2 * y - qy * tileSize;
+                                    const quint32* s0 = (const quint32*)s->constScanLine(sy) + 2 * sx0 - qx * tileSize;
+                                    const quint32* s1 = (const quint32*)s->constScanLine(sy + 1) + 2 * sx0 - qx * tileSize;
+                                    quint32* d        = (quint32*)t->scanLine(y) + sx0;
+                                    for (int x = sx0; x < sx1; ++x, s0 += 2, s1 += 2)
+                                          *d++ = average4(s0[0], s0[1], s1[0], s1[1]);
+                                    }
+                              }
+                        }
+                  }
+            }
+      }
+
+//---------------------------------------------------------
+//   read
+//    copy rectangle r of level into dst; uncovered pixels
+//    are transparent
+//---------------------------------------------------------
+
+void MosaicCanvas::read(int level, const QRect& r, QImage* dst) const
+      {
+      if (dst->size() != r.size() || dst->format() != QImage::Format_ARGB32_Premultiplied)
+            *dst = QImage(r.size(), QImage::Format_ARGB32_Premultiplied);
+      dst->fill(0);
+      if (r.isEmpty())
+            return;
+      std::lock_guard<std::mutex> lock(mutex);
+      for (int ty = floorDiv(r.top(), tileSize); ty <= floorDiv(r.bottom(), tileSize); ++ty) {
+            for (int tx = floorDiv(r.left(), tileSize); tx <= floorDiv(r.right(), tileSize); ++tx) {
+                  const QImage* t = findTile(level, tx, ty);
+                  if (!t)
+                        continue;
+                  int ax = qMax(r.left(), tx * tileSize);
+                  int bx = qMin(r.right() + 1, (tx + 1) * tileSize);
+                  int ay = qMax(r.top(), ty * tileSize);
+                  int by = qMin(r.bottom() + 1, (ty + 1) * tileSize);
+                  for (int y = ay; y < by; ++y)
+                        memcpy(dst->scanLine(y - r.top()) + (ax - r.left()) * 4,
+                           t->constScanLine(y - ty * tileSize) + (ax - tx * tileSize) * 4, (bx - ax) * 4);
+                  }
+            }
+      }
+
+//---------------------------------------------------------
+//   visibleTiles
+//    tiles of level intersecting r (level pixels)
+//---------------------------------------------------------
+
+std::vector<MosaicTile> MosaicCanvas::visibleTiles(int level, const QRect& r) const
+      {
+      std::vector<MosaicTile> v;
+      if (r.isEmpty())
+            return v;
+      std::lock_guard<std::mutex> lock(mutex);
+      for (int ty = floorDiv(r.top(), tileSize); ty <= floorDiv(r.bottom(), tileSize); ++ty) {
+            for (int tx = floorDiv(r.left(), tileSize); tx <= floorDiv(r.right(), tileSize); ++tx) {
+                  const QImage* t = findTile(level, tx, ty);
+                  if (t)
+                        v.push_back(MosaicTile { QPoint(tx * tileSize, ty * tileSize), *t });
+                  }
+            }
+      return v;
+      }
+
+//---------------------------------------------------------
+//   bounds
+//---------------------------------------------------------
+
+QRect MosaicCanvas::bounds() const
+      {
+      std::lock_guard<std::mutex> lock(mutex);
+      return _bounds;
+      }
+
+QRect MosaicCanvas::bounds(int level) const
+      {
+      QRect r = bounds();
+      if (r.isEmpty())
+            return r;
+      int x0 = floorDiv(r.left(), 1 << level);
+      int y0 = floorDiv(r.top(), 1 << level);
+      return QRect(x0, y0, floorDiv(r.right(), 1 << level) - x0 + 1, floorDiv(r.bottom(), 1 << level) - y0 + 1);
+      }
+
+//---------------------------------------------------------
+//   memory
+//---------------------------------------------------------
+
+qint64 MosaicCanvas::memory() const
+      {
+      std::lock_guard<std::mutex> lock(mutex);
+      return qint64(tiles.size()) * tileSize * tileSize * 4;
+      }
+
+//---------------------------------------------------------
+//   Mosaic
+//---------------------------------------------------------
+
+Mosaic::Mosaic()
+      {
+      thread = std::thread(&Mosaic::loop, this);
+      }
+
+Mosaic::~Mosaic()
+      {
+      {
+      std::lock_guard<std::mutex> lock(mutex);
+      running = false;
+      }
+      cv.notify_one();
+      thread.join();
+      delete fft;
+      }
+
+//---------------------------------------------------------
+//   frame
+//---------------------------------------------------------
+
+void Mosaic::frame(const FramePtr& f)
+      {
+      if (f->image().isNull())
+            return;
+      {
+      std::lock_guard<std::mutex> lock(mutex);
+      pending         = f->image();
+      pendingSequence = f->sequence;
+      busy            = true;
+      Trace::flowStart("mosaic", f->sequence);
+      }
+      cv.notify_one();
+      }
+
+//---------------------------------------------------------
+//   loop
+//---------------------------------------------------------
+
+void Mosaic::loop()
+      {
+      Trace::setThreadName("mosaic");
+      for (;;) {
+            QImage image;
+            unsigned sequence;
+            {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [this] { return !pending.isNull() || !running; });
+            if (!running)
+                  return;
+            image.swap(pending);
+            sequence = pendingSequence;
+            }
+            Trace::setFrame(sequence);
+            {
+            TraceScope ts("mosaic");
+            Trace::flowEnd("mosaic", sequence);
+            add(image);
+            }
+            busy = false;
+            }
+      }
+
+//---------------------------------------------------------
+//   fftSize
+//    largest power of two not above n, at most maxAnalysis
+//---------------------------------------------------------
+
+static int fftSize(int n)
+      {
+      int p = 1;
+      while (p * 2 <= n && p < maxAnalysis)
+            p *= 2;
+      return p;
+      }
+
+//---------------------------------------------------------
+//   setup
+//    choose the analysis level for the frame size: the
+//    first canvas level where the frame is at most twice
+//    maxAnalysis. The fft window is cropped from the frame,
+//    never padded: a padding edge at the same place in
+//    frame and reference would correlate at zero shift.
+//---------------------------------------------------------
+
+void Mosaic::setup(const QImage& image)
+      {
+      frameWidth  = image.width();
+      frameHeight = image.height();
+      level = 0;
+      while ((frameWidth >> level) > 2 * maxAnalysis || (frameHeight >> level) > 2 * maxAnalysis)
+            ++level;
+      fw = fftSize(frameWidth >> level);
+      fh = fftSize(frameHeight >> level);
+      delete fft;
+      fft = new Fft2d(fw, fh);
+      frameSpectrum.resize(fw * fh);
+      canvasSpectrum.resize(fw * fh);
+      window.resize(fw * fh);
+      std::vector<float> wx(fw), wy(fh);
+      for (int x = 0; x < fw; ++x)
+            wx[x] = 0.5f - 0.5f * cosf(2.0f * float(M_PI) * (x + 0.5f) / fw);
+      for (int y = 0; y < fh; ++y)
+            wy[y] = 0.5f - 0.5f * cosf(2.0f * float(M_PI) * (y + 0.5f) / fh);
+      for (int y = 0; y < fh; ++y)
+            for (int x = 0; x < fw; ++x)
+                  window[y * fw + x] = wx[x] * wy[y];
+
+      // gaussian low pass of the cross power spectrum: the
+      // correlation peak becomes a gaussian of lowpassSigma
+      // pixels, robust against sensor noise and with an
+      // exact sub pixel fit
+
+      lowpass.resize(fw * fh);
+      lowpassSum = 0.0f;
+      const float k = 2.0f * float(M_PI * M_PI) * lowpassSigma * lowpassSigma;
+      for (int y = 0; y < fh; ++y) {
+            float fy = float(y < fh / 2 ? y : y - fh) / fh;
+            for (int x = 0; x < fw; ++x) {
+                  float fx = float(x < fw / 2 ? x : x - fw) / fw;
+                  float v  = expf(-k * (fx * fx + fy * fy));
+                  lowpass[y * fw + x] = v;
+                  lowpassSum += v;
+                  }
+            }
+      }
+
+//---------------------------------------------------------
+//   luma
+//---------------------------------------------------------
+
+static inline int luma(quint32 p)
+      {
+      return (((p >> 16) & 0xff) * 77 + ((p >> 8) & 0xff) * 150 + (p & 0xff) * 29) >> 8;
+      }
+
+//---------------------------------------------------------
+//   finish
+//    subtract the mean of the valid samples, apply the
+//    window; invalid samples (marked negative) become 0
+//---------------------------------------------------------
+
+static void finish(Complex* dst, const float* window, int n)
+      {
+      double sum = 0.0;
+      int count  = 0;
+      for (int i = 0; i < n; ++i) {
+            if (dst[i].real() >= 0.0f) {
+                  sum += dst[i].real();
+                  ++count;
+                  }
+            }
+      float mean = count ? sum / count : 0.0f;
+      for (int i = 0; i < n; ++i) {
+            float v = dst[i].real();
+            dst[i]  = Complex(v >= 0.0f ? (v - mean) * window[i] : 0.0f, 0.0f);
+            }
+      }
+
+//---------------------------------------------------------
+//   frameLuma
+//    luma of the fw x fh window at (ox, oy) of the frame
+//    reduced to the analysis level by a box filter; rows
+//    in parallel
+//---------------------------------------------------------
+
+void Mosaic::frameLuma(const QImage& image, int ox, int oy, Complex* dst) const
+      {
+      const int s     = 1 << level;
+      const int sw    = frameWidth >> level;
+      const int sh    = frameHeight >> level;
+      const float inv = 1.0f / (s * s);
+      ThreadPool* pool = ThreadPool::global();
+      int parts = qMin(pool->size(), fh);
+      pool->run(parts, [&](int part) {
+            for (int y = fh * part / parts; y < fh * (part + 1) / parts; ++y) {
+                  Complex* d = dst + y * fw;
+                  int ly     = oy + y;
+                  for (int x = 0; x < fw; ++x) {
+                        int lx = ox + x;
+                        if (ly < 0 || ly >= sh || lx < 0 || lx >= sw) {
+                              d[x] = Complex(-1.0f, 0.0f);
+                              continue;
+                              }
+                        int sum = 0;
+                        for (int i = 0; i < s; ++i) {
+                              const quint32* p = (const quint32*)image.constScanLine(ly * s + i) + lx * s;
+                              for (int k = 0; k < s; ++k)
+                                    sum += luma(p[k]);
+                              }
+                        d[x] = Complex(sum * inv, 0.0f);
+                        }
+                  }
+            });
+      finish(dst, window.data(), fw * fh);
+      }
+
+//---------------------------------------------------------
+//   canvasLuma
+//    luma of the reference read from the canvas; pixels
+//    not fully covered are invalid
+//---------------------------------------------------------
+
+void Mosaic::canvasLuma(const QImage& image, Complex* dst) const
+      {
+      for (int y = 0; y < fh; ++y) {
+            const quint32* p = (const quint32*)image.constScanLine(y);
+            Complex* d       = dst + y * fw;
+            for (int x = 0; x < fw; ++x)
+                  d[x] = Complex((p[x] >> 24) == 0xff ? float(luma(p[x])) : -1.0f, 0.0f);
+            }
+      finish(dst, window.data(), fw * fh);
+      }
+
+//---------------------------------------------------------
+//   correlate
+//    phase correlation of frameSpectrum against
+//    canvasSpectrum; (dx, dy) is the displacement of the
+//    frame content against the reference, with sub pixel
+//    parabolic fit. Returns false if the peak is too weak
+//    to be trusted.
+//---------------------------------------------------------
+
+bool Mosaic::correlate(double* dx, double* dy)
+      {
+      fft->forward(frameSpectrum.data());
+      fft->forward(canvasSpectrum.data());
+      int n = fw * fh;
+      Complex* a       = frameSpectrum.data();
+      const Complex* b = canvasSpectrum.data();
+      for (int i = 0; i < n; ++i) {
+            float re = a[i].real() * b[i].real() + a[i].imag() * b[i].imag();
+            float im = a[i].imag() * b[i].real() - a[i].real() * b[i].imag();
+            float m  = sqrtf(re * re + im * im);
+            a[i]     = m > 1e-6f ? Complex(re / m * lowpass[i], im / m * lowpass[i]) : Complex(0.0f, 0.0f);
+            }
+      fft->inverse(a);
+
+      int peak  = 0;
+      float max = a[0].real();
+      for (int i = 1; i < n; ++i) {
+            if (a[i].real() > max) {
+                  max  = a[i].real();
+                  peak = i;
+                  }
+            }
+      _peak = int(max / lowpassSum * 1000.0f);
+      if (max < minPeak * lowpassSum)
+            return false;
+
+      int px = peak % fw;
+      int py = peak / fw;
+      auto at = [&](int x, int y) { return a[((y + fh) % fh) * fw + (x + fw) % fw].real(); };
+      auto fit = [](float l, float c, float r) {
+            if (l <= 0.0f || r <= 0.0f)
+                  return 0.0f;
+            float d = logf(l) - 2.0f * logf(c) + logf(r);
+            return d < 0.0f ? 0.5f * (logf(l) - logf(r)) / d : 0.0f;
+            };
+      *dx = (px < fw / 2 ? px : px - fw) + fit(at(px - 1, py), max, at(px + 1, py));
+      *dy = (py < fh / 2 ? py : py - fh) + fit(at(px, py - 1), max, at(px, py + 1));
+      return true;
+      }
+
+//---------------------------------------------------------
+//   add
+//    register image against the canvas and paste it;
+//    return false if the image could not be registered
+//---------------------------------------------------------
+
+bool Mosaic::add(const QImage& src)
+      {
+      QImage image = src.format() == QImage::Format_RGB32 || src.format() == QImage::Format_ARGB32_Premultiplied
+         ? src : src.convertToFormat(QImage::Format_RGB32);
+      if (clearRequest.exchange(false) || image.width() != frameWidth || image.height() != frameHeight) {
+            _canvas.clear();
+            if (image.width() != frameWidth || image.height() != frameHeight)
+                  setup(image);
+            setFrameRect(QRect());
+            started  = false;
+            position = QPoint();
+            velocity = QPoint();
+            }
+      ++_frames;
+      if (!started) {
+            _canvas.paste(image, QPoint());
+            setFrameRect(QRect(0, 0, frameWidth, frameHeight));
+            started = true;
+            ++_version;
+            return true;
+            }
+
+      // the fft window is centered on the frame at the
+      // analysis level
+
+      const int s = 1 << level;
+      int ox = ((frameWidth >> level) - fw) / 2;
+      int oy = ((frameHeight >> level) - fh) / 2;
+      QPoint predicted = position + velocity;
+      int rx = floorDiv(predicted.x(), s);
+      int ry = floorDiv(predicted.y(), s);
+
+      frameLuma(image, ox, oy, frameSpectrum.data());
+      _canvas.read(level, QRect(rx + ox, ry + oy, fw, fh), &reference);
+      canvasLuma(reference, canvasSpectrum.data());
+
+      double dx, dy;
+      if (!correlate(&dx, &dy)) {
+            // retry the next frame at the last position; the
+            // user can move back there to continue
+
+            velocity = QPoint();
+            ++_lost;
+            return false;
+            }
+      QPoint p(lrint((rx - dx) * s), lrint((ry - dy) * s));
+      velocity = p - position;
+      position = p;
+      _canvas.paste(image, position);
+      setFrameRect(QRect(position, image.size()));
+      ++_version;
+      return true;
+      }
+
+//---------------------------------------------------------
+//   clear
+//    the registration restarts with the next frame
+//---------------------------------------------------------
+
+void Mosaic::clear()
+      {
+      clearRequest = true;
+      _canvas.clear();
+      setFrameRect(QRect());
+      ++_version;
+      }
+
+//---------------------------------------------------------
+//   setFrameRect
+//---------------------------------------------------------
+
+void Mosaic::setFrameRect(const QRect& r)
+      {
+      std::lock_guard<std::mutex> lock(rectMutex);
+      _frameRect = r;
+      }
+
+//---------------------------------------------------------
+//   frameRect
+//    canvas rectangle of the last registered frame
+//---------------------------------------------------------
+
+QRect Mosaic::frameRect() const
+      {
+      std::lock_guard<std::mutex> lock(rectMutex);
+      return _frameRect;
+      }
+
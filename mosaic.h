@@ -0,0 +1,167 @@
+//=============================================================================
+//  Cam
+//  Webcam client
+//
+//  Copyright (C) 2016 Werner Schweer
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License version 2
+//  as published by the Free Software Foundation and appearing in
+//  the file LICENCE.GPL
+//=============================================================================
+
+
+#ifndef __MOSAIC_H__
+#define __MOSAIC_H__
+
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <QImage>
+#include <QPoint>
+#include <QRect>
+
+#include "fft.h"
+#include "frame.h"
+
+//---------------------------------------------------------
+//   MosaicTile
+//---------------------------------------------------------
+
+struct MosaicTile {
+      QPoint pos;                   // level pixels
+      QImage image;
+      };
+
+//---------------------------------------------------------
+//   MosaicCanvas
+//    unbounded canvas of tileSize square tiles in
+//    QImage::Format_ARGB32_Premultiplied; transparent where
+//    nothing was pasted. Level n holds the canvas at 1/2^n
+//    scale, updated with every paste for the pasted area
+//    only, so a view reads a fixed number of tiles at any
+//    zoom. Tiles exist only where something was pasted.
+//
+//    all tiles stay in memory: 4 bytes per pixel plus 1/3
+//    for the levels, about 5.3 GB per gigapixel covered
+//
+//    thread safe; tiles handed out are shallow copies, a
+//    later paste detaches
+//---------------------------------------------------------
+
+class MosaicCanvas {
+   public:
+      static const int tileSize = 256;
+      static const int levels   = 12;
+
+   private:
+      struct Key {
+            int level, x, y;
+            bool operator<(const Key& k) const {
+                  return level != k.level ? level < k.level : (y != k.y ? y < k.y : x < k.x);
+                  }
+            };
+      mutable std::mutex mutex;     // protects tiles, _bounds
+      std::map<Key, QImage> tiles;
+      QRect _bounds;                // level 0
+
+      QImage* tile(int level, int tx, int ty);
+      const QImage* findTile(int level, int tx, int ty) const;
+      void reduce(int level, int x0, int y0, int x1, int y1);
+
+   public:
+      void clear();
+      void paste(const QImage& image, const QPoint& pos);
+      void read(int level, const QRect& r, QImage* dst) const;
+      std::vector<MosaicTile> visibleTiles(int level, const QRect& r) const;
+      QRect bounds() const;
+      QRect bounds(int level) const;
+      qint64 memory() const;
+      };
+
+//---------------------------------------------------------
+//   Mosaic
+//    live stitching of a moving stage. Every frame is
+//    registered against the canvas around its predicted
+//    position by phase correlation of the luma of a
+//    centered window at a reduced canvas level (512 x 512
+//    at level 1 for 1080p), then pasted. Frames without a
+//    clear correlation peak are not pasted, the next frame
+//    is tried at the same place.
+//
+//    frames are taken only while the worker is idle
+//---------------------------------------------------------
+
+class Mosaic : public FrameConsumer {
+      MosaicCanvas _canvas;
+
+      std::thread thread;
+      std::mutex mutex;                   // protects pending, pendingSequence, running
+      std::condition_variable cv;
+      QImage pending;                     // decoded frame, not the leased Frame
+      unsigned pendingSequence { 0 };
+      bool running { true };
+      std::atomic<bool> busy { false };
+      std::atomic<bool> clearRequest { false };
+
+      // registration; worker thread or caller of add()
+
+      int frameWidth  { 0 };
+      int frameHeight { 0 };
+      int level       { 0 };              // analysis level
+      int fw          { 0 };              // fft size
+      int fh          { 0 };
+      Fft2d* fft      { 0 };
+      std::vector<Complex> frameSpectrum;
+      std::vector<Complex> canvasSpectrum;
+      std::vector<float> window;          // Hann, fw x fh
+      std::vector<float> lowpass;         // cross power spectrum weights
+      float lowpassSum { 0.0f };          // correlation peak of a perfect match
+      QImage reference;                   // canvas at analysis level
+      QPoint position;                    // level 0 position of the last frame
+      QPoint velocity;
+      bool started { false };
+
+      mutable std::mutex rectMutex;       // protects _frameRect
+      QRect _frameRect;                   // level 0 rectangle of the last frame
+
+      std::atomic<unsigned> _frames  { 0 };
+      std::atomic<unsigned> _lost    { 0 };
+      std::atomic<unsigned> _version { 0 };
+      std::atomic<int> _peak { 0 };       // last correlation peak, per mille
+
+      void setup(const QImage&);
+      void frameLuma(const QImage&, int ox, int oy, Complex* dst) const;
+      void canvasLuma(const QImage&, Complex* dst) const;
+      bool correlate(double* dx, double* dy);
+      void setFrameRect(const QRect&);
+      void loop();
+
+   public:
+      static constexpr double minPeak      = 0.1;     // of a perfect match
+      static constexpr float lowpassSigma  = 1.0f;    // correlation peak width, pixels
+
+      Mosaic();
+      ~Mosaic();
+
+      bool add(const QImage&);
+      void clear();
+
+      const MosaicCanvas& canvas() const  { return _canvas; }
+      QRect frameRect() const;
+      unsigned frames() const             { return _frames;  }
+      unsigned lost() const               { return _lost;    }
+      unsigned version() const            { return _version; }
+      double peak() const                 { return _peak / 1000.0; }
+
+      virtual bool wantsFrame(const Frame& f) override { return !busy && !f.error(); }
+      virtual bool wantsImage(const Frame&) override   { return true; }
+      virtual void frame(const FramePtr&) override;
+      };
+
+#endif
+
@@ -0,0 +1,119 @@
+//=============================================================================
+//  Cam
+//  Webcam client
+//
+//  Copyright (C) 2016 Werner Schweer
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License version 2
+//  as published by the Free Software Foundation and appearing in
+//  the file LICENCE.GPL
+//=============================================================================
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include <QImage>
+
+#include "mosaic.h"
+#include "tiff.h"
+
+//---------------------------------------------------------
+//   pyramidLevels
+//    canvas levels down to the first one fitting into a
+//    single tile
+//---------------------------------------------------------
+
+static int pyramidLevels(const MosaicCanvas& canvas)
+      {
+      int n = 1;
+      for (int level = 0; level < MosaicCanvas::levels - 1; ++level, ++n) {
+            QRect r = canvas.bounds(level);
+            if (r.width() <= MosaicCanvas::tileSize && r.height() <= MosaicCanvas::tileSize)
+                  break;
+            }
+      return n;
+      }
+
+//---------------------------------------------------------
+//   writeTiledTiff
+//    export the canvas as uncovered black, 8 bit RGB tiled
+//    tiff with the reduced levels as pyramid (NewSubfileType
+//    1 in the following IFDs). BigTIFF is written if the
+//    file would not fit into 32 bit offsets. The canvas is
+//    read one tile at a time.
+//---------------------------------------------------------
+
+bool writeTiledTiff(const QString& path, const MosaicCanvas& canvas)
+      {
+      const int ts = MosaicCanvas::tileSize;
+      if (canvas.bounds().isEmpty()) {
+            fprintf(stderr, "mosaic is empty\n");
+            return false;
+            }
+      int levels   = pyramidLevels(canvas);
+      quint64 size = 0;
+      for (int level = 0; level < levels; ++level) {
+            QRect r = canvas.bounds(level);
+            size   += quint64((r.width() + ts - 1) / ts) * ((r.height() + ts - 1) / ts) * ts * ts * 3;
+            }
+      FILE* f = fopen(qPrintable(path), "wb");
+      if (!f) {
+            fprintf(stderr, "cannot open <%s>: %s\n", qPrintable(path), strerror(errno));
+            return false;
+            }
+      bool big = size > bigTiffLimit;
+      TiffWriter w(f, big);
+      w.header();
+
+      QImage tile;
+      std::vector<uchar> rgb(ts * ts * 3);
+      for (int level = 0; level < levels && !w.error(); ++level) {
+            QRect r    = canvas.bounds(level);
+            int tilesX = (r.width() + ts - 1) / ts;
+            int tilesY = (r.height() + ts - 1) / ts;
+            std::vector<quint64> offsets, counts;
+            for (int ty = 0; ty < tilesY; ++ty) {
+                  for (int tx = 0; tx < tilesX; ++tx) {
+                        canvas.read(level, QRect(r.x() + tx * ts, r.y() + ty * ts, ts, ts), &tile);
+                        uchar* d = rgb.data();
+                        for (int y = 0; y < ts; ++y) {
+                              const quint32* s = (const quint32*)tile.constScanLine(y);
+                              for (int x = 0; x < ts; ++x, d += 3) {
+                                    d[0] = s[x] >> 16;
+                                    d[1] = s[x] >> 8;
+                                    d[2] = s[x];
+                                    }
+                              }
+                        offsets.push_back(w.pos());
+                        counts.push_back(rgb.size());
+                        w.write(rgb.data(), rgb.size());
+                        }
+                  }
+            TiffType offsetType = big ? TIFF_LONG8 : TIFF_LONG;
+            std::vector<TiffEntry> entries {
+                  { 254, TIFF_LONG,  { quint64(level ? 1 : 0) } },      // NewSubfileType: reduced image
+                  { 256, TIFF_LONG,  { quint64(r.width()) } },          // ImageWidth
+                  { 257, TIFF_LONG,  { quint64(r.height()) } },         // ImageLength
+                  { 258, TIFF_SHORT, { 8, 8, 8 } },                     // BitsPerSample
+                  { 259, TIFF_SHORT, { 1 } },                           // Compression: none
+                  { 262, TIFF_SHORT, { 2 } },                           // PhotometricInterpretation: RGB
+                  { 277, TIFF_SHORT, { 3 } },                           // SamplesPerPixel
+                  { 284, TIFF_SHORT, { 1 } },                           // PlanarConfiguration: chunky
+                  { 322, TIFF_LONG,  { quint64(ts) } },                 // TileWidth
+                  { 323, TIFF_LONG,  { quint64(ts) } },                 // TileLength
+                  { 324, offsetType, offsets },                         // TileOffsets
+                  { 325, offsetType, counts },                          // TileByteCounts
+                  };
+            w.ifd(entries);
+            }
+      bool ok = !w.error();
+      if (fclose(f) != 0)
+            ok = false;
+      if (!ok)
+            fprintf(stderr, "cannot write <%s>: %s\n", qPrintable(path), strerror(errno));
+      return ok;
+      }
+
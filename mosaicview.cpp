@@ -0,0 +1,208 @@
+//=============================================================================
+//  Cam
+//  Webcam client
+//
+//  Copyright (C) 2016 Werner Schweer
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License version 2
+//  as published by the Free Software Foundation and appearing in
+//  the file LICENCE.GPL
+//=============================================================================
+
+
+#include <math.h>
+
+#include <QApplication>
+#include <QContextMenuEvent>
+#include <QFileDialog>
+#include <QMenu>
+#include <QMouseEvent>
+#include <QPainter>
+#include <QTimer>
+#include <QWheelEvent>
+
+#include "mosaicview.h"
+#include "capture.h"
+#include "mosaic.h"
+#include "tiff.h"
+
+//---------------------------------------------------------
+//   MosaicView
+//---------------------------------------------------------
+
+MosaicView::MosaicView(Capture* c, QWidget* parent)
+   : QWidget(parent), capture(c)
+      {
+      setMinimumSize(160, 120);
+      timer = new QTimer(this);
+      connect(timer, SIGNAL(timeout()), SLOT(poll()));
+      }
+
+//---------------------------------------------------------
+//   showEvent
+//---------------------------------------------------------
+
+void MosaicView::showEvent(QShowEvent* e)
+      {
+      QWidget::showEvent(e);
+      timer->start(200);
+      }
+
+//---------------------------------------------------------
+//   hideEvent
+//---------------------------------------------------------
+
+void MosaicView::hideEvent(QHideEvent* e)
+      {
+      QWidget::hideEvent(e);
+      timer->stop();
+      }
+
+//---------------------------------------------------------
+//   poll
+//    repaint if a frame was added
+//---------------------------------------------------------
+
+void MosaicView::poll()
+      {
+      Mosaic* m = capture->mosaic();
+      unsigned v = m ? m->version() : 0;
+      if (v != version) {
+            version = v;
+            update();
+            }
+      }
+
+//---------------------------------------------------------
+//   fitCanvas
+//---------------------------------------------------------
+
+void MosaicView::fitCanvas()
+      {
+      Mosaic* m = capture->mosaic();
+      QRect r   = m ? m->canvas().bounds() : QRect();
+      if (r.isEmpty())
+            return;
+      scale  = qMin(qreal(width()) / r.width(), qreal(height()) / r.height());
+      center = QPointF(r.x() + r.width() * 0.5, r.y() + r.height() * 0.5);
+      }
+
+//---------------------------------------------------------
+//   paintEvent
+//---------------------------------------------------------
+
+void MosaicView::paintEvent(QPaintEvent*)
+      {
+      QPainter p(this);
+      p.fillRect(rect(), QColor(30, 30, 30));
+      Mosaic* m = capture->mosaic();
+      if (!m)
+            return;
+      if (fit)
+            fitCanvas();
+
+      // level with at most one canvas pixel per widget pixel
+
+      int level = 0;
+      while (level < MosaicCanvas::levels - 1 && scale * (2 << level) <= 1.0)
+            ++level;
+      const qreal ls = 1 << level;
+      QPointF origin = center - QPointF(width() * 0.5, height() * 0.5) / scale;
+      QRect visible(int(floor(origin.x() / ls)), int(floor(origin.y() / ls)),
+         int(ceil(width() / scale / ls)) + 2, int(ceil(height() / scale / ls)) + 2);
+
+      p.setRenderHint(QPainter::SmoothPixmapTransform);
+      const qreal ts = MosaicCanvas::tileSize * ls * scale;
+      for (const MosaicTile& t : m->canvas().visibleTiles(level, visible)) {
+            QPointF pos = (QPointF(t.pos) * ls - origin) * scale;
+            p.drawImage(QRectF(pos.x(), pos.y(), ts, ts), t.image);
+            }
+      QRect fr = m->frameRect();
+      if (!fr.isEmpty()) {
+            QPointF pos = (QPointF(fr.topLeft()) - origin) * scale;
+            p.setPen(QColor(60, 255, 60));
+            p.drawRect(QRectF(pos.x(), pos.y(), fr.width() * scale, fr.height() * scale));
+            }
+      }
+
+//---------------------------------------------------------
+//   wheelEvent
+//    zoom around the mouse position
+//---------------------------------------------------------
+
+void MosaicView::wheelEvent(QWheelEvent* e)
+      {
+      qreal f     = e->delta() > 0 ? 1.25 : 0.8;
+      QPointF pos = QPointF(e->pos()) - QPointF(width() * 0.5, height() * 0.5);
+      QPointF c   = center + pos / scale;
+      scale       = qBound(1.0 / (1 << MosaicCanvas::levels), scale * f, 16.0);
+      center      = c - pos / scale;
+      fit         = false;
+      update();
+      }
+
+//---------------------------------------------------------
+//   mousePressEvent
+//---------------------------------------------------------
+
+void MosaicView::mousePressEvent(QMouseEvent* e)
+      {
+      dragPos = e->pos();
+      }
+
+//---------------------------------------------------------
+//   mouseMoveEvent
+//    pan
+//---------------------------------------------------------
+
+void MosaicView::mouseMoveEvent(QMouseEvent* e)
+      {
+      if (!(e->buttons() & Qt::LeftButton))
+            return;
+      center  = center - QPointF(e->pos() - dragPos) / scale;
+      dragPos = e->pos();
+      fit     = false;
+      update();
+      }
+
+//---------------------------------------------------------
+//   mouseDoubleClickEvent
+//---------------------------------------------------------
+
+void MosaicView::mouseDoubleClickEvent(QMouseEvent*)
+      {
+      fit = true;
+      update();
+      }
+
+//---------------------------------------------------------
+//   contextMenuEvent
+//---------------------------------------------------------
+
+void MosaicView::contextMenuEvent(QContextMenuEvent* e)
+      {
+      Mosaic* m = capture->mosaic();
+      if (!m)
+            return;
+      QMenu menu;
+      QAction* exportAction = menu.addAction(tr("Export TIFF..."));
+      QAction* clearAction  = menu.addAction(tr("Clear"));
+      exportAction->setEnabled(!m->canvas().bounds().isEmpty());
+      QAction* a = menu.exec(e->globalPos());
+      if (a == exportAction) {
+            QString path = QFileDialog::getSaveFileName(this, tr("Export Mosaic"),
+               capture->picturePath() + "/" + capture->picturePrefix() + "-mosaic.tif", tr("TIFF (*.tif *.tiff)"));
+            if (path.isEmpty())
+                  return;
+            QApplication::setOverrideCursor(Qt::WaitCursor);
+            writeTiledTiff(path, m->canvas());
+            QApplication::restoreOverrideCursor();
+            }
+      else if (a == clearAction) {
+            m->clear();
+            fit = true;
+            update();
+            }
+      }
+
@@ -0,0 +1,63 @@
+//=============================================================================
+//  Cam
+//  Webcam client
+//
+//  Copyright (C) 2016 Werner Schweer
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License version 2
+//  as published by the Free Software Foundation and appearing in
+//  the file LICENCE.GPL
+//=============================================================================
+
+
+#ifndef __MOSAICVIEW_H__
+#define __MOSAICVIEW_H__
+
+#include <QPoint>
+#include <QPointF>
+#include <QWidget>
+
+class Capture;
+class QTimer;
+
+//---------------------------------------------------------
+//   MosaicView
+//    pans and zooms the mosaic canvas; paints only the
+//    tiles of the pyramid level matching the zoom, so the
+//    cost does not grow with the mosaic. Fits the whole
+//    mosaic until the user pans or zooms; double click
+//    fits again.
+//---------------------------------------------------------
+
+class MosaicView : public QWidget {
+      Q_OBJECT
+
+      Capture* capture;
+      QTimer* timer;
+      unsigned version { 0 };
+      bool fit         { true };
+      qreal scale      { 1.0 };       // widget pixel per canvas pixel
+      QPointF center;                 // canvas coordinates
+      QPoint dragPos;
+
+      void fitCanvas();
+      virtual void paintEvent(QPaintEvent*) override;
+      virtual void showEvent(QShowEvent*) override;
+      virtual void hideEvent(QHideEvent*) override;
+      virtual void wheelEvent(QWheelEvent*) override;
+      virtual void mousePressEvent(QMouseEvent*) override;
+      virtual void mouseMoveEvent(QMouseEvent*) override;
+      virtual void mouseDoubleClickEvent(QMouseEvent*) override;
+      virtual void contextMenuEvent(QContextMenuEvent*) override;
+
+   private slots:
+      void poll();
+
+   public:
+      MosaicView(Capture*, QWidget* parent = 0);
+      virtual QSize sizeHint() const override { return QSize(320, 240); }
+      };
+
+#endif
+
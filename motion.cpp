@@ -0,0 +1,275 @@
+//=============================================================================
+//  Cam
+//  Webcam client
+//
+//  Copyright (C) 2016 Werner Schweer
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License version 2
+//  as published by the Free Software Foundation and appearing in
+//  the file LICENCE.GPL
+//=============================================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <linux/videodev2.h>
+
+#include <QBuffer>
+#include <QFile>
+#include <QImage>
+
+#include "motion.h"
+#include "decoder.h"
+#include "jpeg.h"
+#include "yuv.h"
+#include "trace.h"
+
+//---------------------------------------------------------
+//   MotionDetector
+//---------------------------------------------------------
+
+MotionDetector::MotionDetector(double a, int pre, int post, const QString& p, const QString& pf)
+   : area(a), preFrames(qMax(0, pre)), postFrames(qMax(1, post)), path(p), prefix(pf)
+      {
+      decoder = MjpegDecoder::create();
+      thread  = std::thread(&MotionDetector::loop, this);
+      }
+
+MotionDetector::~MotionDetector()
+      {
+      {
+      std::lock_guard<std::mutex> lock(mutex);
+      running = false;
+      }
+      cv.notify_one();
+      thread.join();
+      delete decoder;
+      }
+
+//---------------------------------------------------------
+//   reduce
+//    luma grid of 1/8 resolution into grid; return false
+//    if the frame cannot be analyzed
+//---------------------------------------------------------
+
+bool MotionDetector::reduce(const Frame& f)
+      {
+      int w, h;
+      if (f.pixelFormat == V4L2_PIX_FMT_MJPEG) {
+            if (!decoder->decodeLuma(f.data(), f.size(), &grid, &w, &h))
+                  return false;
+            }
+      else if (f.pixelFormat == V4L2_PIX_FMT_YUYV || f.pixelFormat == V4L2_PIX_FMT_NV12) {
+            // one cell is the mean of 8 neighboring luma
+            // samples of the first row of the 8x8 block
+
+            int step = f.pixelFormat == V4L2_PIX_FMT_YUYV ? 2 : 1;
+            w = f.width / 8;
+            h = f.height / 8;
+            grid.resize(w * h);
+            for (int y = 0; y < h; ++y) {
+                  const uchar* s = f.plane(0) + y * 8 * f.stride(0);
+                  uchar* d       = grid.data() + y * w;
+                  for (int x = 0; x < w; ++x) {
+                        int sum = 0;
+                        for (int i = 0; i < 8; ++i)
+                              sum += s[i * step];
+                        d[x] = sum >> 3;
+                        s += 8 * step;
+                        }
+                  }
+            }
+      else
+            return false;
+      if (w != gridWidth || h != gridHeight) {
+            gridWidth  = w;
+            gridHeight = h;
+            background.clear();
+            }
+      return w > 0 && h > 0;
+      }
+
+//---------------------------------------------------------
+//   detect
+//    compare grid against the background and update the
+//    background; a change of more than half of the cells
+//    is taken as a change of light and restarts the
+//    background
+//---------------------------------------------------------
+
+bool MotionDetector::detect()
+      {
+      int n = gridWidth * gridHeight;
+      if (background.empty()) {
+            background.resize(n);
+            for (int i = 0; i < n; ++i)
+                  background[i] = grid[i] << 8;
+            return false;
+            }
+      int changed = 0;
+      for (int i = 0; i < n; ++i) {
+            int g  = grid[i];
+            int bg = background[i];
+            if (abs(g - (bg >> 8)) > threshold)
+                  ++changed;
+            background[i] = bg + (((g << 8) - bg) >> 4);
+            }
+      if (changed * 2 > n) {
+            for (int i = 0; i < n; ++i)
+                  background[i] = grid[i] << 8;
+            return false;
+            }
+      return changed * 100.0 > area * n;
+      }
+
+//---------------------------------------------------------
+//   frame
+//---------------------------------------------------------
+
+void MotionDetector::frame(const FramePtr& f)
+      {
+      if (++count >= analyzeInterval) {
+            TraceScope ts("motion detect");
+            count = 0;
+            if (reduce(*f) && detect()) {
+                  if (remaining == 0)
+                        startEvent();
+                  remaining = postFrames;
+                  }
+            }
+      if (remaining == 0 && preFrames == 0)
+            return;
+      Shot s;
+      s.data         = QByteArray((const char*)f->data(), f->size());
+      s.pixelFormat  = f->pixelFormat;
+      s.width        = f->width;
+      s.height       = f->height;
+      s.bytesPerLine = f->bytesPerLine;
+      s.sequence     = f->sequence;
+      if (remaining > 0) {
+            --remaining;
+            save(std::move(s));
+            }
+      else {
+            _memory += s.data.size();
+            ring.push_back(std::move(s));
+            if (int(ring.size()) > preFrames) {
+                  _memory -= ring.front().data.size();
+                  ring.pop_front();
+                  }
+            }
+      }
+
+//---------------------------------------------------------
+//   startEvent
+//    skip event numbers already used in path, then queue
+//    the pre trigger frames
+//---------------------------------------------------------
+
+void MotionDetector::startEvent()
+      {
+      do {
+            ++event;
+            } while (QFile::exists(fileName(event, 0)));
+      number = 0;
+      ++_events;
+      while (!ring.empty()) {
+            _memory -= ring.front().data.size();
+            save(std::move(ring.front()));
+            ring.pop_front();
+            }
+      }
+
+//---------------------------------------------------------
+//   save
+//    queue shot for the saver thread; if the disk cannot
+//    keep up the shot is dropped
+//---------------------------------------------------------
+
+void MotionDetector::save(Shot&& s)
+      {
+      s.event  = event;
+      s.number = number++;
+      {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (int(queue.size()) >= maxQueue) {
+            ++_dropped;
+            return;
+            }
+      _memory += s.data.size();
+      Trace::flowStart("motion", s.sequence);
+      queue.push_back(std::move(s));
+      }
+      cv.notify_one();
+      }
+
+//---------------------------------------------------------
+//   loop
+//    saver thread; writes the remaining shots on exit
+//---------------------------------------------------------
+
+void MotionDetector::loop()
+      {
+      Trace::setThreadName("motion");
+      std::unique_lock<std::mutex> lock(mutex);
+      for (;;) {
+            cv.wait(lock, [this] { return !queue.empty() || !running; });
+            if (queue.empty())
+                  break;
+            Shot s = std::move(queue.front());
+            queue.pop_front();
+            lock.unlock();
+            if (write(s))
+                  ++_frames;
+            _memory -= s.data.size();
+            lock.lock();
+            }
+      }
+
+//---------------------------------------------------------
+//   fileName
+//---------------------------------------------------------
+
+QString MotionDetector::fileName(int e, int n) const
+      {
+      return QString("%1/%2-motion%3-%4.jpeg").arg(path).arg(prefix)
+         .arg(e, 4, 10, QChar('0')).arg(n, 4, 10, QChar('0'));
+      }
+
+//---------------------------------------------------------
+//   write
+//    mjpeg frames are written as they are, raw frames are
+//    converted and jpeg encoded here
+//---------------------------------------------------------
+
+bool MotionDetector::write(const Shot& s)
+      {
+      Trace::setFrame(s.sequence);
+      TraceScope ts("motion write");
+      Trace::flowEnd("motion", s.sequence);
+      const uchar* p = (const uchar*)s.data.constData();
+      QByteArray ba;
+      if (s.pixelFormat == V4L2_PIX_FMT_MJPEG)
+            ba = jpegAddHuffmanTables(p, s.data.size());
+      else {
+            QImage image(s.width, s.height, QImage::Format_RGB32);
+            if (s.pixelFormat == V4L2_PIX_FMT_YUYV)
+                  yuyvToRgb32(p, s.bytesPerLine, image.bits(), image.bytesPerLine(), s.width, s.height);
+            else if (s.pixelFormat == V4L2_PIX_FMT_NV12)
+                  nv12ToRgb32(p, s.bytesPerLine, p + s.bytesPerLine * s.height, s.bytesPerLine,
+                     image.bits(), image.bytesPerLine(), s.width, s.height);
+            else
+                  return false;
+            QBuffer b(&ba);
+            b.open(QIODevice::WriteOnly);
+            image.save(&b, "jpeg", 90);
+            }
+      QString name = fileName(s.event, s.number);
+      QFile f(name);
+      if (ba.isEmpty() || !f.open(QIODevice::WriteOnly) || f.write(ba) != ba.size()) {
+            fprintf(stderr, "cannot write motion picture <%s>\n", qPrintable(name));
+            return false;
+            }
+      return true;
+      }
+
@@ -0,0 +1,114 @@
+//=============================================================================
+//  Cam
+//  Webcam client
+//
+//  Copyright (C) 2016 Werner Schweer
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License version 2
+//  as published by the Free Software Foundation and appearing in
+//  the file LICENCE.GPL
+//=============================================================================
+
+#ifndef __MOTION_H__
+#define __MOTION_H__
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <QByteArray>
+#include <QString>
+
+#include "frame.h"
+
+class MjpegDecoder;
+
+//---------------------------------------------------------
+//   MotionDetector
+//    motion triggered capture. Every analyzeInterval'th
+//    frame is reduced to a luma grid of 1/8 resolution:
+//    mjpeg frames with a DC only decode, raw frames by
+//    averaging 8 luma samples in every 8th row. The grid
+//    is compared against a running average background;
+//    motion is detected if more than area percent of the
+//    cells differ by more than threshold.
+//
+//    the payload of the last preFrames frames is kept in a
+//    ring; on motion these and all frames up to postFrames
+//    after the last motion are written by a saver thread,
+//    mjpeg frames as they are. Nothing is decoded at full
+//    resolution while there is no motion.
+//---------------------------------------------------------
+
+class MotionDetector : public FrameConsumer {
+      struct Shot {
+            QByteArray data;              // payload as captured
+            unsigned pixelFormat;
+            int width, height, bytesPerLine;
+            int event, number;
+            unsigned sequence;            // driver frame sequence
+            };
+
+      double area;                        // percent of cells
+      int preFrames;
+      int postFrames;
+      int threshold  { 24 };
+      QString path;
+      QString prefix;
+
+      // capture thread
+
+      MjpegDecoder* decoder;
+      std::vector<uchar> grid;
+      std::vector<quint16> background;    // 8.8 fixed point
+      int gridWidth  { 0 };
+      int gridHeight { 0 };
+      int count      { 0 };               // frames since last analysis
+      int remaining  { 0 };               // frames still to save
+      int event      { 0 };
+      int number     { 0 };               // frame in event
+      std::deque<Shot> ring;
+
+      // saver thread
+
+      std::thread thread;
+      std::mutex mutex;                   // protects queue, running
+      std::condition_variable cv;
+      std::deque<Shot> queue;
+      bool running { true };
+
+      std::atomic<unsigned> _events { 0 };
+      std::atomic<unsigned> _frames { 0 };
+      std::atomic<unsigned> _dropped { 0 };
+      std::atomic<qint64> _memory { 0 };  // payload in ring and queue
+
+      bool reduce(const Frame&);
+      bool detect();
+      void startEvent();
+      void save(Shot&&);
+      void loop();
+      bool write(const Shot&);
+      QString fileName(int event, int number) const;
+
+   public:
+      static const int analyzeInterval = 2;
+      static const int maxQueue        = 120;     // shots waiting for the saver
+
+      MotionDetector(double area, int preFrames, int postFrames, const QString& path, const QString& prefix);
+      ~MotionDetector();
+
+      unsigned events() const       { return _events; }
+      unsigned frames() const       { return _frames; }
+      unsigned dropped() const      { return _dropped; }
+      qint64 memory() const         { return _memory; }
+
+      virtual bool wantsFrame(const Frame& f) override { return !f.error(); }
+      virtual void frame(const FramePtr&) override;
+      };
+
+#endif
+
@@ -0,0 +1,143 @@
+//=============================================================================
+//  Cam
+//  Webcam client
+//
+//  Copyright (C) 2016 Werner Schweer
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License version 2
+//  as published by the Free Software Foundation and appearing in
+//  the file LICENCE.GPL
+//=============================================================================
+
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+#include <QStringList>
+
+#include "realtime.h"
+
+//---------------------------------------------------------
+//   parseCpuList
+//    "2", "0,2" or "4-7"
+//---------------------------------------------------------
+
+bool parseCpuList(const QString& s, std::vector<int>* cpus)
+      {
+      cpus->clear();
+      for (const QString& part : s.split(',', QString::SkipEmptyParts)) {
+            QStringList range = part.split('-');
+            bool ok1, ok2 = true;
+            int first = range[0].toInt(&ok1);
+            int last  = range.size() == 2 ? range[1].toInt(&ok2) : first;
+            if (!ok1 || !ok2 || range.size() > 2 || first < 0 || last < first || last >= CPU_SETSIZE)
+                  return false;
+            for (int cpu = first; cpu <= last; ++cpu)
+                  cpus->push_back(cpu);
+            }
+      return !cpus->empty();
+      }
+
+//---------------------------------------------------------
+//   parseSchedPolicy
+//---------------------------------------------------------
+
+bool parseSchedPolicy(const QString& s, int* policy)
+      {
+      QString p = s.toLower();
+      if (p == "fifo")
+            *policy = SCHED_FIFO;
+      else if (p == "rr")
+            *policy = SCHED_RR;
+      else if (p == "other")
+            *policy = SCHED_OTHER;
+      else
+            return false;
+      return true;
+      }
+
+//---------------------------------------------------------
+//   schedPolicyName
+//---------------------------------------------------------
+
+const char* schedPolicyName(int policy)
+      {
+      switch (policy) {
+            case SCHED_FIFO: return "SCHED_FIFO";
+            case SCHED_RR:   return "SCHED_RR";
+            default:         return "SCHED_OTHER";
+            }
+      }
+
+//---------------------------------------------------------
+//   setThreadScheduling
+//    real time policies need CAP_SYS_NICE or an
+//    RLIMIT_RTPRIO of at least priority; on failure the
+//    thread keeps its policy
+//---------------------------------------------------------
+
+bool setThreadScheduling(pthread_t thread, int policy, int priority)
+      {
+      int min = sched_get_priority_min(policy);
+      int max = sched_get_priority_max(policy);
+      if (priority < min || priority > max) {
+            fprintf(stderr, "cam: %s priority %d out of range %d - %d\n",
+               schedPolicyName(policy), priority, min, max);
+            return false;
+            }
+      struct sched_param param;
+      memset(&param, 0, sizeof(param));
+      param.sched_priority = priority;
+      int err = pthread_setschedparam(thread, policy, &param);
+      if (err) {
+            struct rlimit rl;
+            getrlimit(RLIMIT_RTPRIO, &rl);
+            fprintf(stderr, "cam: cannot set %s priority %d: %s (needs CAP_SYS_NICE or RLIMIT_RTPRIO >= %d, is %ld)\n",
+               schedPolicyName(policy), priority, strerror(err), priority, long(rl.rlim_cur));
+            return false;
+            }
+      return true;
+      }
+
+//---------------------------------------------------------
+//   setThreadAffinity
+//---------------------------------------------------------
+
+bool setThreadAffinity(pthread_t thread, const std::vector<int>& cpus)
+      {
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      for (int cpu : cpus)
+            CPU_SET(cpu, &set);
+      int err = pthread_setaffinity_np(thread, sizeof(set), &set);
+      if (err) {
+            fprintf(stderr, "cam: cannot set cpu affinity: %s\n", strerror(err));
+            return false;
+            }
+      return true;
+      }
+
+//---------------------------------------------------------
+//   lockProcessMemory
+//    MCL_FUTURE makes every later allocation fail once
+//    RLIMIT_MEMLOCK is reached, so it is only used without
+//    limit; else only the present pages are locked
+//---------------------------------------------------------
+
+bool lockProcessMemory()
+      {
+      struct rlimit rl;
+      getrlimit(RLIMIT_MEMLOCK, &rl);
+      int flags = rl.rlim_cur == RLIM_INFINITY ? MCL_CURRENT | MCL_FUTURE : MCL_CURRENT;
+      if (mlockall(flags) < 0) {
+            fprintf(stderr, "cam: cannot lock process memory: %s (RLIMIT_MEMLOCK %ld kB)\n",
+               strerror(errno), rl.rlim_cur == RLIM_INFINITY ? -1L : long(rl.rlim_cur / 1024));
+            return false;
+            }
+      return true;
+      }
+
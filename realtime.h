@@ -0,0 +1,50 @@
+//=============================================================================
+//  Cam
+//  Webcam client
+//
+//  Copyright (C) 2016 Werner Schweer
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License version 2
+//  as published by the Free Software Foundation and appearing in
+//  the file LICENCE.GPL
+//=============================================================================
+
+
+#ifndef __REALTIME_H__
+#define __REALTIME_H__
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <vector>
+
+#include <QString>
+
+//---------------------------------------------------------
+//   RealtimeSetting
+//    scheduling of the pipeline stages; the capture thread
+//    can run with a real time policy, capture and decode
+//    threads can be pinned to cpus. lockMemory locks the
+//    V4L2 buffers and, where RLIMIT_MEMLOCK allows it, all
+//    present and future pages of the process.
+//---------------------------------------------------------
+
+struct RealtimeSetting {
+      int policy        { SCHED_OTHER };  // capture thread: SCHED_FIFO, SCHED_RR
+      int priority      { 0 };
+      std::vector<int> captureCpus;       // empty: any cpu
+      std::vector<int> decodeCpus;        // thread pool workers
+      bool lockMemory   { false };
+      };
+
+extern bool parseCpuList(const QString&, std::vector<int>*);
+extern bool parseSchedPolicy(const QString&, int* policy);
+extern const char* schedPolicyName(int policy);
+
+extern bool setThreadScheduling(pthread_t, int policy, int priority);
+extern bool setThreadAffinity(pthread_t, const std::vector<int>& cpus);
+extern bool lockProcessMemory();
+
+#endif
+
@@ -0,0 +1,72 @@
+//=============================================================================
+//  Cam
+//  Webcam client
+//
+//  Copyright (C) 2016 Werner Schweer
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License version 2
+//  as published by the Free Software Foundation and appearing in
+//  the file LICENCE.GPL
+//=============================================================================
+
+#include <string.h>
+#include <errno.h>
+
+#include "recorder.h"
+#include "trace.h"
+
+//---------------------------------------------------------
+//   ~Recorder
+//---------------------------------------------------------
+
+Recorder::~Recorder()
+      {
+      close();
+      }
+
+//---------------------------------------------------------
+//   open
+//---------------------------------------------------------
+
+bool Recorder::open(const QString& path)
+      {
+      close();
+      file = fopen(qPrintable(path), "ab");
+      if (!file) {
+            fprintf(stderr, "cannot open recording <%s>: %s\n", qPrintable(path), strerror(errno));
+            return false;
+            }
+      return true;
+      }
+
+//---------------------------------------------------------
+//   close
+//---------------------------------------------------------
+
+void Recorder::close()
+      {
+      if (file) {
+            fclose(file);
+            file = 0;
+            }
+      }
+
+//---------------------------------------------------------
+//   frame
+//---------------------------------------------------------
+
+void Recorder::frame(const FramePtr& f)
+      {
+      TraceScope ts("record");
+      if (f->size() == 0)
+            return;
+      size_t n = fwrite(f->data(), 1, f->size(), file);
+      if (n != size_t(f->size())) {
+            fprintf(stderr, "recording failed: %s\n", strerror(errno));
+            close();
+            return;
+            }
+      _bytes += n;
+      }
+
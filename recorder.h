@@ -0,0 +1,46 @@
+//=============================================================================
+//  Cam
+//  Webcam client
+//
+//  Copyright (C) 2016 Werner Schweer
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License version 2
+//  as published by the Free Software Foundation and appearing in
+//  the file LICENCE.GPL
+//=============================================================================
+
+#ifndef __RECORDER_H__
+#define __RECORDER_H__
+
+#include <stdio.h>
+
+#include <atomic>
+
+#include <QString>
+
+#include "frame.h"
+
+//---------------------------------------------------------
+//   Recorder
+//    append every captured frame unchanged to a file;
+//    mjpeg gives a concatenated jpeg stream
+//---------------------------------------------------------
+
+class Recorder : public FrameConsumer {
+      FILE* file { 0 };
+      std::atomic<quint64> _bytes { 0 };
+
+   public:
+      ~Recorder();
+      bool open(const QString& path);
+      void close();
+      quint64 bytes() const                     { return _bytes; }
+
+      virtual bool wantsFrame(const Frame&) override { return file != 0; }
+      virtual bool wantsSkipped() const override     { return true; }
+      virtual void frame(const FramePtr&) override;
+      };
+
+#endif
+
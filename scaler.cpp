@@ -0,0 +1,167 @@
+//=============================================================================
+//  Cam
+//  Webcam client
+//
+//  Copyright (C) 2016 Werner Schweer
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License version 2
+//  as published by the Free Software Foundation and appearing in
+//  the file LICENCE.GPL
+//=============================================================================
+
+#include <QMetaObject>
+#include <QObject>
+
+#include "scaler.h"
+#include "trace.h"
+
+//---------------------------------------------------------
+//   Scaler
+//---------------------------------------------------------
+
+Scaler::Scaler(QObject* n)
+   : notify(n)
+      {
+      thread = std::thread(&Scaler::loop, this);
+      }
+
+Scaler::~Scaler()
+      {
+      {
+      std::lock_guard<std::mutex> lock(mutex);
+      running = false;
+      }
+      cv.notify_one();
+      thread.join();
+      }
+
+//---------------------------------------------------------
+//   post
+//    scale image to size device pixels; the result is
+//    drawn 1:1 on a display with devicePixelRatio
+//---------------------------------------------------------
+
+void Scaler::post(const QImage& image, const QSize& s, qreal devicePixelRatio)
+      {
+      {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!overlay.isNull() && (s != size || devicePixelRatio != ratio))
+            newOverlay = true;
+      pending = image;
+      size    = s;
+      ratio   = devicePixelRatio;
+      frame   = Trace::frame();
+      Trace::flowStart("scale", frame);
+      }
+      cv.notify_one();
+      }
+
+//---------------------------------------------------------
+//   postOverlay
+//    scale overlay to the size of the last posted image;
+//    a null overlay clears the overlay result
+//---------------------------------------------------------
+
+void Scaler::postOverlay(const QImage& o)
+      {
+      {
+      std::lock_guard<std::mutex> lock(mutex);
+      overlay    = o;
+      newOverlay = true;
+      }
+      cv.notify_one();
+      }
+
+//---------------------------------------------------------
+//   take
+//    return true if a new scaled image or overlay is
+//    available; only the new ones are stored
+//---------------------------------------------------------
+
+bool Scaler::take(QImage* image, QImage* o)
+      {
+      std::lock_guard<std::mutex> lock(resultMutex);
+      if (!newResult && !newOverlayResult)
+            return false;
+      if (newResult) {
+            *image = result;
+            result = QImage();
+            }
+      if (newOverlayResult) {
+            *o            = overlayResult;
+            overlayResult = QImage();
+            }
+      newResult        = false;
+      newOverlayResult = false;
+      return true;
+      }
+
+//---------------------------------------------------------
+//   loop
+//    enlarged images keep sharp pixels as before, reduced
+//    images are filtered. The compact formats are converted
+//    here at display size, so paintEvent() draws without
+//    conversion; RGB16 is a native raster format. The
+//    overlay is a mask and is never filtered.
+//---------------------------------------------------------
+
+void Scaler::loop()
+      {
+      Trace::setThreadName("scaler");
+      std::unique_lock<std::mutex> lock(mutex);
+      for (;;) {
+            cv.wait(lock, [this] { return !pending.isNull() || newOverlay || !running; });
+            if (!running)
+                  break;
+            QImage image = pending;
+            QImage o;
+            bool doOverlay = newOverlay;
+            if (doOverlay)
+                  o = overlay;
+            QSize s      = size;
+            qreal r      = ratio;
+            pending      = QImage();
+            newOverlay   = false;
+            Trace::setFrame(frame);
+            lock.unlock();
+
+            TraceScope ts("scale");
+
+            QImage scaled;
+            if (!image.isNull()) {
+                  Trace::flowEnd("scale", Trace::frame());
+                  if (s == image.size())
+                        scaled = image;
+                  else {
+                        Qt::TransformationMode mode = s.width() > image.width()
+                           ? Qt::FastTransformation : Qt::SmoothTransformation;
+                        scaled = image.scaled(s, Qt::IgnoreAspectRatio, mode);
+                        }
+                  if (scaled.format() == QImage::Format_Grayscale8 || scaled.format() == QImage::Format_RGB888)
+                        scaled = scaled.convertToFormat(QImage::Format_RGB32);
+                  scaled.setDevicePixelRatio(r);
+                  }
+            if (!o.isNull() && s.isValid()) {
+                  if (o.size() != s)
+                        o = o.scaled(s, Qt::IgnoreAspectRatio, Qt::FastTransformation);
+                  o.setDevicePixelRatio(r);
+                  }
+            else
+                  o = QImage();
+            {
+            std::lock_guard<std::mutex> rl(resultMutex);
+            if (!image.isNull()) {
+                  result    = scaled;
+                  newResult = true;
+                  }
+            if (doOverlay) {
+                  overlayResult    = o;
+                  newOverlayResult = true;
+                  }
+            }
+            if (notify)
+                  QMetaObject::invokeMethod(notify, "update", Qt::QueuedConnection);
+            lock.lock();
+            }
+      }
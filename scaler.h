@@ -0,0 +1,65 @@
+//=============================================================================
+//  Cam
+//  Webcam client
+//
+//  Copyright (C) 2016 Werner Schweer
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License version 2
+//  as published by the Free Software Foundation and appearing in
+//  the file LICENCE.GPL
+//=============================================================================
+
+#ifndef __SCALER_H__
+#define __SCALER_H__
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include <QImage>
+#include <QSize>
+
+class QObject;
+
+//---------------------------------------------------------
+//   Scaler
+//    scales images to display size in a worker thread, so
+//    the gui thread only blits them. Only the newest
+//    posted image is scaled; older ones are dropped.
+//    An overlay (focus peaking) is scaled to the same
+//    size and rescaled when the size changes. The update()
+//    slot of notify is invoked when a result is ready.
+//---------------------------------------------------------
+
+class Scaler {
+      QObject* notify;
+      std::thread thread;
+      std::mutex mutex;                   // protects pending, overlay, newOverlay, size, ratio, running
+      std::condition_variable cv;
+      QImage pending;
+      QImage overlay;                     // source resolution, kept for rescaling
+      bool newOverlay { false };          // overlay has to be (re)scaled
+      QSize size;                         // device pixels
+      qreal ratio  { 1.0 };               // device pixel ratio
+      unsigned frame { 0 };               // sequence of pending, for the trace
+      bool running { true };
+
+      std::mutex resultMutex;             // protects result, overlayResult, newResult, newOverlayResult
+      QImage result;
+      QImage overlayResult;
+      bool newResult { false };
+      bool newOverlayResult { false };
+
+      void loop();
+
+   public:
+      Scaler(QObject* notify = 0);
+      ~Scaler();
+      void post(const QImage&, const QSize& size, qreal devicePixelRatio);
+      void postOverlay(const QImage&);
+      bool take(QImage* image, QImage* overlay);
+      };
+
+#endif
+
@@ -0,0 +1,231 @@
+//=============================================================================
+//  Cam
+//  Webcam client
+//
+//  Copyright (C) 2016 Werner Schweer
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License version 2
+//  as published by the Free Software Foundation and appearing in
+//  the file LICENCE.GPL
+//=============================================================================
+
+#include <linux/videodev2.h>
+
+#include "shmring.h"
+#include "jpeg.h"
+
+//---------------------------------------------------------
+//   ~ShmRing
+//---------------------------------------------------------
+
+ShmRing::~ShmRing()
+      {
+      close();
+      }
+
+//---------------------------------------------------------
+//   create
+//    an existing ring of the same name is marked closed
+//    and replaced, attached readers keep the old mapping
+//    until they detach
+//---------------------------------------------------------
+
+bool ShmRing::create(const QString& name, int count, size_t slotSize)
+      {
+      close();
+      if (count < 2 || count > CAM_SHM_MAX_SLOTS) {
+            fprintf(stderr, "ShmRing: bad number of slots %d\n", count);
+            return false;
+            }
+      _name = name.startsWith('/') ? name.toLocal8Bit() : ("/" + name).toLocal8Bit();
+
+      struct cam_shm s;
+      if (cam_shm_attach(&s, _name.constData()) == 0) {
+            __atomic_store_n(&s.header->closed, 1, __ATOMIC_RELEASE);
+            __atomic_add_fetch(&s.header->futex, 1, __ATOMIC_RELEASE);
+            syscall(SYS_futex, &s.header->futex, FUTEX_WAKE, INT_MAX, 0, 0, 0);
+            cam_shm_detach(&s);
+            }
+      shm_unlink(_name.constData());
+
+      fd = shm_open(_name.constData(), O_RDWR | O_CREAT | O_EXCL, 0644);
+      if (fd < 0) {
+            fprintf(stderr, "ShmRing: cannot create <%s>: %s\n", _name.constData(), strerror(errno));
+            return false;
+            }
+      slotSize           = (slotSize + 63) & ~size_t(63);
+      size_t dataOffset  = (sizeof(struct cam_shm_header) + 4095) & ~size_t(4095);
+      size               = dataOffset + count * slotSize;
+      if (ftruncate(fd, size) < 0) {
+            fprintf(stderr, "ShmRing: cannot resize <%s>: %s\n", _name.constData(), strerror(errno));
+            close();
+            return false;
+            }
+      void* p = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      if (p == MAP_FAILED) {
+            fprintf(stderr, "ShmRing: cannot map <%s>: %s\n", _name.constData(), strerror(errno));
+            close();
+            return false;
+            }
+      header              = (struct cam_shm_header*)p;
+      header->version     = CAM_SHM_VERSION;
+      header->slot_count  = count;
+      header->slot_size   = slotSize;
+      header->data_offset = dataOffset;
+      sequence            = 0;
+      __atomic_store_n(&header->magic, CAM_SHM_MAGIC, __ATOMIC_RELEASE);
+      return true;
+      }
+
+//---------------------------------------------------------
+//   close
+//---------------------------------------------------------
+
+void ShmRing::close()
+      {
+      if (header) {
+            __atomic_store_n(&header->closed, 1, __ATOMIC_RELEASE);
+            __atomic_add_fetch(&header->futex, 1, __ATOMIC_RELEASE);
+            syscall(SYS_futex, &header->futex, FUTEX_WAKE, INT_MAX, 0, 0, 0);
+            munmap(header, size);
+            header = 0;
+            }
+      if (fd >= 0) {
+            ::close(fd);
+            shm_unlink(_name.constData());
+            fd = -1;
+            }
+      }
+
+//---------------------------------------------------------
+//   begin
+//    return the data area of the next slot; the slot is
+//    invalid until commit()
+//---------------------------------------------------------
+
+uchar* ShmRing::begin(size_t* capacity)
+      {
+      uint64_t seq = sequence + 1;
+      struct cam_shm_slot* slot = &header->slot[seq % header->slot_count];
+      __atomic_store_n(&slot->sequence, 0, __ATOMIC_RELAXED);
+      __atomic_thread_fence(__ATOMIC_RELEASE);
+      *capacity = header->slot_size;
+      return (uchar*)header + header->data_offset + (seq % header->slot_count) * header->slot_size;
+      }
+
+//---------------------------------------------------------
+//   commit
+//    publish the slot filled after begin() and wake
+//    waiting readers
+//---------------------------------------------------------
+
+void ShmRing::commit(unsigned format, int width, int height, int stride, size_t bytes, uint64_t timestamp)
+      {
+      uint64_t seq = ++sequence;
+      struct cam_shm_slot* slot = &header->slot[seq % header->slot_count];
+      slot->timestamp = timestamp;
+      slot->format    = format;
+      slot->width     = width;
+      slot->height    = height;
+      slot->stride    = stride;
+      slot->size      = bytes;
+      __atomic_store_n(&slot->sequence, seq, __ATOMIC_RELEASE);
+      __atomic_store_n(&header->sequence, seq, __ATOMIC_RELEASE);
+      __atomic_store_n(&header->futex, uint32_t(seq), __ATOMIC_SEQ_CST);
+      if (__atomic_load_n(&header->waiters, __ATOMIC_SEQ_CST))
+            syscall(SYS_futex, &header->futex, FUTEX_WAKE, INT_MAX, 0, 0, 0);
+      }
+
+//---------------------------------------------------------
+//   readers
+//    number of attached readers; a crashed reader is
+//    still counted
+//---------------------------------------------------------
+
+int ShmRing::readers() const
+      {
+      return header ? int(__atomic_load_n(&header->readers, __ATOMIC_RELAXED)) : 0;
+      }
+
+//---------------------------------------------------------
+//   shmFormat
+//    fourcc of a decoded image; 0 if it is not published
+//---------------------------------------------------------
+
+static unsigned shmFormat(QImage::Format format)
+      {
+      switch (format) {
+            case QImage::Format_RGB32:      return V4L2_PIX_FMT_XBGR32;
+            case QImage::Format_RGB888:     return V4L2_PIX_FMT_RGB24;
+            case QImage::Format_RGB16:      return V4L2_PIX_FMT_RGB565;
+            case QImage::Format_Grayscale8: return V4L2_PIX_FMT_GREY;
+            default:                        return 0;
+            }
+      }
+
+//---------------------------------------------------------
+//   create
+//---------------------------------------------------------
+
+bool ShmPublisher::create(const QString& name, int width, int height, QImage::Format format, int bufferSize)
+      {
+      int bits      = QImage::toPixelFormat(format).bitsPerPixel();
+      size_t stride = ((size_t(width) * bits + 31) >> 5) * 4;     // QImage lines are 32 bit aligned
+      hasFrames     = frames.create(name, 4, stride * height);
+      hasRaw    = raw.create(name + "-raw", 8, bufferSize + jpegHuffmanTablesSize());
+      return hasFrames && hasRaw;
+      }
+
+//---------------------------------------------------------
+//   wantsFrame
+//---------------------------------------------------------
+
+bool ShmPublisher::wantsFrame(const Frame& f)
+      {
+      return (hasRaw && raw.readers() > 0) || wantsImage(f);
+      }
+
+//---------------------------------------------------------
+//   wantsImage
+//---------------------------------------------------------
+
+bool ShmPublisher::wantsImage(const Frame&)
+      {
+      return hasFrames && frames.readers() > 0;
+      }
+
+//---------------------------------------------------------
+//   frame
+//---------------------------------------------------------
+
+void ShmPublisher::frame(const FramePtr& f)
+      {
+      size_t capacity;
+      if (hasRaw && raw.readers() > 0 && f->size() > 0) {
+            uchar* p = raw.begin(&capacity);
+            int n;
+            int stride = 0;
+            if (f->pixelFormat == V4L2_PIX_FMT_MJPEG)
+                  n = jpegCopyWithHuffmanTables(f->data(), f->size(), p, capacity);
+            else {
+                  n = size_t(f->size()) <= capacity ? f->size() : -1;
+                  if (n > 0)
+                        memcpy(p, f->data(), n);
+                  stride = f->bytesPerLine;
+                  }
+            if (n > 0)
+                  raw.commit(f->pixelFormat, f->width, f->height, stride, n, f->timestamp);
+            }
+      const QImage& img = f->image();
+      unsigned format = shmFormat(img.format());
+      if (hasFrames && frames.readers() > 0 && !img.isNull() && format) {
+            uchar* p = frames.begin(&capacity);
+            size_t n = size_t(img.bytesPerLine()) * img.height();
+            if (n <= capacity) {
+                  memcpy(p, img.constBits(), n);
+                  frames.commit(format, img.width(), img.height(), img.bytesPerLine(), n, f->timestamp);
+                  }
+            }
+      }
+
@@ -0,0 +1,72 @@
+//=============================================================================
+//  Cam
+//  Webcam client
+//
+//  Copyright (C) 2016 Werner Schweer
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License version 2
+//  as published by the Free Software Foundation and appearing in
+//  the file LICENCE.GPL
+//=============================================================================
+
+#ifndef __SHMRING_H__
+#define __SHMRING_H__
+
+#include <QByteArray>
+#include <QImage>
+#include <QString>
+
+#include "camshm.h"
+#include "frame.h"
+
+//---------------------------------------------------------
+//   ShmRing
+//    writer side of the shared memory frame ring
+//    described in camshm.h
+//---------------------------------------------------------
+
+class ShmRing {
+      QByteArray _name;
+      int fd         { -1 };
+      size_t size    { 0 };
+      struct cam_shm_header* header { 0 };
+      uint64_t sequence { 0 };
+
+   public:
+      ~ShmRing();
+      bool create(const QString& name, int count, size_t slotSize);
+      void close();
+      uchar* begin(size_t* capacity);
+      void commit(unsigned format, int width, int height, int stride, size_t bytes, uint64_t timestamp);
+      int readers() const;
+      const QByteArray& name() const { return _name; }
+      size_t mapped() const          { return size; }
+      };
+
+//---------------------------------------------------------
+//   ShmPublisher
+//    publishes frames to the rings <name> (decoded) and
+//    <name>-raw (as captured); a ring is written, and
+//    frames are decoded for it, only while a reader is
+//    attached. The decoded ring is sized for the image
+//    format.
+//---------------------------------------------------------
+
+class ShmPublisher : public FrameConsumer {
+      ShmRing frames;
+      ShmRing raw;
+      bool hasFrames { false };
+      bool hasRaw    { false };
+
+   public:
+      bool create(const QString& name, int width, int height, QImage::Format, int bufferSize);
+      qint64 memory() const { return qint64(frames.mapped()) + raw.mapped(); }
+
+      virtual bool wantsFrame(const Frame&) override;
+      virtual bool wantsImage(const Frame&) override;
+      virtual void frame(const FramePtr&) override;
+      };
+
+#endif
+
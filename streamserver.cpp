@@ -0,0 +1,353 @@
+//=============================================================================
+//  Cam
+//  Webcam client
+//
+//  Copyright (C) 2016 Werner Schweer
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License version 2
+//  as published by the Free Software Foundation and appearing in
+//  the file LICENCE.GPL
+//=============================================================================
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <linux/videodev2.h>
+
+#include <algorithm>
+#include <chrono>
+
+#include <QBuffer>
+
+#include "streamserver.h"
+
+static const char response[] =
+      "HTTP/1.0 200 OK\r\n"
+      "Connection: close\r\n"
+      "Cache-Control: no-cache, no-store, must-revalidate\r\n"
+      "Pragma: no-cache\r\n"
+      "Content-Type: multipart/x-mixed-replace; boundary=camframe\r\n"
+      "\r\n";
+
+//---------------------------------------------------------
+//   Client
+//    head and data are sent as one unit; offset counts
+//    the bytes already written
+//---------------------------------------------------------
+
+struct StreamServer::Client {
+      int fd;
+      QString address;
+      QByteArray head;              // http response or part header
+      QByteArray data;              // jpeg frame
+      int offset          { 0 };
+      quint64 sequence    { 0 };    // last frame started
+      quint64 bytes       { 0 };
+      unsigned frames     { 0 };
+      unsigned dropped    { 0 };
+      std::chrono::steady_clock::time_point connected;
+
+      bool busy() const { return offset < head.size() + data.size(); }
+      bool send();
+      };
+
+//---------------------------------------------------------
+//   send
+//    write as much as the socket takes; return false on
+//    error
+//---------------------------------------------------------
+
+bool StreamServer::Client::send()
+      {
+      struct iovec iov[2];
+      int n = 0;
+      if (offset < head.size()) {
+            iov[n].iov_base = (void*)(head.constData() + offset);
+            iov[n].iov_len  = head.size() - offset;
+            ++n;
+            iov[n].iov_base = (void*)data.constData();
+            iov[n].iov_len  = data.size();
+            ++n;
+            }
+      else {
+            iov[n].iov_base = (void*)(data.constData() + offset - head.size());
+            iov[n].iov_len  = data.size() - (offset - head.size());
+            ++n;
+            }
+      struct msghdr msg;
+      memset(&msg, 0, sizeof(msg));
+      msg.msg_iov    = iov;
+      msg.msg_iovlen = n;
+      ssize_t rv = sendmsg(fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+      if (rv < 0)
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+      offset += rv;
+      bytes  += rv;
+      if (!busy()) {
+            if (!data.isEmpty())
+                  ++frames;
+            head.clear();           // release the frame
+            data.clear();
+            offset = 0;
+            }
+      return true;
+      }
+
+//---------------------------------------------------------
+//   ~StreamServer
+//---------------------------------------------------------
+
+StreamServer::~StreamServer()
+      {
+      stop();
+      }
+
+//---------------------------------------------------------
+//   start
+//    listen on all interfaces
+//---------------------------------------------------------
+
+bool StreamServer::start(int port)
+      {
+      listenFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+      if (listenFd < 0) {
+            fprintf(stderr, "StreamServer: socket: %s\n", strerror(errno));
+            return false;
+            }
+      int on = 1;
+      setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+      struct sockaddr_in addr;
+      memset(&addr, 0, sizeof(addr));
+      addr.sin_family      = AF_INET;
+      addr.sin_port        = htons(port);
+      addr.sin_addr.s_addr = htonl(INADDR_ANY);
+      if (bind(listenFd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(listenFd, SOMAXCONN) < 0) {
+            fprintf(stderr, "StreamServer: cannot listen on port %d: %s\n", port, strerror(errno));
+            ::close(listenFd);
+            listenFd = -1;
+            return false;
+            }
+      wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+      if (wakeFd < 0) {
+            fprintf(stderr, "StreamServer: eventfd: %s\n", strerror(errno));
+            ::close(listenFd);
+            listenFd = -1;
+            return false;
+            }
+      running = true;
+      thread  = std::thread(&StreamServer::loop, this);
+      return true;
+      }
+
+//---------------------------------------------------------
+//   stop
+//---------------------------------------------------------
+
+void StreamServer::stop()
+      {
+      if (!running)
+            return;
+      running = false;
+      uint64_t one = 1;
+      if (write(wakeFd, &one, sizeof(one)) < 0)
+            fprintf(stderr, "StreamServer: wakeup failed: %s\n", strerror(errno));
+      thread.join();
+      ::close(listenFd);
+      ::close(wakeFd);
+      listenFd = -1;
+      wakeFd   = -1;
+      }
+
+//---------------------------------------------------------
+//   post
+//    called from the capture thread; only the newest frame
+//    is kept
+//---------------------------------------------------------
+
+void StreamServer::post(const QByteArray& jpeg)
+      {
+      char buffer[128];
+      int n = snprintf(buffer, sizeof(buffer),
+         "\r\n--camframe\r\nContent-Type: image/jpeg\r\nContent-Length: %d\r\n\r\n", jpeg.size());
+      QByteArray h(buffer, n);
+      {
+      std::lock_guard<std::mutex> lock(frameMutex);
+      latest = jpeg;
+      header = h;
+      ++sequence;
+      }
+      uint64_t one = 1;
+      if (write(wakeFd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+            fprintf(stderr, "StreamServer: wakeup failed: %s\n", strerror(errno));
+      }
+
+//---------------------------------------------------------
+//   wantsImage
+//---------------------------------------------------------
+
+bool StreamServer::wantsImage(const Frame& f)
+      {
+      return f.pixelFormat != V4L2_PIX_FMT_MJPEG;
+      }
+
+//---------------------------------------------------------
+//   frame
+//---------------------------------------------------------
+
+void StreamServer::frame(const FramePtr& f)
+      {
+      if (f->pixelFormat == V4L2_PIX_FMT_MJPEG) {
+            post(f->jpeg());
+            return;
+            }
+      if (f->image().isNull())
+            return;
+      QByteArray ba;
+      QBuffer b(&ba);
+      b.open(QIODevice::WriteOnly);
+      if (f->image().save(&b, "jpeg", 80))
+            post(ba);
+      }
+
+//---------------------------------------------------------
+//   stats
+//---------------------------------------------------------
+
+std::vector<StreamClientStats> StreamServer::stats() const
+      {
+      std::lock_guard<std::mutex> lock(statsMutex);
+      return _stats;
+      }
+
+//---------------------------------------------------------
+//   loop
+//---------------------------------------------------------
+
+void StreamServer::loop()
+      {
+      std::vector<Client*> clientList;
+      std::vector<struct pollfd> fds;
+      auto lastStats = std::chrono::steady_clock::now();
+
+      while (running) {
+            fds.clear();
+            fds.push_back({ listenFd, POLLIN, 0 });
+            fds.push_back({ wakeFd, POLLIN, 0 });
+            for (Client* c : clientList)
+                  fds.push_back({ c->fd, short(POLLIN | (c->busy() ? POLLOUT : 0)), 0 });
+            if (poll(fds.data(), fds.size(), 1000) < 0 && errno != EINTR) {
+                  fprintf(stderr, "StreamServer: poll: %s\n", strerror(errno));
+                  break;
+                  }
+            if (fds[1].revents & POLLIN) {
+                  uint64_t n;
+                  if (read(wakeFd, &n, sizeof(n)) < 0 && errno != EAGAIN)
+                        fprintf(stderr, "StreamServer: read: %s\n", strerror(errno));
+                  }
+
+            // read and discard requests, drop closed connections
+
+            for (size_t i = 0; i < clientList.size(); ++i) {
+                  Client* c = clientList[i];
+                  short revents = fds[i + 2].revents;
+                  if (revents & POLLIN) {
+                        char buffer[1024];
+                        ssize_t n = recv(c->fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+                        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR))
+                              revents |= POLLHUP;
+                        }
+                  if (revents & (POLLHUP | POLLERR)) {
+                        ::close(c->fd);
+                        delete c;
+                        clientList[i] = 0;
+                        }
+                  }
+            clientList.erase(std::remove(clientList.begin(), clientList.end(), (Client*)0), clientList.end());
+
+            if (fds[0].revents & POLLIN) {
+                  for (;;) {
+                        struct sockaddr_in addr;
+                        socklen_t len = sizeof(addr);
+                        int fd = accept4(listenFd, (struct sockaddr*)&addr, &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                        if (fd < 0)
+                              break;
+                        Client* c    = new Client;
+                        c->fd        = fd;
+                        c->address   = QString("%1:%2").arg(inet_ntoa(addr.sin_addr)).arg(ntohs(addr.sin_port));
+                        c->head      = QByteArray(response, sizeof(response) - 1);
+                        c->connected = std::chrono::steady_clock::now();
+                        {
+                        std::lock_guard<std::mutex> lock(frameMutex);
+                        c->sequence = sequence;     // start with next frame
+                        }
+                        clientList.push_back(c);
+                        }
+                  }
+
+            QByteArray f, h;
+            quint64 seq;
+            {
+            std::lock_guard<std::mutex> lock(frameMutex);
+            f   = latest;
+            h   = header;
+            seq = sequence;
+            }
+
+            // every idle client gets the newest frame; frames
+            // posted while it was busy are dropped
+
+            for (size_t i = 0; i < clientList.size(); ++i) {
+                  Client* c = clientList[i];
+                  if (!c->busy() && c->sequence < seq) {
+                        c->dropped  += seq - c->sequence - 1;
+                        c->sequence  = seq;
+                        c->head      = h;
+                        c->data      = f;
+                        c->offset    = 0;
+                        }
+                  if (c->busy() && !c->send()) {
+                        ::close(c->fd);
+                        delete c;
+                        clientList[i] = 0;
+                        }
+                  }
+            clientList.erase(std::remove(clientList.begin(), clientList.end(), (Client*)0), clientList.end());
+            _clients = clientList.size();
+
+            auto now = std::chrono::steady_clock::now();
+            if (now - lastStats >= std::chrono::milliseconds(500)) {
+                  std::vector<StreamClientStats> sl;
+                  for (Client* c : clientList) {
+                        StreamClientStats s;
+                        s.address = c->address;
+                        s.bytes   = c->bytes;
+                        s.frames  = c->frames;
+                        s.dropped = c->dropped + (seq > c->sequence ? seq - c->sequence - 1 : 0);
+                        s.seconds = std::chrono::duration<double>(now - c->connected).count();
+                        sl.push_back(s);
+                        }
+                  std::lock_guard<std::mutex> lock(statsMutex);
+                  _stats.swap(sl);
+                  lastStats = now;
+                  }
+            }
+      for (Client* c : clientList) {
+            ::close(c->fd);
+            delete c;
+            }
+      _clients = 0;
+      std::lock_guard<std::mutex> lock(statsMutex);
+      _stats.clear();
+      }
+
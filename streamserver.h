@@ -0,0 +1,86 @@
+//=============================================================================
+//  Cam
+//  Webcam client
+//
+//  Copyright (C) 2016 Werner Schweer
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License version 2
+//  as published by the Free Software Foundation and appearing in
+//  the file LICENCE.GPL
+//=============================================================================
+
+#ifndef __STREAMSERVER_H__
+#define __STREAMSERVER_H__
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <QByteArray>
+#include <QString>
+
+#include "frame.h"
+
+//---------------------------------------------------------
+//   StreamClientStats
+//---------------------------------------------------------
+
+struct StreamClientStats {
+      QString address;
+      quint64 bytes;
+      unsigned frames;        // completely sent
+      unsigned dropped;       // skipped because client was busy, including
+                              // those a client stuck on a frame will skip
+      double seconds;         // connected since
+      };
+
+//---------------------------------------------------------
+//   StreamServer
+//    multipart/x-mixed-replace http server for jpeg frames
+//
+//    every posted frame is shared by all clients (QByteArray
+//    is reference counted) and sent with sendmsg() without
+//    copying; a client which is still busy with a frame
+//    skips to the newest one when it is done, so slow
+//    clients never block the capture thread
+//
+//    as FrameConsumer mjpeg frames are passed through,
+//    other formats are encoded once per frame
+//---------------------------------------------------------
+
+class StreamServer : public FrameConsumer {
+      struct Client;
+
+      int listenFd { -1 };
+      int wakeFd   { -1 };          // eventfd, signals new frame
+      std::thread thread;
+      std::atomic<bool> running { false };
+
+      std::mutex frameMutex;        // protects latest, header, sequence
+      QByteArray latest;            // newest frame
+      QByteArray header;            // its part header
+      quint64 sequence { 0 };
+
+      std::atomic<int> _clients { 0 };
+      mutable std::mutex statsMutex;
+      std::vector<StreamClientStats> _stats;
+
+      void loop();
+
+   public:
+      virtual ~StreamServer();
+      bool start(int port);
+      void stop();
+      void post(const QByteArray& jpeg);
+      int clients() const           { return _clients; }
+      std::vector<StreamClientStats> stats() const;
+
+      virtual bool wantsFrame(const Frame&) override { return _clients > 0; }
+      virtual bool wantsImage(const Frame&) override;
+      virtual void frame(const FramePtr&) override;
+      };
+
+#endif
+
@@ -0,0 +1,135 @@
+//=============================================================================
+//  Cam
+//  Webcam client
+//
+//  Copyright (C) 2016 Werner Schweer
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License version 2
+//  as published by the Free Software Foundation and appearing in
+//  the file LICENCE.GPL
+//=============================================================================
+
+#include <algorithm>
+
+#include "threadpool.h"
+#include "trace.h"
+
+//---------------------------------------------------------
+//   ThreadPool
+//    threads - 1 workers; the caller of run() is the
+//    last thread
+//---------------------------------------------------------
+
+ThreadPool::ThreadPool(int threads)
+      {
+      for (int i = 1; i < threads; ++i)
+            workers.push_back(std::thread(&ThreadPool::loop, this));
+      }
+
+ThreadPool::~ThreadPool()
+      {
+      {
+      std::lock_guard<std::mutex> lock(mutex);
+      running = false;
+      }
+      cv.notify_all();
+      for (std::thread& t : workers)
+            t.join();
+      }
+
+//---------------------------------------------------------
+//   global
+//    one thread per core, shared by all users
+//---------------------------------------------------------
+
+ThreadPool* ThreadPool::global()
+      {
+      static ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()));
+      return &pool;
+      }
+
+//---------------------------------------------------------
+//   handles
+//    of the workers, to set their affinity or scheduling
+//---------------------------------------------------------
+
+std::vector<std::thread::native_handle_type> ThreadPool::handles()
+      {
+      std::vector<std::thread::native_handle_type> hl;
+      for (std::thread& t : workers)
+            hl.push_back(t.native_handle());
+      return hl;
+      }
+
+//---------------------------------------------------------
+//   take
+//    next part of job; called with mutex held
+//---------------------------------------------------------
+
+int ThreadPool::take(Job* job)
+      {
+      int i = job->next++;
+      if (job->next == job->n)      // all parts started
+            jobs.erase(std::find(jobs.begin(), jobs.end(), job));
+      return i;
+      }
+
+//---------------------------------------------------------
+//   finish
+//    called with mutex held
+//---------------------------------------------------------
+
+void ThreadPool::finish(Job* job)
+      {
+      if (--job->pending == 0)
+            done.notify_all();
+      }
+
+//---------------------------------------------------------
+//   run
+//    call f(0) ... f(n - 1) in parallel
+//---------------------------------------------------------
+
+void ThreadPool::run(int n, const std::function<void(int)>& f)
+      {
+      if (n <= 1 || workers.empty()) {
+            for (int i = 0; i < n; ++i)
+                  f(i);
+            return;
+            }
+      Job job { &f, n, 0, n };
+      std::unique_lock<std::mutex> lock(mutex);
+      jobs.push_back(&job);
+      cv.notify_all();
+      while (job.next < job.n) {
+            int i = take(&job);
+            lock.unlock();
+            f(i);
+            lock.lock();
+            finish(&job);
+            }
+      done.wait(lock, [&job] { return job.pending == 0; });
+      }
+
+//---------------------------------------------------------
+//   loop
+//---------------------------------------------------------
+
+void ThreadPool::loop()
+      {
+      Trace::setThreadName("pool");
+      std::unique_lock<std::mutex> lock(mutex);
+      for (;;) {
+            cv.wait(lock, [this] { return !jobs.empty() || !running; });
+            if (!running)
+                  break;
+            Job* job = jobs.front();
+            int i    = take(job);
+            lock.unlock();
+            (*job->f)(i);
+            lock.lock();
+            finish(job);
+            }
+      }
+
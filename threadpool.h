@@ -0,0 +1,62 @@
+//=============================================================================
+//  Cam
+//  Webcam client
+//
+//  Copyright (C) 2016 Werner Schweer
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License version 2
+//  as published by the Free Software Foundation and appearing in
+//  the file LICENCE.GPL
+//=============================================================================
+
+#ifndef __THREADPOOL_H__
+#define __THREADPOOL_H__
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//---------------------------------------------------------
+//   ThreadPool
+//    persistent worker threads for fork/join work within
+//    one frame. run() returns when all parts are done;
+//    the calling thread works on the parts as well, so a
+//    job never waits in a queue behind idle workers.
+//    run() may be called from several threads at once.
+//---------------------------------------------------------
+
+class ThreadPool {
+      struct Job {
+            const std::function<void(int)>* f;
+            int n;
+            int next;                     // next part to start
+            int pending;                  // parts not finished
+            };
+
+      std::vector<std::thread> workers;
+      std::mutex mutex;                   // protects jobs, running and the Job counters
+      std::condition_variable cv;
+      std::condition_variable done;
+      std::deque<Job*> jobs;
+      bool running { true };
+
+      int take(Job*);
+      void finish(Job*);
+      void loop();
+
+   public:
+      ThreadPool(int threads);
+      ~ThreadPool();
+      int size() const              { return workers.size() + 1; }
+      std::vector<std::thread::native_handle_type> handles();
+      void run(int n, const std::function<void(int)>& f);
+
+      static ThreadPool* global();
+      };
+
+#endif
+
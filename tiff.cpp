@@ -0,0 +1,160 @@
+//=============================================================================
+//  Cam
+//  Webcam client
+//
+//  Copyright (C) 2016 Werner Schweer
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License version 2
+//  as published by the Free Software Foundation and appearing in
+//  the file LICENCE.GPL
+//=============================================================================
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include <QImage>
+
+#include "tiff.h"
+
+//---------------------------------------------------------
+//   header
+//---------------------------------------------------------
+
+void TiffWriter::header()
+      {
+      std::vector<uchar> b { 'I', 'I' };
+      if (big) {
+            put(&b, 43, 2);
+            put(&b, 8, 2);          // offset size
+            put(&b, 0, 2);
+            nextLink = b.size();
+            put(&b, 0, 8);
+            }
+      else {
+            put(&b, 42, 2);
+            nextLink = b.size();
+            put(&b, 0, 4);
+            }
+      write(b.data(), b.size());
+      }
+
+//---------------------------------------------------------
+//   ifd
+//    entries must be sorted by tag
+//---------------------------------------------------------
+
+void TiffWriter::ifd(std::vector<TiffEntry>& entries)
+      {
+      const int inlineSize = big ? 8 : 4;
+      const int countSize  = big ? 8 : 4;
+
+      // out of line values
+
+      std::vector<quint64> valueOffset(entries.size());
+      for (size_t i = 0; i < entries.size(); ++i) {
+            const TiffEntry& e = entries[i];
+            int n = typeSize(e.type) * e.values.size();
+            if (n <= inlineSize)
+                  continue;
+            std::vector<uchar> b;
+            for (quint64 v : e.values)
+                  put(&b, v, typeSize(e.type));
+            if (pos() & 1)
+                  write("", 1);
+            valueOffset[i] = pos();
+            write(b.data(), b.size());
+            }
+      if (pos() & 1)
+            write("", 1);
+      quint64 offset = pos();
+
+      std::vector<uchar> b;
+      put(&b, entries.size(), big ? 8 : 2);
+      for (size_t i = 0; i < entries.size(); ++i) {
+            const TiffEntry& e = entries[i];
+            put(&b, e.tag, 2);
+            put(&b, e.type, 2);
+            put(&b, e.values.size(), countSize);
+            int n = typeSize(e.type) * e.values.size();
+            if (n <= inlineSize) {
+                  for (quint64 v : e.values)
+                        put(&b, v, typeSize(e.type));
+                  for (; n < inlineSize; ++n)
+                        b.push_back(0);
+                  }
+            else
+                  put(&b, valueOffset[i], inlineSize);
+            }
+      quint64 link = offset + b.size();
+      put(&b, 0, inlineSize);
+      write(b.data(), b.size());
+
+      // link into the previous IFD
+
+      std::vector<uchar> o;
+      put(&o, offset, inlineSize);
+      quint64 end = pos();
+      if (fseeko(f, nextLink, SEEK_SET) == 0)
+            write(o.data(), o.size());
+      else
+            ok = false;
+      fseeko(f, end, SEEK_SET);
+      nextLink = link;
+      }
+
+
+//---------------------------------------------------------
+//   writeTiff
+//    8 bit RGB or, for Grayscale8, 8 bit gray tiff without
+//    compression; strips of 64 rows
+//---------------------------------------------------------
+
+bool writeTiff(const QString& path, const QImage& image)
+      {
+      const int stripRows = 64;
+      bool gray    = image.format() == QImage::Format_Grayscale8;
+      int channels = gray ? 1 : 3;
+      int w        = image.width();
+      int h        = image.height();
+      QImage src   = gray || image.format() == QImage::Format_RGB888
+         ? image : image.convertToFormat(QImage::Format_RGB888);
+      FILE* f = fopen(qPrintable(path), "wb");
+      if (!f) {
+            fprintf(stderr, "cannot open <%s>: %s\n", qPrintable(path), strerror(errno));
+            return false;
+            }
+      bool big = quint64(w) * h * channels > bigTiffLimit;
+      TiffWriter t(f, big);
+      t.header();
+      std::vector<quint64> offsets, counts;
+      for (int y = 0; y < h; y += stripRows) {
+            int rows = qMin(stripRows, h - y);
+            offsets.push_back(t.pos());
+            counts.push_back(quint64(w) * channels * rows);
+            for (int i = 0; i < rows; ++i)
+                  t.write(src.constScanLine(y + i), w * channels);
+            }
+      TiffType offsetType = big ? TIFF_LONG8 : TIFF_LONG;
+      std::vector<TiffEntry> entries {
+            { 256, TIFF_LONG,  { quint64(w) } },                        // ImageWidth
+            { 257, TIFF_LONG,  { quint64(h) } },                        // ImageLength
+            { 258, TIFF_SHORT, std::vector<quint64>(channels, 8) },      // BitsPerSample
+            { 259, TIFF_SHORT, { 1 } },                                 // Compression: none
+            { 262, TIFF_SHORT, { quint64(gray ? 1 : 2) } },             // PhotometricInterpretation
+            { 273, offsetType, offsets },                               // StripOffsets
+            { 277, TIFF_SHORT, { quint64(channels) } },                 // SamplesPerPixel
+            { 278, TIFF_LONG,  { quint64(stripRows) } },                // RowsPerStrip
+            { 279, offsetType, counts },                                // StripByteCounts
+            { 284, TIFF_SHORT, { 1 } },                                 // PlanarConfiguration: chunky
+            };
+      t.ifd(entries);
+      bool ok = !t.error();
+      if (fclose(f) != 0)
+            ok = false;
+      if (!ok)
+            fprintf(stderr, "cannot write <%s>: %s\n", qPrintable(path), strerror(errno));
+      return ok;
+      }
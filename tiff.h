@@ -0,0 +1,74 @@
+//=============================================================================
+//  Cam
+//  Webcam client
+//
+//  Copyright (C) 2016 Werner Schweer
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License version 2
+//  as published by the Free Software Foundation and appearing in
+//  the file LICENCE.GPL
+//=============================================================================
+
+
+#ifndef __TIFF_H__
+#define __TIFF_H__
+
+#include <stdio.h>
+#include <vector>
+
+#include <QImage>
+#include <QString>
+
+class MosaicCanvas;
+
+static const quint64 bigTiffLimit = 0xf0000000;   // classic tiff offsets are 32 bit
+
+enum TiffType { TIFF_SHORT = 3, TIFF_LONG = 4, TIFF_LONG8 = 16 };
+
+//---------------------------------------------------------
+//   TiffEntry
+//---------------------------------------------------------
+
+struct TiffEntry {
+      quint16 tag;
+      TiffType type;
+      std::vector<quint64> values;
+      };
+
+//---------------------------------------------------------
+//   TiffWriter
+//    little endian tiff or BigTIFF; strip or tile data is
+//    written first, then the out of line tag values and
+//    the IFD, which is linked into the previous IFD
+//---------------------------------------------------------
+
+class TiffWriter {
+      FILE* f;
+      bool big;
+      quint64 nextLink;             // file position of the pointer to the next IFD
+      bool ok { true };
+
+      void put(std::vector<uchar>* b, quint64 v, int size) {
+            for (int i = 0; i < size; ++i)
+                  b->push_back(uchar(v >> (8 * i)));
+            }
+      static int typeSize(TiffType t) { return t == TIFF_SHORT ? 2 : (t == TIFF_LONG ? 4 : 8); }
+
+   public:
+      TiffWriter(FILE* file, bool b) : f(file), big(b) {}
+      bool error() const      { return !ok; }
+      quint64 pos()           { return ftello(f); }
+      void write(const void* p, size_t n) {
+            if (ok && fwrite(p, 1, n, f) != n)
+                  ok = false;
+            }
+      void header();
+      void ifd(std::vector<TiffEntry>& entries);
+      };
+
+extern bool writeTiff(const QString& path, const QImage& image);
+extern bool writeTiledTiff(const QString& path, const MosaicCanvas& canvas);     // mosaictiff.cpp
+
+#endif
+
@@ -0,0 +1,124 @@
+//=============================================================================
+//  Cam
+//  Webcam client
+//
+//  Copyright (C) 2016 Werner Schweer
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License version 2
+//  as published by the Free Software Foundation and appearing in
+//  the file LICENCE.GPL
+//=============================================================================
+
+#include <string.h>
+#include <errno.h>
+#include <linux/videodev2.h>
+
+#include <QBuffer>
+#include <QFile>
+
+#include "timelapse.h"
+#include "trace.h"
+
+//---------------------------------------------------------
+//   Timelapse
+//---------------------------------------------------------
+
+Timelapse::Timelapse(double seconds, const QString& p, const QString& pf)
+   : interval(quint64(seconds * 1e9)), path(p), prefix(pf)
+      {
+      }
+
+Timelapse::~Timelapse()
+      {
+      if (file)
+            fclose(file);
+      }
+
+//---------------------------------------------------------
+//   setRecording
+//    append samples to file instead of writing single
+//    pictures
+//---------------------------------------------------------
+
+bool Timelapse::setRecording(const QString& s)
+      {
+      file = fopen(qPrintable(s), "ab");
+      if (!file) {
+            fprintf(stderr, "cannot open timelapse recording <%s>: %s\n", qPrintable(s), strerror(errno));
+            return false;
+            }
+      return true;
+      }
+
+//---------------------------------------------------------
+//   wantsFrame
+//---------------------------------------------------------
+
+bool Timelapse::wantsFrame(const Frame& f)
+      {
+      return f.timestamp >= next && !f.error();
+      }
+
+//---------------------------------------------------------
+//   wantsImage
+//---------------------------------------------------------
+
+bool Timelapse::wantsImage(const Frame& f)
+      {
+      return f.pixelFormat != V4L2_PIX_FMT_MJPEG;
+      }
+
+//---------------------------------------------------------
+//   frame
+//---------------------------------------------------------
+
+void Timelapse::frame(const FramePtr& f)
+      {
+      TraceScope ts("timelapse");
+      // keep the schedule fixed to the first sample so the
+      // interval does not drift with the frame rate
+
+      if (next == 0)
+            next = f->timestamp;
+      while (next <= f->timestamp)
+            next += interval;
+
+      QByteArray ba;
+      if (f->pixelFormat == V4L2_PIX_FMT_MJPEG)
+            ba = f->jpeg();
+      else if (!f->image().isNull()) {
+            QBuffer b(&ba);
+            b.open(QIODevice::WriteOnly);
+            f->image().save(&b, "jpeg", 90);
+            }
+      if (!ba.isEmpty() && write(ba))
+            ++_frames;
+      }
+
+//---------------------------------------------------------
+//   write
+//---------------------------------------------------------
+
+bool Timelapse::write(const QByteArray& ba)
+      {
+      if (file) {
+            if (fwrite(ba.constData(), 1, ba.size(), file) != size_t(ba.size())) {
+                  fprintf(stderr, "timelapse recording failed: %s\n", strerror(errno));
+                  return false;
+                  }
+            fflush(file);
+            return true;
+            }
+      QString name;
+      do {
+            name = QString("%1/%2%3.jpeg").arg(path).arg(prefix).arg(number++, 6, 10, QChar('0'));
+            } while (QFile::exists(name));
+      QFile f(name);
+      if (!f.open(QIODevice::WriteOnly) || f.write(ba) != ba.size()) {
+            fprintf(stderr, "cannot write timelapse picture <%s>\n", qPrintable(name));
+            return false;
+            }
+      return true;
+      }
+
@@ -0,0 +1,56 @@
+//=============================================================================
+//  Cam
+//  Webcam client
+//
+//  Copyright (C) 2016 Werner Schweer
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License version 2
+//  as published by the Free Software Foundation and appearing in
+//  the file LICENCE.GPL
+//=============================================================================
+
+#ifndef __TIMELAPSE_H__
+#define __TIMELAPSE_H__
+
+#include <stdio.h>
+
+#include <atomic>
+
+#include <QString>
+
+#include "frame.h"
+
+//---------------------------------------------------------
+//   Timelapse
+//    keeps one frame per interval, scheduled on the
+//    capture timestamps; all other frames are requeued
+//    without decoding. mjpeg frames are written as they
+//    are, other formats are jpeg encoded. Frames go into
+//    numbered files or are appended to one recording.
+//---------------------------------------------------------
+
+class Timelapse : public FrameConsumer {
+      quint64 interval;             // ns
+      quint64 next { 0 };           // timestamp of next sample
+      QString path;
+      QString prefix;
+      int number   { 0 };
+      FILE* file   { 0 };
+      std::atomic<unsigned> _frames { 0 };
+
+      bool write(const QByteArray&);
+
+   public:
+      Timelapse(double seconds, const QString& path, const QString& prefix);
+      ~Timelapse();
+      bool setRecording(const QString& file);
+      unsigned frames() const       { return _frames; }
+
+      virtual bool wantsFrame(const Frame&) override;
+      virtual bool wantsImage(const Frame&) override;
+      virtual void frame(const FramePtr&) override;
+      };
+
+#endif
+
@@ -0,0 +1,283 @@
+//=============================================================================
+//  Cam
+//  Webcam client
+//
+//  Copyright (C) 2016 Werner Schweer
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License version 2
+//  as published by the Free Software Foundation and appearing in
+//  the file LICENCE.GPL
+//=============================================================================
+
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include <mutex>
+#include <vector>
+
+#include <QByteArray>
+
+#include "trace.h"
+
+std::atomic<bool> Trace::on { false };
+
+//---------------------------------------------------------
+//   TraceEvent
+//---------------------------------------------------------
+
+struct TraceEvent {
+      enum class Type : quint8 { Complete, FlowStart, FlowEnd };
+      const char* name;
+      quint64 start;
+      quint64 duration;
+      unsigned frame;
+      Type type;
+      };
+
+//---------------------------------------------------------
+//   TraceRing
+//    written by its thread only; count is published with
+//    release order so write() sees complete events. count
+//    doubles as sequence lock: the slot of event n is
+//    rewritten only after count reached n + ringSize, so
+//    a copy of event n is intact if count is still below
+//    that afterwards. Rings outlive their threads, the
+//    events of finished threads are still written.
+//---------------------------------------------------------
+
+struct TraceRing {
+      std::vector<TraceEvent> events;
+      std::atomic<quint64> count { 0 };
+      int tid;
+      QByteArray name;
+
+      TraceRing() : events(Trace::ringSize) {}
+      };
+
+static std::mutex mutex;                  // protects rings, tracePath
+static std::vector<TraceRing*> rings;
+static QString tracePath;
+
+static thread_local TraceRing* localRing   { 0 };
+static thread_local unsigned localFrame     { 0 };
+static thread_local const char* localName   { 0 };
+
+//---------------------------------------------------------
+//   ring
+//    of the calling thread, created on first use
+//---------------------------------------------------------
+
+static TraceRing* ring()
+      {
+      if (!localRing) {
+            TraceRing* r = new TraceRing;
+            r->tid  = syscall(SYS_gettid);
+            r->name = localName ? QByteArray(localName) : QByteArray("thread ") + QByteArray::number(r->tid);
+            std::lock_guard<std::mutex> lock(mutex);
+            rings.push_back(r);
+            localRing = r;
+            }
+      return localRing;
+      }
+
+//---------------------------------------------------------
+//   record
+//---------------------------------------------------------
+
+static void record(const char* name, quint64 start, quint64 duration, unsigned frame, TraceEvent::Type type)
+      {
+      TraceRing* r   = ring();
+      quint64 n = r->count.load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);     // count before the event
+      TraceEvent& e  = r->events[n % Trace::ringSize];
+      e.name     = name;
+      e.start    = start;
+      e.duration = duration;
+      e.frame    = frame;
+      e.type     = type;
+      r->count.store(n + 1, std::memory_order_release);
+      }
+
+//---------------------------------------------------------
+//   writeJsonString
+//---------------------------------------------------------
+
+static void writeJsonString(FILE* f, const char* s)
+      {
+      fputc('"', f);
+      for (; *s; ++s) {
+            if (*s == '"' || *s == '\\')
+                  fputc('\\', f);
+            if (uchar(*s) >= 0x20)
+                  fputc(*s, f);
+            }
+      fputc('"', f);
+      }
+
+//---------------------------------------------------------
+//   start
+//    start recording; write() saves to path
+//---------------------------------------------------------
+
+void Trace::start(const QString& p)
+      {
+      {
+      std::lock_guard<std::mutex> lock(mutex);
+      tracePath = p;
+      }
+      on = true;
+      }
+
+//---------------------------------------------------------
+//   path
+//---------------------------------------------------------
+
+QString Trace::path()
+      {
+      std::lock_guard<std::mutex> lock(mutex);
+      return tracePath;
+      }
+
+//---------------------------------------------------------
+//   setThreadName
+//    shown as track name; call before the first event
+//---------------------------------------------------------
+
+void Trace::setThreadName(const char* name)
+      {
+      localName = name;
+      if (localRing) {
+            std::lock_guard<std::mutex> lock(mutex);
+            localRing->name = name;
+            }
+      }
+
+//---------------------------------------------------------
+//   setFrame
+//---------------------------------------------------------
+
+void Trace::setFrame(unsigned sequence)
+      {
+      localFrame = sequence;
+      }
+
+//---------------------------------------------------------
+//   frame
+//---------------------------------------------------------
+
+unsigned Trace::frame()
+      {
+      return localFrame;
+      }
+
+//---------------------------------------------------------
+//   now
+//---------------------------------------------------------
+
+quint64 Trace::now()
+      {
+      struct timespec ts;
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      return quint64(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+      }
+
+//---------------------------------------------------------
+//   complete
+//---------------------------------------------------------
+
+void Trace::complete(const char* name, quint64 start, quint64 end)
+      {
+      record(name, start, end - start, localFrame, TraceEvent::Type::Complete);
+      }
+
+//---------------------------------------------------------
+//   flowStart
+//    a frame is handed to another thread; bound to the
+//    enclosing scope of the calling thread
+//---------------------------------------------------------
+
+void Trace::flowStart(const char* name, unsigned frame)
+      {
+      if (enabled())
+            record(name, now(), 0, frame, TraceEvent::Type::FlowStart);
+      }
+
+//---------------------------------------------------------
+//   flowEnd
+//---------------------------------------------------------
+
+void Trace::flowEnd(const char* name, unsigned frame)
+      {
+      if (enabled())
+            record(name, now(), 0, frame, TraceEvent::Type::FlowEnd);
+      }
+
+//---------------------------------------------------------
+//   write
+//    Chrome Trace TraceEvent JSON, timestamps in microseconds;
+//    recording goes on. Every event is copied and then
+//    checked against the ring count, events the thread
+//    overwrote meanwhile are skipped.
+//---------------------------------------------------------
+
+bool Trace::write()
+      {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (tracePath.isEmpty())
+            return false;
+      FILE* f = fopen(qPrintable(tracePath), "w");
+      if (!f) {
+            fprintf(stderr, "cam: cannot write trace <%s>: %s\n", qPrintable(tracePath), strerror(errno));
+            return false;
+            }
+      int pid = getpid();
+      fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+      fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"cam\"}}", pid);
+      for (TraceRing* r : rings) {
+            fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":", pid, r->tid);
+            writeJsonString(f, r->name.constData());
+            fprintf(f, "}}");
+            quint64 end   = r->count.load(std::memory_order_acquire);
+            quint64 begin = end > quint64(ringSize) ? end - ringSize : 0;
+            quint64 skipped = 0;
+            for (quint64 i = begin; i < end; ++i) {
+                  TraceEvent e = r->events[i % ringSize];
+                  std::atomic_thread_fence(std::memory_order_acquire);     // the copy before count
+                  if (r->count.load(std::memory_order_relaxed) - i >= quint64(ringSize)) {
+                        ++skipped;
+                        continue;
+                        }
+                  fprintf(f, ",\n{\"name\":");
+                  writeJsonString(f, e.name);
+                  switch (e.type) {
+                        case TraceEvent::Type::Complete:
+                              fprintf(f, ",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f", e.start / 1000.0, e.duration / 1000.0);
+                              break;
+                        case TraceEvent::Type::FlowStart:
+                              fprintf(f, ",\"cat\":\"frame\",\"ph\":\"s\",\"id\":%u,\"ts\":%.3f", e.frame, e.start / 1000.0);
+                              break;
+                        case TraceEvent::Type::FlowEnd:
+                              fprintf(f, ",\"cat\":\"frame\",\"ph\":\"f\",\"bp\":\"e\",\"id\":%u,\"ts\":%.3f",
+                                 e.frame, e.start / 1000.0);
+                              break;
+                        }
+                  fprintf(f, ",\"pid\":%d,\"tid\":%d,\"args\":{\"frame\":%u}}", pid, r->tid, e.frame);
+                  }
+            if (skipped) {
+                  fprintf(stderr, "cam: %llu events of <%s> overwritten while writing\n",
+                     (unsigned long long)skipped, r->name.constData());
+                  }
+            }
+      fprintf(f, "\n]}\n");
+      bool ok = fclose(f) == 0;
+      if (!ok)
+            fprintf(stderr, "cam: cannot write trace <%s>: %s\n", qPrintable(tracePath), strerror(errno));
+      return ok;
+      }
+
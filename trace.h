@@ -0,0 +1,74 @@
+//=============================================================================
+//  Cam
+//  Webcam client
+//
+//  Copyright (C) 2016 Werner Schweer
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License version 2
+//  as published by the Free Software Foundation and appearing in
+//  the file LICENCE.GPL
+//=============================================================================
+
+
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <atomic>
+
+#include <QString>
+
+//---------------------------------------------------------
+//   Trace
+//    pipeline trace for chrome://tracing and
+//    ui.perfetto.dev. Every thread records into its own
+//    ring of the last ringSize events without locking;
+//    write() saves all rings as Chrome Trace Event JSON.
+//
+//    events are tagged with the frame (driver sequence)
+//    the thread works on, set with setFrame(). Handoffs
+//    between threads are flow events with the frame as id.
+//
+//    while tracing is off a TraceScope costs one relaxed
+//    atomic load.
+//---------------------------------------------------------
+
+class Trace {
+      static std::atomic<bool> on;
+
+   public:
+      static const int ringSize = 32768;    // events per thread
+
+      static void start(const QString& path);
+      static bool enabled()                 { return on.load(std::memory_order_relaxed); }
+      static bool write();
+      static QString path();
+
+      static void setThreadName(const char*);
+      static void setFrame(unsigned sequence);
+      static unsigned frame();
+
+      static quint64 now();                 // CLOCK_MONOTONIC ns
+      static void complete(const char* name, quint64 start, quint64 end);
+      static void flowStart(const char* name, unsigned frame);
+      static void flowEnd(const char* name, unsigned frame);
+      };
+
+//---------------------------------------------------------
+//   TraceScope
+//    records name from construction to destruction
+//---------------------------------------------------------
+
+class TraceScope {
+      const char* name;
+      quint64 start { 0 };
+
+   public:
+      TraceScope(const char* n) : name(n) { if (Trace::enabled()) start = Trace::now(); }
+      ~TraceScope()                        { if (start) Trace::complete(name, start, Trace::now()); }
+      TraceScope(const TraceScope&) = delete;
+      TraceScope& operator=(const TraceScope&) = delete;
+      };
+
+#endif
+
@@ -18,9 +18,63 @@
 #include <errno.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/resource.h>
 #include <linux/videodev2.h>
+#include <poll.h>
+#include <time.h>
+
+#include <algorithm>
 
 #include "v4l2.h"
+#include "yuv.h"
+#include "histogram.h"
+#include "decoder.h"
+#include "trace.h"
+
+//---------------------------------------------------------
+//   pixelFormatName
+//---------------------------------------------------------
+
+QString pixelFormatName(unsigned fourcc)
+      {
+      char s[5] = { char(fourcc & 0xff), char((fourcc >> 8) & 0xff),
+                    char((fourcc >> 16) & 0xff), char((fourcc >> 24) & 0xff), 0 };
+      return QString(s).trimmed();
+      }
+
+//---------------------------------------------------------
+//   parseImageFormat
+//    decoded image format from "rgb32", "rgb888", "rgb16"
+//    or "gray"; Format_Invalid if unknown
+//---------------------------------------------------------
+
+QImage::Format parseImageFormat(const QString& s)
+      {
+      QString f = s.toLower();
+      if (f.isEmpty() || f == "rgb32")
+            return QImage::Format_RGB32;
+      if (f == "rgb888" || f == "rgb24")
+            return QImage::Format_RGB888;
+      if (f == "rgb16" || f == "rgb565")
+            return QImage::Format_RGB16;
+      if (f == "gray" || f == "grey" || f == "gray8")
+            return QImage::Format_Grayscale8;
+      return QImage::Format_Invalid;
+      }
+
+//---------------------------------------------------------
+//   imageFormatName
+//---------------------------------------------------------
+
+QString imageFormatName(QImage::Format f)
+      {
+      switch (f) {
+            case QImage::Format_RGB888:     return "rgb888";
+            case QImage::Format_RGB16:      return "rgb16";
+            case QImage::Format_Grayscale8: return "gray";
+            default:                        return "rgb32";
+            }
+      }
 
 //---------------------------------------------------------
 //   V4l2
@@ -33,6 +87,16 @@ V4l2::V4l2()
 V4l2::~V4l2()
       {
       close();
+      delete decoder;
+      }
+
+//---------------------------------------------------------
+//   decoderName
+//---------------------------------------------------------
+
+const char* V4l2::decoderName() const
+      {
+      return decoder ? decoder->name() : "";
       }
 
 //---------------------------------------------------------
@@ -46,7 +110,10 @@ bool V4l2::open(const QString& p)
       path = p;
       char* videodevice = path.toLocal8Bit().data();
       fd = ::open(videodevice, O_RDWR);
-      return fd != -1;
+      if (fd == -1)
+            return false;
+      queryControls();
+      return true;
       }
 
 //---------------------------------------------------------
@@ -59,6 +126,9 @@ bool V4l2::close()
             return false;
       int rv = ::close(fd);
       fd = -1;
+      std::lock_guard<std::mutex> lock(controlMutex);
+      _controls.clear();
+      eventsSubscribed = false;
       return rv != -1;
       }
 
@@ -95,27 +165,44 @@ bool V4l2::canStreaming()
       }
 
 //---------------------------------------------------------
-//   setMjpegFormat
+//   setFormat
 //---------------------------------------------------------
 
-bool V4l2::setMjpegFormat(int w, int h)
+bool V4l2::setFormat(unsigned fourcc, int w, int h)
       {
       struct v4l2_format fmt;
       memset(&fmt, 0, sizeof(struct v4l2_format));
       fmt.type                = V4L2_BUF_TYPE_VIDEO_CAPTURE;
       fmt.fmt.pix.width       = w;
       fmt.fmt.pix.height      = h;
-      fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_MJPEG;
+      fmt.fmt.pix.pixelformat = fourcc;
       fmt.fmt.pix.field       = V4L2_FIELD_ANY;
       int ret = ioctl(fd, VIDIOC_S_FMT, &fmt);
       if (ret < 0) {
-            fprintf(stderr, "Camera <%s> does not support format MJPEG: %s.\n", qPrintable(path), strerror(errno));
+            fprintf(stderr, "Camera <%s> does not support format %s: %s.\n",
+               qPrintable(path), qPrintable(pixelFormatName(fourcc)), strerror(errno));
+            return false;
+            }
+      if (fmt.fmt.pix.pixelformat != fourcc) {
+            fprintf(stderr, "Camera <%s> does not support format %s\n",
+               qPrintable(path), qPrintable(pixelFormatName(fourcc)));
             return false;
             }
       if ((int(fmt.fmt.pix.width) != w) || (int(fmt.fmt.pix.height) != h)) {
             fprintf(stderr, " format %d x %d unavailable, get %d x %d \n",
                w, h, fmt.fmt.pix.width, fmt.fmt.pix.height);
             }
+      if (fourcc == V4L2_PIX_FMT_MJPEG && !decoder) {
+            decoder = MjpegDecoder::create(QByteArray(), decodeThreads);
+            decoder->setFormat(_imageFormat);
+            decoder->setAverager(averager);
+            }
+      _pixelFormat  = fourcc;
+      _width        = fmt.fmt.pix.width;
+      _height       = fmt.fmt.pix.height;
+      _bytesPerLine = fmt.fmt.pix.bytesperline;
+      if (_bytesPerLine == 0)
+            _bytesPerLine = fourcc == V4L2_PIX_FMT_YUYV ? _width * 2 : _width;
       return true;
       }
 
@@ -134,26 +221,189 @@ bool V4l2::setFramerate(int fps)
       return ret >= 0;
       }
 
+//---------------------------------------------------------
+//   isCompound
+//---------------------------------------------------------
+
+bool V4l2Control::isCompound() const
+      {
+      return (flags & V4L2_CTRL_FLAG_HAS_PAYLOAD) || type >= V4L2_CTRL_COMPOUND_TYPES;
+      }
+
+//---------------------------------------------------------
+//   is64
+//---------------------------------------------------------
+
+bool V4l2Control::is64() const
+      {
+      return type == V4L2_CTRL_TYPE_INTEGER64;
+      }
+
+//---------------------------------------------------------
+//   queryControls
+//    enumerate all controls once and cache their
+//    description
+//---------------------------------------------------------
+
+bool V4l2::queryControls()
+      {
+      std::lock_guard<std::mutex> lock(controlMutex);
+      _controls.clear();
+
+      const unsigned next = V4L2_CTRL_FLAG_NEXT_CTRL | V4L2_CTRL_FLAG_NEXT_COMPOUND;
+      struct v4l2_query_ext_ctrl q;
+      memset(&q, 0, sizeof(q));
+      q.id = next;
+      while (ioctl(fd, VIDIOC_QUERY_EXT_CTRL, &q) == 0) {
+            if (q.type != V4L2_CTRL_TYPE_CTRL_CLASS && !(q.flags & V4L2_CTRL_FLAG_DISABLED)) {
+                  V4l2Control c;
+                  c.id           = q.id;
+                  c.type         = q.type;
+                  c.name         = QString::fromLatin1(q.name, strnlen(q.name, sizeof(q.name)));
+                  c.minimum      = q.minimum;
+                  c.maximum      = q.maximum;
+                  c.step         = q.step;
+                  c.defaultValue = q.default_value;
+                  c.flags        = q.flags;
+                  c.elemSize     = q.elem_size;
+                  c.elems        = q.elems;
+                  queryMenu(&c);
+                  _controls[c.id] = c;
+                  }
+            q.id |= next;
+            }
+      if (errno == ENOTTY)          // kernel without extended control query
+            return queryControlsLegacy();
+      return true;
+      }
+
+//---------------------------------------------------------
+//   queryControlsLegacy
+//---------------------------------------------------------
+
+bool V4l2::queryControlsLegacy()
+      {
+      struct v4l2_queryctrl q;
+      memset(&q, 0, sizeof(q));
+      q.id = V4L2_CTRL_FLAG_NEXT_CTRL;
+      while (ioctl(fd, VIDIOC_QUERYCTRL, &q) == 0) {
+            if (q.type != V4L2_CTRL_TYPE_CTRL_CLASS && !(q.flags & V4L2_CTRL_FLAG_DISABLED)) {
+                  V4l2Control c;
+                  c.id           = q.id;
+                  c.type         = q.type;
+                  c.name         = QString::fromLatin1((const char*)q.name, strnlen((const char*)q.name, sizeof(q.name)));
+                  c.minimum      = q.minimum;
+                  c.maximum      = q.maximum;
+                  c.step         = q.step;
+                  c.defaultValue = q.default_value;
+                  c.flags        = q.flags;
+                  c.elemSize     = sizeof(qint32);
+                  c.elems        = 1;
+                  queryMenu(&c);
+                  _controls[c.id] = c;
+                  }
+            q.id |= V4L2_CTRL_FLAG_NEXT_CTRL;
+            }
+      return !_controls.empty();
+      }
+
+//---------------------------------------------------------
+//   queryMenu
+//---------------------------------------------------------
+
+void V4l2::queryMenu(V4l2Control* c)
+      {
+      if (c->type != V4L2_CTRL_TYPE_MENU && c->type != V4L2_CTRL_TYPE_INTEGER_MENU)
+            return;
+      for (qint64 i = c->minimum; i <= c->maximum; ++i) {
+            struct v4l2_querymenu m;
+            memset(&m, 0, sizeof(m));
+            m.id    = c->id;
+            m.index = i;
+            if (ioctl(fd, VIDIOC_QUERYMENU, &m) < 0)    // menus may have holes
+                  continue;
+            QString name;
+            if (c->type == V4L2_CTRL_TYPE_MENU)
+                  name = QString::fromLatin1((const char*)m.name, strnlen((const char*)m.name, sizeof(m.name)));
+            else
+                  name = QString::number(qint64(m.value));
+            c->menu.push_back(std::make_pair(int(i), name));
+            }
+      }
+
 //---------------------------------------------------------
 //   isControl
-//    return >= 0 ok otherwhise -1
+//    return cached control description or null
 //---------------------------------------------------------
 
-int V4l2::isControl(int control, struct v4l2_queryctrl* queryctrl)
+const V4l2Control* V4l2::isControl(int control) const
       {
-      int err = 0;
-      queryctrl->id = control;
-      if ((err = ioctl(fd, VIDIOC_QUERYCTRL, queryctrl)) < 0)
-            printf("ioctl querycontrol error %d \n", errno);
-      else if (queryctrl->flags & V4L2_CTRL_FLAG_DISABLED)
-            printf("control %s disabled \n", (char*) queryctrl->name);
-      else if (queryctrl->flags & V4L2_CTRL_TYPE_BOOLEAN)
-            return 1;
-      else if (queryctrl->type & V4L2_CTRL_TYPE_INTEGER)
+      auto i = _controls.find(control);
+      if (i == _controls.end()) {
+            fprintf(stderr, "Camera <%s>: unknown control 0x%x\n", qPrintable(path), control);
             return 0;
-      else
-            printf("contol %s unsupported  \n", (char*) queryctrl->name);
-      return -1;
+            }
+      return &i->second;
+      }
+
+//---------------------------------------------------------
+//   controls
+//---------------------------------------------------------
+
+std::vector<V4l2Control> V4l2::controls() const
+      {
+      std::lock_guard<std::mutex> lock(controlMutex);
+      std::vector<V4l2Control> cl;
+      for (auto& i : _controls)
+            cl.push_back(i.second);
+      return cl;
+      }
+
+//---------------------------------------------------------
+//   readControl
+//    use the cached value if it is kept current by
+//    control events
+//---------------------------------------------------------
+
+bool V4l2::readControl(int control, qint64* value)
+      {
+      std::lock_guard<std::mutex> lock(controlMutex);
+      auto i = _controls.find(control);
+      if (i == _controls.end() || i->second.isCompound())
+            return false;
+      V4l2Control& c = i->second;
+      if (c.valueValid && !(c.flags & V4L2_CTRL_FLAG_VOLATILE)) {
+            *value = c.value;
+            return true;
+            }
+      struct v4l2_ext_control ec;
+      memset(&ec, 0, sizeof(ec));
+      ec.id = control;
+      struct v4l2_ext_controls ecs;
+      memset(&ecs, 0, sizeof(ecs));
+      ecs.which    = V4L2_CTRL_WHICH_CUR_VAL;
+      ecs.count    = 1;
+      ecs.controls = &ec;
+      if (ioctl(fd, VIDIOC_G_EXT_CTRLS, &ecs) < 0) {
+            fprintf(stderr, "Camera <%s>: cannot get control <%s>: %s\n",
+               qPrintable(path), qPrintable(c.name), strerror(errno));
+            return false;
+            }
+      c.value      = c.is64() ? ec.value64 : ec.value;
+      c.valueValid = eventsSubscribed;
+      *value = c.value;
+      return true;
+      }
+
+//---------------------------------------------------------
+//   writeControl
+//---------------------------------------------------------
+
+bool V4l2::writeControl(int control, qint64 value)
+      {
+      std::vector<V4l2ControlValue> vl;
+      vl.push_back({ control, value });
+      return setControls(vl);
       }
 
 //---------------------------------------------------------
@@ -162,17 +412,10 @@ int V4l2::isControl(int control, struct v4l2_queryctrl* queryctrl)
 
 int V4l2::getControl(int control)
       {
-      struct v4l2_queryctrl queryctrl;
-      struct v4l2_control control_s;
-      int err;
-      if (isControl(control, &queryctrl) < 0)
+      qint64 value;
+      if (!readControl(control, &value))
             return -1;
-      control_s.id = control;
-      if ((err = ioctl(fd, VIDIOC_G_CTRL, &control_s)) < 0) {
-            printf("ioctl get control error\n");
-            return -1;
-            }
-      return control_s.value;
+      return value;
       }
 
 //---------------------------------------------------------
@@ -181,23 +424,7 @@ int V4l2::getControl(int control)
 
 int V4l2::setControl(int control, int value)
       {
-      struct v4l2_control control_s;
-      struct v4l2_queryctrl queryctrl;
-      int min, max;
-      int err;
-      if (isControl(control, &queryctrl) < 0)
-            return -1;
-      min = queryctrl.minimum;
-      max = queryctrl.maximum;
-      if ((value >= min) && (value <= max)) {
-            control_s.id = control;
-            control_s.value = value;
-            if ((err = ioctl(fd, VIDIOC_S_CTRL, &control_s)) < 0) {
-                  printf("ioctl set control error\n");
-                  return -1;
-                  }
-            }
-      return 0;
+      return writeControl(control, value) ? 0 : -1;
       }
 
 //---------------------------------------------------------
@@ -206,30 +433,24 @@ int V4l2::setControl(int control, int value)
 
 int V4l2::upControl(int control)
       {
-      struct v4l2_control control_s;
-      struct v4l2_queryctrl queryctrl;
-      int max, current, step;
-      int err;
-
-      if (isControl(control, &queryctrl) < 0)
+      const V4l2Control* c;
+      qint64 max, step;
+      {
+      std::lock_guard<std::mutex> lock(controlMutex);
+      if (!(c = isControl(control)))
+            return -1;
+      max  = c->maximum;
+      step = c->step ? c->step : 1;
+      }
+      qint64 current;
+      if (!readControl(control, &current))
             return -1;
-      max  = queryctrl.maximum;
-      step = queryctrl.step;
-      current = getControl(control);
-      current += step;
-      if (current <= max) {
-            control_s.id = control;
-            control_s.value = current;
-            if ((err = ioctl(fd, VIDIOC_S_CTRL, &control_s)) < 0) {
-                  printf("ioctl set control error\n");
+      if (current + step <= max) {
+            current += step;
+            if (!writeControl(control, current))
                   return -1;
-                  }
-            printf ("Control name:%s set to value:%d\n", queryctrl.name, control_s.value);
-            }
-      else {
-            printf ("Control name:%s already has max value:%d \n", queryctrl.name, max);
             }
-      return control_s.value;
+      return current;
       }
 
 //---------------------------------------------------------
@@ -238,28 +459,24 @@ int V4l2::upControl(int control)
 
 int V4l2::downControl(int control)
       {
-      struct v4l2_control control_s;
-      struct v4l2_queryctrl queryctrl;
-      int min, current, step;
-      int err;
-      if (isControl(control, &queryctrl) < 0)
+      const V4l2Control* c;
+      qint64 min, step;
+      {
+      std::lock_guard<std::mutex> lock(controlMutex);
+      if (!(c = isControl(control)))
             return -1;
-      min = queryctrl.minimum;
-      step = queryctrl.step;
-      current = getControl(control);
-      current -= step;
-      if (current >= min) {
-            control_s.id = control;
-            control_s.value = current;
-            if ((err = ioctl(fd, VIDIOC_S_CTRL, &control_s)) < 0) {
-                  printf("ioctl set control error\n");
+      min  = c->minimum;
+      step = c->step ? c->step : 1;
+      }
+      qint64 current;
+      if (!readControl(control, &current))
+            return -1;
+      if (current - step >= min) {
+            current -= step;
+            if (!writeControl(control, current))
                   return -1;
-                  }
-            printf ("Control name:%s set to value:%d\n", queryctrl.name, control_s.value);
             }
-      else
-            printf ("Control name:%s already has min value:%d \n", queryctrl.name, min);
-      return control_s.value;
+      return current;
       }
 
 //---------------------------------------------------------
@@ -268,20 +485,18 @@ int V4l2::downControl(int control)
 
 int V4l2::toggleControl(int control)
       {
-      struct v4l2_control control_s;
-      struct v4l2_queryctrl queryctrl;
-      int current;
-      int err;
-      if (isControl(control, &queryctrl) != 1)
+      {
+      std::lock_guard<std::mutex> lock(controlMutex);
+      const V4l2Control* c = isControl(control);
+      if (!c || c->type != V4L2_CTRL_TYPE_BOOLEAN)
+            return -1;
+      }
+      qint64 current;
+      if (!readControl(control, &current))
             return -1;
-      current = getControl(control);
-      control_s.id = control;
-      control_s.value = !current;
-      if ((err = ioctl(fd, VIDIOC_S_CTRL, &control_s)) < 0) {
-            printf("ioctl toggle control error\n");
+      if (!writeControl(control, !current))
             return -1;
-            }
-      return control_s.value;
+      return !current;
       }
 
 //---------------------------------------------------------
@@ -290,56 +505,416 @@ int V4l2::toggleControl(int control)
 
 bool V4l2::resetControl(int control)
       {
-      struct v4l2_queryctrl queryctrl;
-      if (isControl(control, &queryctrl) < 0)
+      qint64 val;
+      {
+      std::lock_guard<std::mutex> lock(controlMutex);
+      const V4l2Control* c = isControl(control);
+      if (!c)
             return false;
-      int val_def = queryctrl.default_value;
-      struct v4l2_control control_s;
-      control_s.id = control;
-      control_s.value = val_def;
-      int err = ioctl(fd, VIDIOC_S_CTRL, &control_s);
-      if (err < 0) {
-            printf("ioctl reset control error\n");
+      val = c->defaultValue;
+      }
+      return writeControl(control, val);
+      }
+
+//---------------------------------------------------------
+//   setControls
+//    set several controls atomically with one ioctl;
+//    values are clamped to the control range
+//---------------------------------------------------------
+
+bool V4l2::setControls(const std::vector<V4l2ControlValue>& vl)
+      {
+      std::lock_guard<std::mutex> lock(controlMutex);
+      std::vector<struct v4l2_ext_control> ecl;
+      for (const V4l2ControlValue& v : vl) {
+            const V4l2Control* c = isControl(v.control);
+            if (!c || c->isCompound() || (c->flags & V4L2_CTRL_FLAG_READ_ONLY))
+                  continue;
+            struct v4l2_ext_control ec;
+            memset(&ec, 0, sizeof(ec));
+            ec.id = v.control;
+            qint64 value = qBound(c->minimum, v.value, c->maximum);
+            if (c->is64())
+                  ec.value64 = value;
+            else
+                  ec.value = value;
+            ecl.push_back(ec);
+            }
+      if (ecl.empty())
+            return false;
+      struct v4l2_ext_controls ecs;
+      memset(&ecs, 0, sizeof(ecs));
+      ecs.which    = V4L2_CTRL_WHICH_CUR_VAL;
+      ecs.count    = ecl.size();
+      ecs.controls = ecl.data();
+      if (ioctl(fd, VIDIOC_S_EXT_CTRLS, &ecs) < 0) {
+            fprintf(stderr, "Camera <%s>: cannot set controls: %s\n", qPrintable(path), strerror(errno));
             return false;
             }
+      for (const struct v4l2_ext_control& ec : ecl) {
+            V4l2Control& c = _controls[ec.id];
+            c.value      = c.is64() ? ec.value64 : ec.value;
+            c.valueValid = eventsSubscribed;
+            }
       return true;
       }
 
 //---------------------------------------------------------
-//   grab
-//    try reading a picture into tmpbuffer
-//    return image size or -1 on error
+//   subscribeControlEvents
+//    subscribe to value changes of all controls; the
+//    initial events fill the value cache
 //---------------------------------------------------------
 
-#define HEADERFRAME1 0xaf
+bool V4l2::subscribeControlEvents()
+      {
+      std::lock_guard<std::mutex> lock(controlMutex);
+      bool ok = true;
+      for (auto& i : _controls) {
+            if (i.second.isCompound())
+                  continue;
+            struct v4l2_event_subscription sub;
+            memset(&sub, 0, sizeof(sub));
+            sub.type  = V4L2_EVENT_CTRL;
+            sub.id    = i.first;
+            sub.flags = V4L2_EVENT_SUB_FL_SEND_INITIAL;
+            if (ioctl(fd, VIDIOC_SUBSCRIBE_EVENT, &sub) < 0)
+                  ok = false;
+            }
+      if (!ok)
+            fprintf(stderr, "Camera <%s>: cannot subscribe control events: %s\n", qPrintable(path), strerror(errno));
+      eventsSubscribed = ok;
+      return ok;
+      }
+
+//---------------------------------------------------------
+//   readEvents
+//    dequeue pending control events and update the
+//    cache; return number of events
+//---------------------------------------------------------
 
-QImage V4l2::grab()
+int V4l2::readEvents()
       {
-      struct v4l2_buffer buf;
-      memset(&buf, 0, sizeof(struct v4l2_buffer));
-      buf.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-      buf.memory = V4L2_MEMORY_MMAP;
+      std::lock_guard<std::mutex> lock(controlMutex);
+      int n = 0;
+      for (;;) {
+            struct v4l2_event ev;
+            memset(&ev, 0, sizeof(ev));
+            if (ioctl(fd, VIDIOC_DQEVENT, &ev) < 0)
+                  break;
+            ++n;
+            if (ev.type != V4L2_EVENT_CTRL)
+                  continue;
+            auto i = _controls.find(ev.id);
+            if (i == _controls.end())
+                  continue;
+            V4l2Control& c = i->second;
+            const struct v4l2_event_ctrl& ec = ev.u.ctrl;
+            if (ec.changes & V4L2_EVENT_CTRL_CH_VALUE) {
+                  c.value      = c.is64() ? ec.value64 : ec.value;
+                  c.valueValid = eventsSubscribed;
+                  }
+            if (ec.changes & V4L2_EVENT_CTRL_CH_FLAGS)
+                  c.flags = ec.flags;
+            if (ec.changes & V4L2_EVENT_CTRL_CH_RANGE) {
+                  c.minimum      = ec.minimum;
+                  c.maximum      = ec.maximum;
+                  c.step         = ec.step;
+                  c.defaultValue = ec.default_value;
+                  }
+            if (!ev.pending)
+                  break;
+            }
+      return n;
+      }
+
+//---------------------------------------------------------
+//   dequeue
+//    wait for the next filled buffer
+//---------------------------------------------------------
 
-      int ret = ioctl(fd, VIDIOC_DQBUF, &buf);
+bool V4l2::dequeue(struct v4l2_buffer* buf)
+      {
+      memset(buf, 0, sizeof(struct v4l2_buffer));
+      buf->type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+      buf->memory = V4L2_MEMORY_MMAP;
+
+      int ret = ioctl(fd, VIDIOC_DQBUF, buf);
       if (ret < 0) {
             printf("Unable to dequeue buffer: %s\n", strerror(errno));
-            return QImage();
+            return false;
             }
+      lost[buf->index] = sequenceValid ? buf->sequence - lastSequence - 1 : 0;
+      lastSequence     = buf->sequence;
+      sequenceValid    = true;
+      check[buf->index] = JpegError::None;
+      if (_pixelFormat == V4L2_PIX_FMT_MJPEG) {
+            if (buf->bytesused > memLength[buf->index])
+                  check[buf->index] = JpegError::Short;
+            else
+                  check[buf->index] = validate(data(*buf), buf->bytesused, &jpeg[buf->index]);
+            }
+      return true;
+      }
 
-      int size = buf.bytesused;
-      if (size <= HEADERFRAME1) {
-            printf("Ignoring empty buffer ...\n");
-            return QImage();
+//---------------------------------------------------------
+//   dequeueLatest
+//    dequeue the next buffer and then all buffers which
+//    are already filled; older buffers are requeued
+//    without being decoded, only the newest one is
+//    returned; skip is called for every dropped buffer
+//    before it is requeued
+//---------------------------------------------------------
+
+bool V4l2::dequeueLatest(struct v4l2_buffer* buf, int* skipped,
+   const std::function<void(const struct v4l2_buffer&)>& skip)
+      {
+      *skipped = 0;
+      if (!dequeue(buf))
+            return false;
+      for (;;) {
+            struct pollfd fds = { fd, POLLIN, 0 };
+            if (poll(&fds, 1, 0) <= 0 || !(fds.revents & POLLIN))
+                  break;
+            struct v4l2_buffer next;
+            if (!dequeue(&next))
+                  break;
+            if (skip)
+                  skip(*buf);
+            requeue(buf);
+            *buf = next;
+            ++*skipped;
             }
-      QByteArray data((const char*)mem[buf.index], size);
-      QImage image = QImage::fromData(data, "mjpeg");
+      return true;
+      }
 
-      ret = ioctl(fd, VIDIOC_QBUF, &buf);
-      if (ret < 0)
+//---------------------------------------------------------
+//   requeue
+//---------------------------------------------------------
+
+bool V4l2::requeue(struct v4l2_buffer* buf)
+      {
+      int ret = ioctl(fd, VIDIOC_QBUF, buf);
+      if (ret < 0) {
             printf("Unable to requeue buffer (%d).\n", errno);
+            return false;
+            }
+      return true;
+      }
+
+//---------------------------------------------------------
+//   decoderMemory
+//---------------------------------------------------------
+
+qint64 V4l2::decoderMemory() const
+      {
+      return decoder ? decoder->memory() : 0;
+      }
+
+//---------------------------------------------------------
+//   setImageFormat
+//    format of decoded images: RGB32, RGB888, RGB16 or
+//    Grayscale8
+//---------------------------------------------------------
+
+void V4l2::setImageFormat(QImage::Format f)
+      {
+      _imageFormat = f;
+      if (decoder)
+            decoder->setFormat(f);
+      }
+
+//---------------------------------------------------------
+//   setAverager
+//    decoded mjpeg frames are averaged in the yuv planes,
+//    raw frames are averaged by the caller
+//---------------------------------------------------------
+
+void V4l2::setAverager(FrameAverager* a)
+      {
+      averager = a;
+      if (decoder)
+            decoder->setAverager(a);
+      }
+
+//---------------------------------------------------------
+//   validate
+//    check the structure of a mjpeg frame before it is
+//    decoded, recorded or saved; the frame has to match
+//    the negotiated size within one MCU, some encoders
+//    round it up
+//---------------------------------------------------------
+
+JpegError V4l2::validate(const uchar* p, int size, JpegInfo* info) const
+      {
+      JpegError e = jpegValidate(p, size, info);
+      if (e == JpegError::None && (qAbs(info->width - _width) >= 16 || qAbs(info->height - _height) >= 16))
+            e = JpegError::Size;
+      return e;
+      }
+
+//---------------------------------------------------------
+//   decode
+//    convert a dequeued buffer into an image; mjpeg
+//    buffers were validated by dequeue(), frames which
+//    failed give a null image
+//---------------------------------------------------------
+
+QImage V4l2::decode(const struct v4l2_buffer& buf, Histogram* histogram)
+      {
+      if (_pixelFormat != V4L2_PIX_FMT_MJPEG)
+            return decodeImage(data(buf), buf.bytesused, histogram);
+      if (check[buf.index] != JpegError::None)
+            return QImage();
+      return decodeImage(data(buf), jpeg[buf.index].end, histogram);
+      }
+
+//---------------------------------------------------------
+//   decode
+//    convert a frame which is not a dequeued buffer
+//---------------------------------------------------------
+
+QImage V4l2::decode(const uchar* p, int size, Histogram* histogram)
+      {
+      JpegInfo info;
+      if (_pixelFormat == V4L2_PIX_FMT_MJPEG) {
+            if (validate(p, size, &info) != JpegError::None)
+                  return QImage();
+            size = info.end;
+            }
+      return decodeImage(p, size, histogram);
+      }
+
+//---------------------------------------------------------
+//   decodeImage
+//    raw frames are corrected during the conversion,
+//    decoded jpeg frames afterwards
+//---------------------------------------------------------
+
+QImage V4l2::decodeImage(const uchar* p, int size, Histogram* histogram)
+      {
+      TraceScope ts(_pixelFormat == V4L2_PIX_FMT_MJPEG ? "decode" : "convert");
+      QImage image;
+      const LensCorrection* lc = correction && correction->width() == _width
+         && correction->height() == _height ? correction.get() : 0;
+      switch (_pixelFormat) {
+            case V4L2_PIX_FMT_MJPEG:
+                  if (!decoder->decode(p, size, &image, histogram))
+                        image = QImage();
+                  else if (lc && lc->remap()) {
+                        QImage corrected(image.size(), image.format());
+                        if (lc->apply(image, &corrected))
+                              image = corrected;
+                        }
+                  else if (lc)
+                        lc->apply(image, &image);
+                  break;
+            case V4L2_PIX_FMT_YUYV:
+                  if (size < _bytesPerLine * _height)
+                        break;
+                  if (histogram)
+                        meter(p, size, histogram);
+                  image = QImage(_width, _height, _imageFormat);
+                  yuyvToImage(p, _bytesPerLine, &image, lc);
+                  break;
+            case V4L2_PIX_FMT_NV12:
+                  if (size < _bytesPerLine * _height * 3 / 2)
+                        break;
+                  if (histogram)
+                        meter(p, size, histogram);
+                  image = QImage(_width, _height, _imageFormat);
+                  nv12ToImage(p, _bytesPerLine, p + _bytesPerLine * _height, _bytesPerLine, &image, lc);
+                  break;
+            }
       return image;
       }
 
+//---------------------------------------------------------
+//   meter
+//    histogram of a raw frame without decoding it; false
+//    for compressed formats
+//---------------------------------------------------------
+
+bool V4l2::meter(const uchar* p, int size, Histogram* histogram)
+      {
+      switch (_pixelFormat) {
+            case V4L2_PIX_FMT_YUYV:
+                  if (size < _bytesPerLine * _height)
+                        return false;
+                  histogramYuyv(histogram, p, _bytesPerLine, _width, _height);
+                  return true;
+            case V4L2_PIX_FMT_NV12:
+                  if (size < _bytesPerLine * _height * 3 / 2)
+                        return false;
+                  histogramNv12(histogram, p, _bytesPerLine, p + _bytesPerLine * _height, _bytesPerLine,
+                     _width, _height);
+                  return true;
+            }
+      return false;
+      }
+
+//---------------------------------------------------------
+//   frame
+//    wrap a dequeued buffer; the buffer is requeued when
+//    the frame is released or destroyed unless the caller
+//    requeues it itself. Padding after the EOI of valid
+//    mjpeg frames is cut off.
+//---------------------------------------------------------
+
+FramePtr V4l2::frame(const struct v4l2_buffer& buf, bool rq)
+      {
+      struct v4l2_buffer b = buf;
+      std::function<void()> lease;
+      if (rq)
+            lease = [this, b]() mutable { requeue(&b); };
+      else
+            lease = []() {};
+      int size = _pixelFormat == V4L2_PIX_FMT_MJPEG && check[buf.index] == JpegError::None
+         ? jpeg[buf.index].end : int(buf.bytesused);
+      FramePtr f = std::make_shared<Frame>(data(buf), size, lease);
+      f->sequence     = buf.sequence;
+      f->flags        = buf.flags;
+      f->pixelFormat  = _pixelFormat;
+      f->width        = _width;
+      f->height       = _height;
+      f->bytesPerLine = _bytesPerLine;
+      f->lost         = lost[buf.index];
+      if ((buf.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC)
+            f->timestamp = quint64(buf.timestamp.tv_sec) * 1000000000ull + buf.timestamp.tv_usec * 1000ull;
+      else {
+            struct timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            f->timestamp = quint64(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+            }
+      return f;
+      }
+
+//---------------------------------------------------------
+//   grabFrame
+//    read and decode the next frame
+//---------------------------------------------------------
+
+FramePtr V4l2::grabFrame()
+      {
+      struct v4l2_buffer buf;
+      if (!dequeue(&buf))
+            return FramePtr();
+      FramePtr f = frame(buf);
+      f->setImage(decode(buf));
+      f->release(true);
+      return f;
+      }
+
+//---------------------------------------------------------
+//   grab
+//    read the next picture
+//---------------------------------------------------------
+
+QImage V4l2::grab()
+      {
+      FramePtr f = grabFrame();
+      return f ? f->image() : QImage();
+      }
+
 //---------------------------------------------------------
 //   initBuffers
 //---------------------------------------------------------
@@ -363,6 +938,8 @@ bool V4l2::initBuffers()
       /*
        * map the buffers
        */
+      _bufferSize   = 0;
+      sequenceValid = false;
       for (int i = 0; i < NB_BUFFER; i++) {
             struct v4l2_buffer buf;
             memset(&buf, 0, sizeof(struct v4l2_buffer));
@@ -379,6 +956,8 @@ bool V4l2::initBuffers()
                   fprintf(stderr, "Unable to map buffer: %s\n", strerror(errno));
                   return false;
                   }
+            memLength[i] = buf.length;
+            _bufferSize  = std::max(_bufferSize, int(buf.length));
             }
       /*
        * Queue the buffers.
@@ -398,6 +977,27 @@ bool V4l2::initBuffers()
       return true;
       }
 
+//---------------------------------------------------------
+//   lockBuffers
+//    fault in and lock the mapped buffers; munmap() in
+//    freeBuffers() unlocks them
+//---------------------------------------------------------
+
+bool V4l2::lockBuffers()
+      {
+      for (int i = 0; i < NB_BUFFER; ++i) {
+            if (mlock(mem[i], memLength[i]) < 0) {
+                  int err = errno;
+                  struct rlimit rl;
+                  getrlimit(RLIMIT_MEMLOCK, &rl);
+                  fprintf(stderr, "Unable to lock buffer %d: %s (RLIMIT_MEMLOCK %ld kB)\n", i, strerror(err),
+                     rl.rlim_cur == RLIM_INFINITY ? -1L : long(rl.rlim_cur / 1024));
+                  return false;
+                  }
+            }
+      return true;
+      }
+
 //---------------------------------------------------------
 //   freeBuffers
 //---------------------------------------------------------
@@ -13,11 +13,64 @@
 #ifndef __V4L2_H__
 #define __V4L2_H__
 
+#include <functional>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include <linux/videodev2.h>
+
 #include <QString>
 #include <QImage>
 
+#include "correction.h"
+#include "frame.h"
+#include "jpeg.h"
+
 #define NB_BUFFER 4
 
+class MjpegDecoder;
+class FrameAverager;
+struct Histogram;
+
+//---------------------------------------------------------
+//   V4l2Control
+//    cached control description
+//---------------------------------------------------------
+
+struct V4l2Control {
+      unsigned id           { 0 };
+      unsigned type         { 0 };
+      QString name;
+      qint64 minimum        { 0 };
+      qint64 maximum        { 0 };
+      qint64 step           { 1 };
+      qint64 defaultValue   { 0 };
+      unsigned flags        { 0 };
+      unsigned elemSize     { 0 };
+      unsigned elems        { 0 };
+      std::vector<std::pair<int, QString>> menu;   // menu index, item name
+
+      qint64 value          { 0 };     // last known value
+      bool valueValid       { false };
+
+      bool isCompound() const;
+      bool is64() const;
+      };
+
+//---------------------------------------------------------
+//   V4l2ControlValue
+//---------------------------------------------------------
+
+struct V4l2ControlValue {
+      int control;
+      qint64 value;
+      };
+
+extern QString pixelFormatName(unsigned fourcc);
+extern QImage::Format parseImageFormat(const QString&);
+extern QString imageFormatName(QImage::Format);
+
 //---------------------------------------------------------
 //   V4l2
 //    video for linux II c++ wrapper
@@ -27,8 +80,36 @@ class V4l2 {
       int     fd           { -1 };
       QString path;
       void* mem[NB_BUFFER];
+      size_t memLength[NB_BUFFER];
+
+      unsigned _pixelFormat   { 0 };
+      int _width              { 0 };
+      int _height             { 0 };
+      int _bytesPerLine       { 0 };
+      int _bufferSize         { 0 };    // largest mapped buffer
+      unsigned lastSequence   { 0 };
+      bool sequenceValid      { false };
+      unsigned lost[NB_BUFFER];         // frames the driver dropped before buffer
+      JpegError check[NB_BUFFER];       // mjpeg validation of buffer
+      JpegInfo jpeg[NB_BUFFER];
+      MjpegDecoder* decoder   { 0 };
+      int decodeThreads       { 1 };
+      QImage::Format _imageFormat { QImage::Format_RGB32 };
+      FrameAverager* averager { 0 };    // averages the mjpeg yuv planes
+      LensCorrectionPtr correction;     // applied by decode() if of frame size
 
-      int isControl(int control, struct v4l2_queryctrl* queryctrl);
+      std::map<unsigned, V4l2Control> _controls;
+      mutable std::mutex controlMutex;
+      bool eventsSubscribed { false };
+
+      bool queryControls();
+      bool queryControlsLegacy();
+      void queryMenu(V4l2Control*);
+      const V4l2Control* isControl(int control) const;
+      bool readControl(int control, qint64* value);
+      bool writeControl(int control, qint64 value);
+      JpegError validate(const uchar* data, int size, JpegInfo*) const;
+      QImage decodeImage(const uchar* data, int size, Histogram*);
 
    public:
       V4l2();
@@ -44,15 +125,46 @@ class V4l2 {
       int downControl(int control);
       int toggleControl(int control);
       bool resetControl(int control);
+      bool setControls(const std::vector<V4l2ControlValue>&);
+      std::vector<V4l2Control> controls() const;
+
+      bool subscribeControlEvents();
+      int readEvents();
 
       bool canVideoCapture();
       bool canStreaming();
 
-      bool setMjpegFormat(int w, int h);
+      void setDecodeThreads(int n)       { decodeThreads = n; }
+      void setImageFormat(QImage::Format);
+      void setAverager(FrameAverager*);
+      QImage::Format imageFormat() const { return _imageFormat; }
+      void setCorrection(const LensCorrectionPtr& c) { correction = c; }
+      bool setFormat(unsigned fourcc, int w, int h);
+      bool setMjpegFormat(int w, int h)  { return setFormat(V4L2_PIX_FMT_MJPEG, w, h); }
       bool setFramerate(int fps);
+      unsigned pixelFormat() const       { return _pixelFormat; }
+      int width() const                  { return _width;  }
+      int height() const                 { return _height; }
+      int bytesPerLine() const           { return _bytesPerLine; }
+      int bufferSize() const             { return _bufferSize; }
+      const char* decoderName() const;
+      qint64 decoderMemory() const;
 
+      bool dequeue(struct v4l2_buffer*);
+      bool dequeueLatest(struct v4l2_buffer*, int* skipped,
+         const std::function<void(const struct v4l2_buffer&)>& skip = nullptr);
+      bool requeue(struct v4l2_buffer*);
+      QImage decode(const uchar* data, int size, Histogram* = 0);
+      QImage decode(const struct v4l2_buffer&, Histogram* = 0);
+      JpegError jpegError(const struct v4l2_buffer& buf) const { return check[buf.index]; }
+      const JpegInfo& jpegInfo(const struct v4l2_buffer& buf) const { return jpeg[buf.index]; }
+      bool meter(const uchar* data, int size, Histogram*);
+      const uchar* data(const struct v4l2_buffer& buf) const { return (const uchar*)mem[buf.index]; }
+      FramePtr frame(const struct v4l2_buffer&, bool requeue = true);
+      FramePtr grabFrame();
       QImage grab();
       bool initBuffers();
+      bool lockBuffers();
       bool freeBuffers();
       };
 
@@ -0,0 +1,549 @@
+//=============================================================================
+//  Cam
+//  Webcam client
+//
+//  Copyright (C) 2016 Werner Schweer
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License version 2
+//  as published by the Free Software Foundation and appearing in
+//  the file LICENCE.GPL
+//=============================================================================
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <vector>
+
+#include "yuv.h"
+#include "correction.h"
+#include "threadpool.h"
+#include "trace.h"
+
+//    R = (74 * (Y - 16)             + 102 * (V - 128)) >> 6
+//    G = (74 * (Y - 16) - 25 * (U - 128) - 52 * (V - 128)) >> 6
+//    B = (74 * (Y - 16) + 129 * (U - 128)            ) >> 6
+//
+//    all intermediate values fit into 16 bit (saturating)
+
+//---------------------------------------------------------
+//   clamp
+//---------------------------------------------------------
+
+static inline uchar clamp(int v)
+      {
+      return v < 0 ? 0 : (v > 255 ? 255 : v);
+      }
+
+//---------------------------------------------------------
+//   output formats
+//    pixel() writes one pixel, store8() eight pixels from
+//    16 bit lanes (SSE2)
+//---------------------------------------------------------
+
+struct Rgb32 {
+      static const int bpp = 4;
+      static inline void pixel(int r, int g, int b, uchar* d) {
+            d[0] = clamp(b);
+            d[1] = clamp(g);
+            d[2] = clamp(r);
+            d[3] = 0xff;
+            }
+#ifdef __SSE2__
+      static inline void store8(__m128i r, __m128i g, __m128i b, uchar* d) {
+            __m128i b8 = _mm_packus_epi16(b, _mm_setzero_si128());
+            __m128i g8 = _mm_packus_epi16(g, _mm_setzero_si128());
+            __m128i r8 = _mm_packus_epi16(r, _mm_setzero_si128());
+            __m128i bg = _mm_unpacklo_epi8(b8, g8);
+            __m128i ra = _mm_unpacklo_epi8(r8, _mm_set1_epi8(-1));
+            _mm_storeu_si128((__m128i*)d,        _mm_unpacklo_epi16(bg, ra));
+            _mm_storeu_si128((__m128i*)(d + 16), _mm_unpackhi_epi16(bg, ra));
+            }
+#endif
+      };
+
+struct Rgb16 {
+      static const int bpp = 2;
+      static inline void pixel(int r, int g, int b, uchar* d) {
+            *(quint16*)d = ((clamp(r) & 0xf8) << 8) | ((clamp(g) & 0xfc) << 3) | (clamp(b) >> 3);
+            }
+#ifdef __SSE2__
+      static inline void store8(__m128i r, __m128i g, __m128i b, uchar* d) {
+            const __m128i zero = _mm_setzero_si128();
+            r = _mm_unpacklo_epi8(_mm_packus_epi16(r, zero), zero);
+            g = _mm_unpacklo_epi8(_mm_packus_epi16(g, zero), zero);
+            b = _mm_unpacklo_epi8(_mm_packus_epi16(b, zero), zero);
+            __m128i v = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(r, _mm_set1_epi16(0xf8)), 8),
+                        _mm_or_si128(_mm_slli_epi16(_mm_and_si128(g, _mm_set1_epi16(0xfc)), 3),
+                                     _mm_srli_epi16(b, 3)));
+            _mm_storeu_si128((__m128i*)d, v);
+            }
+#endif
+      };
+
+struct Rgb888 {
+      static const int bpp = 3;
+      static inline void pixel(int r, int g, int b, uchar* d) {
+            d[0] = clamp(r);
+            d[1] = clamp(g);
+            d[2] = clamp(b);
+            }
+#ifdef __SSE2__
+      static inline void store8(__m128i r, __m128i g, __m128i b, uchar* d) {
+            // no byte shuffle in SSE2; interleave from the
+            // clamped bytes
+            uchar t[3][16];
+            _mm_storeu_si128((__m128i*)t[0], _mm_packus_epi16(r, r));
+            _mm_storeu_si128((__m128i*)t[1], _mm_packus_epi16(g, g));
+            _mm_storeu_si128((__m128i*)t[2], _mm_packus_epi16(b, b));
+            for (int i = 0; i < 8; ++i) {
+                  d[i * 3]     = t[0][i];
+                  d[i * 3 + 1] = t[1][i];
+                  d[i * 3 + 2] = t[2][i];
+                  }
+            }
+#endif
+      };
+
+//---------------------------------------------------------
+//   yuvPixel
+//    y16 - luma - 16, u, v - chroma - 128
+//---------------------------------------------------------
+
+template <class S>
+static inline void yuvPixel16(int y16, int u, int v, uchar* d)
+      {
+      int c = 74 * y16 + 32;
+      S::pixel((c + 102 * v) >> 6, (c - 25 * u - 52 * v) >> 6, (c + 129 * u) >> 6, d);
+      }
+
+template <class S>
+static inline void yuvPixel(int y, int u, int v, uchar* d)
+      {
+      yuvPixel16<S>(y - 16, u - 128, v - 128, d);
+      }
+
+#ifdef __SSE2__
+//---------------------------------------------------------
+//   yuv8
+//    convert 8 pixel
+//    y16  - 8 x int16 luma - 16
+//    u, v - 8 x int16 chroma - 128
+//---------------------------------------------------------
+
+template <class S>
+static inline void yuv8(__m128i y16, __m128i u, __m128i v, uchar* dst)
+      {
+      __m128i c = _mm_mullo_epi16(y16, _mm_set1_epi16(74));
+      c = _mm_add_epi16(c, _mm_set1_epi16(32));
+      __m128i r = _mm_adds_epi16(c, _mm_mullo_epi16(v, _mm_set1_epi16(102)));
+      __m128i g = _mm_subs_epi16(c, _mm_mullo_epi16(u, _mm_set1_epi16(25)));
+      g = _mm_subs_epi16(g, _mm_mullo_epi16(v, _mm_set1_epi16(52)));
+      __m128i b = _mm_adds_epi16(c, _mm_mullo_epi16(u, _mm_set1_epi16(129)));
+      S::store8(_mm_srai_epi16(r, 6), _mm_srai_epi16(g, 6), _mm_srai_epi16(b, 6), dst);
+      }
+
+//---------------------------------------------------------
+//   splitChroma
+//    interleaved U0 V0 U1 V1 ... (4 pairs) to 8 x U and
+//    8 x V, each sample doubled and centered
+//---------------------------------------------------------
+
+static inline void splitChroma(__m128i uv, __m128i* u, __m128i* v)
+      {
+      __m128i a = _mm_and_si128(uv, _mm_set1_epi32(0xffff));
+      __m128i b = _mm_srli_epi32(uv, 16);
+      *u = _mm_sub_epi16(_mm_or_si128(a, _mm_slli_epi32(a, 16)), _mm_set1_epi16(128));
+      *v = _mm_sub_epi16(_mm_or_si128(b, _mm_slli_epi32(b, 16)), _mm_set1_epi16(128));
+      }
+
+//---------------------------------------------------------
+//   yuv8
+//    y  - 8 x int16 luma
+//    uv - 8 x int16 chroma, interleaved U0 V0 U1 V1 ...
+//---------------------------------------------------------
+
+template <class S>
+static inline void yuv8(__m128i y, __m128i uv, uchar* dst)
+      {
+      __m128i u, v;
+      splitChroma(uv, &u, &v);
+      yuv8<S>(_mm_sub_epi16(y, _mm_set1_epi16(16)), u, v, dst);
+      }
+#endif
+
+//---------------------------------------------------------
+//   yuyvTo
+//---------------------------------------------------------
+
+template <class S>
+static void yuyvTo(const uchar* src, int srcStride, uchar* dst, int dstStride, int w, int h)
+      {
+      for (int row = 0; row < h; ++row) {
+            const uchar* s = src + row * srcStride;
+            uchar* d       = dst + row * dstStride;
+            int x = 0;
+#ifdef __SSE2__
+            for (; x + 8 <= w; x += 8) {
+                  __m128i p = _mm_loadu_si128((const __m128i*)(s + x * 2));
+                  yuv8<S>(_mm_and_si128(p, _mm_set1_epi16(0xff)), _mm_srli_epi16(p, 8), d + x * S::bpp);
+                  }
+#endif
+            for (; x + 2 <= w; x += 2) {
+                  const uchar* p = s + x * 2;
+                  yuvPixel<S>(p[0], p[1], p[3], d + x * S::bpp);
+                  yuvPixel<S>(p[2], p[1], p[3], d + (x + 1) * S::bpp);
+                  }
+            }
+      }
+
+//---------------------------------------------------------
+//   nv12To
+//---------------------------------------------------------
+
+template <class S>
+static void nv12To(const uchar* y, int yStride, const uchar* uv, int uvStride,
+   uchar* dst, int dstStride, int w, int h)
+      {
+      for (int row = 0; row < h; ++row) {
+            const uchar* sy  = y + row * yStride;
+            const uchar* suv = uv + (row / 2) * uvStride;
+            uchar* d         = dst + row * dstStride;
+            int x = 0;
+#ifdef __SSE2__
+            const __m128i zero = _mm_setzero_si128();
+            for (; x + 8 <= w; x += 8) {
+                  __m128i yy  = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(sy + x)), zero);
+                  __m128i uuv = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(suv + x)), zero);
+                  yuv8<S>(yy, uuv, d + x * S::bpp);
+                  }
+#endif
+            for (; x + 2 <= w; x += 2) {
+                  yuvPixel<S>(sy[x],     suv[x], suv[x + 1], d + x * S::bpp);
+                  yuvPixel<S>(sy[x + 1], suv[x], suv[x + 1], d + (x + 1) * S::bpp);
+                  }
+            }
+      }
+
+//---------------------------------------------------------
+//   lumaToGray8
+//    only the luma samples (step bytes apart) are
+//    expanded to full range; no color conversion
+//---------------------------------------------------------
+
+static void lumaToGray8(const uchar* src, int srcStride, int step, uchar* dst, int dstStride, int w, int h)
+      {
+      for (int row = 0; row < h; ++row) {
+            const uchar* s = src + row * srcStride;
+            uchar* d       = dst + row * dstStride;
+            int x = 0;
+#ifdef __SSE2__
+            const __m128i k16 = _mm_set1_epi16(16);
+            const __m128i k74 = _mm_set1_epi16(74);
+            const __m128i k32 = _mm_set1_epi16(32);
+            for (; x + 16 <= w; x += 16) {
+                  __m128i a, b;
+                  if (step == 2) {
+                        a = _mm_and_si128(_mm_loadu_si128((const __m128i*)(s + x * 2)), _mm_set1_epi16(0xff));
+                        b = _mm_and_si128(_mm_loadu_si128((const __m128i*)(s + x * 2 + 16)), _mm_set1_epi16(0xff));
+                        }
+                  else {
+                        __m128i p = _mm_loadu_si128((const __m128i*)(s + x));
+                        a = _mm_unpacklo_epi8(p, _mm_setzero_si128());
+                        b = _mm_unpackhi_epi8(p, _mm_setzero_si128());
+                        }
+                  a = _mm_srai_epi16(_mm_add_epi16(_mm_mullo_epi16(_mm_sub_epi16(a, k16), k74), k32), 6);
+                  b = _mm_srai_epi16(_mm_add_epi16(_mm_mullo_epi16(_mm_sub_epi16(b, k16), k74), k32), 6);
+                  _mm_storeu_si128((__m128i*)(d + x), _mm_packus_epi16(a, b));
+                  }
+#endif
+            for (; x < w; ++x)
+                  d[x] = clamp((74 * (s[x * step] - 16) + 32) >> 6);
+            }
+      }
+
+//---------------------------------------------------------
+//   RawSource
+//    luma and horizontally halved chroma of YUYV or NV12
+//---------------------------------------------------------
+
+struct RawSource {
+      const uchar* y;
+      int yStride, yStep;
+      const uchar* u;
+      const uchar* v;
+      int cStride, cStep;
+      int cShiftY;                        // vertical chroma subsampling
+      bool yuyv;
+
+      const uchar* luma(int x, int row) const { return y + row * yStride + x * yStep; }
+      int cu(int x, int row) const        { return u[(row >> cShiftY) * cStride + (x >> 1) * cStep]; }
+      int cv(int x, int row) const        { return v[(row >> cShiftY) * cStride + (x >> 1) * cStep]; }
+      };
+
+//---------------------------------------------------------
+//   Gray8
+//    corrected luma only, expanded to full range
+//---------------------------------------------------------
+
+struct Gray8 {
+      static const int bpp = 1;
+      };
+
+template <class S>
+static inline void correctedPixel(int y16, int u, int v, uchar* d)
+      {
+      yuvPixel16<S>(y16, u, v, d);
+      }
+
+template <>
+inline void correctedPixel<Gray8>(int y16, int, int, uchar* d)
+      {
+      *d = clamp((74 * y16 + 32) >> 6);
+      }
+
+#ifdef __SSE2__
+template <class S>
+static inline void corrected8(__m128i y16, __m128i u, __m128i v, uchar* d)
+      {
+      yuv8<S>(y16, u, v, d);
+      }
+
+template <>
+inline void corrected8<Gray8>(__m128i y16, __m128i, __m128i, uchar* d)
+      {
+      __m128i c = _mm_add_epi16(_mm_mullo_epi16(y16, _mm_set1_epi16(74)), _mm_set1_epi16(32));
+      c = _mm_srai_epi16(c, 6);
+      _mm_storel_epi64((__m128i*)d, _mm_packus_epi16(c, c));
+      }
+
+//---------------------------------------------------------
+//   gain8
+//    (v * gain) >> 12 for signed v of at most 12 bit,
+//    limited to lo - hi so that the conversion cannot
+//    overflow 16 bit
+//---------------------------------------------------------
+
+static inline __m128i gain8(__m128i v, __m128i gain, int lo, int hi)
+      {
+      __m128i r = _mm_mulhi_epi16(_mm_slli_epi16(v, 4), gain);
+      return _mm_min_epi16(_mm_max_epi16(r, _mm_set1_epi16(lo)), _mm_set1_epi16(hi));
+      }
+#endif
+
+static const int maxLuma   = 400;      // corrected luma - 16
+static const int maxChroma = 200;      // corrected chroma - 128
+
+//---------------------------------------------------------
+//   gain1
+//---------------------------------------------------------
+
+static inline int gain1(int v, int gain, int lo, int hi)
+      {
+      return qBound(lo, (v * gain) >> LensCorrection::gainShift, hi);
+      }
+
+//---------------------------------------------------------
+//   correctedTo
+//    raw frame to image with dark level, flat field gain
+//    and distortion applied in the same pass: without
+//    distortion the source is read in place, with
+//    distortion each row is first gathered through the
+//    remap table into a luma and chroma row (bilinear
+//    luma, nearest chroma), then corrected and converted
+//    with SIMD
+//---------------------------------------------------------
+
+template <class S>
+static void correctedTo(const RawSource& src, const LensCorrection& lc, uchar* dst, int dstStride,
+   int w, int y0, int y1)
+      {
+      std::vector<qint16> ry, ru, rv;
+      if (lc.remap()) {
+            ry.resize(w + 8);
+            ru.resize(w + 8);
+            rv.resize(w + 8);
+            }
+      for (int row = y0; row < y1; ++row) {
+            const qint16* gain = lc.gain(row);
+            const qint16* dark = lc.darkY(row);
+            uchar* d           = dst + row * dstStride;
+            if (lc.remap()) {
+                  const LensCorrection::Remap* m = lc.remap(row);
+                  for (int x = 0; x < w; ++x, ++m) {
+                        const uchar* p = src.luma(m->x, m->y);
+                        const uchar* q = p + src.yStride;
+                        int top = p[0] * 16 + (p[src.yStep] - p[0]) * m->fx;
+                        int bot = q[0] * 16 + (q[src.yStep] - q[0]) * m->fx;
+                        ry[x]   = ((top * 16 + (bot - top) * m->fy + 128) >> 8) - 16;
+                        int nx  = m->x + (m->fx >= 8);
+                        int ny  = m->y + (m->fy >= 8);
+                        ru[x]   = src.cu(nx, ny) - 128;
+                        rv[x]   = src.cv(nx, ny) - 128;
+                        }
+                  }
+            int x = 0;
+#ifdef __SSE2__
+            const __m128i zero = _mm_setzero_si128();
+            for (; x + 8 <= w; x += 8) {
+                  __m128i y16, u, v;
+                  if (lc.remap()) {
+                        y16 = _mm_loadu_si128((const __m128i*)(ry.data() + x));
+                        u   = _mm_loadu_si128((const __m128i*)(ru.data() + x));
+                        v   = _mm_loadu_si128((const __m128i*)(rv.data() + x));
+                        }
+                  else if (src.yuyv) {
+                        __m128i p = _mm_loadu_si128((const __m128i*)(src.y + row * src.yStride + x * 2));
+                        y16 = _mm_sub_epi16(_mm_and_si128(p, _mm_set1_epi16(0xff)), _mm_set1_epi16(16));
+                        splitChroma(_mm_srli_epi16(p, 8), &u, &v);
+                        }
+                  else {
+                        const uchar* sy = src.y + row * src.yStride + x;
+                        const uchar* su = src.u + (row >> 1) * src.cStride + x;
+                        y16 = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)sy), zero), _mm_set1_epi16(16));
+                        splitChroma(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)su), zero), &u, &v);
+                        }
+                  __m128i g = _mm_loadu_si128((const __m128i*)(gain + x));
+                  y16 = gain8(_mm_sub_epi16(y16, _mm_loadu_si128((const __m128i*)(dark + x))), g, -16, maxLuma);
+                  u   = gain8(u, g, -maxChroma, maxChroma);
+                  v   = gain8(v, g, -maxChroma, maxChroma);
+                  corrected8<S>(y16, u, v, d + x * S::bpp);
+                  }
+#endif
+            for (; x < w; ++x) {
+                  int y16, u, v;
+                  if (lc.remap()) {
+                        y16 = ry[x];
+                        u   = ru[x];
+                        v   = rv[x];
+                        }
+                  else {
+                        y16 = *src.luma(x, row) - 16;
+                        u   = src.cu(x, row) - 128;
+                        v   = src.cv(x, row) - 128;
+                        }
+                  int g = gain[x];
+                  correctedPixel<S>(gain1(y16 - dark[x], g, -16, maxLuma),
+                     gain1(u, g, -maxChroma, maxChroma), gain1(v, g, -maxChroma, maxChroma), d + x * S::bpp);
+                  }
+            }
+      }
+
+//---------------------------------------------------------
+//   correctedToImage
+//    in bands of rows on the thread pool; the remap gather
+//    is not memory bound
+//---------------------------------------------------------
+
+static void correctedToImage(const RawSource& src, const LensCorrection& lc, QImage* image)
+      {
+      uchar* d = image->bits();
+      int ds   = image->bytesPerLine();
+      int w    = qMin(image->width(), lc.width());
+      int h    = qMin(image->height(), lc.height());
+      int n    = lc.remap() ? ThreadPool::global()->size() : 1;
+      int bandHeight = (h + n - 1) / n;
+      unsigned frame = Trace::frame();
+      ThreadPool::global()->run(n, [&](int i) {
+            Trace::setFrame(frame);
+            TraceScope ts("correct");
+            int y0 = i * bandHeight;
+            int y1 = qMin(h, y0 + bandHeight);
+            switch (image->format()) {
+                  case QImage::Format_Grayscale8:
+                        correctedTo<Gray8>(src, lc, d, ds, w, y0, y1);
+                        break;
+                  case QImage::Format_RGB16:
+                        correctedTo<Rgb16>(src, lc, d, ds, w, y0, y1);
+                        break;
+                  case QImage::Format_RGB888:
+                        correctedTo<Rgb888>(src, lc, d, ds, w, y0, y1);
+                        break;
+                  default:
+                        correctedTo<Rgb32>(src, lc, d, ds, w, y0, y1);
+                        break;
+                  }
+            });
+      }
+
+//---------------------------------------------------------
+//   yuyvToRgb32
+//---------------------------------------------------------
+
+void yuyvToRgb32(const uchar* src, int srcStride, uchar* dst, int dstStride, int w, int h)
+      {
+      yuyvTo<Rgb32>(src, srcStride, dst, dstStride, w, h);
+      }
+
+//---------------------------------------------------------
+//   nv12ToRgb32
+//---------------------------------------------------------
+
+void nv12ToRgb32(const uchar* y, int yStride, const uchar* uv, int uvStride,
+   uchar* dst, int dstStride, int w, int h)
+      {
+      nv12To<Rgb32>(y, yStride, uv, uvStride, dst, dstStride, w, h);
+      }
+
+//---------------------------------------------------------
+//   yuyvToImage
+//---------------------------------------------------------
+
+void yuyvToImage(const uchar* src, int srcStride, QImage* image, const LensCorrection* lc)
+      {
+      if (lc) {
+            correctedToImage({ src, srcStride, 2, src + 1, src + 3, srcStride, 4, 0, true }, *lc, image);
+            return;
+            }
+      uchar* d = image->bits();
+      int ds   = image->bytesPerLine();
+      int w    = image->width();
+      int h    = image->height();
+      switch (image->format()) {
+            case QImage::Format_Grayscale8:
+                  lumaToGray8(src, srcStride, 2, d, ds, w, h);
+                  break;
+            case QImage::Format_RGB16:
+                  yuyvTo<Rgb16>(src, srcStride, d, ds, w, h);
+                  break;
+            case QImage::Format_RGB888:
+                  yuyvTo<Rgb888>(src, srcStride, d, ds, w, h);
+                  break;
+            default:
+                  yuyvTo<Rgb32>(src, srcStride, d, ds, w, h);
+                  break;
+            }
+      }
+
+//---------------------------------------------------------
+//   nv12ToImage
+//---------------------------------------------------------
+
+void nv12ToImage(const uchar* y, int yStride, const uchar* uv, int uvStride, QImage* image,
+   const LensCorrection* lc)
+      {
+      if (lc) {
+            correctedToImage({ y, yStride, 1, uv, uv + 1, uvStride, 2, 1, false }, *lc, image);
+            return;
+            }
+      uchar* d = image->bits();
+      int ds   = image->bytesPerLine();
+      int w    = image->width();
+      int h    = image->height();
+      switch (image->format()) {
+            case QImage::Format_Grayscale8:
+                  lumaToGray8(y, yStride, 1, d, ds, w, h);
+                  break;
+            case QImage::Format_RGB16:
+                  nv12To<Rgb16>(y, yStride, uv, uvStride, d, ds, w, h);
+                  break;
+            case QImage::Format_RGB888:
+                  nv12To<Rgb888>(y, yStride, uv, uvStride, d, ds, w, h);
+                  break;
+            default:
+                  nv12To<Rgb32>(y, yStride, uv, uvStride, d, ds, w, h);
+                  break;
+            }
+      }
+
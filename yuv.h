@@ -0,0 +1,42 @@
+//=============================================================================
+//  Cam
+//  Webcam client
+//
+//  Copyright (C) 2016 Werner Schweer
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License version 2
+//  as published by the Free Software Foundation and appearing in
+//  the file LICENCE.GPL
+//=============================================================================
+
+#ifndef __YUV_H__
+#define __YUV_H__
+
+#include <QImage>
+
+//---------------------------------------------------------
+//   raw camera format to QImage::Format_RGB32 converters
+//    BT.601 limited range, SSE2 with scalar tail
+//---------------------------------------------------------
+
+extern void yuyvToRgb32(const uchar* src, int srcStride, uchar* dst, int dstStride, int w, int h);
+extern void nv12ToRgb32(const uchar* y, int yStride, const uchar* uv, int uvStride,
+   uchar* dst, int dstStride, int w, int h);
+
+class LensCorrection;
+
+//---------------------------------------------------------
+//   converters into an allocated image of format
+//    RGB32, RGB16, RGB888 or Grayscale8; Grayscale8 only
+//    expands the luma samples to full range. With a lens
+//    correction of the frame size, flat field and
+//    distortion are corrected in the same pass.
+//---------------------------------------------------------
+
+extern void yuyvToImage(const uchar* src, int srcStride, QImage* image, const LensCorrection* = 0);
+extern void nv12ToImage(const uchar* y, int yStride, const uchar* uv, int uvStride, QImage* image,
+   const LensCorrection* = 0);
+
+#endif
+